@@ -378,6 +378,25 @@ BootMonGetFileFromAsciiFileName (
   OUT BOOTMON_FS_FILE       **File
   );
 
+/**
+  Index a file of the volume under its current name.
+
+  Must be called whenever the name returned for the file by
+  BootMonGetFileFromAsciiFileName() changes. The file is removed from the
+  bucket it was previously linked to if any.
+
+  @param[in]  Instance       Pointer to the description of the volume.
+  @param[in]  File           Pointer to the description of the file.
+  @param[in]  AsciiFileName  Current name of the file.
+
+**/
+VOID
+BootMonFsHashFile (
+  IN BOOTMON_FS_INSTANCE  *Instance,
+  IN BOOTMON_FS_FILE      *File,
+  IN CONST CHAR8          *AsciiFileName
+  );
+
 EFI_STATUS
 BootMonGetFileFromPosition (
   IN  BOOTMON_FS_INSTANCE   *Instance,
@@ -326,6 +326,7 @@ SetFileName (
     // OK, change the filename.
     AsciiStrToUnicodeStrS (AsciiFileName, File->Info->FileName,
       (File->Info->Size - SIZE_OF_EFI_FILE_INFO) / sizeof (CHAR16));
+    BootMonFsHashFile (Instance, File, AsciiFileName);
     return EFI_SUCCESS;
   }
 }
@@ -54,6 +54,44 @@ EFI_FILE_PROTOCOL mBootMonFsFileTemplate = {
   BootMonFsFlushFile
 };
 
+/**
+  Compute the bucket of the name hash table a file name belongs to (FNV-1a).
+
+  @param[in]  AsciiFileName  Name of the file.
+
+  @return  Index of the bucket.
+
+**/
+STATIC
+UINTN
+BootMonFsNameHash (
+  IN CONST CHAR8  *AsciiFileName
+  )
+{
+  UINT32  Hash;
+
+  Hash = 0x811C9DC5;
+  while (*AsciiFileName != '\0') {
+    Hash = (Hash ^ (UINT8)*AsciiFileName++) * 0x01000193;
+  }
+
+  return Hash & (BOOTMON_FS_NAME_HASH_SIZE - 1);
+}
+
+VOID
+BootMonFsHashFile (
+  IN BOOTMON_FS_INSTANCE  *Instance,
+  IN BOOTMON_FS_FILE      *File,
+  IN CONST CHAR8          *AsciiFileName
+  )
+{
+  RemoveEntryList (&File->NameLink);
+  InsertTailList (
+    &Instance->NameHash[BootMonFsNameHash (AsciiFileName)],
+    &File->NameLink
+    );
+}
+
 /**
   Search for a file given its name coded in Ascii.
 
@@ -85,18 +123,21 @@ BootMonGetFileFromAsciiFileName (
   OUT BOOTMON_FS_FILE       **File
   )
 {
+  LIST_ENTRY       *Bucket;
   LIST_ENTRY       *Entry;
   BOOTMON_FS_FILE  *FileEntry;
   CHAR8            OpenFileAsciiFileName[MAX_NAME_LENGTH];
   CHAR8            *AsciiFileNameToCompare;
 
-  // Go through all the files in the list and return the file handle
-  for (Entry = GetFirstNode (&Instance->RootFile->Link);
-       !IsNull (&Instance->RootFile->Link, Entry);
-       Entry = GetNextNode (&Instance->RootFile->Link, Entry)
+  // Only the files hashed under the same name as the one searched for may
+  // match, go through them and return the file handle
+  Bucket = &Instance->NameHash[BootMonFsNameHash (AsciiFileName)];
+  for (Entry = GetFirstNode (Bucket);
+       !IsNull (Bucket, Entry);
+       Entry = GetNextNode (Bucket, Entry)
        )
   {
-    FileEntry = BOOTMON_FS_FILE_FROM_LINK_THIS (Entry);
+    FileEntry = BOOTMON_FS_FILE_FROM_NAME_LINK (Entry);
     if (FileEntry->Info != NULL) {
       UnicodeStrToAsciiStrS (FileEntry->Info->FileName, OpenFileAsciiFileName,
         MAX_NAME_LENGTH);
@@ -154,6 +195,7 @@ BootMonFsCreateFile (
 
   NewFile->Signature = BOOTMON_FS_FILE_SIGNATURE;
   InitializeListHead (&NewFile->Link);
+  InitializeListHead (&NewFile->NameLink);
   InitializeListHead (&NewFile->RegionToFlushLink);
   NewFile->Instance = Instance;
 
@@ -321,6 +363,7 @@ BootMonFsDriverStart (
   EFI_STATUS           Status;
   UINTN                VolumeNameSize;
   EFI_FILE_INFO       *Info;
+  UINTN                Index;
 
   Instance = AllocateZeroPool (sizeof (BOOTMON_FS_INSTANCE));
   if (Instance == NULL) {
@@ -360,6 +403,10 @@ BootMonFsDriverStart (
   Instance->Media = Instance->BlockIo->Media;
   Instance->Binding = DriverBinding;
 
+  for (Index = 0; Index < BOOTMON_FS_NAME_HASH_SIZE; Index++) {
+    InitializeListHead (&Instance->NameHash[Index]);
+  }
+
     // Initialize the Simple File System Protocol
   Instance->Fs.Revision = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION;
   Instance->Fs.OpenVolume = OpenBootMonFsOpenVolume;
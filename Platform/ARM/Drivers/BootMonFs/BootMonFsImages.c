@@ -135,57 +135,105 @@ BootMonFsIsImageValid (
   return TRUE;
 }
 
+/**
+  Read the blocks [FirstLba, EndLba) of the volume in a single request and
+  register every image whose description sits at the end of one of them.
+
+  The blocks are parsed from the last one downwards. As an image description
+  is stored in the last block of its image, all the blocks from BlockStart to
+  BlockEnd of a discovered image are known to belong to it and are skipped
+  without being parsed.
+
+  @param[in]      Instance  Pointer to the description of the volume.
+  @param[in]      FirstLba  First block of the span.
+  @param[in, out] EndLba    On input, the block following the span. On output,
+                            the block following the part of the volume that
+                            is still to be scanned.
+  @param[in]      Buffer    Buffer large enough to hold the whole span.
+
+  @retval  EFI_SUCCESS           The span was parsed.
+  @retval  EFI_OUT_OF_RESOURCES  The description of an image could not be
+                                 allocated.
+  @retval  Others                The span could not be read from the media.
+
+**/
 STATIC
 EFI_STATUS
-BootMonFsDiscoverNextImage (
+BootMonFsDiscoverImagesInSpan (
   IN     BOOTMON_FS_INSTANCE      *Instance,
-  IN OUT EFI_LBA                  *LbaStart,
-  IN OUT BOOTMON_FS_FILE          *File
+  IN     EFI_LBA                   FirstLba,
+  IN OUT EFI_LBA                  *EndLba,
+  IN     UINT8                    *Buffer
   )
 {
   EFI_DISK_IO_PROTOCOL  *DiskIo;
+  EFI_BLOCK_IO_MEDIA    *Media;
+  BOOTMON_FS_FILE       *NewFile;
   EFI_LBA                CurrentLba;
   UINT64                 DescOffset;
   EFI_STATUS             Status;
 
   DiskIo = Instance->DiskIo;
+  Media = Instance->Media;
+  CurrentLba = *EndLba;
+
+  Status = DiskIo->ReadDisk (DiskIo,
+                     Media->MediaId,
+                     FirstLba * Media->BlockSize,
+                     (UINTN)(CurrentLba - FirstLba) * Media->BlockSize,
+                     Buffer
+                     );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  NewFile = NULL;
+  while (CurrentLba > FirstLba) {
+    CurrentLba--;
 
-  CurrentLba = *LbaStart;
+    if (NewFile == NULL) {
+      Status = BootMonFsCreateFile (Instance, &NewFile);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+    }
 
-  // Look for images in the rest of this block
-  while (CurrentLba <= Instance->Media->LastBlock) {
     // Work out the byte offset into media of the image description in this block
     // If present, the image description is at the very end of the block.
-    DescOffset = ((CurrentLba + 1) * Instance->Media->BlockSize) - sizeof (HW_IMAGE_DESCRIPTION);
-
-    // Read the image description from media
-    Status = DiskIo->ReadDisk (DiskIo,
-                       Instance->Media->MediaId,
-                       DescOffset,
-                       sizeof (HW_IMAGE_DESCRIPTION),
-                       &File->HwDescription
-                       );
-    if (EFI_ERROR (Status)) {
-      return Status;
-    }
+    DescOffset = ((CurrentLba + 1) * Media->BlockSize) - sizeof (HW_IMAGE_DESCRIPTION);
+
+    // BootMonFsIsImageValid() updates the checksum of the description it is
+    // given, work on a copy rather than on the span buffer.
+    CopyMem (&NewFile->HwDescription,
+      Buffer + (UINTN)(DescOffset - (FirstLba * Media->BlockSize)),
+      sizeof (HW_IMAGE_DESCRIPTION)
+      );
 
     // If we found a valid image description...
-    if (BootMonFsIsImageValid (&File->HwDescription, (CurrentLba - Instance->Media->LowestAlignedLba))) {
+    if (BootMonFsIsImageValid (&NewFile->HwDescription, (CurrentLba - Media->LowestAlignedLba))) {
       DEBUG ((EFI_D_ERROR, "Found image: %a in block %d.\n",
-        &(File->HwDescription.Footer.Filename),
-        (UINTN)(CurrentLba - Instance->Media->LowestAlignedLba)
+        &(NewFile->HwDescription.Footer.Filename),
+        (UINTN)(CurrentLba - Media->LowestAlignedLba)
         ));
-      File->HwDescAddress = DescOffset;
+      NewFile->HwDescAddress = DescOffset;
+
+      // The volume is scanned backwards, insert at the head of the list to
+      // keep the files in disk-order.
+      InsertHeadList (&Instance->RootFile->Link, &NewFile->Link);
+      BootMonFsHashFile (Instance, NewFile, NewFile->HwDescription.Footer.Filename);
 
-      *LbaStart = CurrentLba + 1;
-      return EFI_SUCCESS;
-    } else {
-      CurrentLba++;
+      // The other blocks of the image only contain its data
+      CurrentLba = NewFile->HwDescription.BlockStart + Media->LowestAlignedLba;
+      NewFile = NULL;
     }
   }
 
-  *LbaStart = CurrentLba;
-  return EFI_NOT_FOUND;
+  if (NewFile != NULL) {
+    FreePool (NewFile);
+  }
+
+  *EndLba = CurrentLba;
+  return EFI_SUCCESS;
 }
 
 EFI_STATUS
@@ -195,28 +243,41 @@ BootMonFsInitialize (
 {
   EFI_STATUS               Status;
   EFI_LBA                  Lba;
-  UINT32                   ImageCount;
-  BOOTMON_FS_FILE          *NewFile;
+  EFI_LBA                  SpanStart;
+  UINTN                    SpanBlocks;
+  UINT8                    *Buffer;
+
+  //
+  // Read the volume by spans of several blocks rather than issuing a request
+  // per block for its image description.
+  //
+  SpanBlocks = BOOTMON_FS_DISCOVERY_SPAN_SIZE / Instance->Media->BlockSize;
+  if (SpanBlocks == 0) {
+    SpanBlocks = 1;
+  }
+
+  Buffer = AllocatePool (SpanBlocks * Instance->Media->BlockSize);
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
 
-  ImageCount = 0;
-  Lba = 0;
+  // Scan from the end of the volume so that the extent of every image found
+  // can be skipped.
+  Lba = Instance->Media->LastBlock + 1;
+  while (Lba > 0) {
+    SpanStart = (Lba > SpanBlocks) ? (Lba - SpanBlocks) : 0;
 
-  while (1) {
-    Status = BootMonFsCreateFile (Instance, &NewFile);
-    if (EFI_ERROR (Status)) {
+    Status = BootMonFsDiscoverImagesInSpan (Instance, SpanStart, &Lba, Buffer);
+    if (Status == EFI_OUT_OF_RESOURCES) {
+      FreePool (Buffer);
       return Status;
-    }
-
-    Status = BootMonFsDiscoverNextImage (Instance, &Lba, NewFile);
-    if (EFI_ERROR (Status)) {
-      // Free NewFile allocated by BootMonFsCreateFile ()
-      FreePool (NewFile);
+    } else if (EFI_ERROR (Status)) {
       break;
     }
-    InsertTailList (&Instance->RootFile->Link, &NewFile->Link);
-    ImageCount++;
   }
 
+  FreePool (Buffer);
+
   Instance->Initialized = TRUE;
   return EFI_SUCCESS;
 }
@@ -35,18 +35,31 @@
 
 #define BOOTMON_FS_VOLUME_LABEL   L"NOR Flash"
 
+// Amount of media read at once when looking for the images of a volume
+#define BOOTMON_FS_DISCOVERY_SPAN_SIZE  SIZE_2MB
+
+// Number of buckets of the file name hash table, must be a power of 2
+#define BOOTMON_FS_NAME_HASH_SIZE       32
+
 typedef struct _BOOTMON_FS_INSTANCE BOOTMON_FS_INSTANCE;
 
+// Data written to a file and not flushed yet. The regions of a file are kept
+// sorted by offset, adjacent or overlapping writes are merged into a single
+// region.
 typedef struct {
   LIST_ENTRY            Link;
   VOID*                 Buffer;
   UINTN                 Size;
+  UINTN                 Capacity; // Allocated size of Buffer
   UINT64                Offset; // Offset from the start of the file
 } BOOTMON_FS_FILE_REGION;
 
 typedef struct {
   UINT32                Signature;
   LIST_ENTRY            Link;
+  // Link in the bucket of the volume's name hash table matching the current
+  // name of the file
+  LIST_ENTRY            NameLink;
   BOOTMON_FS_INSTANCE   *Instance;
 
   UINTN                 HwDescAddress;
@@ -69,6 +82,7 @@ typedef struct {
 #define BOOTMON_FS_FILE_SIGNATURE              SIGNATURE_32('b', 'o', 't', 'f')
 #define BOOTMON_FS_FILE_FROM_FILE_THIS(a)      CR (a, BOOTMON_FS_FILE, File, BOOTMON_FS_FILE_SIGNATURE)
 #define BOOTMON_FS_FILE_FROM_LINK_THIS(a)      CR (a, BOOTMON_FS_FILE, Link, BOOTMON_FS_FILE_SIGNATURE)
+#define BOOTMON_FS_FILE_FROM_NAME_LINK(a)      CR (a, BOOTMON_FS_FILE, NameLink, BOOTMON_FS_FILE_SIGNATURE)
 
 struct _BOOTMON_FS_INSTANCE {
   UINT32                               Signature;
@@ -88,6 +102,7 @@ struct _BOOTMON_FS_INSTANCE {
   CHAR16                               Label[20];
 
   BOOTMON_FS_FILE                     *RootFile; // All the other files are linked to this root
+  LIST_ENTRY                           NameHash[BOOTMON_FS_NAME_HASH_SIZE];
   BOOLEAN                              Initialized;
 };
 
@@ -297,6 +297,15 @@ BootMonFsFlushFile (
 
   UnicodeStrToAsciiStrS (Info->FileName, AsciiFileName, MAX_NAME_LENGTH);
 
+  // Nothing to do if the file is on the media and neither its data nor its
+  // description have changed since then
+  if ((File->HwDescription.RegionCount > 0) &&
+      IsListEmpty (&File->RegionToFlushLink) &&
+      (AsciiStrCmp (AsciiFileName, File->HwDescription.Footer.Filename) == 0) &&
+      (Info->FileSize == File->HwDescription.Region[0].Size)) {
+    return EFI_SUCCESS;
+  }
+
   // If the file doesn't exist then find a space for it
   if (File->HwDescription.RegionCount == 0) {
     Status = BootMonFsFindSpaceForNewFile (
@@ -463,6 +472,9 @@ BootMonFsCloseFile (
     This->Flush (This);
     FreePool (File->Info);
     File->Info = NULL;
+
+    // From now on the file is known by the name written on the media
+    BootMonFsHashFile (File->Instance, File, File->HwDescription.Footer.Filename);
   }
 
   return EFI_SUCCESS;
@@ -678,6 +690,7 @@ BootMonFsOpenFile (
         goto Error;
       }
       InsertHeadList (&Instance->RootFile->Link, &File->Link);
+      BootMonFsHashFile (Instance, File, AsciiFileName);
       Info->Attribute = Attributes;
     } else {
       //
@@ -788,6 +801,7 @@ BootMonFsDelete (
 
   // Remove the entry from the list
   RemoveEntryList (&File->Link);
+  RemoveEntryList (&File->NameLink);
   FreePool (File->Info);
   FreePool (File);
 
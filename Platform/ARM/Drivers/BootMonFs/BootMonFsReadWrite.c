@@ -46,13 +46,19 @@ BootMonFsReadFile (
   OUT VOID              *Buffer
   )
 {
-  BOOTMON_FS_INSTANCE   *Instance;
-  BOOTMON_FS_FILE       *File;
-  EFI_DISK_IO_PROTOCOL  *DiskIo;
-  EFI_BLOCK_IO_MEDIA    *Media;
-  UINT64                FileStart;
-  EFI_STATUS            Status;
-  UINTN                 RemainingFileSize;
+  BOOTMON_FS_INSTANCE     *Instance;
+  BOOTMON_FS_FILE         *File;
+  EFI_DISK_IO_PROTOCOL    *DiskIo;
+  EFI_BLOCK_IO_MEDIA      *Media;
+  UINT64                  FileStart;
+  EFI_STATUS              Status;
+  UINTN                   RemainingFileSize;
+  UINT64                  OnMediaSize;
+  UINTN                   ReadSize;
+  LIST_ENTRY              *RegionToFlushLink;
+  BOOTMON_FS_FILE_REGION  *Region;
+  UINT64                  OverlapStart;
+  UINT64                  OverlapEnd;
 
   if ((This == NULL)       ||
       (BufferSize == NULL) ||
@@ -64,10 +70,6 @@ BootMonFsReadFile (
     return EFI_INVALID_PARAMETER;
   }
 
-  // Ensure the file has been written in Flash before reading it.
-  // This keeps the code simple and avoids having to manage a non-flushed file.
-  BootMonFsFlushFile (This);
-
   Instance  = File->Instance;
   DiskIo    = Instance->DiskIo;
   Media     = Instance->Media;
@@ -92,27 +94,119 @@ BootMonFsReadFile (
     *BufferSize = RemainingFileSize;
   }
 
-  Status = DiskIo->ReadDisk (
-                    DiskIo,
-                    Media->MediaId,
-                    FileStart + File->Position,
-                    *BufferSize,
-                    Buffer
-                    );
-  if (EFI_ERROR (Status)) {
-    *BufferSize = 0;
+  // Read the part of the data that is already on the media
+  OnMediaSize = 0;
+  if (File->HwDescription.RegionCount > 0) {
+    OnMediaSize = File->HwDescription.Region[0].Size;
+  }
+
+  ReadSize = 0;
+  if (File->Position < OnMediaSize) {
+    ReadSize = (UINTN)MIN (*BufferSize, OnMediaSize - File->Position);
+    Status = DiskIo->ReadDisk (
+                      DiskIo,
+                      Media->MediaId,
+                      FileStart + File->Position,
+                      ReadSize,
+                      Buffer
+                      );
+    if (EFI_ERROR (Status)) {
+      *BufferSize = 0;
+      return Status;
+    }
+  }
+
+  // The part of the file past its data on the media is only defined by the
+  // data that has not been flushed yet
+  if (ReadSize < *BufferSize) {
+    ZeroMem ((UINT8*)Buffer + ReadSize, *BufferSize - ReadSize);
+  }
+
+  // Serve the data that has not been flushed yet from the pending regions
+  for (RegionToFlushLink = GetFirstNode (&File->RegionToFlushLink);
+       !IsNull (&File->RegionToFlushLink, RegionToFlushLink);
+       RegionToFlushLink = GetNextNode (&File->RegionToFlushLink, RegionToFlushLink)
+       )
+  {
+    Region = (BOOTMON_FS_FILE_REGION*)RegionToFlushLink;
+    if (Region->Offset >= File->Position + *BufferSize) {
+      break;
+    }
+
+    OverlapStart = MAX (Region->Offset, File->Position);
+    OverlapEnd   = MIN (Region->Offset + Region->Size, File->Position + *BufferSize);
+    if (OverlapStart < OverlapEnd) {
+      CopyMem (
+        (UINT8*)Buffer + (UINTN)(OverlapStart - File->Position),
+        (UINT8*)Region->Buffer + (UINTN)(OverlapStart - Region->Offset),
+        (UINTN)(OverlapEnd - OverlapStart)
+        );
+    }
   }
 
   File->Position += *BufferSize;
 
-  return Status;
+  return EFI_SUCCESS;
+}
+
+/**
+  Resize a region waiting to be flushed so that it starts at a given offset of
+  the file and has a given size, keeping its data at the same file offsets.
+
+  The buffer of the region grows geometrically so that a sequence of writes
+  appending to the region does not copy its data again on every write.
+
+  @param[in out]  Region  The region to resize.
+  @param[in]      Offset  The new offset of the region, not greater than its
+                          current offset.
+  @param[in]      Size    The new size of the region, it must cover the
+                          current data of the region.
+
+  @retval  EFI_SUCCESS           The region was resized.
+  @retval  EFI_OUT_OF_RESOURCES  Unable to allocate the new buffer.
+
+**/
+STATIC
+EFI_STATUS
+ResizeFileRegion (
+  IN OUT BOOTMON_FS_FILE_REGION  *Region,
+  IN     UINT64                  Offset,
+  IN     UINTN                   Size
+  )
+{
+  UINTN  Shift;
+  UINTN  Capacity;
+  VOID   *Buffer;
+
+  Shift = (UINTN)(Region->Offset - Offset);
+  if ((Shift == 0) && (Size <= Region->Capacity)) {
+    Region->Size = Size;
+    return EFI_SUCCESS;
+  }
+
+  Capacity = MAX (Size, Region->Capacity + (Region->Capacity / 2));
+  Buffer = AllocatePool (Capacity);
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CopyMem ((UINT8*)Buffer + Shift, Region->Buffer, Region->Size);
+  FreePool (Region->Buffer);
+
+  Region->Buffer   = Buffer;
+  Region->Capacity = Capacity;
+  Region->Offset   = Offset;
+  Region->Size     = Size;
+
+  return EFI_SUCCESS;
 }
 
 /**
   Write data to an open file.
 
   The data is not written to the flash yet. It will be written when the file
-  will be either read, closed or flushed.
+  will be either closed or flushed. Writes that are adjacent to or overlap
+  data that has not been flushed yet are merged into the same region.
 
   @param[in]      This        A pointer to the EFI_FILE_PROTOCOL instance that
                               is the file handle to write data to.
@@ -136,8 +230,16 @@ BootMonFsWriteFile (
   IN VOID               *Buffer
   )
 {
+  EFI_STATUS              Status;
   BOOTMON_FS_FILE         *File;
   BOOTMON_FS_FILE_REGION  *Region;
+  BOOTMON_FS_FILE_REGION  *NextRegion;
+  LIST_ENTRY              *RegionToFlushLink;
+  LIST_ENTRY              *NextRegionToFlushLink;
+  UINT64                  WriteStart;
+  UINT64                  WriteEnd;
+  UINT64                  RegionStart;
+  UINT64                  RegionEnd;
 
   if (This == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -151,24 +253,90 @@ BootMonFsWriteFile (
     return EFI_ACCESS_DENIED;
   }
 
-  // Allocate and initialize the memory region
-  Region = (BOOTMON_FS_FILE_REGION*)AllocateZeroPool (sizeof (BOOTMON_FS_FILE_REGION));
-  if (Region == NULL) {
-    *BufferSize = 0;
-    return EFI_OUT_OF_RESOURCES;
+  WriteStart = File->Position;
+  WriteEnd   = WriteStart + *BufferSize;
+
+  // Look for the first region that ends at or after the start of the write
+  for (RegionToFlushLink = GetFirstNode (&File->RegionToFlushLink);
+       !IsNull (&File->RegionToFlushLink, RegionToFlushLink);
+       RegionToFlushLink = GetNextNode (&File->RegionToFlushLink, RegionToFlushLink)
+       )
+  {
+    Region = (BOOTMON_FS_FILE_REGION*)RegionToFlushLink;
+    if (Region->Offset + Region->Size >= WriteStart) {
+      break;
+    }
   }
 
-  Region->Buffer = AllocateCopyPool (*BufferSize, Buffer);
-  if (Region->Buffer == NULL) {
-    *BufferSize = 0;
-    FreePool (Region);
-    return EFI_OUT_OF_RESOURCES;
-  }
+  if (IsNull (&File->RegionToFlushLink, RegionToFlushLink) ||
+      (((BOOTMON_FS_FILE_REGION*)RegionToFlushLink)->Offset > WriteEnd)) {
+    // The write does not touch any pending data, allocate and initialize a
+    // new region in front of the region found if any
+    Region = (BOOTMON_FS_FILE_REGION*)AllocateZeroPool (sizeof (BOOTMON_FS_FILE_REGION));
+    if (Region == NULL) {
+      *BufferSize = 0;
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Region->Buffer = AllocateCopyPool (*BufferSize, Buffer);
+    if (Region->Buffer == NULL) {
+      *BufferSize = 0;
+      FreePool (Region);
+      return EFI_OUT_OF_RESOURCES;
+    }
 
-  Region->Size   = *BufferSize;
-  Region->Offset = File->Position;
+    Region->Size     = *BufferSize;
+    Region->Capacity = *BufferSize;
+    Region->Offset   = WriteStart;
+
+    InsertTailList (RegionToFlushLink, &Region->Link);
+  } else {
+    // Work out the extent covered by the write and all the regions it touches
+    Region      = (BOOTMON_FS_FILE_REGION*)RegionToFlushLink;
+    RegionStart = MIN (Region->Offset, WriteStart);
+    RegionEnd   = MAX (Region->Offset + Region->Size, WriteEnd);
+    for (NextRegionToFlushLink = GetNextNode (&File->RegionToFlushLink, RegionToFlushLink);
+         !IsNull (&File->RegionToFlushLink, NextRegionToFlushLink);
+         NextRegionToFlushLink = GetNextNode (&File->RegionToFlushLink, NextRegionToFlushLink)
+         )
+    {
+      NextRegion = (BOOTMON_FS_FILE_REGION*)NextRegionToFlushLink;
+      if (NextRegion->Offset > WriteEnd) {
+        break;
+      }
+      RegionEnd = MAX (NextRegion->Offset + NextRegion->Size, RegionEnd);
+    }
+
+    Status = ResizeFileRegion (Region, RegionStart, (UINTN)(RegionEnd - RegionStart));
+    if (EFI_ERROR (Status)) {
+      *BufferSize = 0;
+      return Status;
+    }
 
-  InsertTailList (&File->RegionToFlushLink, &Region->Link);
+    // Merge the following regions the write touches into this one
+    NextRegionToFlushLink = GetNextNode (&File->RegionToFlushLink, RegionToFlushLink);
+    while (!IsNull (&File->RegionToFlushLink, NextRegionToFlushLink)) {
+      NextRegion = (BOOTMON_FS_FILE_REGION*)NextRegionToFlushLink;
+      if (NextRegion->Offset > WriteEnd) {
+        break;
+      }
+      CopyMem (
+        (UINT8*)Region->Buffer + (UINTN)(NextRegion->Offset - Region->Offset),
+        NextRegion->Buffer,
+        NextRegion->Size
+        );
+      NextRegionToFlushLink = RemoveEntryList (NextRegionToFlushLink);
+      FreePool (NextRegion->Buffer);
+      FreePool (NextRegion);
+    }
+
+    // The data of the write supersedes the data pending at the same offsets
+    CopyMem (
+      (UINT8*)Region->Buffer + (UINTN)(WriteStart - Region->Offset),
+      Buffer,
+      *BufferSize
+      );
+  }
 
   File->Position += *BufferSize;
 
@@ -27,7 +27,16 @@
 #define IS_DEVICE_PATH_NODE(node,type,subtype)    \
         (((node)->Type == (type)) && ((node)->SubType == (subtype)))
 
-#define MAX_TFTP_FILE_SIZE    0x01000000
+#define MAX_TFTP_FILE_SIZE    0x10000000
+
+/* Defines related to the TFTP options negotiated with the server */
+
+#define TFTP_DEFAULT_BLOCK_SIZE   512
+#define TFTP_MAX_BLOCK_SIZE       65464   // RFC 2348
+#define TFTP_WINDOW_SIZE          16      // RFC 7440
+
+// Size of the IPv4, UDP and TFTP DATA headers preceding the data of a block
+#define TFTP_DATA_PACKET_OVERHEAD (20 + 8 + 4)
 
 /* Type and defines to set up the DHCP4 options */
 
@@ -890,7 +899,61 @@ Error :
 }
 
 /**
-  Update the progress of a file download
+  Grow the buffer a file is downloaded into, keeping the data received so far.
+
+  @param[in out]  Context  Context of the download
+  @param[in]      MinSize  Minimum size in bytes of the new buffer
+
+  @retval  EFI_SUCCESS           The buffer was grown.
+  @retval  EFI_BUFFER_TOO_SMALL  The file is larger than MAX_TFTP_FILE_SIZE.
+  @retval  !EFI_SUCCESS          The new buffer could not be allocated.
+
+**/
+STATIC
+EFI_STATUS
+BdsTftpGrowBuffer (
+  IN OUT BDS_TFTP_CONTEXT  *Context,
+  IN     UINT64            MinSize
+  )
+{
+  EFI_STATUS            Status;
+  EFI_PHYSICAL_ADDRESS  NewBuffer;
+  UINT64                NewSize;
+
+  if (MinSize > MAX_TFTP_FILE_SIZE) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  // Double the size of the buffer so that only a few copies are needed
+  NewSize = MIN (MAX (Context->BufferSize * 2, MinSize), MAX_TFTP_FILE_SIZE);
+
+  Status = gBS->AllocatePages (
+                  AllocateAnyPages,
+                  EfiBootServicesCode,
+                  EFI_SIZE_TO_PAGES ((UINTN)NewSize),
+                  &NewBuffer
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  CopyMem (
+    (VOID*)(UINTN)NewBuffer,
+    (VOID*)(UINTN)Context->Buffer,
+    (UINTN)Context->DownloadedNbOfBytes
+    );
+  gBS->FreePages (Context->Buffer, EFI_SIZE_TO_PAGES ((UINTN)Context->BufferSize));
+
+  Context->Buffer     = NewBuffer;
+  Context->BufferSize = NewSize;
+  Context->Relocated  = TRUE;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Store the data of a file being downloaded and update the progress of the
+  download.
   This procedure is called each time a new TFTP packet is received.
 
   @param[in]  This       MTFTP4 protocol interface
@@ -898,7 +961,8 @@ Error :
   @param[in]  PacketLen  Length of the packet
   @param[in]  Packet     Address of the packet
 
-  @retval  EFI_SUCCESS  All packets are accepted.
+  @retval  EFI_SUCCESS   The packet was accepted.
+  @retval  !EFI_SUCCESS  The data could not be stored, abort the download.
 
 **/
 STATIC
@@ -911,6 +975,8 @@ Mtftp4CheckPacket (
   )
 {
   BDS_TFTP_CONTEXT  *Context;
+  EFI_STATUS        Status;
+  UINTN             DataLength;
   CHAR16            Progress[TFTP_PROGRESS_MESSAGE_SIZE];
   UINT64            NbOfKb;
   UINTN             Index;
@@ -935,7 +1001,26 @@ Mtftp4CheckPacket (
     // . OpCode = EFI_MTFTP4_OPCODE_DATA
     // . Block  = the number of this block of data
     //
-    Context->DownloadedNbOfBytes += PacketLen - sizeof (Packet->OpCode) - sizeof (Packet->Data.Block);
+    DataLength = PacketLen - sizeof (Packet->OpCode) - sizeof (Packet->Data.Block);
+
+    //
+    // The MTFTP4 driver only passes the blocks in sequence, append the data
+    // to the buffer, growing it if the file is larger than expected.
+    //
+    if (Context->DownloadedNbOfBytes + DataLength > Context->BufferSize) {
+      Status = BdsTftpGrowBuffer (Context, Context->DownloadedNbOfBytes + DataLength);
+      if (EFI_ERROR (Status)) {
+        Context->Status = Status;
+        return Status;
+      }
+    }
+    CopyMem (
+      (UINT8*)(UINTN)Context->Buffer + Context->DownloadedNbOfBytes,
+      Packet->Data.Data,
+      DataLength
+      );
+
+    Context->DownloadedNbOfBytes += DataLength;
     NbOfKb = Context->DownloadedNbOfBytes / 1024;
 
     Progress[0] = L'\0';
@@ -1021,8 +1106,15 @@ BdsTftpLoadImage (
   CHAR16                   *PathName;
   CHAR8                    *AsciiFilePath;
   EFI_MTFTP4_TOKEN         Mtftp4Token;
+  EFI_MTFTP4_OPTION        Mtftp4Options[2];
+  UINT32                   Mtftp4OptionCount;
+  CHAR8                    BlockSizeStr[8];
+  CHAR8                    WindowSizeStr[8];
+  EFI_SIMPLE_NETWORK_PROTOCOL  *Snp;
+  UINTN                    BlockSize;
   UINT64                   FileSize;
   UINT64                   TftpBufferSize;
+  EFI_PHYSICAL_ADDRESS     ImageAddress;
   BDS_TFTP_CONTEXT         *TftpContext;
   UINTN                    PathNameLen;
 
@@ -1172,67 +1264,135 @@ BdsTftpLoadImage (
   AsciiFilePath = AllocatePool (PathNameLen);
   UnicodeStrToAsciiStrS (PathName, AsciiFilePath, PathNameLen);
 
+  //
+  // Ask the server for the largest blocks the link can carry and for several
+  // blocks to be sent per acknowledgement. "blksize" comes first, so that the
+  // option list can be cut down to it alone.
+  //
+  BlockSize = TFTP_DEFAULT_BLOCK_SIZE;
+  Status = gBS->HandleProtocol (ControllerHandle, &gEfiSimpleNetworkProtocolGuid, (VOID **) &Snp);
+  if (!EFI_ERROR (Status) && (Snp->Mode->MaxPacketSize > TFTP_DATA_PACKET_OVERHEAD + TFTP_DEFAULT_BLOCK_SIZE)) {
+    BlockSize = MIN (Snp->Mode->MaxPacketSize - TFTP_DATA_PACKET_OVERHEAD, TFTP_MAX_BLOCK_SIZE);
+  }
+
+  AsciiSPrint (BlockSizeStr, sizeof (BlockSizeStr), "%d", (UINT32)BlockSize);
+  AsciiSPrint (WindowSizeStr, sizeof (WindowSizeStr), "%d", TFTP_WINDOW_SIZE);
+  Mtftp4Options[0].OptionStr = (UINT8*)"blksize";
+  Mtftp4Options[0].ValueStr  = (UINT8*)BlockSizeStr;
+  Mtftp4Options[1].OptionStr = (UINT8*)"windowsize";
+  Mtftp4Options[1].ValueStr  = (UINT8*)WindowSizeStr;
+  Mtftp4OptionCount = 2;
+
   //
   // Try to get the size of the file in bytes from the server. If it fails,
-  // start with a 8MB buffer to download the file.
+  // start with a 16MB buffer to download the file, it is grown as needed.
   //
   FileSize = 0;
-  if (Mtftp4GetFileSize (Mtftp4, AsciiFilePath, &FileSize) == EFI_SUCCESS) {
+  if ((Mtftp4GetFileSize (Mtftp4, AsciiFilePath, &FileSize) == EFI_SUCCESS) &&
+      (FileSize > 0)) {
     TftpBufferSize = FileSize;
   } else {
     TftpBufferSize = SIZE_16MB;
   }
 
-  TftpContext = AllocatePool (sizeof (BDS_TFTP_CONTEXT));
+  TftpContext = AllocateZeroPool (sizeof (BDS_TFTP_CONTEXT));
   if (TftpContext == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
     goto Error;
   }
   TftpContext->FileSize = FileSize;
 
-  for (; TftpBufferSize <= MAX_TFTP_FILE_SIZE;
-         TftpBufferSize = (TftpBufferSize + SIZE_16MB) & (~(SIZE_16MB-1))) {
-    //
-    // Allocate a buffer to hold the whole file.
-    //
-    Status = gBS->AllocatePages (
-                    Type,
-                    EfiBootServicesCode,
-                    EFI_SIZE_TO_PAGES (TftpBufferSize),
-                    Image
-                    );
-    if (EFI_ERROR (Status)) {
-      Print (L"Failed to allocate space for image\n");
-      goto Error;
-    }
+  //
+  // Allocate a buffer to hold the whole file.
+  //
+  ImageAddress = *Image;
+  Status = gBS->AllocatePages (
+                  Type,
+                  EfiBootServicesCode,
+                  EFI_SIZE_TO_PAGES ((UINTN)TftpBufferSize),
+                  Image
+                  );
+  if (EFI_ERROR (Status)) {
+    Print (L"Failed to allocate space for image\n");
+    goto Error;
+  }
+  TftpContext->Buffer     = *Image;
+  TftpContext->BufferSize = TftpBufferSize;
 
+  while (TRUE) {
     TftpContext->DownloadedNbOfBytes   = 0;
     TftpContext->LastReportedNbOfBytes = 0;
+    TftpContext->Status                = EFI_SUCCESS;
 
+    //
+    // The data is stored by Mtftp4CheckPacket() as it is received, the MTFTP4
+    // driver does not need a buffer of its own.
+    //
     ZeroMem (&Mtftp4Token, sizeof (EFI_MTFTP4_TOKEN));
     Mtftp4Token.Filename    = (UINT8*)AsciiFilePath;
-    Mtftp4Token.BufferSize  = TftpBufferSize;
-    Mtftp4Token.Buffer      = (VOID *)(UINTN)*Image;
+    Mtftp4Token.OptionCount = Mtftp4OptionCount;
+    Mtftp4Token.OptionList  = Mtftp4Options;
     Mtftp4Token.CheckPacket = Mtftp4CheckPacket;
     Mtftp4Token.Context     = (VOID*)TftpContext;
 
     Print (L"Downloading the file <%a> from the TFTP server\n", AsciiFilePath);
     Status = Mtftp4->ReadFile (Mtftp4, &Mtftp4Token);
     Print (L"\n");
-    if (EFI_ERROR (Status)) {
-      gBS->FreePages (*Image, EFI_SIZE_TO_PAGES (TftpBufferSize));
-      if (Status == EFI_BUFFER_TOO_SMALL) {
-        Print (L"Downloading failed, file larger than expected.\n");
-        continue;
-      } else {
-        goto Error;
-      }
+    if (EFI_ERROR (TftpContext->Status)) {
+      Status = TftpContext->Status;
     }
 
-    *ImageSize = Mtftp4Token.BufferSize;
+    //
+    // Options that are not supported by the MTFTP4 driver or by the server
+    // make the transfer fail before any data is received. MTFTP4 drivers
+    // without RFC 7440 support reject "windowsize", so first retry with
+    // "blksize" only, then without any option.
+    //
+    if (((Status == EFI_UNSUPPORTED) || (Status == EFI_TFTP_ERROR)) &&
+        (Mtftp4OptionCount != 0) && (TftpContext->DownloadedNbOfBytes == 0)) {
+      Mtftp4OptionCount--;
+      continue;
+    }
     break;
   }
 
+  if (EFI_ERROR (Status)) {
+    if (Status == EFI_BUFFER_TOO_SMALL) {
+      Print (L"Downloading failed, file larger than %d bytes.\n", MAX_TFTP_FILE_SIZE);
+    }
+    gBS->FreePages (TftpContext->Buffer, EFI_SIZE_TO_PAGES ((UINTN)TftpContext->BufferSize));
+    goto Error;
+  }
+
+  //
+  // If the buffer had to be grown, it was not allocated as requested by the
+  // caller. Move the file to a buffer of the requested type.
+  //
+  if (TftpContext->Relocated) {
+    *Image = ImageAddress;
+    Status = gBS->AllocatePages (
+                    Type,
+                    EfiBootServicesCode,
+                    EFI_SIZE_TO_PAGES ((UINTN)TftpContext->DownloadedNbOfBytes),
+                    Image
+                    );
+    if (!EFI_ERROR (Status)) {
+      CopyMem (
+        (VOID*)(UINTN)*Image,
+        (VOID*)(UINTN)TftpContext->Buffer,
+        (UINTN)TftpContext->DownloadedNbOfBytes
+        );
+    } else {
+      Print (L"Failed to allocate space for image\n");
+    }
+    gBS->FreePages (TftpContext->Buffer, EFI_SIZE_TO_PAGES ((UINTN)TftpContext->BufferSize));
+    if (EFI_ERROR (Status)) {
+      goto Error;
+    }
+  }
+
+  *ImageSize = (UINTN)TftpContext->DownloadedNbOfBytes;
+
 Error:
   if (Dhcp4ChildHandle != NULL) {
     if (Dhcp4 != NULL) {
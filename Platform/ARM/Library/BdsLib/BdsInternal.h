@@ -94,9 +94,13 @@ typedef struct _BDS_SYSTEM_MEMORY_RESOURCE {
 } BDS_SYSTEM_MEMORY_RESOURCE;
 
 typedef struct {
-  UINT64  FileSize;
-  UINT64  DownloadedNbOfBytes;
-  UINT64  LastReportedNbOfBytes;
+  UINT64                FileSize;
+  UINT64                DownloadedNbOfBytes;
+  UINT64                LastReportedNbOfBytes;
+  EFI_PHYSICAL_ADDRESS  Buffer;       // Pages the file is downloaded into
+  UINT64                BufferSize;
+  BOOLEAN               Relocated;    // Buffer was reallocated to grow it
+  EFI_STATUS            Status;       // Why the download was aborted if it was
 } BDS_TFTP_CONTEXT;
 
 /**
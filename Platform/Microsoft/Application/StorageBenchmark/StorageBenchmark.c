@@ -0,0 +1,862 @@
+/** @file
+*
+*  Block storage benchmark.
+*
+*  Measures the throughput and latency distribution of raw block IO on a
+*  EFI_BLOCK_IO/EFI_BLOCK_IO2 device for sequential and random access, reads and
+*  writes, a set of IO sizes and a queue depth. Queue depths above 1 are issued
+*  through EFI_BLOCK_IO2. Together with SdhcSimDxe it allows measuring the
+*  SdMmcDxe IO path without hardware.
+*
+*  Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+*
+*  This program and the accompanying materials
+*  are licensed and made available under the terms and conditions of the BSD License
+*  which accompanies this distribution.  The full text of the license may be found at
+*  http://opensource.org/licenses/bsd-license.php
+*
+*  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+*
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/SortLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/ShellParameters.h>
+
+#define BENCHMARK_MAX_BLOCK_SIZES   16
+#define BENCHMARK_MAX_QUEUE_DEPTH   32
+#define BENCHMARK_DEFAULT_IO_COUNT  256
+#define BENCHMARK_DEFAULT_SPAN_MB   64
+
+typedef enum {
+  AccessPatternSequential = 0,
+  AccessPatternRandom,
+  AccessPatternMax
+} ACCESS_PATTERN;
+
+typedef struct {
+  BOOLEAN           Patterns[AccessPatternMax];
+  BOOLEAN           Read;
+  BOOLEAN           Write;
+  BOOLEAN           WriteConfirmed;
+  UINT32            QueueDepth;
+  UINT32            IoCount;
+  UINT64            StartLba;
+  UINT64            SpanBytes;
+  UINTN             BlockSizes[BENCHMARK_MAX_BLOCK_SIZES];
+  UINTN             BlockSizeCount;
+  CONST CHAR16      *DevicePathText;
+} BENCHMARK_CONFIG;
+
+typedef struct {
+  EFI_BLOCK_IO2_TOKEN   Token;
+  VOID                  *Buffer;
+  UINTN                 BufferPages;
+  UINT64                SubmitTime;
+  BOOLEAN               Busy;
+} BENCHMARK_SLOT;
+
+typedef struct {
+  EFI_BLOCK_IO_PROTOCOL   *BlockIo;
+  EFI_BLOCK_IO2_PROTOCOL  *BlockIo2;
+  UINT64                  SpanBlocks;
+  UINT64                  RandomState;
+  BENCHMARK_SLOT          Slots[BENCHMARK_MAX_QUEUE_DEPTH];
+  UINT64                  *Latencies;
+} BENCHMARK_CONTEXT;
+
+STATIC BOOLEAN mPerformanceCounterCountsUp;
+
+VOID
+PrintUsage (
+  VOID
+  )
+{
+  Print (
+    L"Usage: StorageBenchmark [-seq] [-rand] [-read] [-write -y] [-qd N]\n"
+    L"                        [-bs SIZE[,SIZE...]] [-n N] [-lba N] [-span MB]\n"
+    L"                        [DevicePath]\n"
+    L"  -seq, -rand   Access pattern, both by default\n"
+    L"  -read         Measure reads, the default\n"
+    L"  -write -y     Measure writes, destroys the data in the tested range\n"
+    L"  -qd N         Queue depth, above 1 requires EFI_BLOCK_IO2 (default 1, max %d)\n"
+    L"  -bs SIZES     IO sizes in bytes with an optional K or M suffix\n"
+    L"                (default 512,4K,64K,1M)\n"
+    L"  -n N          Number of IOs per test (default %d)\n"
+    L"  -lba N        First LBA of the tested range (default 0)\n"
+    L"  -span MB      Size of the tested range (default %dMB)\n"
+    L"Without a DevicePath the raw block devices are listed\n",
+    BENCHMARK_MAX_QUEUE_DEPTH,
+    BENCHMARK_DEFAULT_IO_COUNT,
+    BENCHMARK_DEFAULT_SPAN_MB);
+}
+
+BOOLEAN
+ParseNumber (
+  IN CONST CHAR16 *String,
+  OUT UINT64 *Value
+  )
+{
+  if ((String == NULL) || (*String < L'0') || (*String > L'9')) {
+    return FALSE;
+  }
+
+  *Value = 0;
+  for (; *String != L'\0'; ++String) {
+    if ((*String < L'0') || (*String > L'9')) {
+      return FALSE;
+    }
+    *Value = MultU64x32 (*Value, 10) + (*String - L'0');
+  }
+
+  return TRUE;
+}
+
+BOOLEAN
+ParseBlockSizes (
+  IN CONST CHAR16 *String,
+  OUT BENCHMARK_CONFIG *Config
+  )
+{
+  UINTN Size;
+
+  Config->BlockSizeCount = 0;
+  Size = 0;
+
+  for (;; ++String) {
+    if ((*String >= L'0') && (*String <= L'9')) {
+      Size = (Size * 10) + (*String - L'0');
+      continue;
+    }
+
+    if ((*String == L'K') || (*String == L'k')) {
+      Size *= SIZE_1KB;
+      ++String;
+    } else if ((*String == L'M') || (*String == L'm')) {
+      Size *= SIZE_1MB;
+      ++String;
+    }
+
+    if (((*String != L',') && (*String != L'\0')) ||
+        (Size == 0) ||
+        (Config->BlockSizeCount == BENCHMARK_MAX_BLOCK_SIZES)) {
+      return FALSE;
+    }
+
+    Config->BlockSizes[Config->BlockSizeCount++] = Size;
+    Size = 0;
+
+    if (*String == L'\0') {
+      return TRUE;
+    }
+  }
+}
+
+EFI_STATUS
+ParseArguments (
+  OUT BENCHMARK_CONFIG *Config
+  )
+{
+  UINTN                           ArgIdx;
+  CONST CHAR16                    *Arg;
+  EFI_SHELL_PARAMETERS_PROTOCOL   *ShellParameters;
+  EFI_STATUS                      Status;
+  UINT64                          Value;
+
+  Status = gBS->HandleProtocol (
+                  gImageHandle,
+                  &gEfiShellParametersProtocolGuid,
+                  (VOID **)&ShellParameters);
+  if (EFI_ERROR (Status)) {
+    Print (L"StorageBenchmark must be run from the UEFI Shell\n");
+    return Status;
+  }
+
+  ZeroMem (Config, sizeof (*Config));
+  Config->QueueDepth = 1;
+  Config->IoCount = BENCHMARK_DEFAULT_IO_COUNT;
+  Config->SpanBytes = MultU64x32 (SIZE_1MB, BENCHMARK_DEFAULT_SPAN_MB);
+  Config->BlockSizes[0] = 512;
+  Config->BlockSizes[1] = SIZE_4KB;
+  Config->BlockSizes[2] = SIZE_64KB;
+  Config->BlockSizes[3] = SIZE_1MB;
+  Config->BlockSizeCount = 4;
+
+  for (ArgIdx = 1; ArgIdx < ShellParameters->Argc; ++ArgIdx) {
+    Arg = ShellParameters->Argv[ArgIdx];
+
+    if (StrCmp (Arg, L"-seq") == 0) {
+      Config->Patterns[AccessPatternSequential] = TRUE;
+    } else if (StrCmp (Arg, L"-rand") == 0) {
+      Config->Patterns[AccessPatternRandom] = TRUE;
+    } else if (StrCmp (Arg, L"-read") == 0) {
+      Config->Read = TRUE;
+    } else if (StrCmp (Arg, L"-write") == 0) {
+      Config->Write = TRUE;
+    } else if (StrCmp (Arg, L"-y") == 0) {
+      Config->WriteConfirmed = TRUE;
+    } else if ((Arg[0] == L'-') && ((ArgIdx + 1) < ShellParameters->Argc)) {
+      ++ArgIdx;
+      if (StrCmp (Arg, L"-bs") == 0) {
+        if (!ParseBlockSizes (ShellParameters->Argv[ArgIdx], Config)) {
+          goto InvalidArgument;
+        }
+        continue;
+      }
+
+      if (!ParseNumber (ShellParameters->Argv[ArgIdx], &Value)) {
+        goto InvalidArgument;
+      }
+
+      if ((StrCmp (Arg, L"-qd") == 0) &&
+          (Value > 0) && (Value <= BENCHMARK_MAX_QUEUE_DEPTH)) {
+        Config->QueueDepth = (UINT32)Value;
+      } else if ((StrCmp (Arg, L"-n") == 0) && (Value > 0) && (Value <= MAX_UINT32)) {
+        Config->IoCount = (UINT32)Value;
+      } else if (StrCmp (Arg, L"-lba") == 0) {
+        Config->StartLba = Value;
+      } else if ((StrCmp (Arg, L"-span") == 0) && (Value > 0)) {
+        Config->SpanBytes = MultU64x32 (Value, SIZE_1MB);
+      } else {
+        goto InvalidArgument;
+      }
+    } else if ((Arg[0] != L'-') && (Config->DevicePathText == NULL)) {
+      Config->DevicePathText = Arg;
+    } else {
+      goto InvalidArgument;
+    }
+  }
+
+  if (!Config->Patterns[AccessPatternSequential] &&
+      !Config->Patterns[AccessPatternRandom]) {
+    Config->Patterns[AccessPatternSequential] = TRUE;
+    Config->Patterns[AccessPatternRandom] = TRUE;
+  }
+
+  if (!Config->Read && !Config->Write) {
+    Config->Read = TRUE;
+  }
+
+  if (Config->Write && !Config->WriteConfirmed) {
+    Print (L"-write destroys the data in the tested range, confirm with -y\n");
+    return EFI_ACCESS_DENIED;
+  }
+
+  return EFI_SUCCESS;
+
+InvalidArgument:
+  Print (L"Invalid argument '%s'\n", Arg);
+  PrintUsage ();
+  return EFI_INVALID_PARAMETER;
+}
+
+VOID
+ListBlockDevices (
+  VOID
+  )
+{
+  EFI_BLOCK_IO_PROTOCOL   *BlockIo;
+  CHAR16                  *DevicePathText;
+  UINTN                   HandleCount;
+  UINTN                   HandleIdx;
+  EFI_HANDLE              *Handles;
+  EFI_STATUS              Status;
+
+  Status = gBS->LocateHandleBuffer (
+                  ByProtocol,
+                  &gEfiBlockIoProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &Handles);
+  if (EFI_ERROR (Status)) {
+    Print (L"No block devices found\n");
+    return;
+  }
+
+  Print (L"Block devices:\n");
+  for (HandleIdx = 0; HandleIdx < HandleCount; ++HandleIdx) {
+    Status = gBS->HandleProtocol (
+                    Handles[HandleIdx],
+                    &gEfiBlockIoProtocolGuid,
+                    (VOID **)&BlockIo);
+    if (EFI_ERROR (Status) ||
+        BlockIo->Media->LogicalPartition ||
+        !BlockIo->Media->MediaPresent) {
+      continue;
+    }
+
+    DevicePathText = ConvertDevicePathToText (
+                       DevicePathFromHandle (Handles[HandleIdx]),
+                       FALSE,
+                       FALSE);
+    if (DevicePathText == NULL) {
+      continue;
+    }
+
+    Print (
+      L"  %s %ldMB\n",
+      DevicePathText,
+      DivU64x32 (
+        MultU64x32 (BlockIo->Media->LastBlock + 1, BlockIo->Media->BlockSize),
+        SIZE_1MB));
+    FreePool (DevicePathText);
+  }
+
+  FreePool (Handles);
+}
+
+EFI_STATUS
+OpenBlockDevice (
+  IN CONST CHAR16 *DevicePathText,
+  OUT BENCHMARK_CONTEXT *Ctx
+  )
+{
+  EFI_DEVICE_PATH_PROTOCOL  *DevicePath;
+  EFI_HANDLE                Handle;
+  EFI_DEVICE_PATH_PROTOCOL  *RemainingDevicePath;
+  EFI_STATUS                Status;
+
+  DevicePath = ConvertTextToDevicePath (DevicePathText);
+  if (DevicePath == NULL) {
+    Print (L"Invalid device path '%s'\n", DevicePathText);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  RemainingDevicePath = DevicePath;
+  Status = gBS->LocateDevicePath (
+                  &gEfiBlockIoProtocolGuid,
+                  &RemainingDevicePath,
+                  &Handle);
+  if (!EFI_ERROR (Status) && !IsDevicePathEnd (RemainingDevicePath)) {
+    Status = EFI_NOT_FOUND;
+  }
+
+  FreePool (DevicePath);
+
+  if (EFI_ERROR (Status)) {
+    Print (L"No block device at '%s'. %r\n", DevicePathText, Status);
+    return Status;
+  }
+
+  Status = gBS->HandleProtocol (
+                  Handle,
+                  &gEfiBlockIoProtocolGuid,
+                  (VOID **)&Ctx->BlockIo);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  // EFI_BLOCK_IO2 is optional and only needed for queue depths above 1
+  Status = gBS->HandleProtocol (
+                  Handle,
+                  &gEfiBlockIo2ProtocolGuid,
+                  (VOID **)&Ctx->BlockIo2);
+  if (EFI_ERROR (Status)) {
+    Ctx->BlockIo2 = NULL;
+  }
+
+  return EFI_SUCCESS;
+}
+
+UINT64
+ElapsedNanoseconds (
+  IN UINT64 StartTime,
+  IN UINT64 EndTime
+  )
+{
+  if (mPerformanceCounterCountsUp) {
+    return GetTimeInNanoSecond (EndTime - StartTime);
+  }
+
+  return GetTimeInNanoSecond (StartTime - EndTime);
+}
+
+UINT64
+NextRandom (
+  IN OUT BENCHMARK_CONTEXT *Ctx
+  )
+{
+  // xorshift64, fixed seeded so that runs are comparable
+  Ctx->RandomState ^= LShiftU64 (Ctx->RandomState, 13);
+  Ctx->RandomState ^= RShiftU64 (Ctx->RandomState, 7);
+  Ctx->RandomState ^= LShiftU64 (Ctx->RandomState, 17);
+  return Ctx->RandomState;
+}
+
+EFI_LBA
+NextLba (
+  IN OUT BENCHMARK_CONTEXT *Ctx,
+  IN CONST BENCHMARK_CONFIG *Config,
+  IN ACCESS_PATTERN Pattern,
+  IN UINTN BlockSize,
+  IN UINT32 IoIdx
+  )
+{
+  UINT64 BlocksPerIo;
+  UINT64 IoSlotCount;
+  UINT64 IoSlot;
+
+  BlocksPerIo = BlockSize / Ctx->BlockIo->Media->BlockSize;
+  IoSlotCount = DivU64x64Remainder (Ctx->SpanBlocks, BlocksPerIo, NULL);
+
+  if (Pattern == AccessPatternSequential) {
+    DivU64x64Remainder (IoIdx, IoSlotCount, &IoSlot);
+  } else {
+    DivU64x64Remainder (NextRandom (Ctx), IoSlotCount, &IoSlot);
+  }
+
+  return Config->StartLba + MultU64x64 (IoSlot, BlocksPerIo);
+}
+
+VOID
+FreeSlots (
+  IN OUT BENCHMARK_CONTEXT *Ctx
+  )
+{
+  UINT32          SlotIdx;
+  BENCHMARK_SLOT  *Slot;
+
+  for (SlotIdx = 0; SlotIdx < BENCHMARK_MAX_QUEUE_DEPTH; ++SlotIdx) {
+    Slot = &Ctx->Slots[SlotIdx];
+    ASSERT (!Slot->Busy);
+
+    if (Slot->Token.Event != NULL) {
+      gBS->CloseEvent (Slot->Token.Event);
+    }
+
+    if (Slot->Buffer != NULL) {
+      FreePages (Slot->Buffer, Slot->BufferPages);
+    }
+  }
+
+  ZeroMem (Ctx->Slots, sizeof (Ctx->Slots));
+}
+
+EFI_STATUS
+AllocateSlots (
+  IN OUT BENCHMARK_CONTEXT *Ctx,
+  IN UINT32 QueueDepth,
+  IN UINTN BlockSize
+  )
+{
+  UINT32          SlotIdx;
+  BENCHMARK_SLOT  *Slot;
+  EFI_STATUS      Status;
+
+  for (SlotIdx = 0; SlotIdx < QueueDepth; ++SlotIdx) {
+    Slot = &Ctx->Slots[SlotIdx];
+    Slot->BufferPages = EFI_SIZE_TO_PAGES (BlockSize);
+    Slot->Buffer = AllocatePages (Slot->BufferPages);
+    if (Slot->Buffer == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto Exit;
+    }
+
+    // A recognizable per slot pattern, only written by write tests
+    SetMem (Slot->Buffer, BlockSize, (UINT8)(0xA5 ^ SlotIdx));
+
+    // Completion is polled with CheckEvent to timestamp it
+    Status = gBS->CreateEvent (0, TPL_CALLBACK, NULL, NULL, &Slot->Token.Event);
+    if (EFI_ERROR (Status)) {
+      goto Exit;
+    }
+  }
+
+  Status = EFI_SUCCESS;
+
+Exit:
+  if (EFI_ERROR (Status)) {
+    FreeSlots (Ctx);
+  }
+
+  return Status;
+}
+
+EFI_STATUS
+RunSyncIo (
+  IN OUT BENCHMARK_CONTEXT *Ctx,
+  IN CONST BENCHMARK_CONFIG *Config,
+  IN ACCESS_PATTERN Pattern,
+  IN BOOLEAN Write,
+  IN UINTN BlockSize
+  )
+{
+  EFI_BLOCK_IO_PROTOCOL   *BlockIo;
+  UINT64                  EndTime;
+  UINT32                  IoIdx;
+  EFI_LBA                 Lba;
+  UINT64                  StartTime;
+  EFI_STATUS              Status;
+
+  BlockIo = Ctx->BlockIo;
+
+  for (IoIdx = 0; IoIdx < Config->IoCount; ++IoIdx) {
+    Lba = NextLba (Ctx, Config, Pattern, BlockSize, IoIdx);
+    StartTime = GetPerformanceCounter ();
+    if (Write) {
+      Status = BlockIo->WriteBlocks (BlockIo, BlockIo->Media->MediaId, Lba, BlockSize, Ctx->Slots[0].Buffer);
+    } else {
+      Status = BlockIo->ReadBlocks (BlockIo, BlockIo->Media->MediaId, Lba, BlockSize, Ctx->Slots[0].Buffer);
+    }
+    EndTime = GetPerformanceCounter ();
+
+    if (EFI_ERROR (Status)) {
+      Print (L"IO at LBA 0x%lx failed. %r\n", Lba, Status);
+      return Status;
+    }
+
+    Ctx->Latencies[IoIdx] = ElapsedNanoseconds (StartTime, EndTime);
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+RunAsyncIo (
+  IN OUT BENCHMARK_CONTEXT *Ctx,
+  IN CONST BENCHMARK_CONFIG *Config,
+  IN ACCESS_PATTERN Pattern,
+  IN BOOLEAN Write,
+  IN UINTN BlockSize
+  )
+{
+  EFI_BLOCK_IO2_PROTOCOL  *BlockIo2;
+  UINT32                  Completed;
+  UINTN                   EventIdx;
+  EFI_LBA                 Lba;
+  BENCHMARK_SLOT          *Slot;
+  UINT32                  SlotIdx;
+  EFI_STATUS              Status;
+  UINT32                  Submitted;
+
+  BlockIo2 = Ctx->BlockIo2;
+  Completed = 0;
+  Submitted = 0;
+  Status = EFI_SUCCESS;
+
+  while (Completed < Config->IoCount) {
+    // Keep the queue full
+    for (SlotIdx = 0; SlotIdx < Config->QueueDepth; ++SlotIdx) {
+      Slot = &Ctx->Slots[SlotIdx];
+      if (Slot->Busy || (Submitted == Config->IoCount)) {
+        continue;
+      }
+
+      Lba = NextLba (Ctx, Config, Pattern, BlockSize, Submitted);
+      Slot->Token.TransactionStatus = EFI_NOT_READY;
+      Slot->SubmitTime = GetPerformanceCounter ();
+      if (Write) {
+        Status = BlockIo2->WriteBlocksEx (BlockIo2, BlockIo2->Media->MediaId, Lba, &Slot->Token, BlockSize, Slot->Buffer);
+      } else {
+        Status = BlockIo2->ReadBlocksEx (BlockIo2, BlockIo2->Media->MediaId, Lba, &Slot->Token, BlockSize, Slot->Buffer);
+      }
+
+      if (EFI_ERROR (Status)) {
+        Print (L"IO at LBA 0x%lx failed to queue. %r\n", Lba, Status);
+        goto Exit;
+      }
+
+      Slot->Busy = TRUE;
+      ++Submitted;
+    }
+
+    for (SlotIdx = 0; SlotIdx < Config->QueueDepth; ++SlotIdx) {
+      Slot = &Ctx->Slots[SlotIdx];
+      if (!Slot->Busy || EFI_ERROR (gBS->CheckEvent (Slot->Token.Event))) {
+        continue;
+      }
+
+      Ctx->Latencies[Completed++] = ElapsedNanoseconds (Slot->SubmitTime, GetPerformanceCounter ());
+      Slot->Busy = FALSE;
+
+      if (EFI_ERROR (Slot->Token.TransactionStatus)) {
+        Status = Slot->Token.TransactionStatus;
+        Print (L"Queued IO failed. %r\n", Status);
+        goto Exit;
+      }
+    }
+  }
+
+Exit:
+  // Buffers can't be released while the device may still access them
+  for (SlotIdx = 0; SlotIdx < Config->QueueDepth; ++SlotIdx) {
+    Slot = &Ctx->Slots[SlotIdx];
+    if (Slot->Busy) {
+      gBS->WaitForEvent (1, &Slot->Token.Event, &EventIdx);
+      Slot->Busy = FALSE;
+    }
+  }
+
+  return Status;
+}
+
+INTN
+EFIAPI
+CompareLatency (
+  IN CONST VOID *Left,
+  IN CONST VOID *Right
+  )
+{
+  UINT64 LeftValue;
+  UINT64 RightValue;
+
+  LeftValue = *(CONST UINT64 *)Left;
+  RightValue = *(CONST UINT64 *)Right;
+
+  if (LeftValue < RightValue) {
+    return -1;
+  }
+
+  return (LeftValue > RightValue) ? 1 : 0;
+}
+
+/** Returns the latency in microseconds at Permille of the sorted latencies. **/
+UINT64
+LatencyPercentileUs (
+  IN CONST UINT64 *SortedLatencies,
+  IN UINT32 Count,
+  IN UINT32 Permille
+  )
+{
+  UINT64 Rank;
+
+  // Nearest rank
+  Rank = DivU64x32 (MultU64x32 (Count, Permille) + 999, 1000);
+  if (Rank > 0) {
+    --Rank;
+  }
+
+  return DivU64x32 (SortedLatencies[Rank], 1000);
+}
+
+EFI_STATUS
+RunTest (
+  IN OUT BENCHMARK_CONTEXT *Ctx,
+  IN CONST BENCHMARK_CONFIG *Config,
+  IN ACCESS_PATTERN Pattern,
+  IN BOOLEAN Write,
+  IN UINTN BlockSize
+  )
+{
+  UINT64      ElapsedNs;
+  UINT32      IoIdx;
+  UINT64      KBps;
+  UINT64      Iops;
+  UINT64      StartTime;
+  EFI_STATUS  Status;
+  UINT64      TotalLatencyNs;
+
+  Status = AllocateSlots (Ctx, Config->QueueDepth, BlockSize);
+  if (EFI_ERROR (Status)) {
+    Print (L"Failed to allocate %d %luB buffers. %r\n", Config->QueueDepth, (UINT64)BlockSize, Status);
+    return Status;
+  }
+
+  Ctx->RandomState = 0x2545F4914F6CDD1DULL;
+
+  StartTime = GetPerformanceCounter ();
+  if (Config->QueueDepth == 1) {
+    Status = RunSyncIo (Ctx, Config, Pattern, Write, BlockSize);
+  } else {
+    Status = RunAsyncIo (Ctx, Config, Pattern, Write, BlockSize);
+  }
+
+  // Writes are only done once they are on the media, include the flush
+  if (!EFI_ERROR (Status) && Write) {
+    Status = Ctx->BlockIo->FlushBlocks (Ctx->BlockIo);
+    if (EFI_ERROR (Status)) {
+      Print (L"FlushBlocks failed. %r\n", Status);
+    }
+  }
+
+  ElapsedNs = ElapsedNanoseconds (StartTime, GetPerformanceCounter ());
+
+  FreeSlots (Ctx);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (ElapsedNs == 0) {
+    ElapsedNs = 1;
+  }
+
+  TotalLatencyNs = 0;
+  for (IoIdx = 0; IoIdx < Config->IoCount; ++IoIdx) {
+    TotalLatencyNs += Ctx->Latencies[IoIdx];
+  }
+
+  PerformQuickSort (Ctx->Latencies, Config->IoCount, sizeof (UINT64), CompareLatency);
+
+  Iops = DivU64x64Remainder (MultU64x32 (1000000000, Config->IoCount), ElapsedNs, NULL);
+  KBps = DivU64x64Remainder (
+           MultU64x64 (MultU64x32 (BlockSize, Config->IoCount), 1000000000 / SIZE_1KB),
+           ElapsedNs,
+           NULL);
+
+  Print (
+    L"%-4s %-5s QD%-2d %8lu  %8ld %9ld  %7ld %7ld %7ld %7ld %7ld %7ld %7ld\n",
+    (Pattern == AccessPatternSequential) ? L"Seq" : L"Rand",
+    Write ? L"Write" : L"Read",
+    Config->QueueDepth,
+    (UINT64)BlockSize,
+    Iops,
+    KBps,
+    DivU64x32 (Ctx->Latencies[0], 1000),
+    DivU64x32 (DivU64x32 (TotalLatencyNs, Config->IoCount), 1000),
+    LatencyPercentileUs (Ctx->Latencies, Config->IoCount, 500),
+    LatencyPercentileUs (Ctx->Latencies, Config->IoCount, 900),
+    LatencyPercentileUs (Ctx->Latencies, Config->IoCount, 990),
+    LatencyPercentileUs (Ctx->Latencies, Config->IoCount, 999),
+    DivU64x32 (Ctx->Latencies[Config->IoCount - 1], 1000));
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+RunBenchmark (
+  IN OUT BENCHMARK_CONTEXT *Ctx,
+  IN CONST BENCHMARK_CONFIG *Config
+  )
+{
+  UINTN               BlockSizeIdx;
+  EFI_BLOCK_IO_MEDIA  *Media;
+  UINT64              MediaBlockCount;
+  ACCESS_PATTERN      Pattern;
+  EFI_STATUS          Status;
+  UINT32              WriteIdx;
+
+  Media = Ctx->BlockIo->Media;
+  MediaBlockCount = Media->LastBlock + 1;
+
+  if (!Media->MediaPresent) {
+    Print (L"No media\n");
+    return EFI_NO_MEDIA;
+  }
+
+  if (Config->Write && Media->ReadOnly) {
+    Print (L"The media is write protected\n");
+    return EFI_WRITE_PROTECTED;
+  }
+
+  if (Media->IoAlign > EFI_PAGE_SIZE) {
+    Print (L"IoAlign %d is not supported\n", Media->IoAlign);
+    return EFI_UNSUPPORTED;
+  }
+
+  if ((Config->QueueDepth > 1) && (Ctx->BlockIo2 == NULL)) {
+    Print (L"Queue depth %d requires EFI_BLOCK_IO2\n", Config->QueueDepth);
+    return EFI_UNSUPPORTED;
+  }
+
+  if (Config->StartLba >= MediaBlockCount) {
+    Print (L"LBA 0x%lx is beyond the last block 0x%lx\n", Config->StartLba, Media->LastBlock);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Ctx->SpanBlocks = MIN (
+                      DivU64x32 (Config->SpanBytes, Media->BlockSize),
+                      MediaBlockCount - Config->StartLba);
+
+  for (BlockSizeIdx = 0; BlockSizeIdx < Config->BlockSizeCount; ++BlockSizeIdx) {
+    if (((Config->BlockSizes[BlockSizeIdx] % Media->BlockSize) != 0) ||
+        ((Config->BlockSizes[BlockSizeIdx] / Media->BlockSize) > Ctx->SpanBlocks)) {
+      Print (
+        L"IO size %lu is not a multiple of the %dB block size or larger than the tested range\n",
+        (UINT64)Config->BlockSizes[BlockSizeIdx],
+        Media->BlockSize);
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  Ctx->Latencies = AllocatePool (Config->IoCount * sizeof (UINT64));
+  if (Ctx->Latencies == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Print (
+    L"Media: %dB blocks, LastBlock 0x%lx, IoAlign %d, BlockIo2 %a\n",
+    Media->BlockSize,
+    Media->LastBlock,
+    Media->IoAlign,
+    (Ctx->BlockIo2 != NULL) ? "yes" : "no");
+  Print (
+    L"Range: LBA 0x%lx-0x%lx, %d IOs per test\n\n",
+    Config->StartLba,
+    Config->StartLba + Ctx->SpanBlocks - 1,
+    Config->IoCount);
+  Print (L"                    Size      IOPS      KB/s  Latency(us)\n");
+  Print (L"                                                  min     avg     p50     p90     p99   p99.9     max\n");
+
+  Status = EFI_SUCCESS;
+  for (WriteIdx = 0; WriteIdx < 2; ++WriteIdx) {
+    if (((WriteIdx == 0) && !Config->Read) || ((WriteIdx == 1) && !Config->Write)) {
+      continue;
+    }
+
+    for (Pattern = AccessPatternSequential; Pattern < AccessPatternMax; ++Pattern) {
+      if (!Config->Patterns[Pattern]) {
+        continue;
+      }
+
+      for (BlockSizeIdx = 0; BlockSizeIdx < Config->BlockSizeCount; ++BlockSizeIdx) {
+        Status = RunTest (Ctx, Config, Pattern, (WriteIdx == 1), Config->BlockSizes[BlockSizeIdx]);
+        if (EFI_ERROR (Status)) {
+          goto Exit;
+        }
+      }
+    }
+  }
+
+Exit:
+  FreePool (Ctx->Latencies);
+  Ctx->Latencies = NULL;
+
+  return Status;
+}
+
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  BENCHMARK_CONFIG    Config;
+  BENCHMARK_CONTEXT   Ctx;
+  UINT64              EndValue;
+  UINT64              StartValue;
+  EFI_STATUS          Status;
+
+  Status = ParseArguments (&Config);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (Config.DevicePathText == NULL) {
+    PrintUsage ();
+    ListBlockDevices ();
+    return EFI_SUCCESS;
+  }
+
+  GetPerformanceCounterProperties (&StartValue, &EndValue);
+  mPerformanceCounterCountsUp = (EndValue >= StartValue);
+
+  ZeroMem (&Ctx, sizeof (Ctx));
+  Status = OpenBlockDevice (Config.DevicePathText, &Ctx);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return RunBenchmark (&Ctx, &Config);
+}
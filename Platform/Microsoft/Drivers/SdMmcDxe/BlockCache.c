@@ -0,0 +1,485 @@
+/** @file
+*
+*  Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+*
+*  This program and the accompanying materials
+*  are licensed and made available under the terms and conditions of the BSD License
+*  which accompanies this distribution.  The full text of the license may be found at
+*  http://opensource.org/licenses/bsd-license.php
+*
+*  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+*
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/RpmbIo.h>
+#include <Protocol/Sdhc.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <SdMmcHw.h>
+#include "SdMmc.h"
+
+/** Reads from the media, after writing any queued write the read overlaps.
+**/
+EFI_STATUS
+ReadMediaBlocks (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         MediaId,
+  IN EFI_LBA        Lba,
+  IN UINTN          BufferSize,
+  OUT VOID          *Buffer
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = DrainOverlappingWrites (HostInst, Lba, BufferSize / SD_BLOCK_LENGTH_BYTES);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return IoBlocks (
+    &HostInst->BlockIo,
+    SdTransferDirectionRead,
+    MediaId,
+    Lba,
+    BufferSize,
+    Buffer);
+}
+
+#define LBA_TO_CACHE_LINE_LBA(Lba) \
+  ((Lba) & ~((EFI_LBA) SDMMC_BLOCK_CACHE_LINE_BLOCKS - 1))
+
+#define CACHE_LINE_LBA_TO_BUCKET(Lba) \
+  ((UINTN) ((Lba) / SDMMC_BLOCK_CACHE_LINE_BLOCKS) & (SDMMC_BLOCK_CACHE_HASH_BUCKETS - 1))
+
+C_ASSERT ((SDMMC_BLOCK_CACHE_HASH_BUCKETS & (SDMMC_BLOCK_CACHE_HASH_BUCKETS - 1)) == 0);
+C_ASSERT ((SDMMC_BLOCK_CACHE_LINE_BLOCKS & (SDMMC_BLOCK_CACHE_LINE_BLOCKS - 1)) == 0);
+
+SDMMC_BLOCK_CACHE_LINE*
+LookupBlockCacheLine (
+  IN SDMMC_BLOCK_CACHE  *Cache,
+  IN EFI_LBA            LineLba
+  )
+{
+  LIST_ENTRY              *Bucket;
+  LIST_ENTRY              *Link;
+  SDMMC_BLOCK_CACHE_LINE  *Line;
+
+  Bucket = &Cache->HashBuckets[CACHE_LINE_LBA_TO_BUCKET (LineLba)];
+  for (Link = GetFirstNode (Bucket); !IsNull (Bucket, Link); Link = GetNextNode (Bucket, Link)) {
+    Line = SDMMC_BLOCK_CACHE_LINE_FROM_HASH_LINK (Link);
+    if (Line->Lba == LineLba) {
+      ASSERT (Line->Valid);
+      return Line;
+    }
+  }
+
+  return NULL;
+}
+
+VOID
+InvalidateBlockCacheLine (
+  IN SDMMC_BLOCK_CACHE      *Cache,
+  IN SDMMC_BLOCK_CACHE_LINE *Line
+  )
+{
+  if (!Line->Valid) {
+    return;
+  }
+
+  // Move the line to the LRU tail so that it gets recycled first
+  RemoveEntryList (&Line->HashLink);
+  InitializeListHead (&Line->HashLink);
+  RemoveEntryList (&Line->LruLink);
+  InsertTailList (&Cache->LruList, &Line->LruLink);
+  Line->Valid = FALSE;
+}
+
+/** Invalidates all the cache lines that overlap the specified block range.
+**/
+VOID
+InvalidateBlockCacheRange (
+  IN SDMMC_BLOCK_CACHE  *Cache,
+  IN EFI_LBA            Lba,
+  IN UINTN              BlockCount
+  )
+{
+  EFI_LBA                 LineLba;
+  EFI_LBA                 EndLba;
+  SDMMC_BLOCK_CACHE_LINE  *Line;
+  UINT32                  LineIdx;
+
+  EndLba = Lba + BlockCount;
+
+  // For large ranges, it is cheaper to walk the lines than the range.
+  if ((BlockCount / SDMMC_BLOCK_CACHE_LINE_BLOCKS) >= Cache->LineCount) {
+    for (LineIdx = 0; LineIdx < Cache->LineCount; ++LineIdx) {
+      Line = &Cache->Lines[LineIdx];
+      if (Line->Valid &&
+          (Line->Lba < EndLba) &&
+          ((Line->Lba + SDMMC_BLOCK_CACHE_LINE_BLOCKS) > Lba)) {
+        InvalidateBlockCacheLine (Cache, Line);
+      }
+    }
+
+    return;
+  }
+
+  for (LineLba = LBA_TO_CACHE_LINE_LBA (Lba);
+       LineLba < EndLba;
+       LineLba += SDMMC_BLOCK_CACHE_LINE_BLOCKS) {
+    Line = LookupBlockCacheLine (Cache, LineLba);
+    if (Line != NULL) {
+      InvalidateBlockCacheLine (Cache, Line);
+    }
+  }
+}
+
+/** Reads LineCount consecutive lines starting at LineLba from the media into
+  the cache in a single multi-block transfer.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] MediaId The media ID that the read is for.
+  @param[in] LineLba The LBA of the first line to fill.
+  @param[in] LineCount The number of lines to fill.
+
+  @retval EFI_UNSUPPORTED The first line crosses the end of the media and can't
+  be cached, otherwise the media read status is returned.
+**/
+EFI_STATUS
+FillBlockCacheLines (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         MediaId,
+  IN EFI_LBA        LineLba,
+  IN UINT32         LineCount
+  )
+{
+  SDMMC_BLOCK_CACHE       *Cache;
+  SDMMC_BLOCK_CACHE_LINE  *Line;
+  EFI_LBA                 EndLba;
+  UINT32                  LineIdx;
+  EFI_STATUS              Status;
+
+  Cache = &HostInst->BlockCache;
+  ASSERT (LineCount <= Cache->ReadAheadLineCount);
+
+  // Never read past the media end, a partial line at the media end is not
+  // cacheable and gets read directly.
+  EndLba = HostInst->BlockIo.Media->LastBlock + 1;
+  if ((LineLba + SDMMC_BLOCK_CACHE_LINE_BLOCKS) > EndLba) {
+    return EFI_UNSUPPORTED;
+  }
+
+  LineCount = (UINT32) MIN (LineCount, (EndLba - LineLba) / SDMMC_BLOCK_CACHE_LINE_BLOCKS);
+
+  Status = ReadMediaBlocks (
+    HostInst,
+    MediaId,
+    LineLba,
+    LineCount * SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES,
+    Cache->ReadAheadBuffer);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  // Inserting at the LRU head and recycling from the LRU tail guarantees that
+  // none of the lines filled here gets recycled by a later line fill, since
+  // ReadAheadLineCount never exceeds LineCount.
+  for (LineIdx = 0; LineIdx < LineCount; ++LineIdx) {
+    Line = LookupBlockCacheLine (Cache, LineLba);
+    if (Line == NULL) {
+      Line = SDMMC_BLOCK_CACHE_LINE_FROM_LRU_LINK (GetPreviousNode (&Cache->LruList, &Cache->LruList));
+      InvalidateBlockCacheLine (Cache, Line);
+      Line->Lba = LineLba;
+      Line->Valid = TRUE;
+      InsertTailList (
+        &Cache->HashBuckets[CACHE_LINE_LBA_TO_BUCKET (LineLba)],
+        &Line->HashLink);
+    }
+
+    CopyMem (
+      Line->Data,
+      Cache->ReadAheadBuffer + (LineIdx * SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES),
+      SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES);
+
+    RemoveEntryList (&Line->LruLink);
+    InsertHeadList (&Cache->LruList, &Line->LruLink);
+
+    LineLba += SDMMC_BLOCK_CACHE_LINE_BLOCKS;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Serves a read request from the cache, filling the missing lines from the
+  media. A sequential read stream fills a full read-ahead window on each miss,
+  while a random read fills only the lines it needs.
+**/
+EFI_STATUS
+CachedReadBlocks (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         MediaId,
+  IN EFI_LBA        Lba,
+  IN UINTN          BufferSize,
+  OUT VOID          *Buffer
+  )
+{
+  SDMMC_BLOCK_CACHE       *Cache;
+  SDMMC_BLOCK_CACHE_LINE  *Line;
+  EFI_LBA                 LineLba;
+  UINTN                   LineOffset;
+  UINTN                   CopySize;
+  UINT32                  FillLineCount;
+  BOOLEAN                 IsSequential;
+  EFI_STATUS              Status;
+
+  Cache = &HostInst->BlockCache;
+  IsSequential = (Lba == Cache->NextSequentialLba);
+  Cache->NextSequentialLba = Lba + (BufferSize / SD_BLOCK_LENGTH_BYTES);
+
+  while (BufferSize > 0) {
+    LineLba = LBA_TO_CACHE_LINE_LBA (Lba);
+    LineOffset = (UINTN) (Lba - LineLba) * SD_BLOCK_LENGTH_BYTES;
+    CopySize = MIN (BufferSize, SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES - LineOffset);
+
+    Line = LookupBlockCacheLine (Cache, LineLba);
+    if (Line != NULL) {
+      ++Cache->HitCount;
+    } else {
+      ++Cache->MissCount;
+
+      if (IsSequential) {
+        FillLineCount = Cache->ReadAheadLineCount;
+      } else {
+        FillLineCount =
+          (UINT32) ((LineOffset + BufferSize + SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES - 1) /
+                    SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES);
+        FillLineCount = MIN (FillLineCount, Cache->ReadAheadLineCount);
+      }
+
+      Status = FillBlockCacheLines (HostInst, MediaId, LineLba, FillLineCount);
+      if (Status == EFI_UNSUPPORTED) {
+        return ReadMediaBlocks (
+          HostInst,
+          MediaId,
+          Lba,
+          BufferSize,
+          Buffer);
+      } else if (EFI_ERROR (Status)) {
+        return Status;
+      }
+
+      Line = LookupBlockCacheLine (Cache, LineLba);
+      ASSERT (Line != NULL);
+    }
+
+    CopyMem (Buffer, Line->Data + LineOffset, CopySize);
+
+    RemoveEntryList (&Line->LruLink);
+    InsertHeadList (&Cache->LruList, &Line->LruLink);
+
+    Buffer = (VOID*) ((UINTN) Buffer + CopySize);
+    BufferSize -= CopySize;
+    Lba += CopySize / SD_BLOCK_LENGTH_BYTES;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Allocates the SDHC instance block cache according to the platform PCDs.
+
+  A zero PcdSdMmcBlockCacheSizeKB disables the cache.
+
+  @param[in] HostInst The SDHC instance context data.
+
+  @retval EFI_SUCCESS on success, EFI_OUT_OF_RESOURCES otherwise.
+**/
+EFI_STATUS
+InitializeBlockCache (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_BLOCK_CACHE   *Cache;
+  UINT32              BucketIdx;
+  UINT32              LineIdx;
+  EFI_STATUS          Status;
+
+  Cache = &HostInst->BlockCache;
+  ZeroMem (Cache, sizeof (*Cache));
+  InitializeListHead (&Cache->LruList);
+  for (BucketIdx = 0; BucketIdx < SDMMC_BLOCK_CACHE_HASH_BUCKETS; ++BucketIdx) {
+    InitializeListHead (&Cache->HashBuckets[BucketIdx]);
+  }
+
+  Cache->LineCount =
+    (FixedPcdGet32 (PcdSdMmcBlockCacheSizeKB) * 1024) / SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES;
+  if (Cache->LineCount == 0) {
+    LOG_TRACE ("SDHC%d block cache disabled", HostInst->HostExt->SdhcId);
+    return EFI_SUCCESS;
+  }
+
+  Cache->ReadAheadLineCount =
+    FixedPcdGet32 (PcdSdMmcReadAheadBlocks) / SDMMC_BLOCK_CACHE_LINE_BLOCKS;
+  Cache->ReadAheadLineCount = MAX (Cache->ReadAheadLineCount, 1);
+  Cache->ReadAheadLineCount = MIN (Cache->ReadAheadLineCount, Cache->LineCount);
+
+  Cache->Lines = AllocateZeroPool (Cache->LineCount * sizeof (SDMMC_BLOCK_CACHE_LINE));
+  Cache->LinesData = AllocatePool (Cache->LineCount * SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES);
+  Cache->ReadAheadBuffer =
+    AllocatePool (Cache->ReadAheadLineCount * SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES);
+  if ((Cache->Lines == NULL) ||
+      (Cache->LinesData == NULL) ||
+      (Cache->ReadAheadBuffer == NULL)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  for (LineIdx = 0; LineIdx < Cache->LineCount; ++LineIdx) {
+    Cache->Lines[LineIdx].Data =
+      Cache->LinesData + (LineIdx * SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES);
+    InitializeListHead (&Cache->Lines[LineIdx].HashLink);
+    InsertTailList (&Cache->LruList, &Cache->Lines[LineIdx].LruLink);
+  }
+
+  Cache->NextSequentialLba = MAX_UINT64;
+
+  LOG_TRACE (
+    "SDHC%d block cache: %d lines of %d blocks, read-ahead %d lines",
+    HostInst->HostExt->SdhcId,
+    Cache->LineCount,
+    SDMMC_BLOCK_CACHE_LINE_BLOCKS,
+    Cache->ReadAheadLineCount);
+
+  Status = EFI_SUCCESS;
+
+Exit:
+  if (EFI_ERROR (Status)) {
+    DestroyBlockCache (HostInst);
+  }
+
+  return Status;
+}
+
+VOID
+DestroyBlockCache (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_BLOCK_CACHE   *Cache;
+
+  Cache = &HostInst->BlockCache;
+
+  if (Cache->Lines != NULL) {
+    FreePool (Cache->Lines);
+    Cache->Lines = NULL;
+  }
+
+  if (Cache->LinesData != NULL) {
+    FreePool (Cache->LinesData);
+    Cache->LinesData = NULL;
+  }
+
+  if (Cache->ReadAheadBuffer != NULL) {
+    FreePool (Cache->ReadAheadBuffer);
+    Cache->ReadAheadBuffer = NULL;
+  }
+
+  Cache->LineCount = 0;
+}
+
+/** Drops all cached lines, to be called when the media changes.
+
+  @param[in] HostInst The SDHC instance context data.
+**/
+VOID
+InvalidateBlockCache (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_BLOCK_CACHE   *Cache;
+  UINT32              LineIdx;
+
+  Cache = &HostInst->BlockCache;
+
+  if (Cache->LineCount > 0) {
+    LOG_TRACE (
+      "SDHC%d block cache invalidated. (Hits: %d, Misses: %d)",
+      HostInst->HostExt->SdhcId,
+      Cache->HitCount,
+      Cache->MissCount);
+  }
+
+  for (LineIdx = 0; LineIdx < Cache->LineCount; ++LineIdx) {
+    InvalidateBlockCacheLine (Cache, &Cache->Lines[LineIdx]);
+  }
+
+  Cache->NextSequentialLba = MAX_UINT64;
+  Cache->HitCount = 0;
+  Cache->MissCount = 0;
+}
+
+/** Performs an IO request through the SDHC instance block cache.
+
+  Reads that fit in the read-ahead window are served from the cache, larger
+  reads bypass it. Writes invalidate the overlapping cache lines and go to the
+  write queue. Must be called at TPL_CALLBACK like IoBlocks.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] TransferDirection The IO direction.
+  @param[in] MediaId The media ID that the IO request is for.
+  @param[in] Lba The starting logical block address.
+  @param[in] BufferSize The size of the Buffer in bytes.
+  @param[in, out] Buffer The IO buffer.
+
+  @retval The IO request status.
+**/
+EFI_STATUS
+CachedIoBlocks (
+  IN SDHC_INSTANCE          *HostInst,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN OUT VOID               *Buffer
+  )
+{
+  SDMMC_BLOCK_CACHE   *Cache;
+  EFI_STATUS          Status;
+
+  Cache = &HostInst->BlockCache;
+
+  Status = ValidateIoBlocksRequest (
+    &HostInst->BlockIo,
+    TransferDirection,
+    MediaId,
+    Lba,
+    BufferSize,
+    Buffer);
+  if (EFI_ERROR (Status) || (BufferSize == 0)) {
+    return Status;
+  }
+
+  if (TransferDirection == SdTransferDirectionWrite) {
+    InvalidateBlockCacheRange (Cache, Lba, BufferSize / SD_BLOCK_LENGTH_BYTES);
+    Cache->NextSequentialLba = MAX_UINT64;
+    return QueueWriteBlocks (HostInst, MediaId, Lba, BufferSize, Buffer);
+  }
+
+  if (BufferSize > (Cache->ReadAheadLineCount * SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES)) {
+    Cache->NextSequentialLba = Lba + (BufferSize / SD_BLOCK_LENGTH_BYTES);
+    return ReadMediaBlocks (HostInst, MediaId, Lba, BufferSize, Buffer);
+  }
+
+  return CachedReadBlocks (HostInst, MediaId, Lba, BufferSize, Buffer);
+}
@@ -16,6 +16,7 @@
 #include <Uefi.h>
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/RpmbIo.h>
 #include <Protocol/Sdhc.h>
@@ -29,29 +30,10 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-#include "SdMmcHw.h"
+#include <SdMmcHw.h>
 #include "SdMmc.h"
 #include "Protocol.h"
 
-VOID
-BenchmarkIo (
-  IN EFI_BLOCK_IO_PROTOCOL  *This,
-  IN SD_TRANSFER_DIRECTION  TransferDirection,
-  IN UINT32                 MediaId,
-  IN UINTN                  BufferSize,
-  IN UINT32                 Iterations
-  );
-
-EFI_STATUS
-IoBlocks (
-  IN EFI_BLOCK_IO_PROTOCOL  *This,
-  IN SD_TRANSFER_DIRECTION  TransferDirection,
-  IN UINT32                 MediaId,
-  IN EFI_LBA                Lba,
-  IN UINTN                  BufferSize,
-  IN OUT VOID               *Buffer
-  );
-
 VOID
 SortIoReadStatsByTotalTransferTime (
   IN IoReadStatsEntry*   Table,
@@ -74,125 +56,48 @@ SortIoReadStatsByTotalTransferTime (
   }
 }
 
-VOID
-BenchmarkIo (
-  IN EFI_BLOCK_IO_PROTOCOL  *This,
-  IN SD_TRANSFER_DIRECTION  TransferDirection,
-  IN UINT32                 MediaId,
-  IN UINTN                  BufferSize,
-  IN UINT32                 Iterations
-  )
-{
-  ASSERT (Iterations > 0);
-
-  VOID        *Buffer;
-  UINT32      BufferSizeKB;
-  UINT32      CurrIteration;
-  UINT64      EndTime;
-  UINT32      KBps;
-  UINT64      StartTime;
-  EFI_STATUS  Status;
-  UINT64      TotalTransfersTimeUs;
-
-  BufferSizeKB = INT_DIV_ROUND (BufferSize, 1024);
-  Buffer = AllocateZeroPool (BufferSize);
-  if (Buffer == NULL) {
-    LOG_ERROR ("BenchmarkIo() : No enough memory to allocate %dKB buffer", BufferSizeKB);
-    Status = EFI_OUT_OF_RESOURCES;
-    goto Exit;
-  }
-
-  CurrIteration = Iterations;
-  TotalTransfersTimeUs = 0;
-
-  while (CurrIteration--) {
-    StartTime = GetPerformanceCounter ();
-    Status = IoBlocks (
-      This,
-      TransferDirection,
-      MediaId,
-      0, // Lba
-      BufferSize,
-      Buffer
-    );
-    if (EFI_ERROR (Status)) {
-      goto Exit;
-    }
-
-    EndTime = GetPerformanceCounter ();
-    TotalTransfersTimeUs += (((EndTime - StartTime) * 1000000UL) / gHpcTicksPerSeconds);
-  }
-
-  KBps = (UINT32) (((UINT64) BufferSizeKB * (UINT64) Iterations * 1000000UL) / TotalTransfersTimeUs);
-  LOG_INFO (
-    "- BenchmarkIo(%a, %dKB)\t: Xfr Avg:%dus\t%dKBps\t%dMBps",
-    (TransferDirection == SdTransferDirectionRead) ? "Read" : "Write",
-    BufferSizeKB,
-    (UINT32) (TotalTransfersTimeUs / Iterations),
-    KBps,
-    INT_DIV_ROUND (KBps, 1024));
-
-Exit:
-  if (Buffer != NULL) {
-    FreePool (Buffer);
-  }
-}
+/** Validates the parameters of an IO request against the current media.
 
+  @retval EFI_SUCCESS The request is valid, note that a zero BufferSize is valid.
+  @retval Otherwise the EFI_BLOCK_IO error code the request should fail with.
+**/
 EFI_STATUS
-IoBlocks (
+ValidateIoBlocksRequest (
   IN EFI_BLOCK_IO_PROTOCOL  *This,
   IN SD_TRANSFER_DIRECTION  TransferDirection,
   IN UINT32                 MediaId,
   IN EFI_LBA                Lba,
   IN UINTN                  BufferSize,
-  IN OUT VOID               *Buffer
+  IN VOID                   *Buffer
   )
 {
-  CONST SD_COMMAND  *Cmd;
-  VOID              *CurrentBuffer;
-  SDHC_INSTANCE     *HostInst;
-  UINT32            BlockCount;
-  UINT32            BytesRemaining;
-  UINTN             CurrentBufferSize;
-  UINT32            CurrentLba;
-  UINT32            Retry;
-  EFI_STATUS        Status;
-
-  HostInst = SDHC_INSTANCE_FROM_BLOCK_IO_THIS (This);
-  ASSERT (HostInst);
-  ASSERT (HostInst->HostExt);
+  UINT32  BlockCount;
 
   if (This->Media->MediaId != MediaId) {
-    Status = EFI_MEDIA_CHANGED;
-    goto Exit;
+    return EFI_MEDIA_CHANGED;
   }
 
   if (Buffer == NULL) {
-    Status = EFI_INVALID_PARAMETER;
-    goto Exit;
+    return EFI_INVALID_PARAMETER;
   }
 
   // Check if a Card is Present
-  if (!HostInst->BlockIo.Media->MediaPresent) {
-    Status = EFI_NO_MEDIA;
-    goto Exit;
+  if (!This->Media->MediaPresent) {
+    return EFI_NO_MEDIA;
   }
 
   // Reading 0 Byte is valid
   if (BufferSize == 0) {
-    Status = EFI_SUCCESS;
-    goto Exit;
+    return EFI_SUCCESS;
   }
 
   if ((TransferDirection == SdTransferDirectionWrite) && (This->Media->ReadOnly == TRUE)) {
-    Status = EFI_WRITE_PROTECTED;
-    goto Exit;
+    return EFI_WRITE_PROTECTED;
   }
 
-    // The buffer size must be an exact multiple of the block size
+  // The buffer size must be an exact multiple of the block size
   if ((BufferSize % This->Media->BlockSize) != 0) {
-    Status = EFI_BAD_BUFFER_SIZE;
-    goto Exit;
+    return EFI_BAD_BUFFER_SIZE;
   }
 
   BlockCount = BufferSize / This->Media->BlockSize;
@@ -205,8 +110,7 @@ IoBlocks (
       This->Media->LastBlock,
       (Lba + BlockCount - 1));
 
-    Status = EFI_INVALID_PARAMETER;
-    goto Exit;
+    return EFI_INVALID_PARAMETER;
   }
 
   // Check the alignment
@@ -216,10 +120,48 @@ IoBlocks (
       Buffer,
       This->Media->IoAlign);
 
-    Status = EFI_INVALID_PARAMETER;
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+IoBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL  *This,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN OUT VOID               *Buffer
+  )
+{
+  CONST SD_COMMAND  *Cmd;
+  VOID              *CurrentBuffer;
+  SDHC_INSTANCE     *HostInst;
+  UINT32            BlockCount;
+  UINT32            BytesRemaining;
+  UINTN             CurrentBufferSize;
+  UINT32            CurrentLba;
+  UINT32            Retry;
+  EFI_STATUS        Status;
+
+  HostInst = SDHC_INSTANCE_FROM_BLOCK_IO_THIS (This);
+  ASSERT (HostInst);
+  ASSERT (HostInst->HostExt);
+
+  Status = ValidateIoBlocksRequest (This, TransferDirection, MediaId, Lba, BufferSize, Buffer);
+  if (EFI_ERROR (Status) || (BufferSize == 0)) {
+    goto Exit;
+  }
+
+  Status = SdhcSelectBlockIoPartitionMmc (HostInst);
+  if (EFI_ERROR (Status)) {
     goto Exit;
   }
 
+  BlockCount = BufferSize / This->Media->BlockSize;
+
   if (TransferDirection == SdTransferDirectionRead) {
     if (BlockCount == 1) {
       Cmd = &CmdReadSingleBlock;
@@ -268,6 +210,10 @@ IoBlocks (
       LOG_ERROR ("SdhcSendDataCommand failed on retry %d", Retry);
     }
 
+    if (EFI_ERROR (Status)) {
+      goto Exit;
+    }
+
     BytesRemaining -= CurrentBufferSize;
     CurrentLba += CurrentBufferSize / This->Media->BlockSize;
     CurrentBuffer = (VOID*) ((UINTN) CurrentBuffer + CurrentBufferSize);
@@ -311,11 +257,20 @@ BlockIoReset (
   )
 {
   SDHC_INSTANCE   *HostInst;
+  EFI_TPL         OldTpl;
+  EFI_STATUS      Status;
 
   LOG_TRACE ("BlockIoReset()");
 
   HostInst = SDHC_INSTANCE_FROM_BLOCK_IO_THIS (This);
-  return SoftReset (HostInst);
+
+  // Serialize with the asynchronous IO queue processing
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+  DrainWriteQueue (HostInst);
+  Status = SoftReset (HostInst);
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
 }
 
 /**
@@ -354,25 +309,6 @@ BlockIoReadBlocks (
 {
   LOG_TRACE ("BlockIoReadBlocks()");
 
-#if SDMMC_BENCHMARK_IO
-  STATIC BOOLEAN  BenchmarkDone;
-  UINT32          CurrByteSize;
-
-  BenchmarkDone = FALSE;
-  if (!BenchmarkDone) {
-
-    LOG_INFO ("Benchmarking BlockIo Read");
-
-    CurrByteSize = 512;
-    CONST UINT32 MaxByteSize = 8388608; // 8MB Max
-    for (; CurrByteSize <= MaxByteSize; CurrByteSize *= 2) {
-      BenchmarkIo (This, SdTransferDirectionRead, MediaId, CurrByteSize, 10);
-    }
-
-    BenchmarkDone = TRUE;
-  }
-#endif // SDMMC_BENCHMARK_IO
-
 #if SDMMC_COLLECT_STATISTICS
   SDHC_INSTANCE   *HostInst;
   UINT32          BlockIdx;
@@ -406,8 +342,8 @@ BlockIoReadBlocks (
 
   StartTime = GetPerformanceCounter ();
 
-  Status = IoBlocks (
-    This,
+  Status = SyncIoBlocks (
+    HostInst,
     SdTransferDirectionRead,
     MediaId,
     Lba,
@@ -482,7 +418,13 @@ Exit:
   return Status;
 
 #else
-  return IoBlocks (This, SdTransferDirectionRead, MediaId, Lba, BufferSize, Buffer);
+  return SyncIoBlocks (
+    SDHC_INSTANCE_FROM_BLOCK_IO_THIS (This),
+    SdTransferDirectionRead,
+    MediaId,
+    Lba,
+    BufferSize,
+    Buffer);
 #endif // SDMMC_COLLECT_STATISTICS
 }
 
@@ -523,7 +465,13 @@ BlockIoWriteBlocks (
 {
   LOG_TRACE ("BlockIoWriteBlocks()");
 
-  return IoBlocks (This, SdTransferDirectionWrite, MediaId, Lba, BufferSize, Buffer);
+  return SyncIoBlocks (
+    SDHC_INSTANCE_FROM_BLOCK_IO_THIS (This),
+    SdTransferDirectionWrite,
+    MediaId,
+    Lba,
+    BufferSize,
+    Buffer);
 }
 
 /**
@@ -544,5 +492,11 @@ BlockIoFlushBlocks (
 {
   LOG_TRACE ("BlockIoFlushBlocks()");
 
-  return EFI_SUCCESS;
+  return SyncIoBlocks (
+    SDHC_INSTANCE_FROM_BLOCK_IO_THIS (This),
+    SdTransferDirectionUndefined,
+    0, // MediaId
+    0, // Lba
+    0, // BufferSize
+    NULL);
 }
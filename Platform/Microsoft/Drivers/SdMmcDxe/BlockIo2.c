@@ -0,0 +1,582 @@
+/** @file
+*
+*  Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+*
+*  This program and the accompanying materials
+*  are licensed and made available under the terms and conditions of the BSD License
+*  which accompanies this distribution.  The full text of the license may be found at
+*  http://opensource.org/licenses/bsd-license.php
+*
+*  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+*
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/RpmbIo.h>
+#include <Protocol/Sdhc.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include <SdMmcHw.h>
+#include "SdMmc.h"
+#include "Protocol.h"
+
+// An asynchronous EFI_BLOCK_IO2 request waiting in an SDHC instance queue.
+// A request with an undefined transfer direction is a flush request.
+typedef struct {
+  UINTN                   Signature;
+  LIST_ENTRY              Link;
+  SD_TRANSFER_DIRECTION   TransferDirection;
+  UINT32                  MediaId;
+  EFI_LBA                 Lba;
+  UINTN                   BufferSize;
+  VOID                    *Buffer;
+  UINTN                   BytesTransferred;
+  EFI_BLOCK_IO2_TOKEN     *Token;
+} SDHC_ASYNC_IO_REQUEST;
+
+#define SDHC_ASYNC_IO_REQUEST_SIGNATURE   SIGNATURE_32('s', 'd', 'a', 'r')
+#define SDHC_ASYNC_IO_REQUEST_FROM_LINK(a) \
+  CR(a, SDHC_ASYNC_IO_REQUEST, Link, SDHC_ASYNC_IO_REQUEST_SIGNATURE)
+
+/** Removes a request from its queue, reports its final status to the caller
+  and frees it.
+
+  @param[in] Request The request to complete.
+  @param[in] Status The request final status to report in the caller token.
+**/
+VOID
+CompleteAsyncIoRequest (
+  IN SDHC_ASYNC_IO_REQUEST  *Request,
+  IN EFI_STATUS             Status
+  )
+{
+  RemoveEntryList (&Request->Link);
+
+  Request->Token->TransactionStatus = Status;
+  gBS->SignalEvent (Request->Token->Event);
+
+  FreePool (Request);
+}
+
+/** Moves the request at the head of the queue forward by at most one chunk of
+  SDMMC_ASYNC_IO_CHUNK_SIZE_BYTES.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] Request The request at the head of the host queue.
+
+  @retval EFI_NOT_READY The chunk transfer succeeded and there are more chunks
+  left to transfer, otherwise the final request status is returned.
+**/
+EFI_STATUS
+ProcessAsyncIoRequestChunk (
+  IN SDHC_INSTANCE          *HostInst,
+  IN SDHC_ASYNC_IO_REQUEST  *Request
+  )
+{
+  UINTN       ChunkSize;
+  EFI_STATUS  Status;
+
+  // Everything queued before a flush request was already issued at this
+  // point since requests are processed in order.
+  if (Request->TransferDirection == SdTransferDirectionUndefined) {
+    return FlushIoBlocks (HostInst);
+  }
+
+  ChunkSize = MIN (Request->BufferSize - Request->BytesTransferred,
+                   SDMMC_ASYNC_IO_CHUNK_SIZE_BYTES);
+
+  Status = CachedIoBlocks (
+    HostInst,
+    Request->TransferDirection,
+    Request->MediaId,
+    Request->Lba + (Request->BytesTransferred / HostInst->BlockIo.Media->BlockSize),
+    ChunkSize,
+    (VOID*) ((UINTN) Request->Buffer + Request->BytesTransferred));
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Request->BytesTransferred += ChunkSize;
+  if (Request->BytesTransferred < Request->BufferSize) {
+    return EFI_NOT_READY;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Processes queued asynchronous requests in order.
+
+  Must be called at TPL_CALLBACK which serializes the queue processing with
+  the synchronous IO paths and the card detection callback.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] Drain Process the queue until empty if TRUE, otherwise return after
+  SDMMC_ASYNC_IO_TIME_SLICE_MS elapses to give the CPU back to the caller.
+**/
+VOID
+ProcessAsyncIoQueue (
+  IN SDHC_INSTANCE  *HostInst,
+  IN BOOLEAN        Drain
+  )
+{
+  SDHC_ASYNC_IO_REQUEST   *Request;
+  UINT64                  StartTime;
+  EFI_STATUS              Status;
+
+  StartTime = HpcTimerStart ();
+
+  while (!IsListEmpty (&HostInst->AsyncIoQueue)) {
+    Request = SDHC_ASYNC_IO_REQUEST_FROM_LINK (GetFirstNode (&HostInst->AsyncIoQueue));
+    Status = ProcessAsyncIoRequestChunk (HostInst, Request);
+    if (Status != EFI_NOT_READY) {
+      CompleteAsyncIoRequest (Request, Status);
+    }
+
+    if (!Drain &&
+        (HpcTimerElapsedMilliseconds (StartTime) >= SDMMC_ASYNC_IO_TIME_SLICE_MS)) {
+      break;
+    }
+  }
+
+  if (IsListEmpty (&HostInst->AsyncIoQueue)) {
+    gBS->SetTimer (HostInst->AsyncIoEvent, TimerCancel, 0);
+  }
+}
+
+VOID
+EFIAPI
+AsyncIoTimerCallback (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  ProcessAsyncIoQueue ((SDHC_INSTANCE*) Context, FALSE);
+}
+
+/** Completes all queued asynchronous requests without processing them.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] Status The status to report in each aborted request token.
+**/
+VOID
+AbortAsyncIoRequests (
+  IN SDHC_INSTANCE  *HostInst,
+  IN EFI_STATUS     Status
+  )
+{
+  SDHC_ASYNC_IO_REQUEST   *Request;
+  EFI_TPL                 OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  while (!IsListEmpty (&HostInst->AsyncIoQueue)) {
+    Request = SDHC_ASYNC_IO_REQUEST_FROM_LINK (GetFirstNode (&HostInst->AsyncIoQueue));
+    CompleteAsyncIoRequest (Request, Status);
+  }
+
+  gBS->SetTimer (HostInst->AsyncIoEvent, TimerCancel, 0);
+  gBS->RestoreTPL (OldTpl);
+}
+
+/** Executes an IO request synchronously after all queued requests complete.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] TransferDirection The IO direction, or undefined for a flush.
+  @param[in] MediaId The media ID that the IO request is for.
+  @param[in] Lba The starting logical block address.
+  @param[in] BufferSize The size of the Buffer in bytes.
+  @param[in, out] Buffer The IO buffer.
+
+  @retval The IO request status.
+**/
+EFI_STATUS
+SyncIoBlocks (
+  IN SDHC_INSTANCE          *HostInst,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN OUT VOID               *Buffer
+  )
+{
+  EFI_TPL     OldTpl;
+  EFI_STATUS  Status;
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  ProcessAsyncIoQueue (HostInst, TRUE);
+
+  if (TransferDirection == SdTransferDirectionUndefined) {
+    Status = FlushIoBlocks (HostInst);
+  } else {
+    Status = CachedIoBlocks (
+      HostInst,
+      TransferDirection,
+      MediaId,
+      Lba,
+      BufferSize,
+      Buffer);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+/** Validates and queues an asynchronous IO request.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] TransferDirection The IO direction, or undefined for a flush.
+  @param[in] MediaId The media ID that the IO request is for.
+  @param[in] Lba The starting logical block address.
+  @param[in, out] Token The caller token to signal on request completion.
+  @param[in] BufferSize The size of the Buffer in bytes.
+  @param[in, out] Buffer The IO buffer.
+
+  @retval EFI_SUCCESS The request was queued, or completed if empty. Any other
+  error means the request was not queued and the token will not be signaled.
+**/
+EFI_STATUS
+QueueAsyncIoRequest (
+  IN SDHC_INSTANCE            *HostInst,
+  IN SD_TRANSFER_DIRECTION    TransferDirection,
+  IN UINT32                   MediaId,
+  IN EFI_LBA                  Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN  *Token,
+  IN UINTN                    BufferSize,
+  IN OUT VOID                 *Buffer
+  )
+{
+  EFI_TPL                 OldTpl;
+  SDHC_ASYNC_IO_REQUEST   *Request;
+  EFI_STATUS              Status;
+
+  if (TransferDirection != SdTransferDirectionUndefined) {
+    Status = ValidateIoBlocksRequest (
+      &HostInst->BlockIo,
+      TransferDirection,
+      MediaId,
+      Lba,
+      BufferSize,
+      Buffer);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if (BufferSize == 0) {
+      Token->TransactionStatus = EFI_SUCCESS;
+      gBS->SignalEvent (Token->Event);
+      return EFI_SUCCESS;
+    }
+  } else if (!HostInst->BlockIo.Media->MediaPresent) {
+    return EFI_NO_MEDIA;
+  }
+
+  Request = AllocateZeroPool (sizeof (SDHC_ASYNC_IO_REQUEST));
+  if (Request == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Request->Signature = SDHC_ASYNC_IO_REQUEST_SIGNATURE;
+  Request->TransferDirection = TransferDirection;
+  Request->MediaId = MediaId;
+  Request->Lba = Lba;
+  Request->BufferSize = BufferSize;
+  Request->Buffer = Buffer;
+  Request->Token = Token;
+  Token->TransactionStatus = EFI_NOT_READY;
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  if (IsListEmpty (&HostInst->AsyncIoQueue)) {
+    Status = gBS->SetTimer (
+      HostInst->AsyncIoEvent,
+      TimerPeriodic,
+      EFI_TIMER_PERIOD_MILLISECONDS (SDMMC_ASYNC_IO_TIMER_PERIOD_MS));
+    if (EFI_ERROR (Status)) {
+      LOG_ERROR ("SetTimer() failed. %r", Status);
+      gBS->RestoreTPL (OldTpl);
+      FreePool (Request);
+      return Status;
+    }
+  }
+
+  InsertTailList (&HostInst->AsyncIoQueue, &Request->Link);
+
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
+/** Initializes the asynchronous IO queue of an SDHC instance.
+
+  @param[in] HostInst The SDHC instance context data.
+
+  @retval EFI_SUCCESS on success, or the error returned by CreateEvent.
+**/
+EFI_STATUS
+InitializeAsyncIoQueue (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  InitializeListHead (&HostInst->AsyncIoQueue);
+
+  return gBS->CreateEvent (
+    EVT_NOTIFY_SIGNAL | EVT_TIMER,
+    TPL_CALLBACK,
+    AsyncIoTimerCallback,
+    HostInst,
+    &HostInst->AsyncIoEvent);
+}
+
+/** Aborts all pending asynchronous requests and releases the queue resources.
+
+  @param[in] HostInst The SDHC instance context data.
+**/
+VOID
+DestroyAsyncIoQueue (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  if (HostInst->AsyncIoEvent != NULL) {
+    AbortAsyncIoRequests (HostInst, EFI_ABORTED);
+    gBS->CloseEvent (HostInst->AsyncIoEvent);
+    HostInst->AsyncIoEvent = NULL;
+  }
+}
+
+// EFI_BLOCK_IO2 Protocol Callbacks
+
+/**
+  Reset the block device hardware.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.Reset().
+  All pending asynchronous requests are aborted before the reset.
+  ExtendedVerification is ignored in this implementation.
+
+  @param[in]  This                 Indicates a pointer to the calling context.
+  @param[in]  ExtendedVerification Indicates that the driver may perform a more
+                                   exhausive verfication operation of the device
+                                   during reset.
+
+  @retval EFI_SUCCESS          The device was reset.
+  @retval EFI_DEVICE_ERROR     The device is not functioning properly and could
+                               not be reset.
+
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2Reset (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  )
+{
+  SDHC_INSTANCE   *HostInst;
+  EFI_TPL         OldTpl;
+  EFI_STATUS      Status;
+
+  LOG_TRACE ("BlockIo2Reset()");
+
+  HostInst = SDHC_INSTANCE_FROM_BLOCK_IO2_THIS (This);
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+  AbortAsyncIoRequests (HostInst, EFI_ABORTED);
+  DrainWriteQueue (HostInst);
+  Status = SoftReset (HostInst);
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+/**
+  Read BufferSize bytes from Lba into Buffer.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.ReadBlocksEx().
+  If Token is NULL or Token->Event is NULL the read is performed synchronously,
+  otherwise it is queued and the call returns immediately.
+
+  @param[in]       This       Indicates a pointer to the calling context.
+  @param[in]       MediaId    Id of the media, changes every time the media is
+                              replaced.
+  @param[in]       Lba        The starting Logical Block Address to read from.
+  @param[in, out]  Token      A pointer to the token associated with the transaction.
+  @param[in]       BufferSize Size of Buffer, must be a multiple of device block size.
+  @param[out]      Buffer     A pointer to the destination buffer for the data. The
+                              caller is responsible for either having implicit or
+                              explicit ownership of the buffer.
+
+  @retval EFI_SUCCESS           The read request was queued if Token->Event is
+                                not NULL.The data was read correctly from the
+                                device if the Token->Event is NULL.
+  @retval EFI_DEVICE_ERROR      The device reported an error while performing
+                                the read.
+  @retval EFI_NO_MEDIA          There is no media in the device.
+  @retval EFI_MEDIA_CHANGED     The MediaId is not for the current media.
+  @retval EFI_BAD_BUFFER_SIZE   The BufferSize parameter is not a multiple of the
+                                intrinsic block size of the device.
+  @retval EFI_INVALID_PARAMETER The read request contains LBAs that are not valid,
+                                or the buffer is not on proper alignment.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a lack
+                                of resources.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2ReadBlocksEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN UINT32                  MediaId,
+  IN EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN *Token,
+  IN UINTN                   BufferSize,
+  OUT VOID                   *Buffer
+  )
+{
+  SDHC_INSTANCE   *HostInst;
+  EFI_STATUS      Status;
+
+  LOG_TRACE ("BlockIo2ReadBlocksEx()");
+
+  HostInst = SDHC_INSTANCE_FROM_BLOCK_IO2_THIS (This);
+
+  if ((Token == NULL) || (Token->Event == NULL)) {
+    Status = SyncIoBlocks (HostInst, SdTransferDirectionRead, MediaId, Lba, BufferSize, Buffer);
+    if (Token != NULL) {
+      Token->TransactionStatus = Status;
+    }
+    return Status;
+  }
+
+  return QueueAsyncIoRequest (
+    HostInst,
+    SdTransferDirectionRead,
+    MediaId,
+    Lba,
+    Token,
+    BufferSize,
+    Buffer);
+}
+
+/**
+  Write BufferSize bytes from Buffer into Lba.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.WriteBlocksEx().
+  If Token is NULL or Token->Event is NULL the write is performed synchronously,
+  otherwise it is queued and the call returns immediately.
+
+  @param[in]       This       Indicates a pointer to the calling context.
+  @param[in]       MediaId    The media ID that the write request is for.
+  @param[in]       Lba        The starting logical block address to be written.
+  @param[in, out]  Token      A pointer to the token associated with the transaction.
+  @param[in]       BufferSize Size of Buffer, must be a multiple of device block size.
+  @param[in]       Buffer     A pointer to the source buffer for the data.
+
+  @retval EFI_SUCCESS           The write request was queued if Event is not NULL.
+                                The data was written correctly to the device if
+                                the Event is NULL.
+  @retval EFI_WRITE_PROTECTED   The device can not be written to.
+  @retval EFI_NO_MEDIA          There is no media in the device.
+  @retval EFI_MEDIA_CHANGED     The MediaId does not matched the current device.
+  @retval EFI_DEVICE_ERROR      The device reported an error while performing the write.
+  @retval EFI_BAD_BUFFER_SIZE   The Buffer was not a multiple of the block size of the device.
+  @retval EFI_INVALID_PARAMETER The write request contains LBAs that are not valid,
+                                or the buffer is not on proper alignment.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a lack
+                                of resources.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2WriteBlocksEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN UINT32                  MediaId,
+  IN EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN *Token,
+  IN UINTN                   BufferSize,
+  IN VOID                    *Buffer
+  )
+{
+  SDHC_INSTANCE   *HostInst;
+  EFI_STATUS      Status;
+
+  LOG_TRACE ("BlockIo2WriteBlocksEx()");
+
+  HostInst = SDHC_INSTANCE_FROM_BLOCK_IO2_THIS (This);
+
+  if ((Token == NULL) || (Token->Event == NULL)) {
+    Status = SyncIoBlocks (HostInst, SdTransferDirectionWrite, MediaId, Lba, BufferSize, Buffer);
+    if (Token != NULL) {
+      Token->TransactionStatus = Status;
+    }
+    return Status;
+  }
+
+  return QueueAsyncIoRequest (
+    HostInst,
+    SdTransferDirectionWrite,
+    MediaId,
+    Lba,
+    Token,
+    BufferSize,
+    Buffer);
+}
+
+/**
+  Flush the Block Device.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.FlushBlocksEx().
+  The flush completes once all requests queued before it have completed.
+
+  @param[in]      This     Indicates a pointer to the calling context.
+  @param[in, out] Token    A pointer to the token associated with the transaction.
+
+  @retval EFI_SUCCESS          The flush request was queued if Event is not NULL.
+                               All outstanding data was written correctly to the
+                               device if the Event is NULL.
+  @retval EFI_DEVICE_ERROR     The device reported an error while writting back
+                               the data.
+  @retval EFI_NO_MEDIA         There is no media in the device.
+  @retval EFI_OUT_OF_RESOURCES The request could not be completed due to a lack
+                               of resources.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2FlushBlocksEx (
+  IN EFI_BLOCK_IO2_PROTOCOL   *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN  *Token
+  )
+{
+  SDHC_INSTANCE   *HostInst;
+  EFI_STATUS      Status;
+
+  LOG_TRACE ("BlockIo2FlushBlocksEx()");
+
+  HostInst = SDHC_INSTANCE_FROM_BLOCK_IO2_THIS (This);
+
+  if ((Token == NULL) || (Token->Event == NULL)) {
+    Status = SyncIoBlocks (HostInst, SdTransferDirectionUndefined, 0, 0, 0, NULL);
+    if (Token != NULL) {
+      Token->TransactionStatus = Status;
+    }
+    return Status;
+  }
+
+  return QueueAsyncIoRequest (
+    HostInst,
+    SdTransferDirectionUndefined,
+    0,
+    0,
+    Token,
+    0,
+    NULL);
+}
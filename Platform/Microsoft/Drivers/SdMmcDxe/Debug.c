@@ -16,6 +16,7 @@
 #include <Uefi.h>
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/RpmbIo.h>
 #include <Protocol/Sdhc.h>
@@ -29,7 +30,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-#include "SdMmcHw.h"
+#include <SdMmcHw.h>
 #include "SdMmc.h"
 #include "Protocol.h"
 
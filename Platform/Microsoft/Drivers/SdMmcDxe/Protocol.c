@@ -16,6 +16,7 @@
 #include <Uefi.h>
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/RpmbIo.h>
 #include <Protocol/Sdhc.h>
@@ -29,7 +30,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-#include "SdMmcHw.h"
+#include <SdMmcHw.h>
 #include "SdMmc.h"
 #include "Protocol.h"
 
@@ -374,7 +375,8 @@ SdhcSendCommandHelper (
   IN SDHC_INSTANCE        *HostInst,
   IN CONST SD_COMMAND     *Cmd,
   IN UINT32               Arg,
-  IN SD_COMMAND_XFR_INFO  *XfrInfo
+  IN SD_COMMAND_XFR_INFO  *XfrInfo,
+  IN BOOLEAN              UseDma
   )
 {
   EFI_SDHC_PROTOCOL   *HostExt;
@@ -398,7 +400,18 @@ SdhcSendCommandHelper (
     }
   }
 
-  Status = HostExt->SendCommand (HostExt, Cmd, Arg, XfrInfo);
+  if (UseDma) {
+    ASSERT (XfrInfo != NULL);
+    Status = HostExt->SendDmaCommand (HostExt, Cmd, Arg, XfrInfo);
+    if (Status == EFI_UNSUPPORTED) {
+      // Nothing was sent on the bus, let the caller fall back to PIO
+      LOG_TRACE ("DMA transfer not possible for %p, falling back to PIO", XfrInfo->Buffer);
+      return Status;
+    }
+  } else {
+    Status = HostExt->SendCommand (HostExt, Cmd, Arg, XfrInfo);
+  }
+
   if (EFI_ERROR (Status)) {
     LOG_ERROR (
       "HostExt->SendCommand(%cCMD%d, 0x%08x) failed. %r",
@@ -448,7 +461,7 @@ SdhcSendCommand (
 {
   EFI_STATUS Status;
 
-  Status = SdhcSendCommandHelper (HostInst, Cmd, Arg, NULL);
+  Status = SdhcSendCommandHelper (HostInst, Cmd, Arg, NULL, FALSE);
   if (EFI_ERROR (Status)) {
     LOG_ERROR ("Send no-data command failed. %r", Status);
     SdhcRecoverFromErrors (HostInst, Cmd);
@@ -484,6 +497,7 @@ SdhcSendDataCommand (
 {
   EFI_SDHC_PROTOCOL     *HostExt;
   EFI_STATUS            Status;
+  BOOLEAN               UseDma;
   SD_COMMAND_XFR_INFO   XfrInfo;
 
   HostExt = HostInst->HostExt;
@@ -492,35 +506,45 @@ SdhcSendDataCommand (
   XfrInfo.BlockSize = SD_BLOCK_LENGTH_BYTES;
   XfrInfo.Buffer = Buffer;
 
-  Status = SdhcSendCommandHelper (HostInst, Cmd, Arg, &XfrInfo);
+  // With DMA the data is moved as part of sending the command, otherwise it
+  // has to be moved by PIO after the command is sent
+  UseDma = HostInst->HostDmaSupported;
+  Status = SdhcSendCommandHelper (HostInst, Cmd, Arg, &XfrInfo, UseDma);
+  if (UseDma && (Status == EFI_UNSUPPORTED)) {
+    UseDma = FALSE;
+    Status = SdhcSendCommandHelper (HostInst, Cmd, Arg, &XfrInfo, FALSE);
+  }
+
   if (EFI_ERROR (Status)) {
     goto Exit;
   }
 
-  if (Cmd->TransferDirection == SdTransferDirectionRead) {
-    Status = HostExt->ReadBlockData (
-      HostExt,
-      BufferByteSize,
-      (UINT32*) Buffer);
-    if (EFI_ERROR (Status)) {
-      LOG_ERROR (
-        "HostExt->ReadBlockData(Size: 0x%xB) failed. %r",
+  if (!UseDma) {
+    if (Cmd->TransferDirection == SdTransferDirectionRead) {
+      Status = HostExt->ReadBlockData (
+        HostExt,
         BufferByteSize,
-        Status);
-      goto Exit;
-    }
-  } else {
-    ASSERT (Cmd->TransferDirection == SdTransferDirectionWrite);
-    Status = HostExt->WriteBlockData (
-      HostExt,
-      BufferByteSize,
-      (UINT32*) Buffer);
-    if (EFI_ERROR (Status)) {
-      LOG_ERROR (
-        "HostExt->WriteBlockData(Size: 0x%xB) failed. %r",
+        (UINT32*) Buffer);
+      if (EFI_ERROR (Status)) {
+        LOG_ERROR (
+          "HostExt->ReadBlockData(Size: 0x%xB) failed. %r",
+          BufferByteSize,
+          Status);
+        goto Exit;
+      }
+    } else {
+      ASSERT (Cmd->TransferDirection == SdTransferDirectionWrite);
+      Status = HostExt->WriteBlockData (
+        HostExt,
         BufferByteSize,
-        Status);
-      goto Exit;
+        (UINT32*) Buffer);
+      if (EFI_ERROR (Status)) {
+        LOG_ERROR (
+          "HostExt->WriteBlockData(Size: 0x%xB) failed. %r",
+          BufferByteSize,
+          Status);
+        goto Exit;
+      }
     }
   }
 
@@ -1033,7 +1057,7 @@ SdhcSetBlockCount (
   // JEDEC Standard No. 84-A441, Page 76
   // Set bit[31] as 1 to indicate Reliable Write type of programming access.
   if (ReliableWrite) {
-    CmdArg = BlockCount | (1 << 31);
+    CmdArg = BlockCount | MMC_SET_BLOCK_COUNT_RELIABLE;
   } else {
     CmdArg = BlockCount;
   }
@@ -1454,6 +1478,73 @@ SdhcSendExtCsdMmc (
   return EFI_SUCCESS;
 }
 
+/** Sends a packed write of the individual writes described by the packed
+  command header at the beginning of Buffer.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] BlockCount The number of blocks in Buffer including the header.
+  @param[in] Buffer The packed command header block followed by the data of
+  all individual writes in the header order.
+**/
+EFI_STATUS
+SdhcSendPackedWriteMmc (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         BlockCount,
+  IN VOID           *Buffer
+  )
+{
+  MMC_PACKED_CMD_HEADER   *Header;
+  EFI_STATUS              Status;
+
+  Header = (MMC_PACKED_CMD_HEADER*) Buffer;
+  ASSERT (Header->Version == MMC_PACKED_CMD_VERSION);
+  ASSERT (Header->ReadWrite == MMC_PACKED_CMD_WRITE);
+  ASSERT (Header->EntryCount > 0);
+
+  LOG_TRACE (
+    "SdhcSendPackedWriteMmc(BlockCount=%d, EntryCount=%d)",
+    BlockCount,
+    Header->EntryCount);
+
+  Status = SdhcSelectBlockIoPartitionMmc (HostInst);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = SdhcSendCommand (
+    HostInst,
+    &CmdSetBlockCount,
+    BlockCount | MMC_SET_BLOCK_COUNT_PACKED);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  // The packed write address is the address of its first individual write
+  return SdhcSendDataCommand (
+    HostInst,
+    &CmdWriteMultiBlock,
+    Header->Entries[0].WriteArg,
+    BlockCount * SD_BLOCK_LENGTH_BYTES,
+    Buffer);
+}
+
+EFI_STATUS
+SdhcFlushCacheMmc (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  MMC_SWITCH_CMD_ARG  CmdArg;
+
+  LOG_TRACE ("SdhcFlushCacheMmc()");
+
+  ZeroMem (&CmdArg, sizeof (MMC_SWITCH_CMD_ARG));
+  CmdArg.Fields.Access = MmcSwitchCmdAccessTypeWriteByte;
+  CmdArg.Fields.Index = MmcExtCsdBitIndexFlushCache;
+  CmdArg.Fields.Value = 1;
+
+  return SdhcSendCommand (HostInst, &CmdSwitchMmc, CmdArg.AsUint32);
+}
+
 EFI_STATUS
 SdhcSwitchPartitionMmc (
   IN SDHC_INSTANCE                  *HostInst,
@@ -1510,6 +1601,52 @@ SdhcSwitchPartitionMmc (
   return EFI_SUCCESS;
 }
 
+/** Makes sure the MMC has the specified partition selected for data access,
+  the partition switch is skipped if the partition is already selected.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] Partition The partition to select.
+**/
+EFI_STATUS
+SdhcSelectPartitionMmc (
+  IN SDHC_INSTANCE                  *HostInst,
+  IN MMC_EXT_CSD_PARTITION_ACCESS   Partition
+  )
+{
+  if (HostInst->CurrentMmcPartition == Partition) {
+    return EFI_SUCCESS;
+  }
+
+  return SdhcSwitchPartitionMmc (HostInst, Partition);
+}
+
+/** Switches the MMC back to the partition exposed through BlockIo.
+
+  RPMB requests leave the RPMB partition selected so that back to back RPMB
+  requests don't pay for 2 partition switches each, this has to be called
+  before any BlockIo data transfer.
+
+  @param[in] HostInst The SDHC instance context data.
+**/
+EFI_STATUS
+SdhcSelectBlockIoPartitionMmc (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!HostInst->RpmbIoProtocolInstalled) {
+    return EFI_SUCCESS;
+  }
+
+  Status = SdhcSelectPartitionMmc (HostInst, HostInst->BlockIoMmcPartition);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("SdhcSelectPartitionMmc() failed. %r", Status);
+  }
+
+  return Status;
+}
+
 // SD command definitions
 CONST SD_COMMAND CmdGoIdleState = {
   0,
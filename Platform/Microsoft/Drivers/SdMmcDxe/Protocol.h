@@ -190,12 +190,35 @@ SdhcSendExtCsdMmc (
   IN SDHC_INSTANCE  *HostInst
   );
 
+EFI_STATUS
+SdhcSendPackedWriteMmc (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         BlockCount,
+  IN VOID           *Buffer
+  );
+
+EFI_STATUS
+SdhcFlushCacheMmc (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
 EFI_STATUS
 SdhcSwitchPartitionMmc (
   IN SDHC_INSTANCE                  *HostInst,
   IN MMC_EXT_CSD_PARTITION_ACCESS   Partition
   );
 
+EFI_STATUS
+SdhcSelectPartitionMmc (
+  IN SDHC_INSTANCE                  *HostInst,
+  IN MMC_EXT_CSD_PARTITION_ACCESS   Partition
+  );
+
+EFI_STATUS
+SdhcSelectBlockIoPartitionMmc (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
 // SD/MMC Commands
 
 extern CONST SD_COMMAND CmdGoIdleState;
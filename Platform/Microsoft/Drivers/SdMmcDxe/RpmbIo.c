@@ -15,6 +15,7 @@
 #include <Uefi.h>
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/RpmbIo.h>
 #include <Protocol/Sdhc.h>
@@ -28,12 +29,15 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-#include "SdMmcHw.h"
+#include <SdMmcHw.h>
 #include "SdMmc.h"
 #include "Protocol.h"
 
 C_ASSERT(sizeof(EFI_RPMB_DATA_PACKET) == SD_BLOCK_LENGTH_BYTES);
 
+// RPMB partition size = 128kB x RPMB_SIZE_MULT, in data packets
+#define RPMB_PACKETS_PER_SIZE_MULT  ((128 * 1024) / sizeof (EFI_RPMB_DATA_PACKET))
+
 EFI_RPMB_DATA_PACKET ResultRequest = {
   { 0 }, // Stuff
   { 0 }, // MAC
@@ -59,7 +63,7 @@ Uint16ToRpmbBytes (
   ASSERT (RpmbBytes != NULL);
 
   RpmbBytes[0] = (UINT8) (Value >> 8);
-  RpmbBytes[1] = (UINT8) (Value & 0xF);
+  RpmbBytes[1] = (UINT8) (Value & 0xFF);
 }
 
 
@@ -311,6 +315,58 @@ RpmbDumpPacket (
   RpmbHexDump (Packet->RequestOrResponseType, EFI_RPMB_PACKET_TYPE_SIZE);
 }
 
+/** Validates the number of data packets of a multi-packet RPMB request.
+
+  The MAC of an authenticated request covers all of its data packets, so
+  the driver can't split a request that exceeds the card or host limits into
+  multiple transfers, the caller has to size its requests according to the
+  ReliableSectorCount reported by the protocol.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] RequestType The RPMB request type.
+  @param[in] PacketCount The number of data packets to transfer.
+**/
+EFI_STATUS
+RpmbValidatePacketCount (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT16         RequestType,
+  IN UINTN          PacketCount
+  )
+{
+  UINTN MaxPacketCount;
+
+  // Each RPMB data packet is a 256B half sector, the eMMC accepts an
+  // authenticated write of up to REL_WR_SEC_C reliable write sectors.
+  if (RequestType == EFI_RPMB_REQUEST_AUTH_WRITE) {
+    MaxPacketCount = MAX (1, HostInst->RpmbIo.ReliableSectorCount) * 2;
+  } else {
+    MaxPacketCount = HostInst->RpmbIo.RpmbSizeMult * RPMB_PACKETS_PER_SIZE_MULT;
+  }
+
+  MaxPacketCount = MIN (MaxPacketCount, HostInst->HostCapabilities.MaximumBlockCount);
+
+  if (PacketCount > MaxPacketCount) {
+    LOG_ERROR (
+      "RPMB request type 0x%x with %d data packets exceeds the limit of %d packets",
+      (UINTN) RequestType,
+      PacketCount,
+      MaxPacketCount);
+
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Executes an RPMB request sequence on the RPMB partition.
+
+  The RPMB partition is left selected on return, so that back to back RPMB
+  requests issued by OP-TEE secure storage for a single file update don't
+  pay for 2 partition switches and EXT_CSD reads each. BlockIo switches back
+  to its own partition on its next transfer. The request runs at TPL_CALLBACK
+  to serialize it with the asynchronous BlockIo2 and card detection
+  processing which would otherwise switch the partition under it.
+**/
 EFI_STATUS
 RpmbRequest (
   IN EFI_RPMB_IO_PROTOCOL   *This,
@@ -318,16 +374,10 @@ RpmbRequest (
   OUT EFI_RPMB_DATA_BUFFER  *Response
   )
 {
-  SDHC_INSTANCE                 *HostInst;
-  MMC_EXT_CSD_PARTITION_ACCESS  CurrentPartition;
-  UINT16                        RequestType;
-  EFI_STATUS                    Status;
-  BOOLEAN                       SwitchPartition;
-  EFI_STATUS                    SwitchStatus;
-
-  SwitchPartition = FALSE;
-  Status = EFI_SUCCESS;
-  SwitchStatus = EFI_SUCCESS;
+  SDHC_INSTANCE   *HostInst;
+  EFI_TPL         OldTpl;
+  UINT16          RequestType;
+  EFI_STATUS      Status;
 
   ASSERT (This);
   ASSERT (Request);
@@ -337,21 +387,33 @@ RpmbRequest (
   ASSERT (HostInst);
   ASSERT (HostInst->HostExt);
 
-  CurrentPartition = HostInst->CurrentMmcPartition;
-  SwitchStatus = SdhcSwitchPartitionMmc (HostInst, MmcExtCsdPartitionAccessRpmb);
-  if (EFI_ERROR (SwitchStatus)) {
-    LOG_ERROR (
-      "SdhcSwitchPartitionMmc() failed. (SwitchStatus = %r)",
-      SwitchStatus);
+  ASSERT (Request->PacketCount > 0);
+  ASSERT (Request->Packets != NULL);
+  RequestType = RpmbBytesToUint16 (Request->Packets[0].RequestOrResponseType);
 
-    goto Exit;
+  if (RequestType == EFI_RPMB_REQUEST_AUTH_WRITE) {
+    Status = RpmbValidatePacketCount (HostInst, RequestType, Request->PacketCount);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  } else if (RequestType == EFI_RPMB_REQUEST_AUTH_READ) {
+    Status = RpmbValidatePacketCount (HostInst, RequestType, Response->PacketCount);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
   }
 
-  SwitchPartition = TRUE;
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
 
-  ASSERT (Request->PacketCount > 0);
-  ASSERT (Request->Packets != NULL);
-  RequestType = RpmbBytesToUint16 (Request->Packets[0].RequestOrResponseType);
+  // Pending asynchronous IO was issued before this request and has to
+  // complete on the BlockIo partition first.
+  ProcessAsyncIoQueue (HostInst, TRUE);
+
+  Status = SdhcSelectPartitionMmc (HostInst, MmcExtCsdPartitionAccessRpmb);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("SdhcSelectPartitionMmc() failed. (Status = %r)", Status);
+    goto Exit;
+  }
 
   switch (RequestType) {
   case EFI_RPMB_REQUEST_PROGRAM_KEY:
@@ -393,21 +455,9 @@ RpmbRequest (
 
 Exit:
 
-  if (SwitchPartition) {
-    SwitchStatus = SdhcSwitchPartitionMmc (HostInst, CurrentPartition);
-    if (EFI_ERROR (SwitchStatus)) {
-
-      LOG_ERROR (
-        "SdhcSwitchPartitionMmc() failed. (SwitchStatus = %r)",
-        SwitchStatus);
-    }
-  }
+  gBS->RestoreTPL (OldTpl);
 
-  if (EFI_ERROR (Status)) {
-    return Status;
-  } else {
-    return SwitchStatus;
-  }
+  return Status;
 }
 
 /** Authentication key programming request.
@@ -16,7 +16,9 @@
 #include <Uefi.h>
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/DevicePath.h>
+#include <Protocol/ResetNotification.h>
 #include <Protocol/RpmbIo.h>
 #include <Protocol/Sdhc.h>
 
@@ -29,7 +31,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-#include "SdMmcHw.h"
+#include <SdMmcHw.h>
 #include "SdMmc.h"
 #include "Protocol.h"
 
@@ -57,6 +59,14 @@ UINT32 gNextSdhcInstanceId = 0;
 // or if new ones have been plugged in.
 EFI_EVENT gCheckCardsEvent;
 
+// Event triggered on ExitBootServices to write back all queued writes.
+EFI_EVENT gExitBootServicesEvent;
+
+// Event triggered when the reset notification protocol is installed, to
+// register for writing back all queued writes before a ResetSystem().
+EFI_EVENT gResetNotificationEvent;
+VOID *gResetNotificationRegistration;
+
 // The ARM high-performance counter frequency.
 UINT64 gHpcTicksPerSeconds = 0;
 
@@ -67,6 +77,20 @@ CheckCardsCallback (
   IN VOID       *Context
   );
 
+VOID
+EFIAPI
+ExitBootServicesCallback (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  );
+
+VOID
+EFIAPI
+ResetNotificationInstalledCallback (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  );
+
 EFI_STATUS
 EFIAPI
 UninstallAllProtocols (
@@ -159,13 +183,20 @@ CreateSdhcInstance (
     goto Exit;
   }
 
+  // SendDmaCommand got introduced in revision 1.1 and is optional
+  HostInst->HostDmaSupported =
+    (HostExt->Revision >= SDHC_PROTOCOL_INTERFACE_REVISION_1_1) &&
+    (HostExt->SendDmaCommand != NULL);
+
   LOG_TRACE (
-    "Host Capabilities: MaximumBlockSize:%d MaximumBlockCount:%d",
+    "Host Capabilities: MaximumBlockSize:%d MaximumBlockCount:%d DMA:%d",
     HostInst->HostCapabilities.MaximumBlockSize,
-    HostInst->HostCapabilities.MaximumBlockCount);
+    HostInst->HostCapabilities.MaximumBlockCount,
+    HostInst->HostDmaSupported);
 
   HostInst->DevicePathProtocolInstalled = FALSE;
   HostInst->BlockIoProtocolInstalled = FALSE;
+  HostInst->BlockIo2ProtocolInstalled = FALSE;
   HostInst->RpmbIoProtocolInstalled = FALSE;
 
   // Initialize BlockIo Protocol.
@@ -181,6 +212,31 @@ CreateSdhcInstance (
   HostInst->BlockIo.WriteBlocks = BlockIoWriteBlocks;
   HostInst->BlockIo.FlushBlocks = BlockIoFlushBlocks;
 
+  // Initialize BlockIo2 Protocol, both protocols share the same media.
+  HostInst->BlockIo2.Media = HostInst->BlockIo.Media;
+  HostInst->BlockIo2.Reset = BlockIo2Reset;
+  HostInst->BlockIo2.ReadBlocksEx = BlockIo2ReadBlocksEx;
+  HostInst->BlockIo2.WriteBlocksEx = BlockIo2WriteBlocksEx;
+  HostInst->BlockIo2.FlushBlocksEx = BlockIo2FlushBlocksEx;
+
+  Status = InitializeAsyncIoQueue (HostInst);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("InitializeAsyncIoQueue() failed. %r", Status);
+    goto Exit;
+  }
+
+  Status = InitializeBlockCache (HostInst);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("InitializeBlockCache() failed. %r", Status);
+    goto Exit;
+  }
+
+  Status = InitializeWriteQueue (HostInst);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("InitializeWriteQueue() failed. %r", Status);
+    goto Exit;
+  }
+
   // Initialize DevicePath Protocol.
   DevicePath = &HostInst->DevicePath;
 
@@ -209,6 +265,12 @@ CreateSdhcInstance (
 
 Exit:
   if (EFI_ERROR (Status)) {
+    if (HostInst != NULL) {
+      DestroyWriteQueue (HostInst);
+      DestroyBlockCache (HostInst);
+      DestroyAsyncIoQueue (HostInst);
+    }
+
     if (HostInst != NULL && HostInst->BlockIo.Media != NULL) {
       FreePool (HostInst->BlockIo.Media);
       HostInst->BlockIo.Media = NULL;
@@ -238,13 +300,23 @@ DestroySdhcInstance (
   IN SDHC_INSTANCE  *HostInst
   )
 {
+  EFI_TPL    OldTpl;
   EFI_STATUS Status;
 
+  // Write back queued writes while the device is still usable.
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+  DrainWriteQueue (HostInst);
+  gBS->RestoreTPL (OldTpl);
+
   Status = UninstallAllProtocols (HostInst);
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
+  DestroyAsyncIoQueue (HostInst);
+  DestroyWriteQueue (HostInst);
+  DestroyBlockCache (HostInst);
+
   // Free Memory allocated for the EFI_BLOCK_IO protocol
   if (HostInst->BlockIo.Media) {
     FreePool (HostInst->BlockIo.Media);
@@ -488,6 +560,11 @@ SoftReset (
     goto Exit;
   }
 
+  // Requests queued for the previous media must not reach the new one.
+  AbortAsyncIoRequests (HostInst, EFI_MEDIA_CHANGED);
+  DiscardWriteQueue (HostInst);
+  InvalidateBlockCache (HostInst);
+
   HostInst->SlotInitialized = FALSE;
 
   // Clear all media settings regardless of card presence.
@@ -511,23 +588,26 @@ SoftReset (
   HostInst->BlockIo.Media->MediaPresent = HostInst->HostExt->IsCardPresent (HostInst->HostExt);
   if (!HostInst->BlockIo.Media->MediaPresent) {
     // Even if the media is not present, we`d like to communicate that status up
-    // to the storage stack by means of installing the BlockIo protocol.
+    // to the storage stack by means of installing the BlockIo protocols.
     Status =
       gBS->InstallMultipleProtocolInterfaces (
         &HostInst->MmcHandle,
         &gEfiBlockIoProtocolGuid,
         &HostInst->BlockIo,
+        &gEfiBlockIo2ProtocolGuid,
+        &HostInst->BlockIo2,
         NULL);
 
     if (EFI_ERROR (Status)) {
       LOG_ERROR (
-        "SoftReset(): Failed installing EFI_BLOCK_IO_PROTOCOL interface. %r",
+        "SoftReset(): Failed installing EFI_BLOCK_IO_PROTOCOL interfaces. %r",
         Status);
 
       goto Exit;
     }
 
     HostInst->BlockIoProtocolInstalled = TRUE;
+    HostInst->BlockIo2ProtocolInstalled = TRUE;
     LOG_INFO ("SDHC%d media not present, skipping device initialization", HostExt->SdhcId);
     goto Exit;
   } else {
@@ -543,6 +623,8 @@ SoftReset (
     goto Exit;
   }
 
+  HostInst->BlockIo.Media->WriteCaching = (HostInst->WriteQueue.Capacity > 0);
+
   // Update SlotNode subtype based on the card type identified.
   // Note that we only support 1 slot per SDHC, i.e It is assumed that no more
   // than 1 SD/MMC card connected to the same SDHC block on the system.
@@ -576,17 +658,20 @@ SoftReset (
       &HostInst->MmcHandle,
       &gEfiBlockIoProtocolGuid,
       &HostInst->BlockIo,
+      &gEfiBlockIo2ProtocolGuid,
+      &HostInst->BlockIo2,
       NULL);
 
   if (EFI_ERROR (Status)) {
     LOG_ERROR (
-      "SoftReset(): Failed installing EFI_BLOCK_IO_PROTOCOL interface. %r",
+      "SoftReset(): Failed installing EFI_BLOCK_IO_PROTOCOL interfaces. %r",
       Status);
 
     goto Exit;
   }
 
   HostInst->BlockIoProtocolInstalled = TRUE;
+  HostInst->BlockIo2ProtocolInstalled = TRUE;
 
   Status = gBS->InstallMultipleProtocolInterfaces (
       &HostInst->MmcHandle,
@@ -631,6 +716,7 @@ SoftReset (
       PartConfig.AsUint8 = HostInst->CardInfo.Registers.Mmc.ExtCsd.PartitionConfig;
       HostInst->CurrentMmcPartition =
         (MMC_EXT_CSD_PARTITION_ACCESS) PartConfig.Fields.PARTITION_ACCESS;
+      HostInst->BlockIoMmcPartition = HostInst->CurrentMmcPartition;
 
     } else {
       LOG_ERROR (
@@ -735,10 +821,115 @@ CheckCardsCallback (
       if (EFI_ERROR (Status)) {
         LOG_ERROR ("SoftReset() failed. %r", Status);
       }
+    } else if (IsCardPresent) {
+      // Bound the time writes can stay queued to the card check interval.
+      DrainWriteQueue (HostInst);
+    }
+
+    CurrentLink = CurrentLink->ForwardLink;
+  }
+}
+
+VOID
+EFIAPI
+ExitBootServicesCallback (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  LIST_ENTRY      *CurrentLink;
+  SDHC_INSTANCE   *HostInst;
+  EFI_STATUS      Status;
+
+  // For each registered SDHC instance
+  CurrentLink = gSdhcInstancePool.ForwardLink;
+  while (CurrentLink != NULL && CurrentLink != &gSdhcInstancePool) {
+    HostInst = SDHC_INSTANCE_FROM_LINK (CurrentLink);
+    ASSERT (HostInst != NULL);
+
+    Status = FlushIoBlocks (HostInst);
+    if (EFI_ERROR (Status) && (Status != EFI_NO_MEDIA)) {
+      LOG_ERROR ("SDHC%d FlushIoBlocks() failed. %r", HostInst->HostExt->SdhcId, Status);
+    }
+
+    // Hand the card over to the OS with the BlockIo partition selected
+    if (Status != EFI_NO_MEDIA) {
+      SdhcSelectBlockIoPartitionMmc (HostInst);
+    }
+
+    CurrentLink = CurrentLink->ForwardLink;
+  }
+}
+
+/** Writes back all queued writes and flushes the eMMC cache of every SDHC
+  instance before the system is reset, since a reset does not go through
+  ExitBootServices.
+**/
+VOID
+EFIAPI
+ResetNotifyCallback (
+  IN EFI_RESET_TYPE   ResetType,
+  IN EFI_STATUS       ResetStatus,
+  IN UINTN            DataSize,
+  IN VOID             *ResetData OPTIONAL
+  )
+{
+  LIST_ENTRY      *CurrentLink;
+  SDHC_INSTANCE   *HostInst;
+  EFI_TPL         OldTpl;
+  BOOLEAN         RaisedTpl;
+  EFI_STATUS      Status;
+
+  // Keep the card check timer away from the write queues, if the caller's TPL
+  // allows it.
+  RaisedTpl = (EfiGetCurrentTpl () <= TPL_CALLBACK);
+  OldTpl = TPL_APPLICATION;
+  if (RaisedTpl) {
+    OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+  }
+
+  CurrentLink = gSdhcInstancePool.ForwardLink;
+  while (CurrentLink != NULL && CurrentLink != &gSdhcInstancePool) {
+    HostInst = SDHC_INSTANCE_FROM_LINK (CurrentLink);
+    ASSERT (HostInst != NULL);
+
+    Status = FlushIoBlocks (HostInst);
+    if (EFI_ERROR (Status) && (Status != EFI_NO_MEDIA)) {
+      LOG_ERROR ("SDHC%d FlushIoBlocks() failed. %r", HostInst->HostExt->SdhcId, Status);
     }
 
     CurrentLink = CurrentLink->ForwardLink;
   }
+
+  if (RaisedTpl) {
+    gBS->RestoreTPL (OldTpl);
+  }
+}
+
+VOID
+EFIAPI
+ResetNotificationInstalledCallback (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EDKII_RESET_NOTIFICATION_PROTOCOL *ResetNotification;
+  EFI_STATUS                        Status;
+
+  Status = gBS->LocateProtocol (
+    &gEdkiiResetNotificationProtocolGuid,
+    NULL,
+    (VOID **) &ResetNotification);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  gBS->CloseEvent (Event);
+
+  Status = ResetNotification->RegisterResetNotify (
+    ResetNotification,
+    ResetNotifyCallback);
+  ASSERT_EFI_ERROR (Status);
 }
 
 BOOLEAN
@@ -771,6 +962,26 @@ UninstallAllProtocols (
 
   LOG_TRACE ("Uninstalling SDHC%d all protocols", HostInst->HostExt->SdhcId);
 
+  if (HostInst->BlockIo2ProtocolInstalled) {
+    Status =
+      gBS->UninstallMultipleProtocolInterfaces (
+        HostInst->MmcHandle,
+        &gEfiBlockIo2ProtocolGuid,
+        &HostInst->BlockIo2,
+        NULL);
+
+    if (EFI_ERROR (Status)) {
+      LOG_ERROR (
+        "UninstallAllProtocols(): Failed to uninstall EFI_BLOCK_IO2_PROTOCOL. "
+        "(Status = %r)",
+        Status);
+
+      return Status;
+    }
+
+    HostInst->BlockIo2ProtocolInstalled = FALSE;
+  }
+
   if (HostInst->BlockIoProtocolInstalled) {
     Status =
       gBS->UninstallMultipleProtocolInterfaces (
@@ -879,6 +1090,23 @@ SdMmcDxeInitialize (
     (UINT64) (10 * 1000 * SDMMC_CHECK_CARD_INTERVAL_MS)); // 200 ms
   ASSERT_EFI_ERROR (Status);
 
+  Status = gBS->CreateEvent (
+    EVT_SIGNAL_EXIT_BOOT_SERVICES,
+    TPL_CALLBACK,
+    ExitBootServicesCallback,
+    NULL,
+    &gExitBootServicesEvent);
+  ASSERT_EFI_ERROR (Status);
+
+  // A ResetSystem() does not go through ExitBootServices, write back the
+  // queued writes from a reset notification as well.
+  gResetNotificationEvent = EfiCreateProtocolNotifyEvent (
+    &gEdkiiResetNotificationProtocolGuid,
+    TPL_CALLBACK,
+    ResetNotificationInstalledCallback,
+    NULL,
+    &gResetNotificationRegistration);
+
   gHpcTicksPerSeconds = GetPerformanceCounterProperties (NULL, NULL);
   ASSERT (gHpcTicksPerSeconds != 0);
 
@@ -19,8 +19,8 @@
 // Define with non-zero to collect IO statistics and dump it to the terminal.
 #define SDMMC_COLLECT_STATISTICS  0
 
-// Define with non-zero to benchmark IO on the first MmcReadBlocks call and
-// dump to the terminal.
+// Define with non-zero to time the card initialization and dump it to the
+// terminal. IO performance is measured with the StorageBenchmark application.
 #define SDMMC_BENCHMARK_IO        0
 
 // Lower bound of 2s poll wait time (200 x 10ms)
@@ -31,6 +31,28 @@
 // registered SDHC instance.
 #define SDMMC_CHECK_CARD_INTERVAL_MS 1000
 
+// The period at which queued EFI_BLOCK_IO2 requests get processed, and the
+// max time spent processing them per period before returning to the caller.
+#define SDMMC_ASYNC_IO_TIMER_PERIOD_MS  1
+#define SDMMC_ASYNC_IO_TIME_SLICE_MS    10
+
+// Queued EFI_BLOCK_IO2 requests are transferred in chunks of that size so that
+// large requests don't starve the caller for their whole transfer time.
+#define SDMMC_ASYNC_IO_CHUNK_SIZE_BYTES (256 * 1024)
+
+// The number of blocks held by each block cache line. Lines are aligned in the
+// LBA space on their size, which is also the smallest read the cache issues.
+#define SDMMC_BLOCK_CACHE_LINE_BLOCKS     8
+#define SDMMC_BLOCK_CACHE_LINE_SIZE_BYTES \
+  (SDMMC_BLOCK_CACHE_LINE_BLOCKS * SD_BLOCK_LENGTH_BYTES)
+
+// Number of hash buckets used to lookup cache lines by LBA, must be power of 2.
+#define SDMMC_BLOCK_CACHE_HASH_BUCKETS    64
+
+// Max number of non-adjacent writes held in the write queue, which is also the
+// max number of individual writes a packed command header block can describe.
+#define SDMMC_WRITE_QUEUE_MAX_ENTRIES     63
+
 // The number of recursive error recoveries to reach before considering the
 // failure fatal, and not attempting more error recoveries.
 #define SDMMC_ERROR_RECOVERY_ATTEMPT_THRESHOLD    3
@@ -74,6 +96,57 @@ typedef struct {
   UINT32  TotalTransferTimeUs;
 } IoReadStatsEntry;
 
+// Block Cache Definitions
+
+typedef struct {
+  LIST_ENTRY  LruLink;
+  LIST_ENTRY  HashLink;
+  EFI_LBA     Lba;
+  BOOLEAN     Valid;
+  UINT8       *Data;
+} SDMMC_BLOCK_CACHE_LINE;
+
+// A read-only cache of SDMMC_BLOCK_CACHE_LINE_BLOCKS sized lines. Lines are
+// recycled in LRU order, the most recently used line is at the LruList head.
+// Writes invalidate the overlapping lines.
+typedef struct {
+  UINT32                  LineCount;
+  UINT32                  ReadAheadLineCount;
+  SDMMC_BLOCK_CACHE_LINE  *Lines;
+  UINT8                   *LinesData;
+  UINT8                   *ReadAheadBuffer;
+  LIST_ENTRY              LruList;
+  LIST_ENTRY              HashBuckets[SDMMC_BLOCK_CACHE_HASH_BUCKETS];
+  EFI_LBA                 NextSequentialLba;
+  UINT32                  HitCount;
+  UINT32                  MissCount;
+} SDMMC_BLOCK_CACHE;
+
+// Write Queue Definitions
+
+typedef struct {
+  EFI_LBA   Lba;
+  UINT32    BlockCount;
+} SDMMC_WRITE_QUEUE_ENTRY;
+
+// Writes are copied into the queue data buffer in queue order, merging writes
+// to adjacent LBAs into a single entry. The queue is written to the media as a
+// single eMMC packed write if supported, otherwise as one write per entry.
+// The data buffer is preceded by a block reserved for the packed command header.
+typedef struct {
+  UINTN                     Capacity;
+  UINTN                     BytesQueued;
+  UINT32                    MediaId;
+  UINT32                    EntryCount;
+  SDMMC_WRITE_QUEUE_ENTRY   Entries[SDMMC_WRITE_QUEUE_MAX_ENTRIES];
+  UINT8                     *Buffer;
+} SDMMC_WRITE_QUEUE;
+
+#define SDMMC_BLOCK_CACHE_LINE_FROM_LRU_LINK(a) \
+  BASE_CR(a, SDMMC_BLOCK_CACHE_LINE, LruLink)
+#define SDMMC_BLOCK_CACHE_LINE_FROM_HASH_LINK(a) \
+  BASE_CR(a, SDMMC_BLOCK_CACHE_LINE, HashLink)
+
 // Device Path Definitions
 //
 // eMMC and SD device paths got introduced in UEFI 2.6
@@ -125,19 +198,27 @@ typedef struct {
   BOOLEAN                       Disabled;
   SDHC_DEVICE_PATH              DevicePath;
   EFI_BLOCK_IO_PROTOCOL         BlockIo;
+  EFI_BLOCK_IO2_PROTOCOL        BlockIo2;
   EFI_RPMB_IO_PROTOCOL          RpmbIo;
   EFI_SDHC_PROTOCOL             *HostExt;
   SDHC_CAPABILITIES             HostCapabilities;
+  BOOLEAN                       HostDmaSupported;
   BOOLEAN                       DevicePathProtocolInstalled;
   BOOLEAN                       BlockIoProtocolInstalled;
+  BOOLEAN                       BlockIo2ProtocolInstalled;
   BOOLEAN                       RpmbIoProtocolInstalled;
   MMC_EXT_CSD_PARTITION_ACCESS  CurrentMmcPartition;
+  MMC_EXT_CSD_PARTITION_ACCESS  BlockIoMmcPartition;
   CARD_INFO                     CardInfo;
   UINT32                        BlockBuffer[SD_BLOCK_WORD_COUNT];
   UINT32                        CmdResponse[4];
   CONST SD_COMMAND              *PreLastSuccessfulCmd;
   CONST SD_COMMAND              *LastSuccessfulCmd;
   UINT32                        ErrorRecoveryAttemptCount;
+  LIST_ENTRY                    AsyncIoQueue;
+  EFI_EVENT                     AsyncIoEvent;
+  SDMMC_BLOCK_CACHE             BlockCache;
+  SDMMC_WRITE_QUEUE             WriteQueue;
 #ifdef MMC_COLLECT_STATISTICS
   IoReadStatsEntry              IoReadStats[1024];
   UINT32                        IoReadStatsNumEntries;
@@ -147,6 +228,8 @@ typedef struct {
 #define SDHC_INSTANCE_SIGNATURE   SIGNATURE_32('s', 'd', 'h', 'c')
 #define SDHC_INSTANCE_FROM_BLOCK_IO_THIS(a) \
   CR(a, SDHC_INSTANCE, BlockIo, SDHC_INSTANCE_SIGNATURE)
+#define SDHC_INSTANCE_FROM_BLOCK_IO2_THIS(a) \
+  CR(a, SDHC_INSTANCE, BlockIo2, SDHC_INSTANCE_SIGNATURE)
 #define SDHC_INSTANCE_FROM_LINK(a) \
   CR(a, SDHC_INSTANCE, Link, SDHC_INSTANCE_SIGNATURE)
 #define SDHC_INSTANCE_FROM_RPMB_IO_THIS(a) \
@@ -264,6 +347,133 @@ BlockIoFlushBlocks (
   IN EFI_BLOCK_IO_PROTOCOL *This
   );
 
+// EFI_BLOCK_IO2 Protocol Callbacks
+
+/**
+  Reset the block device hardware.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.Reset().
+  All pending asynchronous requests are aborted before the reset.
+
+  @param[in]  This                 Indicates a pointer to the calling context.
+  @param[in]  ExtendedVerification Indicates that the driver may perform a more
+                                   exhausive verfication operation of the device
+                                   during reset.
+
+  @retval EFI_SUCCESS          The device was reset.
+  @retval EFI_DEVICE_ERROR     The device is not functioning properly and could
+                               not be reset.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2Reset (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  );
+
+/**
+  Read BufferSize bytes from Lba into Buffer.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.ReadBlocksEx().
+  If Token is NULL or Token->Event is NULL the read is performed synchronously,
+  otherwise it is queued and the call returns immediately.
+
+  @param[in]       This       Indicates a pointer to the calling context.
+  @param[in]       MediaId    Id of the media, changes every time the media is
+                              replaced.
+  @param[in]       Lba        The starting Logical Block Address to read from.
+  @param[in, out]  Token      A pointer to the token associated with the transaction.
+  @param[in]       BufferSize Size of Buffer, must be a multiple of device block size.
+  @param[out]      Buffer     A pointer to the destination buffer for the data.
+
+  @retval EFI_SUCCESS           The read request was queued if Token->Event is
+                                not NULL.The data was read correctly from the
+                                device if the Token->Event is NULL.
+  @retval EFI_DEVICE_ERROR      The device reported an error while performing
+                                the read.
+  @retval EFI_NO_MEDIA          There is no media in the device.
+  @retval EFI_MEDIA_CHANGED     The MediaId is not for the current media.
+  @retval EFI_BAD_BUFFER_SIZE   The BufferSize parameter is not a multiple of the
+                                intrinsic block size of the device.
+  @retval EFI_INVALID_PARAMETER The read request contains LBAs that are not valid,
+                                or the buffer is not on proper alignment.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a lack
+                                of resources.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2ReadBlocksEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN UINT32                  MediaId,
+  IN EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN *Token,
+  IN UINTN                   BufferSize,
+  OUT VOID                   *Buffer
+  );
+
+/**
+  Write BufferSize bytes from Buffer into Lba.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.WriteBlocksEx().
+  If Token is NULL or Token->Event is NULL the write is performed synchronously,
+  otherwise it is queued and the call returns immediately.
+
+  @param[in]       This       Indicates a pointer to the calling context.
+  @param[in]       MediaId    The media ID that the write request is for.
+  @param[in]       Lba        The starting logical block address to be written.
+  @param[in, out]  Token      A pointer to the token associated with the transaction.
+  @param[in]       BufferSize Size of Buffer, must be a multiple of device block size.
+  @param[in]       Buffer     A pointer to the source buffer for the data.
+
+  @retval EFI_SUCCESS           The write request was queued if Event is not NULL.
+                                The data was written correctly to the device if
+                                the Event is NULL.
+  @retval EFI_WRITE_PROTECTED   The device can not be written to.
+  @retval EFI_NO_MEDIA          There is no media in the device.
+  @retval EFI_MEDIA_CHANGED     The MediaId does not matched the current device.
+  @retval EFI_DEVICE_ERROR      The device reported an error while performing the write.
+  @retval EFI_BAD_BUFFER_SIZE   The Buffer was not a multiple of the block size of the device.
+  @retval EFI_INVALID_PARAMETER The write request contains LBAs that are not valid,
+                                or the buffer is not on proper alignment.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a lack
+                                of resources.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2WriteBlocksEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN UINT32                  MediaId,
+  IN EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN *Token,
+  IN UINTN                   BufferSize,
+  IN VOID                    *Buffer
+  );
+
+/**
+  Flush the Block Device.
+
+  This function implements EFI_BLOCK_IO2_PROTOCOL.FlushBlocksEx().
+  The flush completes once all requests queued before it have completed.
+
+  @param[in]      This     Indicates a pointer to the calling context.
+  @param[in, out] Token    A pointer to the token associated with the transaction.
+
+  @retval EFI_SUCCESS          The flush request was queued if Event is not NULL.
+                               All outstanding data was written correctly to the
+                               device if the Event is NULL.
+  @retval EFI_DEVICE_ERROR     The device reported an error while writting back
+                               the data.
+  @retval EFI_NO_MEDIA         There is no media in the device.
+  @retval EFI_OUT_OF_RESOURCES The request could not be completed due to a lack
+                               of resources.
+**/
+EFI_STATUS
+EFIAPI
+BlockIo2FlushBlocksEx (
+  IN EFI_BLOCK_IO2_PROTOCOL   *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN  *Token
+  );
+
 // EFI_RPMPB_IO Protocol Callbacks
 
 /** Authentication key programming request.
@@ -356,6 +566,130 @@ SoftReset (
   IN SDHC_INSTANCE  *HostInst
   );
 
+EFI_STATUS
+ValidateIoBlocksRequest (
+  IN EFI_BLOCK_IO_PROTOCOL  *This,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN VOID                   *Buffer
+  );
+
+EFI_STATUS
+IoBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL  *This,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN OUT VOID               *Buffer
+  );
+
+// Asynchronous IO Queue Helpers
+
+EFI_STATUS
+InitializeAsyncIoQueue (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+DestroyAsyncIoQueue (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+AbortAsyncIoRequests (
+  IN SDHC_INSTANCE  *HostInst,
+  IN EFI_STATUS     Status
+  );
+
+EFI_STATUS
+SyncIoBlocks (
+  IN SDHC_INSTANCE          *HostInst,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN OUT VOID               *Buffer
+  );
+
+// Block Cache Helpers
+
+EFI_STATUS
+InitializeBlockCache (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+DestroyBlockCache (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+InvalidateBlockCache (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+EFI_STATUS
+CachedIoBlocks (
+  IN SDHC_INSTANCE          *HostInst,
+  IN SD_TRANSFER_DIRECTION  TransferDirection,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN OUT VOID               *Buffer
+  );
+
+// Write Queue Helpers
+
+EFI_STATUS
+InitializeWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+DestroyWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+DiscardWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+EFI_STATUS
+DrainWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+EFI_STATUS
+DrainOverlappingWrites (
+  IN SDHC_INSTANCE  *HostInst,
+  IN EFI_LBA        Lba,
+  IN UINTN          BlockCount
+  );
+
+EFI_STATUS
+QueueWriteBlocks (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         MediaId,
+  IN EFI_LBA        Lba,
+  IN UINTN          BufferSize,
+  IN VOID           *Buffer
+  );
+
+EFI_STATUS
+FlushIoBlocks (
+  IN SDHC_INSTANCE  *HostInst
+  );
+
+VOID
+ProcessAsyncIoQueue (
+  IN SDHC_INSTANCE  *HostInst,
+  IN BOOLEAN        Drain
+  );
+
 // Debugging Helpers
 
 VOID
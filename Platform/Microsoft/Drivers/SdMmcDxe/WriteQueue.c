@@ -0,0 +1,462 @@
+/** @file
+*
+*  Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+*
+*  This program and the accompanying materials
+*  are licensed and made available under the terms and conditions of the BSD License
+*  which accompanies this distribution.  The full text of the license may be found at
+*  http://opensource.org/licenses/bsd-license.php
+*
+*  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+*
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/RpmbIo.h>
+#include <Protocol/Sdhc.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <SdMmcHw.h>
+#include "SdMmc.h"
+#include "Protocol.h"
+
+C_ASSERT (sizeof (MMC_PACKED_CMD_HEADER) == SD_BLOCK_LENGTH_BYTES);
+
+BOOLEAN
+IsPackedWriteSupported (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  MMC_EXT_CSD   *ExtCsd;
+
+  if (HostInst->CardInfo.CardFunction != CardFunctionMmc) {
+    return FALSE;
+  }
+
+  ExtCsd = &HostInst->CardInfo.Registers.Mmc.ExtCsd;
+  return (ExtCsd->ExtendedCsdRevision >= MMC_EXT_CSD_REV_4_5) &&
+         (ExtCsd->MaxPackedWrites > 1);
+}
+
+UINT32
+GetWriteQueueMaxEntryCount (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  if (IsPackedWriteSupported (HostInst)) {
+    return MIN (
+      SDMMC_WRITE_QUEUE_MAX_ENTRIES,
+      HostInst->CardInfo.Registers.Mmc.ExtCsd.MaxPackedWrites);
+  }
+
+  return SDMMC_WRITE_QUEUE_MAX_ENTRIES;
+}
+
+/** Writes all queued entries in a single packed write.
+
+  @retval EFI_UNSUPPORTED The queue can't be written as a packed write.
+**/
+EFI_STATUS
+WriteQueuePacked (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_WRITE_QUEUE       *Queue;
+  MMC_PACKED_CMD_HEADER   *Header;
+  UINT32                  EntryIdx;
+
+  Queue = &HostInst->WriteQueue;
+
+  if ((Queue->EntryCount < 2) ||
+      !IsPackedWriteSupported (HostInst) ||
+      (Queue->EntryCount > HostInst->CardInfo.Registers.Mmc.ExtCsd.MaxPackedWrites)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Header = (MMC_PACKED_CMD_HEADER*) Queue->Buffer;
+  ZeroMem (Header, sizeof (MMC_PACKED_CMD_HEADER));
+  Header->Version = MMC_PACKED_CMD_VERSION;
+  Header->ReadWrite = MMC_PACKED_CMD_WRITE;
+  Header->EntryCount = (UINT8) Queue->EntryCount;
+
+  for (EntryIdx = 0; EntryIdx < Queue->EntryCount; ++EntryIdx) {
+    Header->Entries[EntryIdx].SetBlockCountArg = Queue->Entries[EntryIdx].BlockCount;
+    Header->Entries[EntryIdx].WriteArg = (UINT32) Queue->Entries[EntryIdx].Lba;
+  }
+
+  return SdhcSendPackedWriteMmc (
+    HostInst,
+    (UINT32) ((Queue->BytesQueued / SD_BLOCK_LENGTH_BYTES) + 1),
+    Queue->Buffer);
+}
+
+/** Allocates the SDHC instance write queue according to the platform PCDs.
+
+  A zero PcdSdMmcWriteQueueSizeKB disables the write queue, and writes go
+  straight to the media.
+
+  @param[in] HostInst The SDHC instance context data.
+
+  @retval EFI_SUCCESS on success, EFI_OUT_OF_RESOURCES otherwise.
+**/
+EFI_STATUS
+InitializeWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_WRITE_QUEUE   *Queue;
+
+  Queue = &HostInst->WriteQueue;
+  ZeroMem (Queue, sizeof (*Queue));
+
+  // The whole queue including the packed command header block has to fit in
+  // a single host transfer.
+  Queue->Capacity = MIN (
+    FixedPcdGet32 (PcdSdMmcWriteQueueSizeKB) * 1024,
+    (HostInst->HostCapabilities.MaximumBlockCount - 1) * SD_BLOCK_LENGTH_BYTES);
+  Queue->Capacity -= Queue->Capacity % SD_BLOCK_LENGTH_BYTES;
+
+  if (Queue->Capacity == 0) {
+    LOG_TRACE ("SDHC%d write queue disabled", HostInst->HostExt->SdhcId);
+    return EFI_SUCCESS;
+  }
+
+  Queue->Buffer = AllocatePool (SD_BLOCK_LENGTH_BYTES + Queue->Capacity);
+  if (Queue->Buffer == NULL) {
+    Queue->Capacity = 0;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  LOG_TRACE (
+    "SDHC%d write queue: %dKB",
+    HostInst->HostExt->SdhcId,
+    (UINT32) (Queue->Capacity / 1024));
+
+  return EFI_SUCCESS;
+}
+
+VOID
+DestroyWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_WRITE_QUEUE   *Queue;
+
+  Queue = &HostInst->WriteQueue;
+
+  DiscardWriteQueue (HostInst);
+
+  if (Queue->Buffer != NULL) {
+    FreePool (Queue->Buffer);
+    Queue->Buffer = NULL;
+  }
+
+  Queue->Capacity = 0;
+}
+
+/** Drops all queued writes without writing them, to be called when the media
+  they were queued for is gone.
+
+  @param[in] HostInst The SDHC instance context data.
+**/
+VOID
+DiscardWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_WRITE_QUEUE   *Queue;
+
+  Queue = &HostInst->WriteQueue;
+
+  if (Queue->EntryCount > 0) {
+    LOG_ERROR (
+      "SDHC%d discarding %d queued writes (%d bytes)",
+      HostInst->HostExt->SdhcId,
+      Queue->EntryCount,
+      (UINT32) Queue->BytesQueued);
+  }
+
+  Queue->EntryCount = 0;
+  Queue->BytesQueued = 0;
+}
+
+/** Writes all queued writes to the media and empties the queue.
+
+  If a write fails, it and the writes queued after it are kept in the queue and
+  retried on the next drain, so that a transient failure does not lose
+  acknowledged data. If the media is gone, the queue is discarded instead.
+
+  @param[in] HostInst The SDHC instance context data.
+
+  @retval EFI_SUCCESS All queued writes are on the media.
+  @retval Otherwise the first write failure status.
+**/
+EFI_STATUS
+DrainWriteQueue (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  SDMMC_WRITE_QUEUE   *Queue;
+  UINT8               *Data;
+  UINTN               DataSize;
+  UINT32              EntryIdx;
+  EFI_STATUS          Status;
+
+  Queue = &HostInst->WriteQueue;
+  if (Queue->EntryCount == 0) {
+    return EFI_SUCCESS;
+  }
+
+  LOG_TRACE (
+    "DrainWriteQueue(EntryCount=%d, BytesQueued=%d)",
+    Queue->EntryCount,
+    (UINT32) Queue->BytesQueued);
+
+  Data = Queue->Buffer + SD_BLOCK_LENGTH_BYTES;
+  EntryIdx = 0;
+
+  Status = WriteQueuePacked (HostInst);
+  if (EFI_ERROR (Status)) {
+    if (Status != EFI_UNSUPPORTED) {
+      LOG_ERROR ("Packed write failed, falling back to individual writes. %r", Status);
+    }
+
+    for (EntryIdx = 0; EntryIdx < Queue->EntryCount; ++EntryIdx) {
+      DataSize = Queue->Entries[EntryIdx].BlockCount * SD_BLOCK_LENGTH_BYTES;
+      Status = IoBlocks (
+        &HostInst->BlockIo,
+        SdTransferDirectionWrite,
+        Queue->MediaId,
+        Queue->Entries[EntryIdx].Lba,
+        DataSize,
+        Data);
+      if (EFI_ERROR (Status)) {
+        LOG_ERROR (
+          "Queued write (LBA:0x%08lx, Size(B):0x%x) failed. %r",
+          Queue->Entries[EntryIdx].Lba,
+          (UINT32) DataSize,
+          Status);
+        break;
+      }
+
+      Data += DataSize;
+    }
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Queue->EntryCount = 0;
+    Queue->BytesQueued = 0;
+    return EFI_SUCCESS;
+  }
+
+  if ((Status == EFI_NO_MEDIA) || (Status == EFI_MEDIA_CHANGED)) {
+    DiscardWriteQueue (HostInst);
+    return Status;
+  }
+
+  // Keep the failed write and the ones after it at the head of the queue.
+  if (EntryIdx > 0) {
+    DataSize = Data - (Queue->Buffer + SD_BLOCK_LENGTH_BYTES);
+    CopyMem (
+      Queue->Buffer + SD_BLOCK_LENGTH_BYTES,
+      Data,
+      Queue->BytesQueued - DataSize);
+    CopyMem (
+      &Queue->Entries[0],
+      &Queue->Entries[EntryIdx],
+      (Queue->EntryCount - EntryIdx) * sizeof (Queue->Entries[0]));
+    Queue->EntryCount -= EntryIdx;
+    Queue->BytesQueued -= DataSize;
+  }
+
+  LOG_ERROR (
+    "SDHC%d %d queued writes (%d bytes) kept for retry",
+    HostInst->HostExt->SdhcId,
+    Queue->EntryCount,
+    (UINT32) Queue->BytesQueued);
+
+  return Status;
+}
+
+/** Drains the write queue only if any queued write overlaps the specified
+  block range, which is required before reading that range from the media.
+**/
+EFI_STATUS
+DrainOverlappingWrites (
+  IN SDHC_INSTANCE  *HostInst,
+  IN EFI_LBA        Lba,
+  IN UINTN          BlockCount
+  )
+{
+  SDMMC_WRITE_QUEUE         *Queue;
+  SDMMC_WRITE_QUEUE_ENTRY   *Entry;
+  UINT32                    EntryIdx;
+
+  Queue = &HostInst->WriteQueue;
+
+  for (EntryIdx = 0; EntryIdx < Queue->EntryCount; ++EntryIdx) {
+    Entry = &Queue->Entries[EntryIdx];
+    if ((Entry->Lba < (Lba + BlockCount)) &&
+        ((Entry->Lba + Entry->BlockCount) > Lba)) {
+      return DrainWriteQueue (HostInst);
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/** Queues a validated write request, merging it with the last queued write if
+  adjacent, or overwriting the queued data if it is a rewrite of a range that
+  is already queued.
+
+  @param[in] HostInst The SDHC instance context data.
+  @param[in] MediaId The media ID that the write request is for.
+  @param[in] Lba The starting logical block address.
+  @param[in] BufferSize The size of the Buffer in bytes.
+  @param[in] Buffer The data to write.
+
+  @retval EFI_SUCCESS The write is queued or on the media.
+  @retval Otherwise the write status, or the status of the queued writes that
+  had to be drained to make room for it.
+**/
+EFI_STATUS
+QueueWriteBlocks (
+  IN SDHC_INSTANCE  *HostInst,
+  IN UINT32         MediaId,
+  IN EFI_LBA        Lba,
+  IN UINTN          BufferSize,
+  IN VOID           *Buffer
+  )
+{
+  SDMMC_WRITE_QUEUE         *Queue;
+  SDMMC_WRITE_QUEUE_ENTRY   *Entry;
+  UINTN                     BlockCount;
+  UINTN                     EntryOffset;
+  UINT32                    EntryIdx;
+  EFI_STATUS                Status;
+
+  Queue = &HostInst->WriteQueue;
+  BlockCount = BufferSize / SD_BLOCK_LENGTH_BYTES;
+
+  if (BufferSize > Queue->Capacity) {
+    Status = DrainWriteQueue (HostInst);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    return IoBlocks (
+      &HostInst->BlockIo,
+      SdTransferDirectionWrite,
+      MediaId,
+      Lba,
+      BufferSize,
+      Buffer);
+  }
+
+  if ((Queue->EntryCount > 0) && (Queue->MediaId != MediaId)) {
+    DiscardWriteQueue (HostInst);
+  }
+
+  // A rewrite of a queued range, common for FAT tables and directory entries,
+  // is absorbed in place. A partial overlap is written in order instead.
+  EntryOffset = SD_BLOCK_LENGTH_BYTES;
+  for (EntryIdx = 0; EntryIdx < Queue->EntryCount; ++EntryIdx) {
+    Entry = &Queue->Entries[EntryIdx];
+    if ((Lba >= Entry->Lba) &&
+        ((Lba + BlockCount) <= (Entry->Lba + Entry->BlockCount))) {
+      CopyMem (
+        Queue->Buffer + EntryOffset + ((UINTN) (Lba - Entry->Lba) * SD_BLOCK_LENGTH_BYTES),
+        Buffer,
+        BufferSize);
+      return EFI_SUCCESS;
+    }
+
+    EntryOffset += Entry->BlockCount * SD_BLOCK_LENGTH_BYTES;
+  }
+
+  Status = DrainOverlappingWrites (HostInst, Lba, BlockCount);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Queue->BytesQueued + BufferSize) > Queue->Capacity) {
+    Status = DrainWriteQueue (HostInst);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  Entry = NULL;
+  if (Queue->EntryCount > 0) {
+    Entry = &Queue->Entries[Queue->EntryCount - 1];
+    if ((Entry->Lba + Entry->BlockCount) != Lba) {
+      Entry = NULL;
+    }
+  }
+
+  if (Entry == NULL) {
+    if (Queue->EntryCount >= GetWriteQueueMaxEntryCount (HostInst)) {
+      Status = DrainWriteQueue (HostInst);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+    }
+
+    Entry = &Queue->Entries[Queue->EntryCount];
+    Entry->Lba = Lba;
+    Entry->BlockCount = 0;
+    ++Queue->EntryCount;
+  }
+
+  CopyMem (Queue->Buffer + SD_BLOCK_LENGTH_BYTES + Queue->BytesQueued, Buffer, BufferSize);
+  Entry->BlockCount += (UINT32) BlockCount;
+  Queue->BytesQueued += BufferSize;
+  Queue->MediaId = MediaId;
+
+  return EFI_SUCCESS;
+}
+
+/** Makes all previous writes durable, by draining the write queue and then
+  flushing the eMMC internal volatile cache if enabled.
+
+  @param[in] HostInst The SDHC instance context data.
+**/
+EFI_STATUS
+FlushIoBlocks (
+  IN SDHC_INSTANCE  *HostInst
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = DrainWriteQueue (HostInst);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (!HostInst->BlockIo.Media->MediaPresent) {
+    return EFI_NO_MEDIA;
+  }
+
+  if ((HostInst->CardInfo.CardFunction == CardFunctionMmc) &&
+      ((HostInst->CardInfo.Registers.Mmc.ExtCsd.CacheCtrl &
+        MMC_EXT_CSD_CACHE_CTRL_CACHE_EN) != 0)) {
+    Status = SdhcFlushCacheMmc (HostInst);
+    if (EFI_ERROR (Status)) {
+      LOG_ERROR ("SdhcFlushCacheMmc() failed. %r", Status);
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,1103 @@
+/** @file
+*
+*  Simulated SDHC with a RAM backed SD or eMMC card.
+*
+*  Implements EFI_SDHC_PROTOCOL in software so that SdMmcDxe and the storage
+*  stack on top of it can be exercised and benchmarked without hardware. The
+*  card follows the SD/MMC command state machine closely enough for SdMmcDxe
+*  initialization, single/multi block IO, SET_BLOCK_COUNT, eMMC SWITCH, cache
+*  flush and packed writes, and the time a real card takes is modeled as:
+*  - PcdSdhcSimCommandLatencyUs for every command.
+*  - PcdSdhcSimReadLatencyUs before the first block of a read.
+*  - PcdSdhcSimWriteLatencyUs after the last block of a write or a cache flush.
+*  - One block time per block based on the current bus clock and bus width.
+*
+*  Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+*
+*  This program and the accompanying materials
+*  are licensed and made available under the terms and conditions of the BSD License
+*  which accompanies this distribution.  The full text of the license may be found at
+*  http://opensource.org/licenses/bsd-license.php
+*
+*  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+*
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Protocol/Sdhc.h>
+
+#include <SdMmcHw.h>
+#include "SdhcSimDxe.h"
+
+VOID
+SdhcSimStall (
+  IN UINT64 Nanoseconds
+  )
+{
+  if (Nanoseconds >= 1000) {
+    gBS->Stall ((UINTN) DivU64x32 (Nanoseconds, 1000));
+  }
+}
+
+VOID
+SdhcSimUpdateBlockTransferTime (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx
+  )
+{
+  // Data is clocked out on all data lines in parallel, CRC and start/end bits
+  // are ignored
+  SimCtx->BlockTransferNs = DivU64x32 (
+                              MultU64x32 (1000000000, SD_BLOCK_LENGTH_BYTES * 8),
+                              SimCtx->BusWidth * SimCtx->ClockHz);
+}
+
+UINT32
+SdhcSimCardStatus (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx
+  )
+{
+  CARD_STATUS CardStatus;
+
+  // Error bits are cleared once reported
+  CardStatus.AsUint32 = SimCtx->PendingStatusErrors;
+  SimCtx->PendingStatusErrors = 0;
+
+  CardStatus.Fields.CURRENT_STATE = SimCtx->State;
+  CardStatus.Fields.READY_FOR_DATA = 1;
+  CardStatus.Fields.APP_CMD = SimCtx->AppCmd ? 1 : 0;
+
+  return CardStatus.AsUint32;
+}
+
+BOOLEAN
+SdhcSimIsMediaRangeValid (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN UINT64 Lba,
+  IN UINT32 BlockCount
+  )
+{
+  return (Lba < SimCtx->MediaBlockCount) &&
+         (BlockCount <= (SimCtx->MediaBlockCount - Lba));
+}
+
+VOID
+SdhcSimInitializeRegisters (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx
+  )
+{
+  MMC_EXT_CSD *ExtCsd;
+
+  if (SimCtx->CardType == SDHC_SIM_CARD_TYPE_SD) {
+    SimCtx->SdCid.MID = 0x5D;
+    SimCtx->SdCid.OID = SIGNATURE_16 ('M', 'S');
+    CopyMem (SimCtx->SdCid.PNM, "SIMSD", sizeof (SimCtx->SdCid.PNM));
+    SimCtx->SdCid.PRV = 0x10;
+    SimCtx->SdCid.PSN = SDHC_SIM_PRODUCT_SERIAL_NUMBER;
+    SimCtx->SdCid.MDT = 0x12A;
+
+    // CSD Version 2.0 for SDHC/SDXC, capacity is (C_SIZE + 1) * 512KB
+    SimCtx->SdCsd.CSD_STRUCTURE = 1;
+    SimCtx->SdCsd.TAAC = 0x0E;
+    SimCtx->SdCsd.TRAN_SPEED = 0x32;  // 25MHz
+    SimCtx->SdCsd.CCC = 0x5B5;
+    SimCtx->SdCsd.READ_BL_LEN = 9;
+    SimCtx->SdCsd.C_SIZE = (UINT32) DivU64x32 (SimCtx->MediaBlockCount, 1024) - 1;
+    SimCtx->SdCsd.ERASE_BLK_EN = 1;
+    SimCtx->SdCsd.SECTOR_SIZE = 0x7F;
+    SimCtx->SdCsd.R2W_FACTOR = 2;
+    SimCtx->SdCsd.WRITE_BL_LEN = 9;
+
+    // SD 3.0x with 1-bit and 4-bit bus and SET_BLOCK_COUNT support
+    SimCtx->SdScr.SD_SPEC = 2;
+    SimCtx->SdScr.SD_SPEC3 = 1;
+    SimCtx->SdScr.SD_BUS_WIDTH = BIT0 | BIT2;
+    SimCtx->SdScr.CMD_SUPPORT = BIT1;
+  } else {
+    SimCtx->MmcCid.MID = 0x5D;
+    SimCtx->MmcCid.CBX = 1; // BGA
+    SimCtx->MmcCid.OID = 'M';
+    CopyMem (SimCtx->MmcCid.PNM, "SIMMMC", sizeof (SimCtx->MmcCid.PNM));
+    SimCtx->MmcCid.PRV = 0x10;
+    SimCtx->MmcCid.PSN = SDHC_SIM_PRODUCT_SERIAL_NUMBER;
+    SimCtx->MmcCid.MDT = 0x2A;
+
+    // High capacity eMMC, C_SIZE is saturated and the capacity is in EXT_CSD
+    SimCtx->MmcCsd.CSD_STRUCTURE = 2;
+    SimCtx->MmcCsd.SPEC_VERS = 4;
+    SimCtx->MmcCsd.TAAC = 0x27;
+    SimCtx->MmcCsd.NSAC = 1;
+    SimCtx->MmcCsd.TRAN_SPEED = 0x32; // 26MHz
+    SimCtx->MmcCsd.CCC = 0x8F5;
+    SimCtx->MmcCsd.READ_BL_LEN = 9;
+    SimCtx->MmcCsd.C_SIZEHigh10 = 0x3FF;
+    SimCtx->MmcCsd.C_SIZELow2 = 0x3;
+    SimCtx->MmcCsd.C_SIZE_MULT = 7;
+    SimCtx->MmcCsd.R2W_FACTOR = 2;
+    SimCtx->MmcCsd.WRITE_BL_LEN = 9;
+
+    ExtCsd = &SimCtx->ExtCsd;
+    ExtCsd->SectorCount = (UINT32) SimCtx->MediaBlockCount;
+    ExtCsd->ExtendedCsdRevision = MMC_EXT_CSD_REV_4_5;
+    ExtCsd->CsdStructureVersion = 2;
+    ExtCsd->CardType = MmcExtCsdCardTypeNormalSpeed | MmcExtCsdCardTypeHighSpeed;
+    ExtCsd->ReliableWriteSectorCount = 1;
+    ExtCsd->CacheSize[0] = (UINT8) SDHC_SIM_EMMC_CACHE_SIZE_KB;
+    ExtCsd->CacheSize[1] = (UINT8) (SDHC_SIM_EMMC_CACHE_SIZE_KB >> 8);
+    ExtCsd->MaxPackedWrites = SDHC_SIM_EMMC_MAX_PACKED_WRITES;
+    ExtCsd->MaxPackedReads = SDHC_SIM_EMMC_MAX_PACKED_WRITES;
+    ExtCsd->SupportedCmdSets = 1;
+  }
+}
+
+VOID
+SdhcSimResetCard (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx
+  )
+{
+  MMC_EXT_CSD *ExtCsd;
+
+  SimCtx->State = CardStateIdle;
+  SimCtx->Rca = 0;
+  SimCtx->AppCmd = FALSE;
+  SimCtx->PendingStatusErrors = 0;
+  SimCtx->SetBlockCountArg = 0;
+  SimCtx->DataTarget = SdhcSimDataTargetNone;
+
+  // GO_IDLE_STATE resets the EXT_CSD modes to their defaults
+  ExtCsd = &SimCtx->ExtCsd;
+  ExtCsd->FlushCache = 0;
+  ExtCsd->CacheCtrl = 0;
+  ExtCsd->PackedFailureIndex = 0;
+  ExtCsd->PackedCommandStatus = 0;
+  ExtCsd->PartitionConfig = 0;
+  ExtCsd->BusWidth = MmcExtCsdBusWidth1Bit;
+  ExtCsd->HighSpeedTiming = 0;
+  ExtCsd->PowerClass = 0;
+}
+
+BOOLEAN
+SdhcSimIsPackedHeaderValid (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx
+  )
+{
+  MMC_PACKED_CMD_ENTRY    *Entry;
+  MMC_PACKED_CMD_HEADER   *Header;
+  UINT32                  EntryBlockCount;
+  UINT32                  EntryIdx;
+  UINT32                  TotalBlockCount;
+
+  Header = &SimCtx->PackedHeader;
+  if ((Header->Version != MMC_PACKED_CMD_VERSION) ||
+      (Header->ReadWrite != MMC_PACKED_CMD_WRITE) ||
+      (Header->EntryCount == 0) ||
+      (Header->EntryCount > SimCtx->ExtCsd.MaxPackedWrites) ||
+      (Header->Entries[0].WriteArg != SimCtx->DataLba)) {
+    return FALSE;
+  }
+
+  // The header block is part of the packed write block count
+  TotalBlockCount = 1;
+  for (EntryIdx = 0; EntryIdx < Header->EntryCount; ++EntryIdx) {
+    Entry = &Header->Entries[EntryIdx];
+    EntryBlockCount = Entry->SetBlockCountArg & SDHC_SIM_BLOCK_COUNT_MASK;
+    if ((EntryBlockCount == 0) ||
+        !SdhcSimIsMediaRangeValid (SimCtx, Entry->WriteArg, EntryBlockCount)) {
+      return FALSE;
+    }
+
+    TotalBlockCount += EntryBlockCount;
+  }
+
+  return (TotalBlockCount == SimCtx->DataBlockCount);
+}
+
+VOID
+SdhcSimPackedWriteBlock (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN CONST UINT8 *Block
+  )
+{
+  MMC_PACKED_CMD_ENTRY  *Entry;
+  UINT64                Lba;
+
+  if (SimCtx->DataBlockIndex == 0) {
+    CopyMem (&SimCtx->PackedHeader, Block, sizeof (MMC_PACKED_CMD_HEADER));
+    SimCtx->PackedEntryIndex = 0;
+    SimCtx->PackedEntryBlockIndex = 0;
+
+    if (!SdhcSimIsPackedHeaderValid (SimCtx)) {
+      LOG_ERROR ("Invalid packed command header, dropping the packed write");
+      SimCtx->ExtCsd.PackedCommandStatus = BIT0;
+      SimCtx->ExtCsd.PackedFailureIndex = 0;
+      SimCtx->PendingStatusErrors |= BIT19; // ERROR
+      SimCtx->DataTarget = SdhcSimDataTargetDiscard;
+    }
+    return;
+  }
+
+  Entry = &SimCtx->PackedHeader.Entries[SimCtx->PackedEntryIndex];
+  Lba = Entry->WriteArg + SimCtx->PackedEntryBlockIndex;
+  CopyMem (
+    SimCtx->Media + (UINTN) MultU64x32 (Lba, SD_BLOCK_LENGTH_BYTES),
+    Block,
+    SD_BLOCK_LENGTH_BYTES);
+
+  ++SimCtx->PackedEntryBlockIndex;
+  if (SimCtx->PackedEntryBlockIndex ==
+      (Entry->SetBlockCountArg & SDHC_SIM_BLOCK_COUNT_MASK)) {
+    ++SimCtx->PackedEntryIndex;
+    SimCtx->PackedEntryBlockIndex = 0;
+  }
+}
+
+EFI_STATUS
+SdhcSimTransferData (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN SD_TRANSFER_DIRECTION TransferDirection,
+  IN UINTN LengthInBytes,
+  IN OUT UINT8 *Buffer
+  )
+{
+  UINT32  BlockCount;
+  UINT32  BlockIdx;
+  UINT8   *MediaBlock;
+
+  if ((SimCtx->DataTarget == SdhcSimDataTargetNone) ||
+      (SimCtx->DataDirection != TransferDirection) ||
+      ((LengthInBytes % SD_BLOCK_LENGTH_BYTES) != 0) ||
+      ((LengthInBytes / SD_BLOCK_LENGTH_BYTES) >
+       (SimCtx->DataBlockCount - SimCtx->DataBlockIndex))) {
+    LOG_ERROR ("No data transfer in progress for 0x%xB", LengthInBytes);
+    return EFI_DEVICE_ERROR;
+  }
+
+  BlockCount = (UINT32) (LengthInBytes / SD_BLOCK_LENGTH_BYTES);
+  for (BlockIdx = 0; BlockIdx < BlockCount; ++BlockIdx) {
+    switch (SimCtx->DataTarget) {
+    case SdhcSimDataTargetMedia:
+      MediaBlock = SimCtx->Media +
+                   (UINTN) MultU64x32 (SimCtx->DataLba + SimCtx->DataBlockIndex, SD_BLOCK_LENGTH_BYTES);
+      if (TransferDirection == SdTransferDirectionRead) {
+        CopyMem (Buffer, MediaBlock, SD_BLOCK_LENGTH_BYTES);
+      } else {
+        CopyMem (MediaBlock, Buffer, SD_BLOCK_LENGTH_BYTES);
+      }
+      break;
+
+    case SdhcSimDataTargetRegister:
+      CopyMem (Buffer, SimCtx->RegisterBlock, SD_BLOCK_LENGTH_BYTES);
+      break;
+
+    case SdhcSimDataTargetPacked:
+      SdhcSimPackedWriteBlock (SimCtx, Buffer);
+      break;
+
+    default:
+      ASSERT (SimCtx->DataTarget == SdhcSimDataTargetDiscard);
+      break;
+    }
+
+    ++SimCtx->DataBlockIndex;
+    Buffer += SD_BLOCK_LENGTH_BYTES;
+  }
+
+  SdhcSimStall (MultU64x32 (SimCtx->BlockTransferNs, BlockCount));
+
+  if (SimCtx->DataBlockIndex == SimCtx->DataBlockCount) {
+    if (SimCtx->DataDirection == SdTransferDirectionWrite) {
+      gBS->Stall (FixedPcdGet32 (PcdSdhcSimWriteLatencyUs));
+    }
+
+    SimCtx->DataTarget = SdhcSimDataTargetNone;
+
+    // An open-ended transfer keeps the card in data/rcv state until
+    // STOP_TRANSMISSION
+    if (!SimCtx->DataOpenEnded) {
+      SimCtx->State = CardStateTran;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimStartRegisterRead (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN CONST SD_COMMAND_XFR_INFO *XfrInfo,
+  IN CONST VOID *Register,
+  IN UINTN RegisterSize
+  )
+{
+  if ((XfrInfo == NULL) ||
+      (XfrInfo->BlockSize != SD_BLOCK_LENGTH_BYTES) ||
+      (XfrInfo->BlockCount != 1)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ASSERT (RegisterSize <= sizeof (SimCtx->RegisterBlock));
+  ZeroMem (SimCtx->RegisterBlock, sizeof (SimCtx->RegisterBlock));
+  CopyMem (SimCtx->RegisterBlock, Register, RegisterSize);
+
+  SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+  SimCtx->DataTarget = SdhcSimDataTargetRegister;
+  SimCtx->DataDirection = SdTransferDirectionRead;
+  SimCtx->DataOpenEnded = FALSE;
+  SimCtx->DataBlockCount = 1;
+  SimCtx->DataBlockIndex = 0;
+  SimCtx->State = CardStateData;
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimStartDataCommand (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  CARD_STATUS CardStatus;
+  BOOLEAN     IsPacked;
+
+  if ((XfrInfo == NULL) ||
+      (XfrInfo->BlockSize != SD_BLOCK_LENGTH_BYTES) ||
+      (XfrInfo->BlockCount == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (SimCtx->State != CardStateTran) {
+    return EFI_TIMEOUT;
+  }
+
+  IsPacked = (SimCtx->CardType == SDHC_SIM_CARD_TYPE_EMMC) &&
+             (Cmd->TransferDirection == SdTransferDirectionWrite) &&
+             ((SimCtx->SetBlockCountArg & MMC_SET_BLOCK_COUNT_PACKED) != 0);
+
+  // A multi-block transfer not preceded by SET_BLOCK_COUNT is open-ended
+  SimCtx->DataOpenEnded = (Cmd->TransferType == SdTransferTypeMultiBlock) &&
+                          (SimCtx->SetBlockCountArg == 0);
+  SimCtx->SetBlockCountArg = 0;
+
+  CardStatus.AsUint32 = SdhcSimCardStatus (SimCtx);
+  if (!IsPacked &&
+      !SdhcSimIsMediaRangeValid (SimCtx, Argument, XfrInfo->BlockCount)) {
+    // The host gets the error in the response and no data is transferred
+    CardStatus.Fields.ADDRESS_OUT_OF_RANGE = 1;
+    SimCtx->Response[0] = CardStatus.AsUint32;
+    return EFI_SUCCESS;
+  }
+
+  SimCtx->Response[0] = CardStatus.AsUint32;
+  SimCtx->DataTarget = IsPacked ? SdhcSimDataTargetPacked : SdhcSimDataTargetMedia;
+  SimCtx->DataDirection = Cmd->TransferDirection;
+  SimCtx->DataLba = Argument;
+  SimCtx->DataBlockCount = XfrInfo->BlockCount;
+  SimCtx->DataBlockIndex = 0;
+
+  if (Cmd->TransferDirection == SdTransferDirectionRead) {
+    SimCtx->State = CardStateData;
+    gBS->Stall (FixedPcdGet32 (PcdSdhcSimReadLatencyUs));
+  } else {
+    SimCtx->State = CardStateRcv;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimSwitchMmc (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN UINT32 Argument
+  )
+{
+  MMC_SWITCH_CMD_ARG            SwitchArg;
+  UINT8                         *ExtCsdBytes;
+  MMC_EXT_CSD_PARTITION_CONFIG  PartConfig;
+  UINT8                         Value;
+
+  if (SimCtx->State != CardStateTran) {
+    return EFI_TIMEOUT;
+  }
+
+  SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+
+  SwitchArg.AsUint32 = Argument;
+  ExtCsdBytes = (UINT8*) &SimCtx->ExtCsd;
+
+  // Only the modes segment of the EXT_CSD is writable, SWITCH errors are
+  // reported in the status following the busy period
+  if (SwitchArg.Fields.Index >= OFFSET_OF (MMC_EXT_CSD, ExtendedCsdRevision)) {
+    SimCtx->PendingStatusErrors |= BIT7; // SWITCH_ERROR
+    return EFI_SUCCESS;
+  }
+
+  switch (SwitchArg.Fields.Access) {
+  case MmcSwitchCmdAccessTypeSetBits:
+    Value = ExtCsdBytes[SwitchArg.Fields.Index] | (UINT8) SwitchArg.Fields.Value;
+    break;
+  case MmcSwitchCmdAccessTypeClearBits:
+    Value = ExtCsdBytes[SwitchArg.Fields.Index] & ~((UINT8) SwitchArg.Fields.Value);
+    break;
+  case MmcSwitchCmdAccessTypeWriteByte:
+    Value = (UINT8) SwitchArg.Fields.Value;
+    break;
+  default:
+    // Only the standard command set is simulated
+    return EFI_SUCCESS;
+  }
+
+  switch (SwitchArg.Fields.Index) {
+  case MmcExtCsdBitIndexFlushCache:
+    if ((Value & BIT0) != 0) {
+      gBS->Stall (FixedPcdGet32 (PcdSdhcSimWriteLatencyUs));
+    }
+    // FLUSH_CACHE self-clears when the flush completes
+    Value = 0;
+    break;
+
+  case MmcExtCsdBitIndexPartitionConfig:
+    // Only the user data area is simulated
+    PartConfig.AsUint8 = Value;
+    if (PartConfig.Fields.PARTITION_ACCESS != MmcExtCsdPartitionAccessUserArea) {
+      SimCtx->PendingStatusErrors |= BIT7; // SWITCH_ERROR
+      return EFI_SUCCESS;
+    }
+    break;
+  }
+
+  ExtCsdBytes[SwitchArg.Fields.Index] = Value;
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimSendAppCommand (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN OPTIONAL CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  SD_OCR_EX Ocr;
+
+  if (SimCtx->CardType != SDHC_SIM_CARD_TYPE_SD) {
+    return EFI_TIMEOUT;
+  }
+
+  switch (Cmd->Index) {
+  case 6: // SET_BUS_WIDTH
+    if (SimCtx->State != CardStateTran) {
+      return EFI_TIMEOUT;
+    }
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    return EFI_SUCCESS;
+
+  case 41: // SD_SEND_OP_COND
+    if ((SimCtx->State != CardStateIdle) && (SimCtx->State != CardStateReady)) {
+      return EFI_TIMEOUT;
+    }
+
+    Ocr.AsUint32 = 0;
+    Ocr.Fields.VoltageWindow = SD_OCR_HIGH_VOLTAGE_WINDOW;
+
+    // An inquiry ACMD41 with no voltage window only reads the OCR
+    if ((Argument & SD_OCR_HIGH_VOLTAGE_WINDOW) != 0) {
+      Ocr.Fields.PowerUp = 1;
+      Ocr.Fields.CCS = ((Argument & BIT30) != 0) ? 1 : 0;
+      SimCtx->State = CardStateReady;
+    }
+
+    SimCtx->Response[0] = Ocr.AsUint32;
+    return EFI_SUCCESS;
+
+  case 42: // SET_CLR_CARD_DETECT
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    return EFI_SUCCESS;
+
+  case 51: // SEND_SCR
+    if (SimCtx->State != CardStateTran) {
+      return EFI_TIMEOUT;
+    }
+    return SdhcSimStartRegisterRead (SimCtx, XfrInfo, &SimCtx->SdScr, sizeof (SD_SCR));
+
+  default:
+    return EFI_TIMEOUT;
+  }
+}
+
+EFI_STATUS
+SdhcSimSendStandardCommand (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN OPTIONAL CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  CARD_STATUS CardStatus;
+  BOOLEAN     IsSd;
+  MMC_OCR     Ocr;
+
+  IsSd = (SimCtx->CardType == SDHC_SIM_CARD_TYPE_SD);
+
+  switch (Cmd->Index) {
+  case 0: // GO_IDLE_STATE
+    SdhcSimResetCard (SimCtx);
+    return EFI_SUCCESS;
+
+  case 1: // SEND_OP_COND
+    if (IsSd ||
+        ((SimCtx->State != CardStateIdle) && (SimCtx->State != CardStateReady))) {
+      return EFI_TIMEOUT;
+    }
+
+    Ocr.AsUint32 = 0;
+    Ocr.Fields.VoltageWindow = SD_OCR_HIGH_VOLTAGE_WINDOW | BIT7;
+    Ocr.Fields.AccessMode = SdOcrAccessSectorMode;
+    Ocr.Fields.PowerUp = 1;
+    SimCtx->Response[0] = Ocr.AsUint32;
+    SimCtx->State = CardStateReady;
+    return EFI_SUCCESS;
+
+  case 2: // ALL_SEND_CID
+    if (SimCtx->State != CardStateReady) {
+      return EFI_TIMEOUT;
+    }
+
+    if (IsSd) {
+      CopyMem (SimCtx->Response, &SimCtx->SdCid, sizeof (SD_CID));
+    } else {
+      CopyMem (SimCtx->Response, &SimCtx->MmcCid, sizeof (MMC_CID));
+    }
+    SimCtx->State = CardStateIdent;
+    return EFI_SUCCESS;
+
+  case 3: // SEND_RELATIVE_ADDR (SD) or SET_RELATIVE_ADDR (MMC)
+    if ((SimCtx->State != CardStateIdent) && (SimCtx->State != CardStateStdby)) {
+      return EFI_TIMEOUT;
+    }
+
+    if (IsSd) {
+      // R6 carries the published RCA and the card status bits [12:0]
+      SimCtx->Rca = SDHC_SIM_SD_RCA;
+      SimCtx->Response[0] = (SimCtx->Rca << 16) | (SdhcSimCardStatus (SimCtx) & 0x1FFF);
+    } else {
+      SimCtx->Rca = Argument >> 16;
+      SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    }
+    SimCtx->State = CardStateStdby;
+    return EFI_SUCCESS;
+
+  case 6: // SWITCH (MMC)
+    if (IsSd) {
+      return EFI_TIMEOUT;
+    }
+    return SdhcSimSwitchMmc (SimCtx, Argument);
+
+  case 7: // SELECT/DESELECT_CARD
+    if ((Argument >> 16) != SimCtx->Rca) {
+      // Deselected by address, cards don't respond to deselect
+      if (SimCtx->State == CardStateTran) {
+        SimCtx->State = CardStateStdby;
+      }
+      return EFI_SUCCESS;
+    }
+
+    if (SimCtx->State != CardStateStdby) {
+      return EFI_TIMEOUT;
+    }
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    SimCtx->State = CardStateTran;
+    return EFI_SUCCESS;
+
+  case 8: // SEND_IF_COND (SD) or SEND_EXT_CSD (MMC)
+    if (IsSd) {
+      if (SimCtx->State != CardStateIdle) {
+        return EFI_TIMEOUT;
+      }
+      // R7 echoes back the accepted voltage and the check pattern
+      SimCtx->Response[0] = Argument & 0xFFF;
+      return EFI_SUCCESS;
+    }
+
+    if (SimCtx->State != CardStateTran) {
+      return EFI_TIMEOUT;
+    }
+    return SdhcSimStartRegisterRead (SimCtx, XfrInfo, &SimCtx->ExtCsd, sizeof (MMC_EXT_CSD));
+
+  case 9: // SEND_CSD
+  case 10: // SEND_CID
+    if ((SimCtx->State != CardStateStdby) || ((Argument >> 16) != SimCtx->Rca)) {
+      return EFI_TIMEOUT;
+    }
+
+    if (Cmd->Index == 9) {
+      if (IsSd) {
+        CopyMem (SimCtx->Response, &SimCtx->SdCsd, sizeof (SD_CSD_2));
+      } else {
+        CopyMem (SimCtx->Response, &SimCtx->MmcCsd, sizeof (MMC_CSD));
+      }
+    } else {
+      if (IsSd) {
+        CopyMem (SimCtx->Response, &SimCtx->SdCid, sizeof (SD_CID));
+      } else {
+        CopyMem (SimCtx->Response, &SimCtx->MmcCid, sizeof (MMC_CID));
+      }
+    }
+    return EFI_SUCCESS;
+
+  case 12: // STOP_TRANSMISSION
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    if ((SimCtx->State == CardStateData) || (SimCtx->State == CardStateRcv)) {
+      if (SimCtx->State == CardStateRcv) {
+        gBS->Stall (FixedPcdGet32 (PcdSdhcSimWriteLatencyUs));
+      }
+      SimCtx->DataTarget = SdhcSimDataTargetNone;
+      SimCtx->State = CardStateTran;
+    }
+    return EFI_SUCCESS;
+
+  case 13: // SEND_STATUS
+    if ((Argument >> 16) != SimCtx->Rca) {
+      return EFI_TIMEOUT;
+    }
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    return EFI_SUCCESS;
+
+  case 16: // SET_BLOCKLEN
+    if (SimCtx->State != CardStateTran) {
+      return EFI_TIMEOUT;
+    }
+    CardStatus.AsUint32 = SdhcSimCardStatus (SimCtx);
+    if (Argument != SD_BLOCK_LENGTH_BYTES) {
+      CardStatus.Fields.BLOCK_LEN_ERROR = 1;
+    }
+    SimCtx->Response[0] = CardStatus.AsUint32;
+    return EFI_SUCCESS;
+
+  case 23: // SET_BLOCK_COUNT
+    if (SimCtx->State != CardStateTran) {
+      return EFI_TIMEOUT;
+    }
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    SimCtx->SetBlockCountArg = Argument;
+    return EFI_SUCCESS;
+
+  case 17: // READ_SINGLE_BLOCK
+  case 18: // READ_MULTIPLE_BLOCK
+  case 24: // WRITE_BLOCK
+  case 25: // WRITE_MULTIPLE_BLOCK
+    return SdhcSimStartDataCommand (SimCtx, Cmd, Argument, XfrInfo);
+
+  default:
+    // SDIO and the rest of the commands are not simulated
+    return EFI_TIMEOUT;
+  }
+}
+
+EFI_STATUS
+SdhcSimSendCommand (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN OPTIONAL CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  SDHC_SIM_PRIVATE_CONTEXT  *SimCtx;
+  EFI_STATUS                Status;
+
+  SimCtx = (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext;
+
+  LOG_TRACE (
+    "SdhcSimSendCommand(%cCMD%d, %08x)",
+    ((Cmd->Class == SdCommandClassApp) ? 'A' : ' '),
+    (UINT32)Cmd->Index,
+    Argument);
+
+  gBS->Stall (FixedPcdGet32 (PcdSdhcSimCommandLatencyUs));
+
+  ZeroMem (SimCtx->Response, sizeof (SimCtx->Response));
+
+  // A new command aborts any data transfer the host didn't complete
+  SimCtx->DataTarget = SdhcSimDataTargetNone;
+
+  // APP_CMD applies only to the command right after it
+  if (Cmd->Index == 55) {
+    if ((SimCtx->Rca != 0) && ((Argument >> 16) != SimCtx->Rca)) {
+      return EFI_TIMEOUT;
+    }
+    SimCtx->AppCmd = TRUE;
+    SimCtx->Response[0] = SdhcSimCardStatus (SimCtx);
+    return EFI_SUCCESS;
+  }
+
+  if (Cmd->Class == SdCommandClassApp) {
+    if (SimCtx->AppCmd) {
+      Status = SdhcSimSendAppCommand (SimCtx, Cmd, Argument, XfrInfo);
+    } else {
+      Status = EFI_TIMEOUT;
+    }
+  } else {
+    Status = SdhcSimSendStandardCommand (SimCtx, Cmd, Argument, XfrInfo);
+  }
+
+  SimCtx->AppCmd = FALSE;
+
+  if (EFI_ERROR (Status)) {
+    LOG_TRACE (
+      "%cCMD%d is not accepted in state %d. %r",
+      ((Cmd->Class == SdCommandClassApp) ? 'A' : ' '),
+      (UINT32)Cmd->Index,
+      (UINT32)SimCtx->State,
+      Status);
+  }
+
+  return Status;
+}
+
+EFI_STATUS
+SdhcSimSendDmaCommand (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  SDHC_SIM_PRIVATE_CONTEXT  *SimCtx;
+  EFI_STATUS                Status;
+
+  SimCtx = (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext;
+
+  Status = SdhcSimSendCommand (This, Cmd, Argument, XfrInfo);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  // The command was rejected with an error in its response which the caller
+  // checks, no data to move
+  if (SimCtx->DataTarget == SdhcSimDataTargetNone) {
+    return EFI_SUCCESS;
+  }
+
+  return SdhcSimTransferData (
+           SimCtx,
+           Cmd->TransferDirection,
+           XfrInfo->BlockCount * XfrInfo->BlockSize,
+           XfrInfo->Buffer);
+}
+
+EFI_STATUS
+SdhcSimReceiveResponse (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN CONST SD_COMMAND *Cmd,
+  OUT UINT32 *Buffer
+  )
+{
+  SDHC_SIM_PRIVATE_CONTEXT *SimCtx;
+
+  if (Buffer == NULL) {
+    LOG_ERROR ("Input Buffer is NULL");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  SimCtx = (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext;
+
+  switch (Cmd->ResponseType) {
+  case SdResponseTypeNone:
+    break;
+  case SdResponseTypeR2:
+    CopyMem (Buffer, SimCtx->Response, sizeof (SimCtx->Response));
+    break;
+  default:
+    Buffer[0] = SimCtx->Response[0];
+    break;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimReadBlockData (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN UINTN LengthInBytes,
+  OUT UINT32 *Buffer
+  )
+{
+  ASSERT (Buffer != NULL);
+
+  return SdhcSimTransferData (
+           (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext,
+           SdTransferDirectionRead,
+           LengthInBytes,
+           (UINT8 *)Buffer);
+}
+
+EFI_STATUS
+SdhcSimWriteBlockData (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN UINTN LengthInBytes,
+  IN CONST UINT32 *Buffer
+  )
+{
+  ASSERT (Buffer != NULL);
+
+  return SdhcSimTransferData (
+           (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext,
+           SdTransferDirectionWrite,
+           LengthInBytes,
+           (UINT8 *)Buffer);
+}
+
+EFI_STATUS
+SdhcSimSoftwareReset (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN SDHC_RESET_TYPE ResetType
+  )
+{
+  SDHC_SIM_PRIVATE_CONTEXT *SimCtx;
+
+  SimCtx = (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext;
+
+  // Resetting the host controller doesn't reset the card, only GO_IDLE_STATE does
+  switch (ResetType) {
+  case SdhcResetTypeAll:
+    LOG_TRACE ("SdhcSimSoftwareReset(ALL)");
+    SimCtx->ClockHz = SD_IDENT_MODE_CLOCK_FREQ_HZ;
+    SimCtx->BusWidth = 1;
+    SdhcSimUpdateBlockTransferTime (SimCtx);
+    SimCtx->DataTarget = SdhcSimDataTargetNone;
+    break;
+  case SdhcResetTypeCmd:
+    LOG_TRACE ("SdhcSimSoftwareReset(CMD)");
+    break;
+  case SdhcResetTypeData:
+    LOG_TRACE ("SdhcSimSoftwareReset(DAT)");
+    SimCtx->DataTarget = SdhcSimDataTargetNone;
+    break;
+  default:
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimSetClock (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN UINT32 TargetFreqHz
+  )
+{
+  SDHC_SIM_PRIVATE_CONTEXT *SimCtx;
+
+  if (TargetFreqHz == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  SimCtx = (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext;
+  SimCtx->ClockHz = TargetFreqHz;
+  SdhcSimUpdateBlockTransferTime (SimCtx);
+
+  LOG_TRACE ("SdhcSimSetClock(%dHz)", TargetFreqHz);
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SdhcSimSetBusWidth (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN SD_BUS_WIDTH BusWidth
+  )
+{
+  SDHC_SIM_PRIVATE_CONTEXT *SimCtx;
+
+  SimCtx = (SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext;
+
+  switch (BusWidth) {
+  case SdBusWidth1Bit:
+  case SdBusWidth4Bit:
+    break;
+  case SdBusWidth8Bit:
+    if (SimCtx->CardType == SDHC_SIM_CARD_TYPE_SD) {
+      return EFI_UNSUPPORTED;
+    }
+    break;
+  default:
+    return EFI_INVALID_PARAMETER;
+  }
+
+  SimCtx->BusWidth = (UINT32)BusWidth;
+  SdhcSimUpdateBlockTransferTime (SimCtx);
+
+  LOG_TRACE ("SdhcSimSetBusWidth(%d)", (UINT32)BusWidth);
+
+  return EFI_SUCCESS;
+}
+
+BOOLEAN
+SdhcSimIsCardPresent (
+  IN EFI_SDHC_PROTOCOL *This
+  )
+{
+  return TRUE;
+}
+
+BOOLEAN
+SdhcSimIsReadOnly (
+  IN EFI_SDHC_PROTOCOL *This
+  )
+{
+  return FALSE;
+}
+
+VOID
+SdhcSimGetCapabilities (
+  IN EFI_SDHC_PROTOCOL *This,
+  OUT SDHC_CAPABILITIES *Capabilities
+  )
+{
+  Capabilities->MaximumBlockSize = SD_BLOCK_LENGTH_BYTES;
+  Capabilities->MaximumBlockCount = SDHC_SIM_MAX_BLOCK_COUNT;
+}
+
+VOID
+SdhcSimFreeContext (
+  IN SDHC_SIM_PRIVATE_CONTEXT *SimCtx
+  )
+{
+  if (SimCtx->Media != NULL) {
+    FreePages (SimCtx->Media, SimCtx->MediaPages);
+    SimCtx->Media = NULL;
+  }
+
+  FreePool (SimCtx);
+}
+
+VOID
+SdhcSimCleanup (
+  IN EFI_SDHC_PROTOCOL *This
+  )
+{
+  if (This->PrivateContext != NULL) {
+    SdhcSimFreeContext ((SDHC_SIM_PRIVATE_CONTEXT *)This->PrivateContext);
+    This->PrivateContext = NULL;
+  }
+
+  FreePool (This);
+}
+
+STATIC EFI_SDHC_PROTOCOL mSdhcSimProtocolTemplate = {
+  SDHC_PROTOCOL_INTERFACE_REVISION,   // Revision
+  SDHC_SIM_SDHC_ID,                   // DeviceId
+  NULL,                               // PrivateContext
+  SdhcSimGetCapabilities,
+  SdhcSimSoftwareReset,
+  SdhcSimSetClock,
+  SdhcSimSetBusWidth,
+  SdhcSimIsCardPresent,
+  SdhcSimIsReadOnly,
+  SdhcSimSendCommand,
+  SdhcSimReceiveResponse,
+  SdhcSimReadBlockData,
+  SdhcSimWriteBlockData,
+  SdhcSimCleanup,
+  SdhcSimSendDmaCommand
+};
+
+EFI_STATUS
+EFIAPI
+SdhcSimInitialize (
+  IN EFI_HANDLE ImageHandle,
+  IN EFI_SYSTEM_TABLE *SystemTable
+  )
+{
+  UINT64                    MediaSize;
+  SDHC_SIM_PRIVATE_CONTEXT  *SimCtx;
+  EFI_SDHC_PROTOCOL         *SdhcProtocol;
+  EFI_STATUS                Status;
+
+  SdhcProtocol = NULL;
+  SimCtx = NULL;
+
+  MediaSize = MultU64x32 (SIZE_1MB, FixedPcdGet32 (PcdSdhcSimCardSizeMB));
+  if ((MediaSize == 0) ||
+      ((FixedPcdGet32 (PcdSdhcSimCardType) != SDHC_SIM_CARD_TYPE_SD) &&
+       (FixedPcdGet32 (PcdSdhcSimCardType) != SDHC_SIM_CARD_TYPE_EMMC))) {
+    LOG_ERROR ("Invalid simulated card configuration");
+    Status = EFI_INVALID_PARAMETER;
+    goto Exit;
+  }
+
+  SdhcProtocol = AllocateCopyPool (sizeof (EFI_SDHC_PROTOCOL),
+                                   &mSdhcSimProtocolTemplate);
+  if (SdhcProtocol == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  SimCtx = AllocateZeroPool (sizeof (SDHC_SIM_PRIVATE_CONTEXT));
+  if (SimCtx == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  SimCtx->CardType = FixedPcdGet32 (PcdSdhcSimCardType);
+  SimCtx->MediaBlockCount = DivU64x32 (MediaSize, SD_BLOCK_LENGTH_BYTES);
+  SimCtx->MediaPages = EFI_SIZE_TO_PAGES ((UINTN) MediaSize);
+  SimCtx->Media = AllocatePages (SimCtx->MediaPages);
+  if (SimCtx->Media == NULL) {
+    LOG_ERROR ("Failed to allocate %ldB for the simulated media", MediaSize);
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  ZeroMem (SimCtx->Media, (UINTN) MediaSize);
+
+  SdhcSimInitializeRegisters (SimCtx);
+  SdhcSimResetCard (SimCtx);
+
+  SdhcProtocol->PrivateContext = SimCtx;
+  SdhcSimSoftwareReset (SdhcProtocol, SdhcResetTypeAll);
+
+  if (!FixedPcdGetBool (PcdSdhcSimDmaEnable)) {
+    SdhcProtocol->SendDmaCommand = NULL;
+  }
+
+  LOG_INFO (
+    "Simulating a %dMB %a card on SDHC%d, data transfer mode: %a",
+    FixedPcdGet32 (PcdSdhcSimCardSizeMB),
+    (SimCtx->CardType == SDHC_SIM_CARD_TYPE_SD) ? "SD" : "eMMC",
+    SDHC_SIM_SDHC_ID,
+    (SdhcProtocol->SendDmaCommand != NULL) ? "DMA" : "PIO");
+
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &SimCtx->SdhcProtocolHandle,
+                  &gEfiSdhcProtocolGuid,
+                  SdhcProtocol,
+                  NULL);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("InstallMultipleProtocolInterfaces failed. %r", Status);
+    goto Exit;
+  }
+
+Exit:
+  if (EFI_ERROR (Status)) {
+    if (SimCtx != NULL) {
+      SdhcSimFreeContext (SimCtx);
+    }
+
+    if (SdhcProtocol != NULL) {
+      FreePool (SdhcProtocol);
+    }
+  }
+
+  return Status;
+}
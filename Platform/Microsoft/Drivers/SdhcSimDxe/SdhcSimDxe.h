@@ -0,0 +1,100 @@
+/** @file
+*
+*  Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+*
+*  This program and the accompanying materials
+*  are licensed and made available under the terms and conditions of the BSD License
+*  which accompanies this distribution.  The full text of the license may be found at
+*  http://opensource.org/licenses/bsd-license.php
+*
+*  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+*
+**/
+
+#ifndef _SDHC_SIM_DXE_H_
+#define _SDHC_SIM_DXE_H_
+
+#define LOG_FMT_HELPER(FMT, ...) \
+    "SdhcSim:" FMT "%a\n", __VA_ARGS__
+
+#define LOG_INFO(...) \
+    DEBUG((DEBUG_INFO | DEBUG_BLKIO, LOG_FMT_HELPER(__VA_ARGS__, "")))
+
+#define LOG_TRACE(...) \
+    DEBUG((DEBUG_VERBOSE | DEBUG_BLKIO, LOG_FMT_HELPER(__VA_ARGS__, "")))
+
+#define LOG_ERROR(...) \
+    DEBUG((DEBUG_ERROR | DEBUG_BLKIO, LOG_FMT_HELPER(__VA_ARGS__, "")))
+
+// Values of PcdSdhcSimCardType
+#define SDHC_SIM_CARD_TYPE_SD           0
+#define SDHC_SIM_CARD_TYPE_EMMC         1
+
+// SdhcId of the simulated SDHC, out of the range used by the SoC SDHC drivers
+#define SDHC_SIM_SDHC_ID                0x80
+
+#define SDHC_SIM_MAX_BLOCK_COUNT        0xFFFF
+
+// SET_BLOCK_COUNT argument [15:0] is the number of blocks
+#define SDHC_SIM_BLOCK_COUNT_MASK       0xFFFF
+
+// The RCA published by the simulated SD card, MMC cards get theirs assigned
+// by the host
+#define SDHC_SIM_SD_RCA                 0x5D5D
+
+#define SDHC_SIM_PRODUCT_SERIAL_NUMBER  0x51AD0001
+
+#define SDHC_SIM_EMMC_MAX_PACKED_WRITES 32
+#define SDHC_SIM_EMMC_CACHE_SIZE_KB     512
+
+typedef enum {
+  SdhcSimDataTargetNone = 0,
+  SdhcSimDataTargetMedia,     // Blocks are moved from/to the simulated media
+  SdhcSimDataTargetRegister,  // A register block such as EXT_CSD is read
+  SdhcSimDataTargetPacked,    // A packed command header followed by its data
+  SdhcSimDataTargetDiscard    // Blocks are received and dropped
+} SDHC_SIM_DATA_TARGET;
+
+typedef struct {
+  EFI_HANDLE              SdhcProtocolHandle;
+  UINT32                  CardType;
+
+  // RAM backing the simulated card user area
+  UINT8                   *Media;
+  UINTN                   MediaPages;
+  UINT64                  MediaBlockCount;
+
+  // Card side state
+  CARD_STATE              State;
+  UINT32                  Rca;
+  BOOLEAN                 AppCmd;
+  UINT32                  PendingStatusErrors;  // Reported on the next R1
+  UINT32                  SetBlockCountArg;     // Last CMD23 argument, 0 if none
+  SD_CID                  SdCid;
+  SD_CSD_2                SdCsd;
+  SD_SCR                  SdScr;
+  MMC_CID                 MmcCid;
+  MMC_CSD                 MmcCsd;
+  MMC_EXT_CSD             ExtCsd;
+
+  // Host side state
+  UINT32                  Response[4];
+  UINT32                  ClockHz;
+  UINT32                  BusWidth;
+  UINT64                  BlockTransferNs;
+
+  // The data transfer of the last data command
+  SDHC_SIM_DATA_TARGET    DataTarget;
+  SD_TRANSFER_DIRECTION   DataDirection;
+  BOOLEAN                 DataOpenEnded;
+  UINT64                  DataLba;
+  UINT32                  DataBlockCount;
+  UINT32                  DataBlockIndex;
+  UINT8                   RegisterBlock[SD_BLOCK_LENGTH_BYTES];
+  MMC_PACKED_CMD_HEADER   PackedHeader;
+  UINT32                  PackedEntryIndex;
+  UINT32                  PackedEntryBlockIndex;
+} SDHC_SIM_PRIVATE_CONTEXT;
+
+#endif // _SDHC_SIM_DXE_H_
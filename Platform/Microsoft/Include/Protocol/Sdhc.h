@@ -159,6 +159,20 @@ typedef VOID (EFIAPI *SDHC_CLEANUP) (
   IN EFI_SDHC_PROTOCOL *This
   );
 
+//
+// Sends a data command and moves all of its data using the SDHC DMA engine.
+// Returns once both the command and the data transfer have completed, so the
+// caller proceeds directly to ReceiveResponse. Returns EFI_UNSUPPORTED when
+// the transfer can't be done by DMA, in which case the caller should fall back
+// to SendCommand followed by ReadBlockData/WriteBlockData.
+//
+typedef EFI_STATUS (EFIAPI *SDHC_SENDDMACOMMAND) (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN const SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN const SD_COMMAND_XFR_INFO *XfrInfo
+  );
+
 struct _EFI_SDHC_PROTOCOL {
   UINT32                   Revision;
 
@@ -187,9 +201,16 @@ struct _EFI_SDHC_PROTOCOL {
   SDHC_READBLOCKDATA       ReadBlockData;
   SDHC_WRITEBLOCKDATA      WriteBlockData;
   SDHC_CLEANUP             Cleanup;
+
+  //
+  // Revision 1.1 and above. May be NULL if the SDHC has no DMA support
+  //
+  SDHC_SENDDMACOMMAND      SendDmaCommand;
 };
 
-#define SDHC_PROTOCOL_INTERFACE_REVISION    0x00010000    // 1.0
+#define SDHC_PROTOCOL_INTERFACE_REVISION_1_0  0x00010000    // 1.0
+#define SDHC_PROTOCOL_INTERFACE_REVISION_1_1  0x00010001    // 1.1
+#define SDHC_PROTOCOL_INTERFACE_REVISION      SDHC_PROTOCOL_INTERFACE_REVISION_1_1
 
 extern EFI_GUID gEfiSdhcProtocolGuid;
 
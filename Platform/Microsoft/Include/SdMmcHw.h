@@ -286,7 +286,13 @@ typedef struct {
 
   // Host modifiable modes
 
-  UINT8 Reserved26[134];
+  UINT8 Reserved28[32];
+  UINT8 FlushCache;
+  UINT8 CacheCtrl;
+  UINT8 PowerOffNotification;
+  UINT8 PackedFailureIndex;
+  UINT8 PackedCommandStatus;
+  UINT8 Reserved27[97];
   UINT8 BadBlockManagement;
   UINT8 Reserved25;
   UINT32 EnhancedUserDataStartAddress;
@@ -370,7 +376,12 @@ typedef struct {
   UINT8 PowerClass52MhzDdr195V;
   UINT8 Reserved2;
   UINT8 InitTimeoutAfterPartitioning;
-  UINT8 Reserved1[262];
+  UINT8 Reserved1[7];
+  UINT8 CacheSize[4];
+  UINT8 Reserved0[247];
+  UINT8 MaxPackedWrites;
+  UINT8 MaxPackedReads;
+  UINT8 Reserved29[2];
   UINT8 SupportedCmdSets;
   UINT8 Reserved[7];
 } MMC_EXT_CSD;
@@ -416,7 +427,14 @@ typedef union {
   } Fields;
 } MMC_EXT_CSD_PARTITION_CONFIG;
 
+// EXT_CSD_REV of eMMC 4.5 devices, the first to support packed commands
+#define MMC_EXT_CSD_REV_4_5             6
+
+// EXT_CSD[CACHE_CTRL] CACHE_EN bit
+#define MMC_EXT_CSD_CACHE_CTRL_CACHE_EN   BIT0
+
 typedef enum {
+  MmcExtCsdBitIndexFlushCache = 32,
   MmcExtCsdBitIndexPartitionConfig = 179,
   MmcExtCsdBitIndexBusWidth = 183,
   MmcExtCsdBitIndexHsTiming = 185
@@ -447,6 +465,29 @@ typedef union {
 // Bits [7:4] code the current consumption for the 8 bit bus configuration
 #define MMC_EXT_CSD_POWER_CLASS_8BIT(X)         ((X) >> 4)
 
+// JEDEC Standard No. 84-B45, 6.6.29 Packed Commands
+// A packed write is a CMD23 with the PACKED bit set followed by a CMD25, where
+// the first block transferred is the packed command header block describing
+// each individual write, followed by the data of all individual writes.
+
+#define MMC_PACKED_CMD_VERSION          0x01
+#define MMC_PACKED_CMD_WRITE            0x02
+#define MMC_SET_BLOCK_COUNT_PACKED      BIT30
+#define MMC_SET_BLOCK_COUNT_RELIABLE    BIT31
+
+typedef struct {
+  UINT32 SetBlockCountArg;  // The individual write CMD23 argument
+  UINT32 WriteArg;          // The individual write CMD25 argument
+} MMC_PACKED_CMD_ENTRY;
+
+typedef struct {
+  UINT8 Version;
+  UINT8 ReadWrite;
+  UINT8 EntryCount;
+  UINT8 Reserved[5];
+  MMC_PACKED_CMD_ENTRY Entries[63];
+} MMC_PACKED_CMD_HEADER;
+
 typedef struct {
   UINT32 RESERVED_1;
   UINT32 CMD_SUPPORT : 2;
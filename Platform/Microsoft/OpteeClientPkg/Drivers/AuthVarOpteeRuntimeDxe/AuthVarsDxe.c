@@ -94,6 +94,7 @@ typedef CHAR16 WCHAR;
 typedef CHAR8 CHAR;
 
 #include "UEFIVarServices.h"
+#include "VariableCache.h"
 
 /*
 NTSTATUS codes from the Auth. Var. TA tha we need to specially handle.
@@ -116,6 +117,7 @@ typedef union _VARIABLE_PARAM {
   VARIABLE_GET_NEXT_PARAM  GetNextParam;
   VARIABLE_SET_PARAM       SetParam;
   VARIABLE_QUERY_PARAM     QueryParam;
+  VARIABLE_GET_BATCH_PARAM GetBatchParam;
 
 } VARIABLE_PARAM, *PVARIABLE_PARAM;
 
@@ -130,9 +132,13 @@ typedef union _VARIABLE_RESULT {
   VARIABLE_GET_NEXT_RESULT  GetNextResult;
   //  No VARIABLE_SET_RESULT since no data is returned
   VARIABLE_QUERY_RESULT     QueryResult;
+  VARIABLE_GET_BATCH_RESULT GetBatchResult;
 
 } VARIABLE_RESULT, *PVARIABLE_RESULT;
 
+#define VARIABLE_BATCH_NEXT_ENTRY(Entry) \
+  ((CONST VARIABLE_BATCH_ENTRY *)((CONST UINT8 *)(Entry) + (Entry)->Size))
+
 static EFI_HANDLE mImageHandle = NULL;
 
 GLOBAL_REMOVE_IF_UNREFERENCED CONST CHAR8 *mOperationStr[] = {
@@ -143,6 +149,7 @@ GLOBAL_REMOVE_IF_UNREFERENCED CONST CHAR8 *mOperationStr[] = {
   "VSSetOp",
   "VSQueryInfoOp",
   "VSSignalExitBootServicesOp",
+  "VSGetVariableBatchOp",
 };
 
 VOID
@@ -170,6 +177,16 @@ These must be allocated using the OpTEE client API set.
 TEEC_SharedMemory  mVariableParamMem;
 TEEC_SharedMemory  mVariableResultMem;
 
+/*
+Batched variable operation state. mNameBatch holds the last batch of names
+fetched for GetNextVariableName, it is invalidated by any variable change.
+*/
+
+BOOLEAN                     mVariableBatchSupported = TRUE;
+PVARIABLE_GET_BATCH_RESULT  mNameBatch = NULL;
+BOOLEAN                     mNameBatchValid = FALSE;
+BOOLEAN                     mNameBatchFromFirst = FALSE;
+
 GLOBAL_REMOVE_IF_UNREFERENCED CONST CHAR8 *mSetupModeNames[] = {
   "UserMode",
   "SetupMode"
@@ -267,6 +284,11 @@ OpteeRuntimeVariableInvokeCommand(
       Status = EFI_SECURITY_VIOLATION;
       break;
 
+    case TEEC_ERROR_NOT_SUPPORTED:
+      LOG_TRACE("TEEC not supported");
+      Status = EFI_UNSUPPORTED;
+      break;
+
     default:
       LOG_ERROR(
         "TEEC_InvokeCommand() failed. (TeecResult=0x%X, ErrorOrigin=%d)",
@@ -362,6 +384,18 @@ OpteeRuntimeGetVariable(
     return EFI_OUT_OF_RESOURCES;
   }
 
+  //
+  // Non-volatile variables are served from the normal world cache when
+  // possible, saving a world switch into the TA.
+  //
+  Status = VariableCacheLookup(VariableName, VendorGuid, Attributes, DataSize, Data);
+  if (Status != EFI_NOT_FOUND) {
+    LOG_TRACE("Get Variable: '%S' served from cache (Status=%r)", VariableName, Status);
+    goto Exit;
+  }
+
+  Status = EFI_SUCCESS;
+
   //
   // Security: make sure external pointer values are copied locally to prevent
   // concurrent modification after validation.
@@ -490,6 +524,12 @@ OpteeRuntimeGetVariable(
 
     CopyMem(Data, VariableResult->GetResult.Data, VariableResult->GetResult.DataSize);
 
+    VariableCacheUpdate(
+      VariableName,
+      VendorGuid,
+      VariableResult->GetResult.Attributes,
+      VariableResult->GetResult.DataSize,
+      VariableResult->GetResult.Data);
   }
 
 Exit:
@@ -499,6 +539,296 @@ Exit:
 }
 
 
+/**
+Invokes the batched Get/GetNextVariable operation on the Auth. Var. TA and
+copies the validated result out of the transport buffer.
+Caution: The result is external input and is validated before use, such that
+the entries can be walked with VARIABLE_BATCH_NEXT_ENTRY without further checks.
+@param[in]      Flags              VARIABLE_BATCH_FLAG_* flags.
+@param[in]      VariableName       Name of the variable the batch follows, an
+                                   empty name starts from the first variable.
+@param[in]      VendorGuid         Vendor GUID of the variable the batch follows.
+@param[out]     Batch              Buffer of mVariableResultMem.size bytes receiving
+                                   the result.
+@retval EFI_SUCCESS                Batch holds the result.
+@retval EFI_UNSUPPORTED            The TA doesn't implement the batched operation.
+@retval EFI_NOT_FOUND              VariableName was not found.
+@retval EFI_PROTOCOL_ERROR         The TA returned a malformed result.
+**/
+EFI_STATUS
+OpteeRuntimeGetVariableBatch(
+  IN  UINT32                      Flags,
+  IN  CONST CHAR16                *VariableName,
+  IN  CONST EFI_GUID              *VendorGuid,
+  OUT PVARIABLE_GET_BATCH_RESULT  Batch
+)
+{
+  EFI_STATUS Status = EFI_SUCCESS;
+  PVARIABLE_PARAM VariableParam = (PVARIABLE_PARAM)mVariableParamMem.buffer;
+  PVARIABLE_RESULT VariableResult = (PVARIABLE_RESULT)mVariableResultMem.buffer;
+  CONST VARIABLE_BATCH_ENTRY *Entry;
+  CONST CHAR16 *EntryName;
+  UINT32 VariableNameSize;
+  UINT32 VariableParamSize;
+  UINT32 BatchSize;
+  UINT32 Offset;
+  UINT32 EntryIdx;
+  UINT32 ResultSize = 0;
+  UINT32 AuthvarStatus = 0;
+
+  if (!mVariableBatchSupported) {
+    Status = EFI_UNSUPPORTED;
+    goto Exit;
+  }
+
+  if ((mVariableParamMem.buffer == NULL) ||
+    (mVariableResultMem.buffer == NULL)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  if (*VariableName == L'\0') {
+    VariableNameSize = 0;
+  } else {
+    VariableNameSize = StrSize(VariableName);
+  }
+
+  if ((VariableNameSize >= mVariableParamMem.size) ||
+    (VariableNameSize > MAX_UINT16)) {
+
+    Status = EFI_BAD_BUFFER_SIZE;
+    goto Exit;
+  }
+
+  VariableParamSize = sizeof(VARIABLE_GET_BATCH_PARAM) + VariableNameSize;
+  if (VariableParamSize > mVariableParamMem.size) {
+    Status = EFI_BAD_BUFFER_SIZE;
+    goto Exit;
+  }
+
+  ZeroMem(mVariableParamMem.buffer, mVariableParamMem.size);
+  ZeroMem(mVariableResultMem.buffer, mVariableResultMem.size);
+
+  VariableParam->GetBatchParam.Size = sizeof(VARIABLE_GET_BATCH_PARAM);
+  VariableParam->GetBatchParam.Flags = Flags;
+  VariableParam->GetBatchParam.VariableNameSize = (UINT16)VariableNameSize;
+
+  CopyMem(&VariableParam->GetBatchParam.VendorGuid, VendorGuid, sizeof(VariableParam->GetBatchParam.VendorGuid));
+  CopyMem(&VariableParam->GetBatchParam.VariableName, VariableName, VariableNameSize);
+  LOG_TRACE("Get Variable Batch: '%S' (Flags=0x%x)", VariableName, Flags);
+  Status = OpteeRuntimeVariableInvokeCommand(
+    VSGetVariableBatchOp,
+    VariableParamSize,
+    &mVariableParamMem,
+    mVariableResultMem.size,
+    &mVariableResultMem,
+    &ResultSize,
+    &AuthvarStatus);
+
+  if ((Status == EFI_UNSUPPORTED) || (Status == EFI_PROTOCOL_ERROR)) {
+    LOG_INFO(
+      "Batched variable operation not supported by the TA, using single variable operations (Status=%r)",
+      Status);
+
+    mVariableBatchSupported = FALSE;
+    Status = EFI_UNSUPPORTED;
+    goto Exit;
+  }
+
+  if (EFI_ERROR(Status)) {
+    LOG_TRACE("Get Variable Batch failed: 0x%x (OP-TEE Status:0x%x)", Status, AuthvarStatus);
+    goto Exit;
+  }
+
+  //
+  // Security: the result is copied out of the transport buffer before it is
+  // validated, and only the copy is used afterwards.
+  //
+  BatchSize = VariableResult->GetBatchResult.Size;
+  if ((BatchSize < OFFSET_OF(VARIABLE_GET_BATCH_RESULT, Entries)) ||
+    (BatchSize > mVariableResultMem.size)) {
+
+    LOG_ERROR("Invalid batch result size 0x%x", BatchSize);
+    Status = EFI_PROTOCOL_ERROR;
+    goto Exit;
+  }
+
+  CopyMem(Batch, VariableResult, BatchSize);
+
+  Offset = OFFSET_OF(VARIABLE_GET_BATCH_RESULT, Entries);
+  for (EntryIdx = 0; EntryIdx < Batch->EntryCount; ++EntryIdx) {
+    Entry = (CONST VARIABLE_BATCH_ENTRY *)((CONST UINT8 *)Batch + Offset);
+
+    if (((BatchSize - Offset) < OFFSET_OF(VARIABLE_BATCH_ENTRY, Payload)) ||
+      (Entry->Size > (BatchSize - Offset)) ||
+      ((Entry->Size % VARIABLE_BATCH_ENTRY_ALIGNMENT) != 0) ||
+      (Entry->VariableNameSize > Entry->Size) ||
+      (Entry->DataSize > Entry->Size) ||
+      ((OFFSET_OF(VARIABLE_BATCH_ENTRY, Payload) + Entry->VariableNameSize + Entry->DataSize) > Entry->Size) ||
+      (Entry->VariableNameSize < sizeof(CHAR16)) ||
+      ((Entry->VariableNameSize % sizeof(CHAR16)) != 0) ||
+      (((Flags & VARIABLE_BATCH_FLAG_NAMES_ONLY) != 0) && (Entry->DataSize != 0))) {
+
+      LOG_ERROR("Invalid batch entry %d at offset 0x%x", EntryIdx, Offset);
+      Status = EFI_PROTOCOL_ERROR;
+      goto Exit;
+    }
+
+    EntryName = (CONST CHAR16 *)Entry->Payload;
+    if (EntryName[(Entry->VariableNameSize / sizeof(CHAR16)) - 1] != L'\0') {
+      LOG_ERROR("Batch entry %d name is not terminated", EntryIdx);
+      Status = EFI_PROTOCOL_ERROR;
+      goto Exit;
+    }
+
+    Offset += Entry->Size;
+  }
+
+  LOG_TRACE("Get Variable Batch Success, %d entries", Batch->EntryCount);
+
+Exit:
+  return Status;
+}
+
+/**
+Looks up the variable following VariableName\VendorGuid in the current batch
+of names.
+@param[in]      VariableName       Name of the current variable, an empty name
+                                   for the first variable.
+@param[in]      VendorGuid         Vendor GUID of the current variable.
+@param[out]     NextEntry          The batch entry of the following variable.
+@retval EFI_SUCCESS                NextEntry is the following variable.
+@retval EFI_NOT_FOUND              No variables follow VariableName.
+@retval EFI_NOT_READY              The batch doesn't cover VariableName, it has
+                                   to be refilled from the TA.
+**/
+EFI_STATUS
+OpteeRuntimeNameBatchFindNext(
+  IN  CONST CHAR16                *VariableName,
+  IN  CONST EFI_GUID              *VendorGuid,
+  OUT CONST VARIABLE_BATCH_ENTRY  **NextEntry
+)
+{
+  CONST VARIABLE_BATCH_ENTRY *Entry;
+  UINT32 EntryIdx;
+  BOOLEAN AtEnd;
+
+  if (!mNameBatchValid) {
+    return EFI_NOT_READY;
+  }
+
+  AtEnd = ((mNameBatch->Flags & VARIABLE_BATCH_RESULT_FLAG_END) != 0);
+  Entry = mNameBatch->Entries;
+
+  if (*VariableName == L'\0') {
+    if (!mNameBatchFromFirst) {
+      return EFI_NOT_READY;
+    }
+
+    if (mNameBatch->EntryCount != 0) {
+      *NextEntry = Entry;
+      return EFI_SUCCESS;
+    }
+
+    return AtEnd ? EFI_NOT_FOUND : EFI_NOT_READY;
+  }
+
+  for (EntryIdx = 0; EntryIdx < mNameBatch->EntryCount; ++EntryIdx) {
+    if (CompareGuid(&Entry->VendorGuid, VendorGuid) &&
+      (StrCmp((CONST CHAR16 *)Entry->Payload, VariableName) == 0)) {
+
+      if ((EntryIdx + 1) < mNameBatch->EntryCount) {
+        *NextEntry = VARIABLE_BATCH_NEXT_ENTRY(Entry);
+        return EFI_SUCCESS;
+      }
+
+      return AtEnd ? EFI_NOT_FOUND : EFI_NOT_READY;
+    }
+
+    Entry = VARIABLE_BATCH_NEXT_ENTRY(Entry);
+  }
+
+  return EFI_NOT_READY;
+}
+
+/**
+GetNextVariableName served from batches of names fetched from the TA, such that
+a full enumeration only takes a handful of world switches.
+@param[in, out] VariableNameSize   Size of the variable name.
+@param[in, out] VariableName       Pointer to variable name.
+@param[in, out] VendorGuid         Variable Vendor Guid.
+@retval EFI_SUCCESS                Find the specified variable.
+@retval EFI_NOT_FOUND              Not found.
+@retval EFI_BUFFER_TO_SMALL        VariableNameSize is too small for the result.
+@retval EFI_UNSUPPORTED            Batches are not available, the caller has to
+                                   use the single variable operation.
+**/
+EFI_STATUS
+OpteeRuntimeGetNextVariableNameBatched(
+  IN OUT  UINTN                             *VariableNameSize,
+  IN OUT  CHAR16                            *VariableName,
+  IN OUT  EFI_GUID                          *VendorGuid
+)
+{
+  EFI_STATUS Status;
+  CONST VARIABLE_BATCH_ENTRY *Entry = NULL;
+
+  if (!mVariableBatchSupported) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (mNameBatch == NULL) {
+    mNameBatch = AllocatePool(mVariableResultMem.size);
+    if (mNameBatch == NULL) {
+      return EFI_UNSUPPORTED;
+    }
+  }
+
+  Status = OpteeRuntimeNameBatchFindNext(VariableName, VendorGuid, &Entry);
+  if (Status == EFI_NOT_READY) {
+    mNameBatchValid = FALSE;
+    Status = OpteeRuntimeGetVariableBatch(
+      VARIABLE_BATCH_FLAG_NAMES_ONLY,
+      VariableName,
+      VendorGuid,
+      mNameBatch);
+
+    if (EFI_ERROR(Status)) {
+      goto Exit;
+    }
+
+    mNameBatchValid = TRUE;
+    mNameBatchFromFirst = (*VariableName == L'\0');
+
+    //
+    // The batch starts right after VariableName.
+    //
+    if (mNameBatch->EntryCount == 0) {
+      Status = EFI_NOT_FOUND;
+      goto Exit;
+    }
+
+    Entry = mNameBatch->Entries;
+  }
+
+  if (EFI_ERROR(Status)) {
+    goto Exit;
+  }
+
+  if (*VariableNameSize < Entry->VariableNameSize) {
+    *VariableNameSize = Entry->VariableNameSize;
+    Status = EFI_BUFFER_TOO_SMALL;
+    goto Exit;
+  }
+
+  *VariableNameSize = Entry->VariableNameSize;
+  CopyMem(VendorGuid, &Entry->VendorGuid, sizeof(Entry->VendorGuid));
+  CopyMem(VariableName, Entry->Payload, Entry->VariableNameSize);
+
+Exit:
+  return Status;
+}
+
 /**
 This code Finds the Next available variable.
 @param[in, out] VariableNameSize   Size of the variable name.
@@ -544,6 +874,13 @@ OpteeRuntimeGetNextVariableName(
     goto Exit;
   }
 
+  Status = OpteeRuntimeGetNextVariableNameBatched(VariableNameSize, VariableName, VendorGuid);
+  if (Status != EFI_UNSUPPORTED) {
+    goto Exit;
+  }
+
+  Status = EFI_SUCCESS;
+
   //
   // Security: make sure external pointer values are copied locally to prevent
   // concurrent modification after validation.
@@ -747,6 +1084,13 @@ OpteeRuntimeSetVariable(
     UINTN *SessionId = (UINTN *)Data;
     mTeecSession.session_id = *SessionId;
     LOG_INFO("Test Hook for Injecting Session ID");
+
+    //
+    // The TA state is reconstructed from storage, make sure the following
+    // reads exercise that rather than the cache.
+    //
+    VariableCacheFlush();
+    mNameBatchValid = FALSE;
     return EFI_SUCCESS;
   }
 
@@ -825,11 +1169,32 @@ OpteeRuntimeSetVariable(
     } else {
       LOG_TRACE("Set Variable Success");
     }
-    
+
+    //
+    // Keep the cache in sync with the TA. Authenticated and append writes are
+    // stored by the TA in a form that differs from the payload, so those entries
+    // are dropped and refreshed from the TA on the next read. The cached data is
+    // taken from the shared buffer that the TA consumed rather than the caller's.
+    //
+    if (((Attributes & (EFI_VARIABLE_AUTHENTICATED_WRITE_ACCESS |
+                        EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS |
+                        EFI_VARIABLE_APPEND_WRITE)) != 0) ||
+        ((Attributes & (EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)) == 0) ||
+        (DataSize == 0)) {
+      VariableCacheDelete(VariableName, VendorGuid);
+    } else {
+      VariableCacheUpdate(
+        VariableName,
+        VendorGuid,
+        Attributes,
+        DataSize,
+        &VariableParam->SetParam.Payload[VariableNameSize]);
+    }
   }
 
 Exit:
   if (!EFI_ERROR(Status)) {
+    mNameBatchValid = FALSE;
     SecureBootHook(VariableName, VendorGuid);
   }
 
@@ -1021,6 +1386,148 @@ Exit:
   return Status;
 }
 
+/**
+Populates the variable cache with the non-volatile variables currently held
+by the TA, such that the reads during the rest of the boot are served without
+entering the secure world. The store is read with the batched operation when
+the TA supports it, one variable per world switch otherwise.
+**/
+EFI_STATUS
+OpteeRuntimeVariableCachePopulate(
+  VOID
+)
+{
+  EFI_STATUS Status = EFI_SUCCESS;
+  PVARIABLE_GET_BATCH_RESULT Batch = NULL;
+  CONST VARIABLE_BATCH_ENTRY *Entry;
+  CONST CHAR16 *AnchorName;
+  CONST EFI_GUID *AnchorGuid;
+  EFI_GUID ZeroGuid;
+  UINT32 EntryIdx;
+  CHAR16 *VariableName = NULL;
+  UINTN VariableNameSize;
+  EFI_GUID VendorGuid;
+  VOID *Data = NULL;
+  UINTN DataSize;
+  UINT32 Attributes;
+  UINT32 CachedCount = 0;
+  UINT32 BatchCount = 0;
+
+  VariableCacheInitialize();
+
+  Batch = AllocatePool(mVariableResultMem.size);
+  if (Batch == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  ZeroMem(&ZeroGuid, sizeof(ZeroGuid));
+  AnchorName = L"";
+  AnchorGuid = &ZeroGuid;
+
+  for (;;) {
+    //
+    // The anchor points into Batch, it is consumed before Batch is overwritten.
+    //
+    Status = OpteeRuntimeGetVariableBatch(0, AnchorName, AnchorGuid, Batch);
+    if (EFI_ERROR(Status)) {
+      break;
+    }
+
+    ++BatchCount;
+
+    Entry = Batch->Entries;
+    for (EntryIdx = 0; EntryIdx < Batch->EntryCount; ++EntryIdx) {
+      VariableCacheUpdate(
+        (CONST CHAR16 *)Entry->Payload,
+        &Entry->VendorGuid,
+        Entry->Attributes,
+        Entry->DataSize,
+        &Entry->Payload[Entry->VariableNameSize]);
+
+      if ((Entry->Attributes & EFI_VARIABLE_NON_VOLATILE) != 0) {
+        ++CachedCount;
+      }
+
+      AnchorName = (CONST CHAR16 *)Entry->Payload;
+      AnchorGuid = &Entry->VendorGuid;
+      Entry = VARIABLE_BATCH_NEXT_ENTRY(Entry);
+    }
+
+    if (((Batch->Flags & VARIABLE_BATCH_RESULT_FLAG_END) != 0) ||
+        (Batch->EntryCount == 0)) {
+      break;
+    }
+  }
+
+  if (Status != EFI_UNSUPPORTED) {
+    if (!EFI_ERROR(Status)) {
+      LOG_INFO("Cached %d non-volatile variables in %d batches", CachedCount, BatchCount);
+    }
+
+    goto Exit;
+  }
+
+  VariableName = AllocateZeroPool(mVariableResultMem.size);
+  Data = AllocatePool(mVariableResultMem.size);
+  if ((VariableName == NULL) || (Data == NULL)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Exit;
+  }
+
+  ZeroMem(&VendorGuid, sizeof(VendorGuid));
+
+  for (;;) {
+    VariableNameSize = mVariableResultMem.size - sizeof(VARIABLE_GET_NEXT_RESULT);
+    Status = OpteeRuntimeGetNextVariableName(&VariableNameSize, VariableName, &VendorGuid);
+    if (Status == EFI_NOT_FOUND) {
+      Status = EFI_SUCCESS;
+      break;
+    }
+
+    if (EFI_ERROR(Status)) {
+      LOG_ERROR("OpteeRuntimeGetNextVariableName() failed. (Status=%r)", Status);
+      goto Exit;
+    }
+
+    //
+    // A miss in the cache, the variable is read from the TA and cached if
+    // it is non-volatile.
+    //
+    DataSize = mVariableResultMem.size - sizeof(VARIABLE_GET_RESULT);
+    Status = OpteeRuntimeGetVariable(VariableName, &VendorGuid, &Attributes, &DataSize, Data);
+    if (EFI_ERROR(Status)) {
+      LOG_ERROR(
+        "OpteeRuntimeGetVariable(%g\\%s) failed. (Status=%r)",
+        &VendorGuid,
+        VariableName,
+        Status);
+      continue;
+    }
+
+    if ((Attributes & EFI_VARIABLE_NON_VOLATILE) != 0) {
+      ++CachedCount;
+    }
+  }
+
+  LOG_INFO("Cached %d non-volatile variables", CachedCount);
+
+Exit:
+  if (Batch != NULL) {
+    FreePool(Batch);
+  }
+
+  if (VariableName != NULL) {
+    FreePool(VariableName);
+  }
+
+  if (Data != NULL) {
+    FreePool(Data);
+  }
+
+  return Status;
+}
+
 /**
 Initializes the SecureBoot and SetupMode variables.
 This needs to be done before the variable services protocol is
@@ -1515,6 +2022,15 @@ VariableAuthOpteeRuntimeInitialize(
     goto Exit;
   }
 
+  //
+  // Failing to populate the cache only costs performance, reads that miss
+  // the cache are served by the TA.
+  //
+  Status = OpteeRuntimeVariableCachePopulate();
+  if (EFI_ERROR(Status)) {
+    LOG_ERROR("OpteeRuntimeVariableCachePopulate() failed. (Status=%r)", Status);
+  }
+
   Status = InitSecureBootVariables();
   if (EFI_ERROR(Status)) {
     LOG_ERROR("InitSecureBootVariables() failed. (Status=%r)", Status);
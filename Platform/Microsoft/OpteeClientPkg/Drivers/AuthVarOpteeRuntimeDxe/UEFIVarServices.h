@@ -20,6 +20,7 @@ typedef enum _VARIABLE_SERVICE_OPS
     VSSetOp,
     VSQueryInfoOp,
     VSSignalExitBootServicesOp,
+    VSGetVariableBatchOp,
 } VARIABLE_SERVICE_OPS;
 
 //
@@ -68,6 +69,58 @@ typedef struct _VARIABLE_GET_RESULT
     _Field_size_bytes_(DataSize) BYTE Data[1];
 } VARIABLE_GET_RESULT, *PVARIABLE_GET_RESULT;
 
+//
+// Parameter struct for the batched Get/GetNextVariable operation. Returns the
+// variables following VariableName (or starting from the first variable when
+// VariableNameSize is 0) in enumeration order, as many as fit in the result
+// buffer. With VARIABLE_BATCH_FLAG_NAMES_ONLY only names are returned.
+//
+
+#define VARIABLE_BATCH_FLAG_NAMES_ONLY      0x00000001
+
+typedef struct _VARIABLE_GET_BATCH_PARAM
+{
+    UINT32 Size;
+    UINT32 Flags;
+    UINT16 VariableNameSize;
+    GUID VendorGuid;
+    _Field_size_bytes_(VariableNameSize) WCHAR VariableName[1];
+} VARIABLE_GET_BATCH_PARAM, *PVARIABLE_GET_BATCH_PARAM;
+
+//
+// One variable of a batch result. Size is the offset to the next entry, it
+// covers the header, the name, the data and padding to 8 bytes.
+//
+
+#define VARIABLE_BATCH_ENTRY_ALIGNMENT      8
+
+typedef struct _VARIABLE_BATCH_ENTRY
+{
+    UINT32 Size;
+    GUID VendorGuid;
+    UINT32 Attributes;
+    UINT32 VariableNameSize;
+    UINT32 DataSize;
+    _Field_size_bytes_(VariableNameSize + DataSize) BYTE Payload[1];
+} VARIABLE_BATCH_ENTRY, *PVARIABLE_BATCH_ENTRY;
+
+//
+// Result struct for the batched operation. Size is the number of valid bytes
+// in the result buffer. VARIABLE_BATCH_RESULT_FLAG_END is set when no variables
+// follow the last entry.
+//
+
+#define VARIABLE_BATCH_RESULT_FLAG_END      0x00000001
+
+typedef struct _VARIABLE_GET_BATCH_RESULT
+{
+    UINT32 Size;
+    UINT32 Flags;
+    UINT32 EntryCount;
+    UINT32 Reserved;
+    _Field_size_bytes_(Size) VARIABLE_BATCH_ENTRY Entries[1];
+} VARIABLE_GET_BATCH_RESULT, *PVARIABLE_GET_BATCH_RESULT;
+
 //
 // Parameter struct for Query
 //
@@ -0,0 +1,275 @@
+/** @file
+Normal world read cache of the non-volatile variables held by the OpTEE
+Auth. Var. TA.
+Every GetVariable served by the TA costs a world switch and possibly an RPMB
+round-trip, while BDS reads the same boot and Secure Boot variables many times
+per boot. The cache is populated from the TA once and kept in sync with every
+successful SetVariable. Each entry carries a CRC32 over its contents which is
+verified on every hit, a corrupted entry is dropped and the variable is read
+from the TA again. The TA remains the only authority, the cache is only used
+before ExitBootServices.
+Copyright (c), Microsoft Corporation. All rights reserved.
+This program and the accompanying materials are licensed and made available under the
+terms and conditions of the BSD License which accompanies this distribution.
+The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+**/
+
+#include <PiDxe.h>
+
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/BaseLib.h>
+
+#include "VariableCache.h"
+
+#define VARIABLE_CACHE_ENTRY_SIGNATURE  SIGNATURE_32('V', 'C', 'E', 'N')
+
+//
+// Must be a power of 2.
+//
+#define VARIABLE_CACHE_BUCKET_COUNT     64
+
+typedef struct _VARIABLE_CACHE_ENTRY {
+  UINT32      Signature;
+  LIST_ENTRY  Link;
+  UINT32      Crc32;
+
+  //
+  // Everything from here to the end of the data is covered by Crc32.
+  //
+  EFI_GUID    VendorGuid;
+  UINT32      Attributes;
+  UINT32      VariableNameSize;
+  UINT32      DataSize;
+
+  //
+  // Followed by VariableNameSize bytes of name and DataSize bytes of data.
+  //
+} VARIABLE_CACHE_ENTRY;
+
+#define VARIABLE_CACHE_ENTRY_FROM_LINK(a) \
+  CR(a, VARIABLE_CACHE_ENTRY, Link, VARIABLE_CACHE_ENTRY_SIGNATURE)
+
+#define VARIABLE_CACHE_ENTRY_NAME(Entry) \
+  ((CHAR16 *)((Entry) + 1))
+
+#define VARIABLE_CACHE_ENTRY_DATA(Entry) \
+  ((UINT8 *)((Entry) + 1) + (Entry)->VariableNameSize)
+
+STATIC LIST_ENTRY  mVariableCacheBuckets[VARIABLE_CACHE_BUCKET_COUNT];
+STATIC BOOLEAN     mVariableCacheInitialized = FALSE;
+
+/**
+Hashes the variable name and vendor GUID into a bucket index (FNV-1a).
+**/
+STATIC
+UINTN
+VariableCacheBucket(
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid
+)
+{
+  UINT32 Hash = 0x811C9DC5;
+
+  for (; *VariableName != L'\0'; ++VariableName) {
+    Hash = (Hash ^ *VariableName) * 0x01000193;
+  }
+
+  Hash = (Hash ^ VendorGuid->Data1) * 0x01000193;
+
+  return Hash & (VARIABLE_CACHE_BUCKET_COUNT - 1);
+}
+
+STATIC
+UINT32
+VariableCacheEntryCrc(
+  IN CONST VARIABLE_CACHE_ENTRY  *Entry
+)
+{
+  UINT32 Crc32 = 0;
+
+  gBS->CalculateCrc32(
+    (VOID *)&Entry->VendorGuid,
+    sizeof(*Entry) - OFFSET_OF(VARIABLE_CACHE_ENTRY, VendorGuid) +
+      Entry->VariableNameSize + Entry->DataSize,
+    &Crc32);
+
+  return Crc32;
+}
+
+STATIC
+VOID
+VariableCacheRemoveEntry(
+  IN VARIABLE_CACHE_ENTRY  *Entry
+)
+{
+  RemoveEntryList(&Entry->Link);
+  Entry->Signature = 0;
+  FreePool(Entry);
+}
+
+STATIC
+VARIABLE_CACHE_ENTRY *
+VariableCacheFind(
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid
+)
+{
+  LIST_ENTRY            *Bucket;
+  LIST_ENTRY            *Link;
+  VARIABLE_CACHE_ENTRY  *Entry;
+
+  if (!mVariableCacheInitialized) {
+    return NULL;
+  }
+
+  Bucket = &mVariableCacheBuckets[VariableCacheBucket(VariableName, VendorGuid)];
+
+  for (Link = GetFirstNode(Bucket); !IsNull(Bucket, Link); Link = GetNextNode(Bucket, Link)) {
+    Entry = VARIABLE_CACHE_ENTRY_FROM_LINK(Link);
+    if (CompareGuid(&Entry->VendorGuid, VendorGuid) &&
+        (StrCmp(VARIABLE_CACHE_ENTRY_NAME(Entry), VariableName) == 0)) {
+      return Entry;
+    }
+  }
+
+  return NULL;
+}
+
+VOID
+VariableCacheInitialize(
+  VOID
+)
+{
+  UINTN BucketIdx;
+
+  for (BucketIdx = 0; BucketIdx < VARIABLE_CACHE_BUCKET_COUNT; ++BucketIdx) {
+    InitializeListHead(&mVariableCacheBuckets[BucketIdx]);
+  }
+
+  mVariableCacheInitialized = TRUE;
+}
+
+EFI_STATUS
+VariableCacheLookup(
+  IN      CONST CHAR16    *VariableName,
+  IN      CONST EFI_GUID  *VendorGuid,
+  OUT     UINT32          *Attributes OPTIONAL,
+  IN OUT  UINTN           *DataSize,
+  OUT     VOID            *Data
+)
+{
+  VARIABLE_CACHE_ENTRY *Entry;
+
+  Entry = VariableCacheFind(VariableName, VendorGuid);
+  if (Entry == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (VariableCacheEntryCrc(Entry) != Entry->Crc32) {
+    DEBUG((DEBUG_ERROR, "AUTH-VAR[E]:Cache entry %g\\%s is corrupted, dropping it\n", VendorGuid, VariableName));
+    VariableCacheRemoveEntry(Entry);
+    return EFI_NOT_FOUND;
+  }
+
+  if (Attributes != NULL) {
+    *Attributes = Entry->Attributes;
+  }
+
+  if (*DataSize < Entry->DataSize) {
+    *DataSize = Entry->DataSize;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *DataSize = Entry->DataSize;
+  CopyMem(Data, VARIABLE_CACHE_ENTRY_DATA(Entry), Entry->DataSize);
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+VariableCacheUpdate(
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid,
+  IN UINT32          Attributes,
+  IN UINTN           DataSize,
+  IN CONST VOID      *Data
+)
+{
+  VARIABLE_CACHE_ENTRY *Entry;
+  UINTN VariableNameSize;
+
+  if (!mVariableCacheInitialized) {
+    return EFI_NOT_READY;
+  }
+
+  VariableCacheDelete(VariableName, VendorGuid);
+
+  if ((Attributes & EFI_VARIABLE_NON_VOLATILE) == 0) {
+    return EFI_SUCCESS;
+  }
+
+  VariableNameSize = StrSize(VariableName);
+  if ((VariableNameSize > MAX_UINT32) || (DataSize > MAX_UINT32)) {
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  Entry = AllocatePool(sizeof(*Entry) + VariableNameSize + DataSize);
+  if (Entry == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Entry->Signature = VARIABLE_CACHE_ENTRY_SIGNATURE;
+  CopyGuid(&Entry->VendorGuid, VendorGuid);
+  Entry->Attributes = Attributes;
+  Entry->VariableNameSize = (UINT32)VariableNameSize;
+  Entry->DataSize = (UINT32)DataSize;
+  CopyMem(VARIABLE_CACHE_ENTRY_NAME(Entry), VariableName, VariableNameSize);
+  CopyMem(VARIABLE_CACHE_ENTRY_DATA(Entry), Data, DataSize);
+  Entry->Crc32 = VariableCacheEntryCrc(Entry);
+
+  InsertTailList(
+    &mVariableCacheBuckets[VariableCacheBucket(VariableName, VendorGuid)],
+    &Entry->Link);
+
+  return EFI_SUCCESS;
+}
+
+VOID
+VariableCacheDelete(
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid
+)
+{
+  VARIABLE_CACHE_ENTRY *Entry;
+
+  Entry = VariableCacheFind(VariableName, VendorGuid);
+  if (Entry != NULL) {
+    VariableCacheRemoveEntry(Entry);
+  }
+}
+
+VOID
+VariableCacheFlush(
+  VOID
+)
+{
+  UINTN BucketIdx;
+  LIST_ENTRY *Bucket;
+
+  if (!mVariableCacheInitialized) {
+    return;
+  }
+
+  for (BucketIdx = 0; BucketIdx < VARIABLE_CACHE_BUCKET_COUNT; ++BucketIdx) {
+    Bucket = &mVariableCacheBuckets[BucketIdx];
+    while (!IsListEmpty(Bucket)) {
+      VariableCacheRemoveEntry(VARIABLE_CACHE_ENTRY_FROM_LINK(GetFirstNode(Bucket)));
+    }
+  }
+}
@@ -0,0 +1,86 @@
+/** @file
+Normal world read cache of the non-volatile variables held by the OpTEE
+Auth. Var. TA.
+Copyright (c), Microsoft Corporation. All rights reserved.
+This program and the accompanying materials are licensed and made available under the
+terms and conditions of the BSD License which accompanies this distribution.
+The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+**/
+
+#ifndef _VARIABLE_CACHE_H_
+#define _VARIABLE_CACHE_H_
+
+/**
+Initializes an empty variable cache.
+**/
+VOID
+VariableCacheInitialize(
+  VOID
+);
+
+/**
+Looks up a variable in the cache. An entry that fails its integrity check
+is dropped and reported as not cached.
+@param[in]      VariableName       Name of the variable.
+@param[in]      VendorGuid         Variable vendor GUID.
+@param[out]     Attributes         Attributes of the cached variable.
+@param[in, out] DataSize           Size of Data. If too small, this value
+                                   contains the required size.
+@param[out]     Data               Data pointer.
+@retval EFI_SUCCESS                The variable was returned from the cache.
+@retval EFI_BUFFER_TOO_SMALL       DataSize is too small for the cached data.
+@retval EFI_NOT_FOUND              The variable is not cached, the caller has to
+                                   query the TA.
+**/
+EFI_STATUS
+VariableCacheLookup(
+  IN      CONST CHAR16    *VariableName,
+  IN      CONST EFI_GUID  *VendorGuid,
+  OUT     UINT32          *Attributes OPTIONAL,
+  IN OUT  UINTN           *DataSize,
+  OUT     VOID            *Data
+);
+
+/**
+Inserts or replaces a non-volatile variable in the cache. Variables without
+the non-volatile attribute are not cached and any stale entry is dropped.
+@param[in] VariableName            Name of the variable.
+@param[in] VendorGuid              Variable vendor GUID.
+@param[in] Attributes              Attributes of the variable as stored by the TA.
+@param[in] DataSize                Size of Data.
+@param[in] Data                    The variable data as stored by the TA.
+@retval EFI_SUCCESS                The cache was updated.
+@retval EFI_OUT_OF_RESOURCES       The variable could not be cached.
+**/
+EFI_STATUS
+VariableCacheUpdate(
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid,
+  IN UINT32          Attributes,
+  IN UINTN           DataSize,
+  IN CONST VOID      *Data
+);
+
+/**
+Drops a variable from the cache if it is cached.
+@param[in] VariableName            Name of the variable.
+@param[in] VendorGuid              Variable vendor GUID.
+**/
+VOID
+VariableCacheDelete(
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid
+);
+
+/**
+Drops all the cached variables.
+**/
+VOID
+VariableCacheFlush(
+  VOID
+);
+
+#endif // _VARIABLE_CACHE_H_
@@ -21,6 +21,15 @@
 
 #define MAX_RETRIES                 5
 
+//
+// The device does not acknowledge its address while it is executing a
+// command, so poll for the result instead of always waiting for the 50 ms
+// maximum execution time of the RANDOM opcode.
+//
+#define RANDOM_EXEC_TIME_MIN        (1 * 1000)
+#define RANDOM_EXEC_TIME_MAX        (50 * 1000)
+#define RANDOM_POLL_INTERVAL        500
+
 // Don't bother calculating the CRC for the immutable RANDOM opcode packet
 #define OPCODE_COMMAND_PACKET_CRC   0xcd24
 
@@ -81,6 +90,195 @@ AtSha240aGetInfo (
 }
 
 
+/**
+  Send the wake sequence, which consists of a dummy write to slave address 0x0.
+  The AtSha204a will go back to sleep right in the middle of a transaction if
+  it does not complete in ~1.3 seconds, so the callers wake it up for every
+  batch of RANDOM commands.
+
+  @param[in]  AtSha204a           The device to wake up.
+
+**/
+STATIC
+VOID
+AtSha204aWake (
+  IN ATSHA204A_DEV      *AtSha204a
+  )
+{
+  EFI_STATUS                  Status;
+  I2C_RNG_REQUEST             Request;
+
+  Request.OperationCount            = 1;
+  Request.Operation.Flags           = 0;
+  Request.Operation.LengthInBytes   = 0;
+  Request.Operation.Buffer          = NULL;
+
+  Status = AtSha204a->I2cIo->QueueRequest (AtSha204a->I2cIo, 1, NULL,
+                               (VOID *)&Request, NULL);
+  DEBUG ((DEBUG_INFO, "%a: wake AtSha204a: I2cIo->QueueRequest() - %r\n",
+    __FUNCTION__, Status));
+
+  gBS->Stall (2500); // wait 2.5 ms for wake to complete
+}
+
+/**
+  Issue a single RANDOM command to an awake device and collect its result.
+
+  @param[in]  AtSha204a           The device to query.
+  @param[out] Result              The response packet of the device.
+
+  @retval EFI_SUCCESS             A complete response packet was received.
+  @retval EFI_DEVICE_ERROR        The command could not be sent, or no
+                                  complete response was received in time.
+
+**/
+STATIC
+EFI_STATUS
+AtSha204aRandom (
+  IN  ATSHA204A_DEV             *AtSha204a,
+  OUT ATSHA204A_I2C_RNG_RESULT  *Result
+  )
+{
+  EFI_STATUS                  Status;
+  ATSHA204A_I2C_RNG_COMMAND   Command;
+  I2C_RNG_REQUEST             Request;
+  I2C_RNG_REQUEST             Response;
+  UINTN                       Elapsed;
+
+  Command.Command   = ATSHA204A_COMMAND;
+  Command.Count     = sizeof (Command) - 1;
+  Command.Opcode    = ATSHA204A_OPCODE_RANDOM;
+  Command.Param1    = 0;
+  Command.Param2    = 0;
+  Command.Crc       = OPCODE_COMMAND_PACKET_CRC;
+
+  Request.OperationCount            = 1;
+  Request.Operation.Flags           = 0;
+  Request.Operation.LengthInBytes   = sizeof (Command);
+  Request.Operation.Buffer          = (VOID *)&Command;
+
+  Status = AtSha204a->I2cIo->QueueRequest (AtSha204a->I2cIo, 0, NULL,
+                               (VOID *)&Request, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_INFO, "%a: I2C request transfer failed, Status == %r\n",
+      __FUNCTION__, Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  Response.OperationCount           = 1;
+  Response.Operation.Flags          = I2C_FLAG_READ;
+  Response.Operation.LengthInBytes  = sizeof (*Result);
+  Response.Operation.Buffer         = (VOID *)Result;
+
+  gBS->Stall (RANDOM_EXEC_TIME_MIN);
+  for (Elapsed = RANDOM_EXEC_TIME_MIN; ; Elapsed += RANDOM_POLL_INTERVAL) {
+    Status = AtSha204a->I2cIo->QueueRequest (AtSha204a->I2cIo, 0, NULL,
+                                 (VOID *)&Response, NULL);
+    if (!EFI_ERROR (Status) || Elapsed >= RANDOM_EXEC_TIME_MAX) {
+      break;
+    }
+    gBS->Stall (RANDOM_POLL_INTERVAL);
+  }
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_INFO, "%a: I2C response transfer failed, Status == %r\n",
+      __FUNCTION__, Status));
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (Result->Count < sizeof (*Result)) {
+    //
+    // Incomplete packet received, most likely due to an error.
+    //
+    DEBUG ((DEBUG_INFO, "%a: incomplete packet received\n", __FUNCTION__));
+    return EFI_DEVICE_ERROR;
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Read random bytes straight from the device.
+
+  @param[in]  AtSha204a           The device to read from.
+  @param[in]  ValueLength         The number of bytes to return.
+  @param[out] Value               The buffer receiving the random bytes.
+
+  @retval EFI_SUCCESS             ValueLength random bytes were returned.
+  @retval EFI_DEVICE_ERROR        The device failed repeatedly.
+
+**/
+STATIC
+EFI_STATUS
+AtSha204aReadDevice (
+  IN  ATSHA204A_DEV     *AtSha204a,
+  IN  UINTN             ValueLength,
+  OUT UINT8             *Value
+  )
+{
+  EFI_STATUS                  Status;
+  ATSHA204A_I2C_RNG_RESULT    Result;
+  UINTN                       Retries;
+  UINTN                       Length;
+
+  AtSha204aWake (AtSha204a);
+
+  Retries = 0;
+  while (ValueLength > 0) {
+    Status = AtSha204aRandom (AtSha204a, &Result);
+    if (EFI_ERROR (Status)) {
+      if (++Retries > MAX_RETRIES) {
+        DEBUG ((DEBUG_ERROR, "%a: RANDOM command failed, Status == %r\n",
+          __FUNCTION__, Status));
+        return EFI_DEVICE_ERROR;
+      }
+      AtSha204aWake (AtSha204a);
+      continue;
+    }
+
+    Length = MIN (ValueLength, ATSHA204A_OUTPUT_SIZE);
+    gBS->CopyMem (Value, Result.Result, Length);
+
+    Value += Length;
+    ValueLength -= Length;
+    Retries = 0;
+  }
+  ZeroMem (&Result, sizeof (Result));
+  return EFI_SUCCESS;
+}
+
+/**
+  Timer notification function topping up the entropy pool by one RANDOM
+  result, so that GetRNG() requests can be served without waiting for the
+  device.
+
+  @param[in]  Event               The refill timer event.
+  @param[in]  Context             The ATSHA204A_DEV instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+AtSha204aRefillPool (
+  IN EFI_EVENT          Event,
+  IN VOID               *Context
+  )
+{
+  ATSHA204A_DEV         *AtSha204a;
+  UINTN                 Length;
+
+  AtSha204a = Context;
+
+  Length = MIN (ATSHA204A_POOL_SIZE - AtSha204a->PoolCount,
+             ATSHA204A_OUTPUT_SIZE);
+  if (Length == 0) {
+    return;
+  }
+
+  if (!EFI_ERROR (AtSha204aReadDevice (AtSha204a, Length,
+                    AtSha204a->Pool + AtSha204a->PoolCount))) {
+    AtSha204a->PoolCount += Length;
+  }
+}
+
 /**
   Produces and returns an RNG value using either the default or specified RNG
   algorithm.
@@ -119,96 +317,42 @@ AtSha240aGetRNG (
 {
   EFI_STATUS                  Status;
   ATSHA204A_DEV               *AtSha204a;
-  ATSHA204A_I2C_RNG_COMMAND   Command;
-  ATSHA204A_I2C_RNG_RESULT    Result;
-  I2C_RNG_REQUEST             Request;
-  I2C_RNG_REQUEST             Response;
-  UINTN                       Retries;
+  EFI_TPL                     OldTpl;
+  UINTN                       Length;
 
   if (Algorithm != NULL && !CompareGuid (Algorithm, &gEfiRngAlgorithmRaw)) {
     return EFI_UNSUPPORTED;
   }
 
-  AtSha204a = ATSHA204A_DEV_FROM_THIS (This);
-
-  Request.OperationCount  = 1;
-  Request.Operation.Flags = 0;
-
-  Command.Command   = ATSHA204A_COMMAND;
-  Command.Count     = sizeof (Command) - 1;
-  Command.Opcode    = ATSHA204A_OPCODE_RANDOM;
-  Command.Param1    = 0;
-  Command.Param2    = 0;
-  Command.Crc       = OPCODE_COMMAND_PACKET_CRC;
-
-  Response.OperationCount           = 1;
-  Response.Operation.Flags          = I2C_FLAG_READ;
-  Response.Operation.LengthInBytes  = sizeof (Result);
-  Response.Operation.Buffer         = (VOID *)&Result;
-
-  Retries = 0;
-  while (ValueLength > 0) {
-    //
-    // The AtSha204a will go back to sleep right in the middle of a transaction
-    // if it does not complete in ~1.3 seconds. So send the wake sequence for
-    // each iteration, which consists of a dummy write to slave address 0x0.
-    //
-    Request.Operation.LengthInBytes = 0;
-    Status = AtSha204a->I2cIo->QueueRequest (AtSha204a->I2cIo, 1, NULL,
-                                 (VOID *)&Request, NULL);
-    DEBUG ((DEBUG_INFO, "%a: wake AtSha204a: I2cIo->QueueRequest() - %r\n",
-      __FUNCTION__, Status));
-
-    gBS->Stall (2500); // wait 2.5 ms for wake to complete
-
-    Request.Operation.LengthInBytes = sizeof (Command);
-    Request.Operation.Buffer = (VOID *)&Command;
-    Status = AtSha204a->I2cIo->QueueRequest (AtSha204a->I2cIo, 0, NULL,
-                                 (VOID *)&Request, NULL);
-    if (EFI_ERROR (Status)) {
-      if (++Retries <= MAX_RETRIES) {
-        continue;
-      }
-      DEBUG ((DEBUG_ERROR, "%a: I2C request transfer failed, Status == %r\n",
-        __FUNCTION__, Status));
-      return EFI_DEVICE_ERROR;
-    }
+  if (Value == NULL || ValueLength == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
 
-    gBS->Stall (50 * 1000); // 50 ms max execution time for RANDOM opcode
+  AtSha204a = ATSHA204A_DEV_FROM_THIS (This);
 
-    Status = AtSha204a->I2cIo->QueueRequest (AtSha204a->I2cIo, 0, NULL,
-                                 (VOID *)&Response, NULL);
-    if (EFI_ERROR (Status)) {
-      if (++Retries <= MAX_RETRIES) {
-        continue;
-      }
-      DEBUG ((DEBUG_ERROR, "%a: I2C response transfer failed, Status == %r\n",
-        __FUNCTION__, Status));
-      return EFI_DEVICE_ERROR;
-    }
+  //
+  // Keep the refill timer away from the pool and the device
+  //
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
 
-    if (Result.Count < sizeof (Result)) {
-      //
-      // Incomplete packet received, most likely due to an error. Retry.
-      //
-      if (++Retries <= MAX_RETRIES) {
-        continue;
-      }
-      DEBUG ((DEBUG_WARN, "%a: incomplete packet received\n", __FUNCTION__));
-      return EFI_DEVICE_ERROR;
-    }
+  //
+  // Serve what we can from the pool, consuming it from the top and wiping
+  // the bytes that have been handed out.
+  //
+  Length = MIN (ValueLength, AtSha204a->PoolCount);
+  AtSha204a->PoolCount -= Length;
+  gBS->CopyMem (Value, AtSha204a->Pool + AtSha204a->PoolCount, Length);
+  ZeroMem (AtSha204a->Pool + AtSha204a->PoolCount, Length);
+
+  Status = EFI_SUCCESS;
+  if (ValueLength > Length) {
+    Status = AtSha204aReadDevice (AtSha204a, ValueLength - Length,
+               Value + Length);
+  }
 
-    gBS->CopyMem (Value, Result.Result, MIN (ValueLength,
-                                             ATSHA204A_OUTPUT_SIZE));
-    if (ValueLength < ATSHA204A_OUTPUT_SIZE) {
-      break;
-    }
+  gBS->RestoreTPL (OldTpl);
 
-    Value += ATSHA204A_OUTPUT_SIZE;
-    ValueLength -= ATSHA204A_OUTPUT_SIZE;
-    Retries = 0;
-  }
-  return EFI_SUCCESS;
+  return Status;
 }
 
 EFI_STATUS
@@ -229,6 +373,7 @@ AtSha204aInit (
   AtSha204a->Signature    = ATSHA204A_DEV_SIGNATURE;
   AtSha204a->Rng.GetInfo  = AtSha240aGetInfo;
   AtSha204a->Rng.GetRNG   = AtSha240aGetRNG;
+  AtSha204a->PoolCount    = 0;
 
   //
   // Open I2C I/O Protocol
@@ -243,6 +388,21 @@ AtSha204aInit (
     goto ErrorFreeDev;
   }
 
+  //
+  // Fill the entropy pool in the background
+  //
+  Status = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                  AtSha204aRefillPool, AtSha204a, &AtSha204a->RefillEvent);
+  if (EFI_ERROR (Status)) {
+    goto ErrorCloseProtocol;
+  }
+
+  Status = gBS->SetTimer (AtSha204a->RefillEvent, TimerPeriodic,
+                  ATSHA204A_REFILL_PERIOD);
+  if (EFI_ERROR (Status)) {
+    goto ErrorCloseEvent;
+  }
+
   Status = gBS->InstallProtocolInterface (&ControllerHandle,
                                           &gEfiRngProtocolGuid,
                                           EFI_NATIVE_INTERFACE,
@@ -251,11 +411,14 @@ AtSha204aInit (
     DEBUG ((DEBUG_ERROR,
       "Failed to install RNG protocol interface (Status == %r)\n",
     Status));
-    goto ErrorCloseProtocol;
+    goto ErrorCloseEvent;
   }
 
   return EFI_SUCCESS;
 
+ErrorCloseEvent:
+  gBS->CloseEvent (AtSha204a->RefillEvent);
+
 ErrorCloseProtocol:
   gBS->CloseProtocol (ControllerHandle, &gEfiI2cIoProtocolGuid,
          DriverBindingHandle, ControllerHandle);
@@ -294,6 +457,8 @@ AtSha204aRelease (
     return Status;
   }
 
+  gBS->CloseEvent (AtSha204a->RefillEvent);
+
   Status = gBS->CloseProtocol (ControllerHandle,
                                &gEfiI2cIoProtocolGuid,
                                DriverBindingHandle,
@@ -303,6 +468,7 @@ AtSha204aRelease (
     return Status;
   }
 
+  ZeroMem (AtSha204a->Pool, sizeof (AtSha204a->Pool));
   gBS->FreePool (AtSha204a);
 
   return EFI_SUCCESS;
@@ -29,10 +29,20 @@
 
 #define ATSHA204A_DEV_SIGNATURE   SIGNATURE_32('a','t','s','h')
 
+//
+// Size of the entropy pool, and the period (in 100 ns units) of the timer
+// that tops it up by one RANDOM result at a time.
+//
+#define ATSHA204A_POOL_SIZE       (8 * ATSHA204A_OUTPUT_SIZE)
+#define ATSHA204A_REFILL_PERIOD   (100 * 10000)
+
 typedef struct {
   UINT32                        Signature;
   EFI_I2C_IO_PROTOCOL           *I2cIo;
   EFI_RNG_PROTOCOL              Rng;
+  EFI_EVENT                     RefillEvent;
+  UINTN                         PoolCount;
+  UINT8                         Pool[ATSHA204A_POOL_SIZE];
 } ATSHA204A_DEV;
 
 #define ATSHA204A_DEV_FROM_THIS(a) \
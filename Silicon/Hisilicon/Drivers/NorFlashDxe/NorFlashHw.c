@@ -14,6 +14,7 @@
 **/
 
 #include <PiDxe.h>
+#include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/IoLib.h>
@@ -179,6 +180,25 @@ VOID FlashReset(UINT32 Base)
 }
 
 
+//Reset preceded by the unlock cycles, which also leaves the write-to-buffer
+//abort state a plain reset does not clear
+VOID AbortReset(UINT32 Base)
+{
+    UINT32 dwAddr;
+
+    dwAddr = Base + (gFlashCommandWrite[gIndex.WIndex].BufferProgramAddressStep1 << gFlashInfo[gIndex.InfIndex].ParallelNum);
+    (VOID)PortWriteData(gIndex.InfIndex, dwAddr, gFlashCommandWrite[gIndex.WIndex].BufferProgramDataStep1);
+
+    dwAddr = Base + (gFlashCommandWrite[gIndex.WIndex].BufferProgramAddressStep2 << gFlashInfo[gIndex.InfIndex].ParallelNum);
+    (VOID)PortWriteData(gIndex.InfIndex, dwAddr, gFlashCommandWrite[gIndex.WIndex].BufferProgramDataStep2);
+
+    dwAddr = Base + (gFlashCommandWrite[gIndex.WIndex].BufferProgramAddressStep1 << gFlashInfo[gIndex.InfIndex].ParallelNum);
+    (VOID)PortWriteData(gIndex.InfIndex, dwAddr, gFlashCommandReset[gIndex.ReIndex].ResetData);
+
+    FlashReset(Base);
+}
+
+
 void GetManufacturerID(UINT32 Index, UINT32 Base, UINT8 *pbyData)
 {
 
@@ -279,26 +299,22 @@ EFI_STATUS FlashInit(UINT32 Base)
 }
 
 
-static BOOLEAN width8IsAll(
+static BOOLEAN width64IsErased(
     const UINT64       Base,
     const UINT64       Offset,
-    const UINT64       Length,
-    const UINT8        Value
+    const UINT64       Length
 )
 {
-    UINT64 NewAddr = Base + Offset;
-    UINT64 NewLength = Length;
+    //Blocks are 64-bit aligned, check them a 64-bit word at a time
+    UINTN NewAddr = (UINTN)(Base + Offset);
+    UINT64 NewLength = Length / sizeof(UINT64);
     while (NewLength --)
     {
-        if (*(UINT8 *)(UINTN)NewAddr == Value)
-        {
-            NewAddr ++;
-            continue;
-        }
-        else
+        if (MmioRead64(NewAddr) != MAX_UINT64)
         {
             return FALSE;
         }
+        NewAddr += sizeof(UINT64);
     }
     return TRUE;
 }
@@ -349,9 +365,6 @@ EFI_STATUS BufferWriteCommand(UINTN Base, UINTN Offset, void *pData)
 
        dwAddr = (UINT32)Base + (UINT32)Offset + ((gFlashInfo[gIndex.InfIndex].BufferProgramSize - 1) << gFlashInfo[gIndex.InfIndex].ParallelNum);
        (VOID)PortWriteData(gIndex.InfIndex, dwAddr, gFlashCommandWrite[gIndex.WIndex].BufferProgramtoFlash);
-
-
-
     }
     else
     {
@@ -384,8 +397,7 @@ EFI_STATUS BufferWriteCommand(UINTN Base, UINTN Offset, void *pData)
 
     }
 
-    (void)gBS->Stall(200);
-
+    //Completion is detected by WaitReady
     gFlashBusy = FALSE;
     return EFI_SUCCESS;
 
@@ -422,21 +434,20 @@ EFI_STATUS SectorEraseCommand(UINTN Base, UINTN Offset)
     dwAddr = (UINT32)Base + Offset;
     (VOID)PortWriteData(gIndex.InfIndex, dwAddr, gFlashCommandErase[gIndex.EIndex].SectorEraseDataStep6);
 
-    (void)gBS->Stall(500000);
-
+    //Completion is detected by WaitReady
     gFlashBusy = FALSE;
     return EFI_SUCCESS;
 }
 
 
-EFI_STATUS CompleteCheck(UINT32 Base, UINT32 Offset, void *pData, UINT32 Length)
+EFI_STATUS WaitReady(UINT32 Base, UINT32 Offset, UINT32 TimeoutUs, BOOLEAN BufferProgram)
 {
     UINT32 dwTestAddr;
-    UINT32 dwTestData;
-    UINT32 dwTemp = 0;
-    UINT32 dwTemp1 = 0;
-    UINT32 i;
-    UINT32 dwTimeOut = 3000000;
+    UINT32 dwToggleMask;
+    UINT32 dwFirst;
+    UINT32 dwSecond;
+    UINT32 dwToggle;
+    UINT32 dwSpin = FLASH_POLL_SPIN_COUNT;
 
     if(gFlashBusy)
     {
@@ -445,70 +456,101 @@ EFI_STATUS CompleteCheck(UINT32 Base, UINT32 Offset, void *pData, UINT32 Length)
     }
     gFlashBusy = TRUE;
 
-    if(2 == gFlashInfo[gIndex.InfIndex].ParallelNum)
+    //DQ6 of every chip on the port toggles on each read while the embedded
+    //algorithm runs and stops toggling once it is done
+    dwToggleMask = PortAdjustData(gIndex.InfIndex, FLASH_STATUS_DQ6);
+    dwTestAddr = Base + Offset;
+
+    for (;;)
     {
-        dwTestAddr = Base + Offset + Length - sizeof(UINT32);
-        dwTestData = *((UINT32 *)((UINT8 *)pData + Length - sizeof(UINT32)));
+        dwFirst = PortReadData(gIndex.InfIndex, dwTestAddr);
+        dwSecond = PortReadData(gIndex.InfIndex, dwTestAddr);
+        dwToggle = (dwFirst ^ dwSecond) & dwToggleMask;
+        if (0 == dwToggle)
+        {
+            gFlashBusy = FALSE;
+            return EFI_SUCCESS;
+        }
 
-        while(dwTimeOut--)
+        //DQ5 (time limit exceeded) or, for buffer program, DQ1 (abort) of a
+        //chip that is still toggling means the operation failed
+        if ((dwSecond & (dwToggle >> 1))
+            || (BufferProgram && (dwSecond & (dwToggle >> 5))))
         {
-            dwTemp1 = MmioRead32 (dwTestAddr);
-            if (dwTestData == dwTemp1)
+            dwFirst = PortReadData(gIndex.InfIndex, dwTestAddr);
+            dwSecond = PortReadData(gIndex.InfIndex, dwTestAddr);
+            if ((dwFirst ^ dwSecond) & dwToggleMask)
             {
-                dwTemp = MmioRead32 (dwTestAddr);
-                dwTemp1 = MmioRead32 (dwTestAddr);
-                if ((dwTemp == dwTemp1) && (dwTestData == dwTemp1))
-                {
-                    gFlashBusy = FALSE;
-                    return EFI_SUCCESS;
-                }
+                DEBUG((EFI_D_ERROR, "WaitReady ERROR: address %x, status %x\n", Offset, dwSecond));
+                break;
             }
-
-            (void)gBS->Stall(1);
+            continue;
         }
 
-        if((UINT16)(dwTemp1 >> 16) != (UINT16)(dwTestData >> 16))
+        //Programming a buffer takes a few hundred microseconds, spin for a
+        //while before polling once per microsecond
+        if (dwSpin)
         {
-            DEBUG((EFI_D_ERROR, "CompleteCheck ERROR: chip1 address %x, buffer %x, flash %x!\n", Offset, dwTestData, dwTemp1));
+            dwSpin --;
+            continue;
         }
-        if((UINT16)(dwTemp1) != (UINT16)(dwTestData))
+
+        if (0 == TimeoutUs)
         {
-            DEBUG((EFI_D_ERROR, "CompleteCheck ERROR: chip2 address %x, buffer %x, flash %x!\n", Offset, dwTestData, dwTemp1));
+            DEBUG((EFI_D_ERROR, "WaitReady ERROR: timeout address %x, status %x\n", Offset, dwSecond));
+            break;
         }
+        TimeoutUs --;
+        (void)gBS->Stall(1);
     }
-    else
-    {
-        dwTestAddr = Base + Offset + Length - sizeof(UINT16);
-        dwTestData = *((UINT16 *)((UINT8 *)pData + Length - sizeof(UINT16)));
 
-        while(dwTimeOut--)
-        {
-            dwTemp1 = MmioRead16 (dwTestAddr);
-            if (dwTestData == dwTemp1)
-            {
-                dwTemp = MmioRead16 (dwTestAddr);
-                dwTemp1 = MmioRead16 (dwTestAddr);
-                if ((dwTemp == dwTemp1) && (dwTestData == dwTemp1))
-                {
-                    gFlashBusy = FALSE;
-                    return EFI_SUCCESS;
-                }
-            }
+    AbortReset(Base);
 
-            (void)gBS->Stall(1);
+    gFlashBusy = FALSE;
+    return EFI_DEVICE_ERROR;
+}
+
+static BOOLEAN FlashDataMatches(
+    UINTN          Addr,
+    const UINT8   *pData,
+    UINT32         Length
+)
+{
+    //Compare 64 bits at a time, bytes only up to the first aligned address
+    //and for the tail
+    while (Length && (Addr & (sizeof(UINT64) - 1)))
+    {
+        if (MmioRead8(Addr) != *pData)
+        {
+            return FALSE;
         }
+        Addr ++;
+        pData ++;
+        Length --;
     }
 
-    for(i = 0; i < 5; i ++)
+    while (Length >= sizeof(UINT64))
     {
-        DEBUG((EFI_D_ERROR, "CompleteCheck ERROR: flash %x\n",PortReadData(gIndex.InfIndex, dwTestAddr)));
+        if (MmioRead64(Addr) != ReadUnaligned64((const UINT64 *)pData))
+        {
+            return FALSE;
+        }
+        Addr += sizeof(UINT64);
+        pData += sizeof(UINT64);
+        Length -= sizeof(UINT64);
     }
 
-    FlashReset(Base);
+    while (Length --)
+    {
+        if (MmioRead8(Addr) != *pData)
+        {
+            return FALSE;
+        }
+        Addr ++;
+        pData ++;
+    }
 
-    gFlashBusy = FALSE;
-    DEBUG((EFI_D_ERROR, "CompleteCheck ERROR: timeout address %x, buffer %x, flash %x\n", Offset, dwTestData, dwTemp1));
-    return EFI_TIMEOUT;
+    return TRUE;
 }
 
 EFI_STATUS IsNeedToWrite(
@@ -518,31 +560,18 @@ EFI_STATUS IsNeedToWrite(
     IN  UINT32       Length
   )
 {
-    UINTN NewAddr = Base + Offset;
-    UINT8 FlashData = 0;
-    UINT8 BufferData = 0;
-
-    for(; Length > 0; Length --)
+    if (FlashDataMatches(Base + Offset, Buffer, Length))
     {
-        BufferData = *Buffer;
-        //lint -epn -e511
-        FlashData = *(UINT8 *)NewAddr;
-        if (BufferData != FlashData)
-        {
-            return TRUE;
-        }
-        NewAddr ++;
-        Buffer ++;
+        return FALSE;
     }
 
-    return FALSE;
+    return TRUE;
 }
 
 
 EFI_STATUS BufferWrite(UINT32 Offset, void *pData, UINT32 Length)
 {
     EFI_STATUS Status;
-    UINT32 dwLoop;
     UINT32 Retry = 3;
 
     if (FALSE == IsNeedToWrite(gIndex.Base, Offset, (UINT8 *)pData, Length))
@@ -553,19 +582,16 @@ EFI_STATUS BufferWrite(UINT32 Offset, void *pData, UINT32 Length)
     do
     {
         (void)BufferWriteCommand(gIndex.Base, Offset, pData);
-        Status = CompleteCheck(gIndex.Base, Offset, pData, Length);
+        Status = WaitReady(gIndex.Base, Offset, FLASH_PROGRAM_TIMEOUT_US, TRUE);
 
 
         if (EFI_SUCCESS == Status)
         {
-            for (dwLoop = 0; dwLoop < Length; dwLoop ++)
+            if (!FlashDataMatches(gIndex.Base + Offset, (UINT8 *)pData, Length))
             {
-                if (*(UINT8 *)(UINTN)(gIndex.Base + Offset + dwLoop) != *((UINT8 *)pData + dwLoop))
-                {
-                    DEBUG((EFI_D_ERROR, "Flash_WriteUnit ERROR: address %x, buffer %x, flash %x\n", Offset, *((UINT8 *)pData + dwLoop), *(UINT8 *)(UINTN)(gIndex.Base + Offset + dwLoop)));
-                    Status = EFI_ABORTED;
-                    continue;
-                }
+                DEBUG((EFI_D_ERROR, "Flash_WriteUnit ERROR: address %x, data mismatch\n", Offset));
+                Status = EFI_ABORTED;
+                continue;
             }
         }
         else
@@ -581,26 +607,19 @@ EFI_STATUS BufferWrite(UINT32 Offset, void *pData, UINT32 Length)
 
 EFI_STATUS SectorErase(UINT32 Base, UINT32 Offset)
 {
-    UINT8 gTemp[FLASH_MAX_UNIT];
-    UINT64 dwLoop = FLASH_MAX_UNIT - 1;
     UINT32 Retry = 3;
     EFI_STATUS Status;
 
-    do
-    {
-        gTemp[dwLoop] = 0xFF;
-    }while (dwLoop --);
-
     do
     {
         (void)SectorEraseCommand(Base, Offset);
-        Status = CompleteCheck(Base, Offset, (void *)gTemp, FLASH_MAX_UNIT);
+        Status = WaitReady(Base, Offset, FLASH_ERASE_TIMEOUT_US, FALSE);
 
 
         if (EFI_SUCCESS == Status)
         {
 
-            if (width8IsAll(Base,Offset - (Offset % gFlashInfo[gIndex.InfIndex].BlockSize), gFlashInfo[gIndex.InfIndex].BlockSize, 0xFF))
+            if (width64IsErased(Base,Offset - (Offset % gFlashInfo[gIndex.InfIndex].BlockSize), gFlashInfo[gIndex.InfIndex].BlockSize))
             {
                 return EFI_SUCCESS;
             }
@@ -24,6 +24,14 @@
 
 #define FLASH_DEVICE_NUM  0x10
 
+/*DQ6 toggle bit of both chips on a 32-bit port*/
+#define FLASH_STATUS_DQ6  0x00400040
+
+/*Status polling*/
+#define FLASH_POLL_SPIN_COUNT     64
+#define FLASH_PROGRAM_TIMEOUT_US  3000000
+#define FLASH_ERASE_TIMEOUT_US    4000000
+
 
 
 typedef struct {
@@ -50,21 +50,27 @@ typedef enum {
   (Register) = ((Address)       & 0xfff);  \
 }
 
+//
+// Root port of each segment, together with its cached link state. The link
+// state is refreshed on the first access after a write to the root port,
+// which is where link retraining, disabling or secondary bus reset happens.
+//
+typedef struct {
+  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
+  BOOLEAN                           LinkStateValid;
+  BOOLEAN                           LinkUp;
+} PCI_SEGMENT_ROOT_PORT;
+
+STATIC PCI_SEGMENT_ROOT_PORT mRootPorts[PCIE_MAX_HOSTBRIDGE * PCIE_MAX_ROOTBRIDGE];
+
 STATIC
-PCI_ROOT_BRIDGE_RESOURCE_APPETURE *
-PciSegmentLibGetAppeture (
+PCI_SEGMENT_ROOT_PORT *
+PciSegmentLibGetRootPort (
   IN  UINT32     Segment
   )
 {
-  UINTN Hb;
-  UINTN Rb;
-
-  for (Hb = 0; Hb < PCIE_MAX_HOSTBRIDGE; Hb++) {
-    for (Rb = 0; Rb < PCIE_MAX_ROOTBRIDGE; Rb++) {
-      if (Segment == mResAppeture[Hb][Rb].Segment) {
-        return &mResAppeture[Hb][Rb];
-      }
-    }
+  if (Segment < ARRAY_SIZE (mRootPorts) && mRootPorts[Segment].Appeture != NULL) {
+    return &mRootPorts[Segment];
   }
 
   // Shouldn't reach here
@@ -83,6 +89,83 @@ BOOLEAN PcieIsLinkUp (UINTN RbPciBar)
   return FALSE;
 }
 
+STATIC
+BOOLEAN
+PciSegmentLibIsLinkUp (
+  IN  PCI_SEGMENT_ROOT_PORT   *RootPort
+  )
+{
+  if (!RootPort->LinkStateValid) {
+    RootPort->LinkUp = PcieIsLinkUp (RootPort->Appeture->RbPciBar);
+    RootPort->LinkStateValid = TRUE;
+  }
+  return RootPort->LinkUp;
+}
+
+/**
+  Translate a PCI Segment address into the address of the configuration space
+  of its function.
+
+  @param  Address       The address that encodes the PCI Segment, Bus, Device,
+                        Function and Register.
+  @param  FunctionBase  The MMIO address of register 0 of the function.
+  @param  RootPort      The root port of the segment.
+
+  @retval RETURN_SUCCESS            The configuration space is accessible.
+  @retval RETURN_INVALID_PARAMETER  The segment is unknown.
+  @retval RETURN_NOT_FOUND          Device or function is not 0 on the base bus.
+  @retval RETURN_NOT_READY          The link of the root port is down.
+
+**/
+STATIC
+RETURN_STATUS
+PciSegmentLibGetFunctionBase (
+  IN  UINT64                      Address,
+  OUT UINT64                      *FunctionBase,
+  OUT PCI_SEGMENT_ROOT_PORT       **RootPort
+  )
+{
+  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
+  UINT32    Segment;
+  UINT8     Bus;
+  UINT8     Device;
+  UINT8     Function;
+  UINT32    Register;
+
+  EXTRACT_PCIE_ADDRESS (Address, Segment, Bus, Device, Function, Register);
+  *RootPort = PciSegmentLibGetRootPort (Segment);
+  if (*RootPort == NULL) {
+    return RETURN_INVALID_PARAMETER;
+  }
+  Appeture = (*RootPort)->Appeture;
+
+  if (Bus == Appeture->BusBase) {
+    // ignore device > 0 or function > 0 on base bus
+    if (Device != 0 || Function != 0) {
+      return RETURN_NOT_FOUND;
+    }
+    *FunctionBase = Appeture->RbPciBar;
+    return RETURN_SUCCESS;
+  }
+
+  // Cannot access device under root port when link is not up
+  if (Bus == Appeture->BusBase + 1 && !PciSegmentLibIsLinkUp (*RootPort)) {
+    return RETURN_NOT_READY;
+  }
+
+  *FunctionBase = Appeture->Ecam + ((UINT32)Address & ~0xfff);
+  return RETURN_SUCCESS;
+}
+
+STATIC
+BOOLEAN
+PciSegmentLibIsRootPort (
+  IN  UINT64                      Address,
+  IN  PCI_SEGMENT_ROOT_PORT       *RootPort
+  )
+{
+  return ((Address >> 20) & 0xff) == RootPort->Appeture->BusBase;
+}
 
 STATIC
 UINT32
@@ -162,37 +245,14 @@ PciSegmentLibReadWorker (
   IN  PCI_CFG_WIDTH               Width
   )
 {
-  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
-  UINT32    Segment;
-  UINT8     Bus;
-  UINT8     Device;
-  UINT8     Function;
-  UINT32    Register;
+  PCI_SEGMENT_ROOT_PORT *RootPort;
+  UINT64    FunctionBase;
 
-  UINT64    MmioAddress;
-
-  EXTRACT_PCIE_ADDRESS (Address, Segment, Bus, Device, Function, Register);
-  Appeture = PciSegmentLibGetAppeture (Segment);
-  if (Appeture == NULL) {
+  if (RETURN_ERROR (PciSegmentLibGetFunctionBase (Address, &FunctionBase, &RootPort))) {
     return 0xffffffff;
   }
 
-  if (Bus == Appeture->BusBase) {
-    // ignore device > 0 or function > 0 on base bus
-    if (Device != 0 || Function != 0) {
-      return 0xffffffff;
-    }
-    MmioAddress = Appeture->RbPciBar + Register;
-  } else {
-    // Cannot read from device under root port when link is not up
-    if (Bus == Appeture->BusBase + 1 && !PcieIsLinkUp (Appeture->RbPciBar)) {
-      return 0xffffffff;
-    }
-
-    MmioAddress = Appeture->Ecam + (UINT32)Address;
-  }
-
-  return CpuMemoryServiceRead (MmioAddress, Width);
+  return CpuMemoryServiceRead (FunctionBase + (Address & 0xfff), Width);
 }
 
 /**
@@ -214,40 +274,63 @@ PciSegmentLibWriteWorker (
   IN  UINT32                      Data
   )
 {
-  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
-  UINT32    Segment;
-  UINT8     Bus;
-  UINT8     Device;
-  UINT8     Function;
+  PCI_SEGMENT_ROOT_PORT *RootPort;
+  UINT64    FunctionBase;
   UINT32    Register;
+  RETURN_STATUS Status;
 
-  UINT64    MmioAddress;
-
-  EXTRACT_PCIE_ADDRESS (Address, Segment, Bus, Device, Function, Register);
-  Appeture = PciSegmentLibGetAppeture (Segment);
-  if (Appeture == NULL) {
+  Status = PciSegmentLibGetFunctionBase (Address, &FunctionBase, &RootPort);
+  if (Status == RETURN_NOT_FOUND) {
+    return Data;
+  } else if (RETURN_ERROR (Status)) {
     return 0xffffffff;
   }
 
-  if (Bus == Appeture->BusBase) {
-    // ignore device > 0 or function > 0 on base bus
-    if (Device != 0 || Function != 0) {
-      return Data;
-    }
+  Register = (UINT32)Address & 0xfff;
+  if (PciSegmentLibIsRootPort (Address, RootPort)) {
     // Ignore writing to root port BAR registers, in case we get wrong BAR length
     if ((Register & ~0x3) == 0x14 || (Register & ~0x3) == 0x10) {
       return Data;
     }
-    MmioAddress = Appeture->RbPciBar + Register;
-  } else {
-    // Cannot read from device under root port when link is not up
-    if (Bus == Appeture->BusBase + 1 && !PcieIsLinkUp (Appeture->RbPciBar)) {
-      return 0xffffffff;
+    // Link control or bridge control writes may change the link state
+    RootPort->LinkStateValid = FALSE;
+  }
+
+  return CpuMemoryServiceWrite (FunctionBase + Register, Width, Data);
+}
+
+/**
+  Build the segment indexed root port table from the platform apertures, so
+  that configuration accesses do not have to search it.
+
+  @retval RETURN_SUCCESS  The table was built.
+
+**/
+RETURN_STATUS
+EFIAPI
+Hi161xPciSegmentLibConstructor (
+  VOID
+  )
+{
+  UINTN   Hb;
+  UINTN   Rb;
+  UINT32  Segment;
+
+  for (Hb = 0; Hb < PCIE_MAX_HOSTBRIDGE; Hb++) {
+    for (Rb = 0; Rb < PCIE_MAX_ROOTBRIDGE; Rb++) {
+      Segment = mResAppeture[Hb][Rb].Segment;
+      if (Segment >= ARRAY_SIZE (mRootPorts)) {
+        DEBUG ((DEBUG_ERROR, "%a: segment %d out of range\n", __FUNCTION__, Segment));
+        continue;
+      }
+      // Unused entries alias segment 0, the first match wins
+      if (mRootPorts[Segment].Appeture == NULL) {
+        mRootPorts[Segment].Appeture = &mResAppeture[Hb][Rb];
+      }
     }
-    MmioAddress = Appeture->Ecam + (UINT32)Address;
   }
 
-  return CpuMemoryServiceWrite (MmioAddress, Width, Data);
+  return RETURN_SUCCESS;
 }
 
 /**
@@ -1338,6 +1421,9 @@ PciSegmentReadBuffer (
   )
 {
   UINTN                             ReturnValue;
+  PCI_SEGMENT_ROOT_PORT             *RootPort;
+  UINT64                            FunctionBase;
+  RETURN_STATUS                     Status;
 
   ASSERT_INVALID_PCI_SEGMENT_ADDRESS (StartAddress, 0);
   ASSERT (((StartAddress & 0xFFF) + Size) <= 0x1000);
@@ -1373,11 +1459,17 @@ PciSegmentReadBuffer (
     Buffer = (UINT16*)Buffer + 1;
   }
 
+  //
+  // All registers belong to the same function, so translate the address once
+  // and read as many double words as possible straight from MMIO
+  //
+  Status = PciSegmentLibGetFunctionBase (StartAddress, &FunctionBase, &RootPort);
   while (Size >= sizeof (UINT32)) {
-    //
-    // Read as many double words as possible
-    //
-    WriteUnaligned32 (Buffer, PciSegmentRead32 (StartAddress));
+    if (RETURN_ERROR (Status)) {
+      WriteUnaligned32 (Buffer, 0xffffffff);
+    } else {
+      WriteUnaligned32 (Buffer, MmioRead32 ((UINTN)(FunctionBase + (StartAddress & 0xfff))));
+    }
     StartAddress += sizeof (UINT32);
     Size -= sizeof (UINT32);
     Buffer = (UINT32*)Buffer + 1;
@@ -1437,6 +1529,9 @@ PciSegmentWriteBuffer (
   )
 {
   UINTN                             ReturnValue;
+  PCI_SEGMENT_ROOT_PORT             *RootPort;
+  UINT64                            FunctionBase;
+  RETURN_STATUS                     Status;
 
   ASSERT_INVALID_PCI_SEGMENT_ADDRESS (StartAddress, 0);
   ASSERT (((StartAddress & 0xFFF) + Size) <= 0x1000);
@@ -1472,11 +1567,19 @@ PciSegmentWriteBuffer (
     Buffer = (UINT16*)Buffer + 1;
   }
 
+  //
+  // All registers belong to the same function, so translate the address once
+  // and write as many double words as possible straight to MMIO. Root port
+  // writes keep going through the worker, which filters the BARs and tracks
+  // the link state.
+  //
+  Status = PciSegmentLibGetFunctionBase (StartAddress, &FunctionBase, &RootPort);
   while (Size >= sizeof (UINT32)) {
-    //
-    // Write as many double words as possible
-    //
-    PciSegmentWrite32 (StartAddress, ReadUnaligned32 (Buffer));
+    if (RETURN_ERROR (Status) || PciSegmentLibIsRootPort (StartAddress, RootPort)) {
+      PciSegmentWrite32 (StartAddress, ReadUnaligned32 (Buffer));
+    } else {
+      MmioWrite32 ((UINTN)(FunctionBase + (StartAddress & 0xfff)), ReadUnaligned32 (Buffer));
+    }
     StartAddress += sizeof (UINT32);
     Size -= sizeof (UINT32);
     Buffer = (UINT32*)Buffer + 1;
@@ -116,6 +116,156 @@ out:
   return Status;
 }
 
+/*
+ * Issue a single EEPROM transaction: the two address bytes followed by
+ * Length bytes of data. With Length equal to 0 only the address is written,
+ * which does not start a write cycle and is used for ACK polling.
+ */
+STATIC
+EFI_STATUS
+MvEepromRequest (
+  IN EEPROM_CONTEXT *EepromContext,
+  IN UINT32 Address,
+  IN UINT32 Length,
+  IN UINT8 *Buffer,
+  IN UINT8 Operation
+  )
+{
+  EEPROM_REQUEST_PACKET *RequestPacket = &EepromContext->RequestPacket;
+
+  EepromContext->AddressBuffer[0] = (Address >> 8) & 0xff;
+  EepromContext->AddressBuffer[1] = Address & 0xff;
+
+  RequestPacket->Operation[0].Flags = 0;
+  RequestPacket->Operation[0].LengthInBytes = sizeof (EepromContext->AddressBuffer);
+  RequestPacket->Operation[0].Buffer = EepromContext->AddressBuffer;
+  RequestPacket->Operation[1].Flags = (Operation == EEPROM_READ ? I2C_FLAG_READ : I2C_FLAG_NORESTART);
+  RequestPacket->Operation[1].LengthInBytes = Length;
+  RequestPacket->Operation[1].Buffer = Buffer;
+  RequestPacket->OperationCount = (Length > 0 ? 2 : 1);
+
+  return EepromContext->I2cIo->QueueRequest (EepromContext->I2cIo, 0, NULL,
+           (EFI_I2C_REQUEST_PACKET *) RequestPacket, NULL);
+}
+
+/*
+ * Wait for the end of the internal write cycle. The device does not
+ * acknowledge its address until the page is programmed, so keep addressing
+ * it until it answers instead of waiting for the worst case write time.
+ */
+STATIC
+EFI_STATUS
+MvEepromWaitWriteCycle (
+  IN EEPROM_CONTEXT *EepromContext,
+  IN UINT32 Address
+  )
+{
+  UINTN Elapsed;
+
+  for (Elapsed = 0; Elapsed < EEPROM_WRITE_CYCLE_TIMEOUT; Elapsed += EEPROM_ACK_POLL_INTERVAL) {
+    if (!EFI_ERROR (MvEepromRequest (EepromContext, Address, 0, NULL, EEPROM_WRITE))) {
+      return EFI_SUCCESS;
+    }
+    gBS->Stall (EEPROM_ACK_POLL_INTERVAL);
+  }
+
+  DEBUG((DEBUG_ERROR, "MvEepromTransfer: write cycle timeout at 0x%x\n", Address));
+  return EFI_TIMEOUT;
+}
+
+/*
+ * Fill the shadow copy of the EEPROM with a single sequential read.
+ */
+STATIC
+EFI_STATUS
+MvEepromLoadCache (
+  IN EEPROM_CONTEXT *EepromContext
+  )
+{
+  EFI_STATUS Status;
+
+  if (EepromContext->CacheValid) {
+    return EFI_SUCCESS;
+  }
+
+  if (EepromContext->Cache == NULL) {
+    EepromContext->Cache = AllocatePool (EepromContext->CacheSize);
+    if (EepromContext->Cache == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  Status = MvEepromRequest (EepromContext, 0, EepromContext->CacheSize,
+             EepromContext->Cache, EEPROM_READ);
+  if (EFI_ERROR(Status)) {
+    DEBUG((DEBUG_ERROR, "MvEepromTransfer: failed to load cache (%r)\n", Status));
+    return Status;
+  }
+
+  EepromContext->CacheValid = TRUE;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+MvEepromRead (
+  IN EEPROM_CONTEXT *EepromContext,
+  IN UINT32 Address,
+  IN UINT32 Length,
+  IN UINT8 *Buffer
+  )
+{
+  /* Serve reads from the shadow copy, fall back to the device if unavailable */
+  if ((UINT64) Address + Length <= EepromContext->CacheSize &&
+      !EFI_ERROR (MvEepromLoadCache (EepromContext))) {
+    CopyMem (Buffer, EepromContext->Cache + Address, Length);
+    return EFI_SUCCESS;
+  }
+
+  return MvEepromRequest (EepromContext, Address, Length, Buffer, EEPROM_READ);
+}
+
+STATIC
+EFI_STATUS
+MvEepromWrite (
+  IN EEPROM_CONTEXT *EepromContext,
+  IN UINT32 Address,
+  IN UINT32 Length,
+  IN UINT8 *Buffer
+  )
+{
+  EFI_STATUS Status;
+  UINT32 PageSize = EepromContext->PageSize;
+  UINT32 ChunkLength;
+
+  while (Length > 0) {
+    /* A write must not cross a page boundary, or it would wrap within the page */
+    ChunkLength = MIN (Length, PageSize - (Address % PageSize));
+
+    Status = MvEepromRequest (EepromContext, Address, ChunkLength, Buffer, EEPROM_WRITE);
+    if (!EFI_ERROR(Status)) {
+      Status = MvEepromWaitWriteCycle (EepromContext, Address);
+    }
+    if (EFI_ERROR(Status)) {
+      DEBUG((DEBUG_ERROR, "MvEepromTransfer: error %r during transmission\n", Status));
+      /* The content of the page is unknown now */
+      EepromContext->CacheValid = FALSE;
+      return Status;
+    }
+
+    if (EepromContext->CacheValid && Address < EepromContext->CacheSize) {
+      CopyMem (EepromContext->Cache + Address, Buffer,
+        MIN (ChunkLength, EepromContext->CacheSize - Address));
+    }
+
+    Address += ChunkLength;
+    Buffer += ChunkLength;
+    Length -= ChunkLength;
+  }
+
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 MvEepromTransfer (
@@ -126,50 +276,23 @@ MvEepromTransfer (
   IN UINT8 Operation
   )
 {
-  EFI_I2C_REQUEST_PACKET *RequestPacket;
-  UINTN RequestPacketSize;
-  EFI_STATUS Status = EFI_SUCCESS;
   EEPROM_CONTEXT *EepromContext = EEPROM_SC_FROM_EEPROM(This);
-  UINT32 BufferLength;
-  UINT32 Transmitted = 0;
-  UINT32 CurrentAddress = Address;
 
   ASSERT(EepromContext != NULL);
   ASSERT(EepromContext->I2cIo != NULL);
 
-  RequestPacketSize = sizeof(UINTN) + sizeof (EFI_I2C_OPERATION) * 2;
-  RequestPacket = AllocateZeroPool (RequestPacketSize);
-  if (RequestPacket == NULL)
-    return EFI_OUT_OF_RESOURCES;
-  /* First operation contains address, the second is buffer */
-  RequestPacket->OperationCount = 2;
-  RequestPacket->Operation[0].LengthInBytes = 2;
-  RequestPacket->Operation[0].Buffer = AllocateZeroPool ( RequestPacket->Operation[0].LengthInBytes );
-  if (RequestPacket->Operation[0].Buffer == NULL) {
-    FreePool(RequestPacket);
-    return EFI_OUT_OF_RESOURCES;
+  if (Length == 0) {
+    return EFI_SUCCESS;
+  }
+  if (Buffer == NULL) {
+    return EFI_INVALID_PARAMETER;
   }
-  RequestPacket->Operation[1].Flags = (Operation == EEPROM_READ ? I2C_FLAG_READ : I2C_FLAG_NORESTART);
 
-  while (Length > 0) {
-    CurrentAddress = Address + Transmitted;
-    BufferLength = (Length <= MAX_BUFFER_LENGTH ? Length : MAX_BUFFER_LENGTH);
-    RequestPacket->Operation[0].Buffer[0] = (CurrentAddress >> 8) & 0xff;
-    RequestPacket->Operation[0].Buffer[1] = CurrentAddress & 0xff;
-    RequestPacket->Operation[1].LengthInBytes = BufferLength;
-    RequestPacket->Operation[1].Buffer = Buffer + Transmitted;
-    Status = EepromContext->I2cIo->QueueRequest(EepromContext->I2cIo, 0, NULL, RequestPacket, NULL);
-    if (EFI_ERROR(Status)) {
-      DEBUG((DEBUG_ERROR, "MvEepromTransfer: error %d during transmission\n", Status));
-      break;
-    }
-    Length -= BufferLength;
-    Transmitted += BufferLength;
+  if (Operation == EEPROM_READ) {
+    return MvEepromRead (EepromContext, Address, Length, Buffer);
   }
 
-  FreePool(RequestPacket->Operation[0].Buffer);
-  FreePool(RequestPacket);
-  return Status;
+  return MvEepromWrite (EepromContext, Address, Length, Buffer);
 }
 
 EFI_STATUS
@@ -192,6 +315,11 @@ MvEepromStart (
   EepromContext->ControllerHandle = ControllerHandle;
   EepromContext->Signature = EEPROM_SIGNATURE;
   EepromContext->EepromProtocol.Transfer = MvEepromTransfer;
+  EepromContext->CacheSize = PcdGet32 (PcdEepromSize);
+  EepromContext->PageSize = PcdGet32 (PcdEepromPageSize);
+  if (EepromContext->PageSize == 0) {
+    EepromContext->PageSize = 1;
+  }
 
   Status = gBS->OpenProtocol (
       ControllerHandle,
@@ -271,6 +399,9 @@ MvEepromStop (
       gImageHandle,
       ControllerHandle
       );
+  if (EepromContext->Cache != NULL) {
+    FreePool(EepromContext->Cache);
+  }
   FreePool(EepromContext);
   return EFI_SUCCESS;
 }
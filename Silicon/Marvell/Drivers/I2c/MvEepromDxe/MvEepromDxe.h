@@ -39,7 +39,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define EEPROM_SIGNATURE          SIGNATURE_32 ('E', 'E', 'P', 'R')
 
-#define MAX_BUFFER_LENGTH 64
+/*
+ * After a page write, the EEPROM does not acknowledge its address until the
+ * write cycle is completed. Timeouts are given in us.
+ */
+#define EEPROM_WRITE_CYCLE_TIMEOUT    20000
+#define EEPROM_ACK_POLL_INTERVAL      50
 
 /*
  * I2C_FLAG_NORESTART is not part of PI spec, it allows to continue
@@ -56,11 +61,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   0xadc1901b, 0xb83c, 0x4831, { 0x8f, 0x59, 0x70, 0x89, 0x8f, 0x26, 0x57, 0x1e } \
   }
 
+/* Request packet with room for the address and data operations */
+typedef struct {
+  UINTN OperationCount;
+  EFI_I2C_OPERATION Operation[2];
+} EEPROM_REQUEST_PACKET;
+
 typedef struct {
   UINT32  Signature;
   EFI_HANDLE ControllerHandle;
   EFI_I2C_IO_PROTOCOL *I2cIo;
   MARVELL_EEPROM_PROTOCOL EepromProtocol;
+  EEPROM_REQUEST_PACKET RequestPacket;
+  UINT8 AddressBuffer[2];
+  UINT32 PageSize;
+  /* Shadow of the first CacheSize bytes of the EEPROM, loaded on first read */
+  UINT8 *Cache;
+  UINT32 CacheSize;
+  BOOLEAN CacheValid;
 } EEPROM_CONTEXT;
 
 #define EEPROM_SC_FROM_IO(a) CR (a, EEPROM_CONTEXT, I2cIo, EEPROM_SIGNATURE)
@@ -44,6 +44,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <Library/PcdLib.h>
 #include <Library/UefiLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 
 #include "MvI2cDxe.h"
@@ -131,6 +132,15 @@ MvI2cInitialiseController (
   /* I2cMasterContext->Lock is responsible for serializing I2C operations */
   EfiInitializeLock(&I2cMasterContext->Lock, TPL_NOTIFY);
 
+  Status = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                  MvI2cTransferTimer, I2cMasterContext,
+                  &I2cMasterContext->TimerEvent);
+  if (EFI_ERROR(Status)) {
+    DEBUG((DEBUG_ERROR, "MvI2cDxe: I2C transfer timer creation failed\n"));
+    FreePool(I2cMasterContext);
+    return Status;
+  }
+
   MvI2cCalBaudRate( I2cMasterContext,
                     PcdGet32 (PcdI2cBaudRate),
                     &baud_rate,
@@ -161,6 +171,7 @@ MvI2cInitialiseController (
   return EFI_SUCCESS;
 
 fail:
+  gBS->CloseEvent(I2cMasterContext->TimerEvent);
   FreePool(I2cMasterContext);
   return Status;
 }
@@ -234,97 +245,6 @@ MvI2cControlSet (
   I2C_WRITE(I2cMasterContext, I2C_CONTROL, Value);
 }
 
-STATIC
-VOID
-MvI2cClearIflg (
- IN I2C_MASTER_CONTEXT *I2cMasterContext
- )
-{
-  MvI2cPollCtrl (I2cMasterContext, I2C_OPERATION_TIMEOUT, I2C_CONTROL_IFLG);
-  MvI2cControlClear(I2cMasterContext, I2C_CONTROL_IFLG);
-}
-
-/* Timeout is given in us */
-STATIC
-UINTN
-MvI2cPollCtrl (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN UINTN Timeout,
-  IN UINT32 Mask)
-{
-  Timeout /= 10;
-  while (!(I2C_READ(I2cMasterContext, I2C_CONTROL) & Mask)) {
-    gBS->Stall(10);
-    if (--Timeout == 0)
-      return (Timeout);
-  }
-  return (0);
-}
-
-/*
- * 'Timeout' is given in us. Note also that Timeout handling is not exact --
- * MvI2cLockedStart() total wait can be more than 2 x Timeout
- * (MvI2cPollCtrl() is called twice). 'Mask' can be either I2C_STATUS_START
- * or I2C_STATUS_RPTD_START
- */
-STATIC
-EFI_STATUS
-MvI2cLockedStart (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN INT32 Mask,
-  IN UINT8 Slave,
-  IN UINTN Timeout
-  )
-{
-  UINTN ReadAccess, IflgSet = 0;
-  UINT32 I2cStatus;
-
-  if (Mask == I2C_STATUS_RPTD_START) {
-    /* read IFLG to know if it should be cleared later */
-    IflgSet = I2C_READ(I2cMasterContext, I2C_CONTROL) & I2C_CONTROL_IFLG;
-  }
-
-  MvI2cControlSet(I2cMasterContext, I2C_CONTROL_START);
-
-  if (Mask == I2C_STATUS_RPTD_START && IflgSet) {
-    DEBUG((DEBUG_INFO, "MvI2cDxe: IFLG set, clearing\n"));
-    MvI2cClearIflg(I2cMasterContext);
-  }
-
-  if (MvI2cPollCtrl(I2cMasterContext, Timeout, I2C_CONTROL_IFLG)) {
-    DEBUG((DEBUG_ERROR, "MvI2cDxe: Timeout sending %sSTART condition\n",
-        Mask == I2C_STATUS_START ? "" : "repeated "));
-    return EFI_NO_RESPONSE;
-  }
-
-  I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
-  if (I2cStatus != Mask) {
-    DEBUG((DEBUG_ERROR, "MvI2cDxe: wrong I2cStatus (%02x) after sending %sSTART condition\n",
-        I2cStatus, Mask == I2C_STATUS_START ? "" : "repeated "));
-    return EFI_DEVICE_ERROR;
-  }
-
-  I2C_WRITE(I2cMasterContext, I2C_DATA, Slave);
-  gBS->Stall(I2C_OPERATION_TIMEOUT);
-  MvI2cClearIflg(I2cMasterContext);
-
-  if (MvI2cPollCtrl(I2cMasterContext, Timeout, I2C_CONTROL_IFLG)) {
-    DEBUG((DEBUG_ERROR, "MvI2cDxe: Timeout sending Slave address\n"));
-    return EFI_NO_RESPONSE;
-  }
-
-  ReadAccess = (Slave & 0x1) ? 1 : 0;
-  I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
-  if (I2cStatus != (ReadAccess ?
-      I2C_STATUS_ADDR_R_ACK : I2C_STATUS_ADDR_W_ACK)) {
-    DEBUG((DEBUG_ERROR, "MvI2cDxe: no ACK (I2cStatus: %02x) after sending Slave address\n",
-        I2cStatus));
-    return EFI_NO_RESPONSE;
-  }
-
-  return EFI_SUCCESS;
-}
-
 #define  ABSSUB(a,b)  (((a) > (b)) ? (a) - (b) : (b) - (a))
 STATIC
 VOID
@@ -374,6 +294,10 @@ MvI2cReset (
   param = baud_rate.param;
 
   EfiAcquireLock (&I2cMasterContext->Lock);
+  if (I2cMasterContext->Transfer.InProgress) {
+    EfiReleaseLock (&I2cMasterContext->Lock);
+    return EFI_ALREADY_STARTED;
+  }
   I2C_WRITE(I2cMasterContext, I2C_SOFT_RESET, 0x0);
   gBS->Stall(2 * I2C_OPERATION_TIMEOUT);
   I2C_WRITE(I2cMasterContext, I2C_BAUD_RATE, param);
@@ -385,163 +309,285 @@ MvI2cReset (
 }
 
 /*
- * Timeout is given in us
+ * Move the transfer to the next operation of the request, or to the STOP
+ * condition after the last one.
  */
 STATIC
-EFI_STATUS
-MvI2cRepeatedStart (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN UINT8 Slave,
-  IN UINTN Timeout
+VOID
+MvI2cNextOperation (
+  IN MV_I2C_TRANSFER *Transfer
   )
 {
-  EFI_STATUS Status;
+  EFI_I2C_OPERATION *Operation;
 
-  EfiAcquireLock (&I2cMasterContext->Lock);
-  Status = MvI2cLockedStart(I2cMasterContext, I2C_STATUS_RPTD_START, Slave,
-      Timeout);
-  EfiReleaseLock (&I2cMasterContext->Lock);
+  Operation = &Transfer->RequestPacket->Operation[Transfer->OperationIndex];
+  Operation->LengthInBytes = Transfer->ByteIndex;
 
-  if (EFI_ERROR(Status)) {
-    MvI2cStop(I2cMasterContext);
+  Transfer->OperationIndex++;
+  Transfer->ByteIndex = 0;
+  if (Transfer->OperationIndex == Transfer->RequestPacket->OperationCount) {
+    Transfer->State = MvI2cStateStop;
+  } else if (Operation[1].Flags & I2C_FLAG_NORESTART) {
+    Transfer->State = MvI2cStateData;
+  } else {
+    Transfer->State = MvI2cStateStart;
   }
-  return Status;
 }
 
 /*
- * Timeout is given in us
+ * Abort the transfer with the given status, the STOP condition is sent on the
+ * next step.
  */
 STATIC
-EFI_STATUS
-MvI2cStart (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN UINT8 Slave,
-  IN UINTN Timeout
+VOID
+MvI2cFailTransfer (
+  IN MV_I2C_TRANSFER *Transfer,
+  IN EFI_STATUS Status
   )
 {
-  EFI_STATUS Status;
-
-  EfiAcquireLock (&I2cMasterContext->Lock);
-  Status = MvI2cLockedStart(I2cMasterContext, I2C_STATUS_START, Slave, Timeout);
-  EfiReleaseLock (&I2cMasterContext->Lock);
-
-  if (EFI_ERROR(Status)) {
-    MvI2cStop(I2cMasterContext);
-  }
-  return Status;
+  Transfer->Status = Status;
+  Transfer->State = MvI2cStateStop;
 }
 
+/*
+ * Advance the transfer by one state. Returns EFI_NOT_READY without doing
+ * anything if the state waits for the controller and IFLG is not set yet.
+ * The transfer is completed, and its Event signaled, when the STOP condition
+ * has been sent. Must be called with I2cMasterContext->Lock held.
+ */
 STATIC
 EFI_STATUS
-MvI2cStop (
+MvI2cTransferStep (
   IN I2C_MASTER_CONTEXT *I2cMasterContext
   )
 {
-  EfiAcquireLock (&I2cMasterContext->Lock);
-  MvI2cControlSet(I2cMasterContext, I2C_CONTROL_STOP);
-  gBS->Stall(I2C_OPERATION_TIMEOUT);
-  MvI2cClearIflg(I2cMasterContext);
-  EfiReleaseLock (&I2cMasterContext->Lock);
+  MV_I2C_TRANSFER *Transfer;
+  EFI_I2C_OPERATION *Operation;
+  UINTN ReadMode;
+  UINTN LastByte;
+  UINT32 Control;
+  UINT32 I2cStatus;
+
+  Transfer = &I2cMasterContext->Transfer;
+
+  if (Transfer->State == MvI2cStateStop) {
+    /* Clearing IFLG along with setting STOP releases the bus */
+    Control = I2C_READ(I2cMasterContext, I2C_CONTROL);
+    Control = (Control & ~I2C_CONTROL_IFLG) | I2C_CONTROL_STOP;
+    I2C_WRITE(I2cMasterContext, I2C_CONTROL, Control);
+
+    Transfer->InProgress = FALSE;
+    if (Transfer->Event != NULL) {
+      gBS->SetTimer (I2cMasterContext->TimerEvent, TimerCancel, 0);
+      if (Transfer->I2cStatus != NULL)
+        *Transfer->I2cStatus = Transfer->Status;
+      gBS->SignalEvent (Transfer->Event);
+    }
+    return EFI_SUCCESS;
+  }
+
+  Operation = &Transfer->RequestPacket->Operation[Transfer->OperationIndex];
+  ReadMode = Operation->Flags & I2C_FLAG_READ;
+
+  /*
+   * Do not acknowledge the last byte read before a STOP or repeated START
+   * condition, per I2C specs
+   */
+  LastByte = (Transfer->ByteIndex + 1 == Operation->LengthInBytes) &&
+             ((Transfer->OperationIndex + 1 == Transfer->RequestPacket->OperationCount) ||
+              !(Operation[1].Flags & I2C_FLAG_NORESTART));
+
+  Control = I2C_READ(I2cMasterContext, I2C_CONTROL);
+  if ((Transfer->State != MvI2cStateStart) &&
+      (Transfer->State != MvI2cStateData) &&
+      !(Control & I2C_CONTROL_IFLG)) {
+    return EFI_NOT_READY;
+  }
+
+  switch (Transfer->State) {
+  case MvI2cStateStart:
+    MvI2cControlSet(I2cMasterContext, I2C_CONTROL_START);
+    /* A repeated START is only sent once IFLG is cleared */
+    if (Control & I2C_CONTROL_IFLG) {
+      MvI2cControlClear(I2cMasterContext, I2C_CONTROL_IFLG);
+    }
+    Transfer->State = MvI2cStateAddress;
+    break;
+
+  case MvI2cStateAddress:
+    I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
+    if (I2cStatus != (Transfer->OperationIndex == 0 ?
+        I2C_STATUS_START : I2C_STATUS_RPTD_START)) {
+      DEBUG((DEBUG_ERROR, "MvI2cDxe: wrong I2cStatus (%02x) after sending %sSTART condition\n",
+          I2cStatus, Transfer->OperationIndex == 0 ? "" : "repeated "));
+      MvI2cFailTransfer (Transfer, EFI_DEVICE_ERROR);
+      break;
+    }
+    I2C_WRITE(I2cMasterContext, I2C_DATA, (Transfer->SlaveAddress << 1) | ReadMode);
+    MvI2cControlClear(I2cMasterContext, I2C_CONTROL_IFLG);
+    Transfer->State = MvI2cStateAddressAck;
+    break;
+
+  case MvI2cStateAddressAck:
+    I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
+    if (I2cStatus != (ReadMode ? I2C_STATUS_ADDR_R_ACK : I2C_STATUS_ADDR_W_ACK)) {
+      DEBUG((DEBUG_ERROR, "MvI2cDxe: no ACK (I2cStatus: %02x) after sending Slave address\n",
+          I2cStatus));
+      MvI2cFailTransfer (Transfer, EFI_NO_RESPONSE);
+      break;
+    }
+    Transfer->ByteIndex = 0;
+    Transfer->State = MvI2cStateData;
+    break;
+
+  case MvI2cStateData:
+    if (Transfer->ByteIndex == Operation->LengthInBytes) {
+      MvI2cNextOperation (Transfer);
+      break;
+    }
+    if (ReadMode) {
+      if (LastByte)
+        MvI2cControlClear(I2cMasterContext, I2C_CONTROL_ACK);
+      else
+        MvI2cControlSet(I2cMasterContext, I2C_CONTROL_ACK);
+      Transfer->State = MvI2cStateRead;
+    } else {
+      I2C_WRITE(I2cMasterContext, I2C_DATA, Operation->Buffer[Transfer->ByteIndex]);
+      Transfer->State = MvI2cStateWrite;
+    }
+    MvI2cControlClear(I2cMasterContext, I2C_CONTROL_IFLG);
+    break;
+
+  case MvI2cStateRead:
+    I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
+    if (I2cStatus != (LastByte ?
+        I2C_STATUS_DATA_RD_NOACK : I2C_STATUS_DATA_RD_ACK)) {
+      DEBUG((DEBUG_ERROR, "MvI2cDxe: wrong I2cStatus (%02x) while reading\n", I2cStatus));
+      Operation->LengthInBytes = Transfer->ByteIndex;
+      MvI2cFailTransfer (Transfer, EFI_DEVICE_ERROR);
+      break;
+    }
+    Operation->Buffer[Transfer->ByteIndex++] = I2C_READ(I2cMasterContext, I2C_DATA);
+    Transfer->State = MvI2cStateData;
+    break;
+
+  case MvI2cStateWrite:
+    I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
+    if (I2cStatus != I2C_STATUS_DATA_WR_ACK) {
+      DEBUG((DEBUG_ERROR, "MvI2cDxe: wrong status (%02x) while writing\n", I2cStatus));
+      Operation->LengthInBytes = Transfer->ByteIndex;
+      MvI2cFailTransfer (Transfer, EFI_DEVICE_ERROR);
+      break;
+    }
+    Transfer->ByteIndex++;
+    Transfer->State = MvI2cStateData;
+    break;
+
+  default:
+    ASSERT (FALSE);
+    MvI2cFailTransfer (Transfer, EFI_DEVICE_ERROR);
+    break;
+  }
 
   return EFI_SUCCESS;
 }
 
+/*
+ * Advance the transfer as far as possible. Returns once the transfer is
+ * completed, or once the current state has waited for IFLG for 'Budget' us
+ * within this call. A state that waits for the controller for more than
+ * I2C_TRANSFER_TIMEOUT us in total aborts the transfer. Must be called with
+ * I2cMasterContext->Lock held.
+ */
 STATIC
-EFI_STATUS
-MvI2cRead (
+VOID
+MvI2cTransferPoll (
   IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN OUT UINT8 *Buf,
-  IN UINTN Length,
-  IN OUT UINTN *read,
-  IN UINTN last,
-  IN UINTN delay
+  IN UINTN Budget
   )
 {
-  UINT32 I2cStatus;
-  UINTN LastByte;
-  EFI_STATUS Status;
+  MV_I2C_TRANSFER *Transfer;
+  UINTN Stalled;
 
-  EfiAcquireLock (&I2cMasterContext->Lock);
-  *read = 0;
-  while (*read < Length) {
-    /*
-     * Check if we are reading last byte of the last Buffer,
-     * do not send ACK then, per I2C specs
-     */
-    LastByte = ((*read == Length - 1) && last) ? 1 : 0;
-    if (LastByte)
-      MvI2cControlClear(I2cMasterContext, I2C_CONTROL_ACK);
-    else
-      MvI2cControlSet(I2cMasterContext, I2C_CONTROL_ACK);
-
-    gBS->Stall (I2C_OPERATION_TIMEOUT);
-    MvI2cClearIflg(I2cMasterContext);
-
-    if (MvI2cPollCtrl(I2cMasterContext, delay, I2C_CONTROL_IFLG)) {
-      DEBUG((DEBUG_ERROR, "MvI2cDxe: Timeout reading data\n"));
-      Status = EFI_NO_RESPONSE;
-      goto out;
+  Transfer = &I2cMasterContext->Transfer;
+
+  Stalled = 0;
+  while (Transfer->InProgress) {
+    if (MvI2cTransferStep (I2cMasterContext) != EFI_NOT_READY) {
+      Transfer->WaitTime = 0;
+      Stalled = 0;
+      continue;
     }
 
-    I2cStatus = I2C_READ(I2cMasterContext, I2C_STATUS);
-    if (I2cStatus != (LastByte ?
-        I2C_STATUS_DATA_RD_NOACK : I2C_STATUS_DATA_RD_ACK)) {
-      DEBUG((DEBUG_ERROR, "MvI2cDxe: wrong I2cStatus (%02x) while reading\n", I2cStatus));
-      Status = EFI_DEVICE_ERROR;
-      goto out;
+    if (Transfer->WaitTime >= I2C_TRANSFER_TIMEOUT) {
+      DEBUG((DEBUG_ERROR, "MvI2cDxe: Timeout in transfer state %d\n", Transfer->State));
+      MvI2cFailTransfer (Transfer, EFI_NO_RESPONSE);
+      continue;
     }
 
-    *Buf++ = I2C_READ(I2cMasterContext, I2C_DATA);
-    (*read)++;
+    if (Stalled >= Budget) {
+      break;
+    }
+    Stalled++;
+    gBS->Stall (1);
+    Transfer->WaitTime++;
   }
-  Status = EFI_SUCCESS;
-out:
-  EfiReleaseLock (&I2cMasterContext->Lock);
-  return (Status);
 }
 
+/*
+ * Hand a stalled transfer over to the timer event, remembering when, so that
+ * the time until the next callback counts against the state timeout.
+ */
 STATIC
 EFI_STATUS
-MvI2cWrite (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN OUT CONST UINT8 *Buf,
-  IN UINTN Length,
-  IN OUT UINTN *Sent,
-  IN UINTN Timeout
+MvI2cTransferDefer (
+  IN I2C_MASTER_CONTEXT *I2cMasterContext
   )
 {
-  UINT32 status;
-  EFI_STATUS Status;
+  I2cMasterContext->Transfer.DeferredAt = GetPerformanceCounter ();
+  return gBS->SetTimer (I2cMasterContext->TimerEvent, TimerPeriodic,
+           I2C_ASYNC_POLL_PERIOD);
+}
 
-  EfiAcquireLock (&I2cMasterContext->Lock);
-  *Sent = 0;
-  while (*Sent < Length) {
-    I2C_WRITE(I2cMasterContext, I2C_DATA, *Buf++);
-
-    MvI2cClearIflg(I2cMasterContext);
-    if (MvI2cPollCtrl(I2cMasterContext, Timeout, I2C_CONTROL_IFLG)) {
-      DEBUG((DEBUG_ERROR, "MvI2cDxe: Timeout writing data\n"));
-      Status = EFI_NO_RESPONSE;
-      goto out;
-    }
+STATIC
+VOID
+EFIAPI
+MvI2cTransferTimer (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  I2C_MASTER_CONTEXT *I2cMasterContext = Context;
 
-    status = I2C_READ(I2cMasterContext, I2C_STATUS);
-    if (status != I2C_STATUS_DATA_WR_ACK) {
-      DEBUG((DEBUG_ERROR, "MvI2cDxe: wrong status (%02x) while writing\n", status));
-      Status = EFI_DEVICE_ERROR;
-      goto out;
+  MV_I2C_TRANSFER *Transfer = &I2cMasterContext->Transfer;
+  UINT64 Now;
+
+  EfiAcquireLock (&I2cMasterContext->Lock);
+  if (Transfer->InProgress) {
+    /* Account for the time elapsed since the transfer was left stalled */
+    Now = GetPerformanceCounter ();
+    Transfer->WaitTime += (UINTN) DivU64x32 (
+                            GetTimeInNanoSecond (Now - Transfer->DeferredAt),
+                            1000);
+    Transfer->DeferredAt = Now;
+
+    MvI2cTransferPoll (I2cMasterContext, I2C_ASYNC_STALL_BUDGET);
+    if (Transfer->InProgress) {
+      Transfer->DeferredAt = GetPerformanceCounter ();
     }
-    (*Sent)++;
   }
-  Status = EFI_SUCCESS;
-out:
   EfiReleaseLock (&I2cMasterContext->Lock);
-  return (Status);
 }
 
 /*
  * MvI2cStartRequest should be called only by I2cHost.
  * I2C device drivers ought to use EFI_I2C_IO_PROTOCOL instead.
+ *
+ * Without an Event, the request is completed before returning. Otherwise the
+ * request is polled for as long as the controller keeps making progress, and
+ * only continued from a timer event if it stalls. In both cases Event is
+ * signaled once I2cStatus has been updated, which may happen before
+ * returning.
  */
 STATIC
 EFI_STATUS
@@ -553,76 +599,61 @@ MvI2cStartRequest (
   OUT EFI_STATUS                   *I2cStatus OPTIONAL
   )
 {
-  UINTN Count;
-  UINTN ReadMode;
-  UINTN Transmitted;
   I2C_MASTER_CONTEXT *I2cMasterContext = I2C_SC_FROM_MASTER(This);
-  EFI_I2C_OPERATION *Operation;
-  EFI_STATUS Status = EFI_SUCCESS;
+  MV_I2C_TRANSFER *Transfer;
+  EFI_STATUS Status;
 
   ASSERT (RequestPacket != NULL);
   ASSERT (I2cMasterContext != NULL);
 
-  for (Count = 0; Count < RequestPacket->OperationCount; Count++) {
-    Operation = &RequestPacket->Operation[Count];
-    ReadMode = Operation->Flags & I2C_FLAG_READ;
-
-    if (Count == 0) {
-      Status = MvI2cStart (I2cMasterContext,
-                 (SlaveAddress << 1) | ReadMode,
-                 I2C_TRANSFER_TIMEOUT);
-    } else if (!(Operation->Flags & I2C_FLAG_NORESTART)) {
-      Status = MvI2cRepeatedStart (I2cMasterContext,
-                 (SlaveAddress << 1) | ReadMode,
-                 I2C_TRANSFER_TIMEOUT);
-    }
+  Transfer = &I2cMasterContext->Transfer;
 
-    /* I2C transaction was aborted, so stop further transactions */
-    if (EFI_ERROR (Status)) {
-      MvI2cStop (I2cMasterContext);
-      break;
-    }
+  EfiAcquireLock (&I2cMasterContext->Lock);
+  if (Transfer->InProgress) {
+    EfiReleaseLock (&I2cMasterContext->Lock);
+    return EFI_ALREADY_STARTED;
+  }
 
-    /*
-     * If sending the slave address was successful,
-     * proceed to read or write section.
-     */
-    if (ReadMode) {
-      Status = MvI2cRead (I2cMasterContext,
-                 Operation->Buffer,
-                 Operation->LengthInBytes,
-                 &Transmitted,
-                 Count == 1,
-                 I2C_TRANSFER_TIMEOUT);
-      Operation->LengthInBytes = Transmitted;
-    } else {
-      Status = MvI2cWrite (I2cMasterContext,
-                 Operation->Buffer,
-                 Operation->LengthInBytes,
-                 &Transmitted,
-                 I2C_TRANSFER_TIMEOUT);
-      Operation->LengthInBytes = Transmitted;
-    }
+  if (RequestPacket->OperationCount == 0) {
+    EfiReleaseLock (&I2cMasterContext->Lock);
+    if (I2cStatus != NULL)
+      *I2cStatus = EFI_SUCCESS;
+    if (Event != NULL)
+      gBS->SignalEvent(Event);
+    return EFI_SUCCESS;
+  }
 
-    /*
-     * The I2C read or write transaction failed.
-     * Stop the I2C transaction.
-     */
-    if (EFI_ERROR (Status)) {
-      MvI2cStop (I2cMasterContext);
-      break;
-    }
+  Transfer->InProgress = TRUE;
+  Transfer->State = MvI2cStateStart;
+  Transfer->SlaveAddress = SlaveAddress;
+  Transfer->RequestPacket = RequestPacket;
+  Transfer->OperationIndex = 0;
+  Transfer->ByteIndex = 0;
+  Transfer->WaitTime = 0;
+  Transfer->Status = EFI_SUCCESS;
+  Transfer->Event = Event;
+  Transfer->I2cStatus = I2cStatus;
+
+  if (Event == NULL) {
+    MvI2cTransferPoll (I2cMasterContext, MAX_UINTN);
+    Status = Transfer->Status;
+    EfiReleaseLock (&I2cMasterContext->Lock);
+
+    if (I2cStatus != NULL)
+      *I2cStatus = Status;
+    return Status;
+  }
 
-    /* Check if there is any more data to be sent */
-    if (Count == RequestPacket->OperationCount - 1) {
-      MvI2cStop ( I2cMasterContext );
+  MvI2cTransferPoll (I2cMasterContext, I2C_ASYNC_STALL_BUDGET);
+  if (Transfer->InProgress) {
+    Status = MvI2cTransferDefer (I2cMasterContext);
+    if (EFI_ERROR (Status)) {
+      /* Without the timer, finish the transfer here */
+      MvI2cTransferPoll (I2cMasterContext, MAX_UINTN);
     }
   }
+  EfiReleaseLock (&I2cMasterContext->Lock);
 
-  if (I2cStatus != NULL)
-    *I2cStatus = EFI_SUCCESS;
-  if (Event != NULL)
-    gBS->SignalEvent(Event);
   return EFI_SUCCESS;
 }
 
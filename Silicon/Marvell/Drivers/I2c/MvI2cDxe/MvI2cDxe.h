@@ -70,6 +70,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define I2C_TRANSFER_TIMEOUT 10000
 #define I2C_OPERATION_TIMEOUT 100
 
+/*
+ * Asynchronous transfers are polled to completion by StartRequest as long as
+ * the controller keeps making progress. Once a single state has waited for
+ * I2C_ASYNC_STALL_BUDGET us (e.g. clock stretching), the transfer is handed
+ * over to a periodic timer event, whose callbacks poll in the same way.
+ * I2C_ASYNC_POLL_PERIOD is given in 100ns units.
+ */
+#define I2C_ASYNC_POLL_PERIOD    10000
+#define I2C_ASYNC_STALL_BUDGET   1000
+
 #define I2C_UNKNOWN        0x0
 #define I2C_SLOW           0x1
 #define I2C_FAST           0x2
@@ -93,6 +103,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define I2C_MASTER_SIGNATURE          SIGNATURE_32 ('I', '2', 'C', 'M')
 
+/*
+ * States of a transfer. The states waiting for the controller are only left
+ * once it sets IFLG.
+ */
+typedef enum {
+  MvI2cStateStart,        /* send a START or repeated START condition */
+  MvI2cStateAddress,      /* wait for the START, send the slave address */
+  MvI2cStateAddressAck,   /* wait for the slave to acknowledge its address */
+  MvI2cStateData,         /* transfer the next byte of the operation */
+  MvI2cStateRead,         /* wait for a byte to be received */
+  MvI2cStateWrite,        /* wait for a byte to be sent */
+  MvI2cStateStop          /* send a STOP condition, complete the request */
+} MV_I2C_TRANSFER_STATE;
+
+typedef struct {
+  BOOLEAN                 InProgress;
+  MV_I2C_TRANSFER_STATE   State;
+  UINTN                   SlaveAddress;
+  EFI_I2C_REQUEST_PACKET  *RequestPacket;
+  UINTN                   OperationIndex;
+  UINTN                   ByteIndex;
+  UINTN                   WaitTime;   /* us spent waiting in the current state */
+  UINT64                  DeferredAt; /* performance counter when handed to the timer */
+  EFI_STATUS              Status;
+  EFI_EVENT               Event;
+  EFI_STATUS              *I2cStatus;
+} MV_I2C_TRANSFER;
+
 typedef struct {
   UINT32      Signature;
   EFI_HANDLE  Controller;
@@ -100,6 +138,8 @@ typedef struct {
   UINTN       TclkFrequency;
   UINTN       BaseAddress;
   INTN        Bus;
+  MV_I2C_TRANSFER Transfer;
+  EFI_EVENT   TimerEvent;
   EFI_I2C_MASTER_PROTOCOL I2cMaster;
   EFI_I2C_ENUMERATE_PROTOCOL I2cEnumerate;
   EFI_I2C_BUS_CONFIGURATION_MANAGEMENT_PROTOCOL I2cBusConf;
@@ -157,28 +197,6 @@ MvI2cControlSet (
   IN UINT32 mask
   );
 
-STATIC
-VOID
-MvI2cClearIflg (
- IN I2C_MASTER_CONTEXT *I2cMasterContext
- );
-STATIC
-UINTN
-MvI2cPollCtrl (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN UINTN timeout,
-  IN UINT32 mask
-  );
-
-STATIC
-EFI_STATUS
-MvI2cLockedStart (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN INT32 mask,
-  IN UINT8 slave,
-  IN UINTN timeout
-  );
-
 STATIC
 VOID
 MvI2cCalBaudRate (
@@ -196,45 +214,23 @@ MvI2cReset (
 
 STATIC
 EFI_STATUS
-MvI2cRepeatedStart (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN UINT8 slave,
-  IN UINTN timeout
-  );
-
-STATIC
-EFI_STATUS
-MvI2cStart (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN UINT8 slave,
-  IN UINTN timeout
-  );
-
-STATIC
-EFI_STATUS
-MvI2cStop (
+MvI2cTransferStep (
   IN I2C_MASTER_CONTEXT *I2cMasterContext
   );
 
 STATIC
-EFI_STATUS
-MvI2cRead (
+VOID
+MvI2cTransferPoll (
   IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN OUT UINT8 *buf,
-  IN UINTN len,
-  IN OUT UINTN *read,
-  IN UINTN last,
-  IN UINTN delay
+  IN UINTN Budget
   );
 
 STATIC
-EFI_STATUS
-MvI2cWrite (
-  IN I2C_MASTER_CONTEXT *I2cMasterContext,
-  IN OUT CONST UINT8 *buf,
-  IN UINTN len,
-  IN OUT UINTN *sent,
-  IN UINTN timeout
+VOID
+EFIAPI
+MvI2cTransferTimer (
+  IN EFI_EVENT Event,
+  IN VOID *Context
   );
 
 STATIC
@@ -124,12 +124,14 @@ EFI_SIMPLE_NETWORK_MODE Pp2SnpModeTemplate = {
   },                                                    // Permanent Address
   NET_IFTYPE_ETHERNET,                                  // IfType
   TRUE,                                                 // MacAddressChangeable
-  FALSE,                                                // MultipleTxSupported
+  TRUE,                                                 // MultipleTxSupported
   TRUE,                                                 // MediaPresentSupported
   FALSE                                                 // MediaPresent
 };
 
 #define QueueNext(off)  ((((off) + 1) >= QUEUE_DEPTH) ? 0 : ((off) + 1))
+#define QueueCount(ctx) \
+  (((ctx)->CompletionQueueTail + QUEUE_DEPTH - (ctx)->CompletionQueueHead) % QUEUE_DEPTH)
 
 STATIC
 EFI_STATUS
@@ -157,7 +159,8 @@ QueueRemove (
 {
   VOID *Buffer;
 
-  if (Pp2Context->CompletionQueueTail == Pp2Context->CompletionQueueHead) {
+  /* Only return buffers which HW is done with */
+  if (QueueCount (Pp2Context) == Pp2Context->TxPending) {
     return NULL;
   }
 
@@ -168,6 +171,29 @@ QueueRemove (
   return Buffer;
 }
 
+/*
+ * Account for the descriptors sent by HW since the last call. The physical
+ * TXQ sent counter is cleared on read, so it has to be accumulated here.
+ */
+STATIC
+VOID
+Pp2DxeTxComplete (
+  IN PP2DXE_CONTEXT *Pp2Context
+  )
+{
+  PP2DXE_PORT *Port = &Pp2Context->Port;
+  UINTN TxSent;
+
+  if (Pp2Context->TxPending == 0) {
+    return;
+  }
+
+  TxSent = Mvpp2TxqSentDescProc(Port, &Port->Txqs[0]);
+  ASSERT (TxSent <= Pp2Context->TxPending);
+
+  Pp2Context->TxPending -= MIN (TxSent, Pp2Context->TxPending);
+}
+
 STATIC
 EFI_STATUS
 Pp2DxeBmPoolInit (
@@ -860,6 +886,7 @@ Pp2SnpGetStatus (
   Snp->Mode->MediaPresent = LinkUp;
 
   if (TxBuf != NULL) {
+    Pp2DxeTxComplete (Pp2Context);
     *TxBuf = QueueRemove (Pp2Context);
   }
 
@@ -884,8 +911,6 @@ Pp2SnpTransmit (
   MVPP2_TX_QUEUE *AggrTxq = Mvpp2Shared->AggrTxqs;
   MVPP2_TX_DESC *TxDesc;
   EFI_STATUS Status;
-  INTN PollingCount;
-  INTN TxSent;
   UINT8 *DataPtr = Buffer;
   UINT16 EtherType;
   UINT32 State = This->Mode->State;
@@ -925,14 +950,25 @@ Pp2SnpTransmit (
 
   EtherType = HTONS (*EtherTypePtr);
 
-  /* Fetch next descriptor */
-  TxDesc = Mvpp2TxqNextDescGet(AggrTxq);
+  /*
+   * Limit the packets in flight to the physical TXQ size. The aggregated TXQ
+   * is shared by all ports and is large enough to hold a full physical TXQ
+   * of each port, so its descriptors are never reused before HW moved them.
+   */
+  Pp2DxeTxComplete (Pp2Context);
+  if (Pp2Context->TxPending >= Port->TxRingSize) {
+    ReturnUnlock(SavedTpl, EFI_NOT_READY);
+  }
 
-  if (!TxDesc) {
-    DEBUG((DEBUG_ERROR, "No tx descriptor to use\n"));
-    ReturnUnlock(SavedTpl, EFI_OUT_OF_RESOURCES);
+  /* The caller has to recycle sent buffers through GetStatus to make room */
+  Status = QueueInsert (Pp2Context, Buffer);
+  if (EFI_ERROR (Status)) {
+    ReturnUnlock(SavedTpl, EFI_NOT_READY);
   }
 
+  /* Fetch next descriptor */
+  TxDesc = Mvpp2TxqNextDescGet(AggrTxq);
+
   if (HeaderSize != 0) {
     CopyMem(DataPtr, DestAddr, NET_ETHER_ADDR_LEN);
 
@@ -954,41 +990,11 @@ Pp2SnpTransmit (
 
   InvalidateDataCacheRange (DataPtr, BufferSize);
 
-  /* Issue send */
+  /* Issue send, completion is collected by GetStatus */
   Mvpp2AggrTxqPendDescAdd(Port, 1);
+  Pp2Context->TxPending++;
 
-  /*
-   * Egress processing:
-   * Wait until packet is passed from per-cpu aggregated queue
-   * to physical per-port TXQ.
-   */
-  PollingCount = 0;
-  TxSent = Mvpp2AggrTxqPendDescNumGet(Mvpp2Shared, 0);
-  do {
-    if (PollingCount++ > MVPP2_TX_SEND_MAX_POLLING_COUNT) {
-      DEBUG((DEBUG_ERROR, "Pp2Dxe: transmit polling failed\n"));
-      ReturnUnlock(SavedTpl, EFI_TIMEOUT);
-    }
-    TxSent = Mvpp2AggrTxqPendDescNumGet(Mvpp2Shared, 0);
-  } while (TxSent);
-
-  /* Wait for packet to be transmitted by hardware. */
-  PollingCount = 0;
-  TxSent = Mvpp2TxqSentDescProc(Port, &Port->Txqs[0]);
-  while (!TxSent) {
-    if (PollingCount++ > MVPP2_TX_SEND_MAX_POLLING_COUNT) {
-      DEBUG((DEBUG_ERROR, "Pp2Dxe: transmit polling failed\n"));
-      ReturnUnlock(SavedTpl, EFI_TIMEOUT);
-    }
-    TxSent = Mvpp2TxqSentDescProc(Port, &Port->Txqs[0]);
-  }
-
-  /*
-   * At this point TxSent has increased - HW sent the packet
-   * Add buffer to completion queue and return.
-   */
-  Status = QueueInsert (Pp2Context, Buffer);
-  ReturnUnlock (SavedTpl, Status);
+  ReturnUnlock (SavedTpl, EFI_SUCCESS);
 }
 
 EFI_STATUS
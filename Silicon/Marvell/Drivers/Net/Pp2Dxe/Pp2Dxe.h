@@ -167,12 +167,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define WRAP                              (2 + ETH_HLEN + 4 + 32)
 #define MTU                               1500
 
-/*
- * Maximum retries of checking, wheter HW really sent the packet
- * after it was done is software.
- */
-#define MVPP2_TX_SEND_MAX_POLLING_COUNT   10000
-
 /* Structures */
 typedef struct {
   /* Physical number of this Tx queue */
@@ -360,9 +354,15 @@ typedef struct {
   PP2DXE_PORT                 Port;
   BOOLEAN                     Initialized;
   BOOLEAN                     LateInitialized;
+  /*
+   * Transmitted buffers in submission order. The last TxPending entries are
+   * still owned by HW, the ones before them were sent and can be returned
+   * to the caller through GetStatus.
+   */
   VOID                        *CompletionQueue[QUEUE_DEPTH];
   UINTN                       CompletionQueueHead;
   UINTN                       CompletionQueueTail;
+  UINTN                       TxPending;
   EFI_EVENT                   EfiExitBootServicesEvent;
   PP2_DEVICE_PATH             *DevicePath;
 } PP2DXE_CONTEXT;
@@ -175,6 +175,21 @@ SpiFlashBank (
   return BankSel;
 }
 
+STATIC
+UINTN
+MvSpiFlashMinEraseSize (
+  IN SPI_DEVICE *Slave
+  )
+{
+  if (Slave->Info->Flags & NOR_FLASH_ERASE_4K) {
+    return SIZE_4KB;
+  } else if (Slave->Info->Flags & NOR_FLASH_ERASE_32K) {
+    return SIZE_32KB;
+  }
+
+  return Slave->Info->SectorSize;
+}
+
 EFI_STATUS
 MvSpiFlashErase (
   IN SPI_DEVICE *Slave,
@@ -185,21 +200,15 @@ MvSpiFlashErase (
   EFI_STATUS Status;
   UINT32 EraseAddr;
   UINTN EraseSize;
+  UINTN MinEraseSize;
+  UINTN SectorSize;
   UINT8 Cmd[5];
 
-  if (Slave->Info->Flags & NOR_FLASH_ERASE_4K) {
-    Cmd[0] = CMD_ERASE_4K;
-    EraseSize = SIZE_4KB;
-  } else if (Slave->Info->Flags & NOR_FLASH_ERASE_32K) {
-    Cmd[0] = CMD_ERASE_32K;
-    EraseSize = SIZE_32KB;
-  } else {
-    Cmd[0] = CMD_ERASE_64K;
-    EraseSize = Slave->Info->SectorSize;
-  }
+  MinEraseSize = MvSpiFlashMinEraseSize (Slave);
+  SectorSize = Slave->Info->SectorSize;
 
   // Check input parameters
-  if (Offset % EraseSize || Length % EraseSize) {
+  if (Offset % MinEraseSize || Length % MinEraseSize) {
     DEBUG((DEBUG_ERROR, "SpiFlash: Either erase offset or length "
       "is not multiple of erase size\n"));
     return EFI_DEVICE_ERROR;
@@ -208,6 +217,19 @@ MvSpiFlashErase (
   while (Length) {
     EraseAddr = Offset;
 
+    // Use the largest erase command that fits the remaining range
+    if ((Offset % SectorSize) == 0 && Length >= SectorSize) {
+      Cmd[0] = CMD_ERASE_64K;
+      EraseSize = SectorSize;
+    } else if ((Slave->Info->Flags & NOR_FLASH_ERASE_32K) &&
+               (Offset % SIZE_32KB) == 0 && Length >= SIZE_32KB) {
+      Cmd[0] = CMD_ERASE_32K;
+      EraseSize = SIZE_32KB;
+    } else {
+      Cmd[0] = CMD_ERASE_4K;
+      EraseSize = SIZE_4KB;
+    }
+
     SpiFlashBank (Slave, EraseAddr);
 
     SpiFlashFormatAddress (EraseAddr, Slave->AddrSize, Cmd);
@@ -238,6 +260,26 @@ MvSpiFlashRead (
   UINT32 ReadAddr, ReadLength, RemainLength;
   UINTN BankSel = 0;
 
+  //
+  // Bulk reads from the first bank go through the direct read window
+  // of the controller, if the master supports it for this device. The
+  // window is not mapped for runtime use.
+  //
+  if (!EfiAtRuntime () &&
+      Slave->AddrSize == 3 && Offset + Length <= SPI_FLASH_16MB_BOUN) {
+    if ((UINT64)Slave->Info->SectorSize * Slave->Info->SectorCount >
+        SPI_FLASH_16MB_BOUN) {
+      SpiFlashBank (Slave, 0);
+    }
+
+    Status = SpiMasterProtocol->ReadDirect (SpiMasterProtocol, Slave, Offset,
+                                  Length, Buf);
+    if (Status != EFI_UNSUPPORTED) {
+      return Status;
+    }
+    Status = EFI_SUCCESS;
+  }
+
   Cmd[0] = CMD_READ_ARRAY_FAST;
 
   // Sign end of address with 0 byte
@@ -256,7 +298,7 @@ MvSpiFlashRead (
     }
     SpiFlashFormatAddress (ReadAddr, Slave->AddrSize, Cmd);
     // Program proper read address and read data
-    Status = MvSpiFlashReadCmd (Slave, Cmd, Slave->AddrSize + 2, Buf, Length);
+    Status = MvSpiFlashReadCmd (Slave, Cmd, Slave->AddrSize + 2, Buf, ReadLength);
 
     Offset += ReadLength;
     Length -= ReadLength;
@@ -307,6 +349,66 @@ MvSpiFlashWrite (
   return EFI_SUCCESS;
 }
 
+/*
+ * Check whether programming New over Old requires an erase, i.e. whether
+ * any bit has to go from 0 back to 1.
+ */
+STATIC
+BOOLEAN
+MvSpiFlashNeedsErase (
+  IN UINT8 *Old,
+  IN UINT8 *New,
+  IN UINTN Start,
+  IN UINTN End
+  )
+{
+  UINTN Index;
+
+  for (Index = Start; Index < End; Index++) {
+    if ((~Old[Index] & New[Index]) != 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+ * Program the range between the first and the last byte that differ
+ * without erasing, only valid when no bit has to be set back to 1.
+ */
+STATIC
+EFI_STATUS
+MvSpiFlashProgramChanged (
+  IN SPI_DEVICE *Slave,
+  IN UINT32 Offset,
+  IN UINT8 *Old,
+  IN UINT8 *New,
+  IN UINTN Start,
+  IN UINTN End
+  )
+{
+  while (Start < End && Old[Start] == New[Start]) {
+    Start++;
+  }
+
+  while (End > Start && Old[End - 1] == New[End - 1]) {
+    End--;
+  }
+
+  if (Start == End) {
+    return EFI_SUCCESS;
+  }
+
+  return MvSpiFlashWrite (Slave, Offset + Start, End - Start, New + Start);
+}
+
+/*
+ * Update a sector with new data, touching the flash only as much as needed.
+ * Unchanged sectors are skipped, changes which only clear bits are programmed
+ * without erasing and only the runs of erase blocks in which some bits have
+ * to be set back to 1 are erased, using the largest erase commands that fit.
+ */
 STATIC
 EFI_STATUS
 MvSpiFlashUpdateBlock (
@@ -315,45 +417,113 @@ MvSpiFlashUpdateBlock (
   IN UINTN ToUpdate,
   IN UINT8 *Buf,
   IN UINT8 *TmpBuf,
-  IN UINTN EraseSize
+  IN UINTN EraseSize,
+  IN OUT SPI_FLASH_UPDATE_STATS *Stats
   )
 {
   EFI_STATUS Status;
+  UINTN BlockSize;
+  UINTN Start;
+  UINTN RunEnd;
+  BOOLEAN Erased;
 
   // Read backup
   Status = MvSpiFlashRead (Slave, Offset, EraseSize, TmpBuf);
-    if (EFI_ERROR (Status)) {
-      DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while reading old data\n"));
-      return Status;
+  if (EFI_ERROR (Status)) {
+    DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while reading old data\n"));
+    return Status;
+  }
+
+  if (CompareMem (TmpBuf, Buf, ToUpdate) == 0) {
+    Stats->SectorsUnchanged++;
+    return EFI_SUCCESS;
+  }
+
+  BlockSize = MvSpiFlashMinEraseSize (Slave);
+  Erased = FALSE;
+
+  for (Start = 0; Start < ToUpdate; Start = RunEnd) {
+    RunEnd = Start + BlockSize;
+
+    if (!MvSpiFlashNeedsErase (TmpBuf, Buf, Start, MIN (RunEnd, ToUpdate))) {
+      Status = MvSpiFlashProgramChanged (Slave, Offset, TmpBuf, Buf, Start,
+                 MIN (RunEnd, ToUpdate));
+      if (EFI_ERROR (Status)) {
+        DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while writing new data\n"));
+        return Status;
+      }
+      continue;
     }
 
-  // Erase entire sector
-  Status = MvSpiFlashErase (Slave, Offset, EraseSize);
-  if (EFI_ERROR (Status)) {
+    // Extend the run over the following blocks which need an erase as well
+    while (RunEnd < ToUpdate &&
+           MvSpiFlashNeedsErase (TmpBuf, Buf, RunEnd,
+             MIN (RunEnd + BlockSize, ToUpdate))) {
+      RunEnd += BlockSize;
+    }
+
+    Status = MvSpiFlashErase (Slave, Offset + Start, RunEnd - Start);
+    if (EFI_ERROR (Status)) {
       DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while erasing block\n"));
       return Status;
     }
 
-  // Write new data
-  MvSpiFlashWrite (Slave, Offset, ToUpdate, Buf);
-  if (EFI_ERROR (Status)) {
+    Stats->BytesErased += RunEnd - Start;
+    Erased = TRUE;
+
+    // Write new data
+    Status = MvSpiFlashWrite (Slave, Offset + Start,
+               MIN (RunEnd, ToUpdate) - Start, Buf + Start);
+    if (EFI_ERROR (Status)) {
       DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while writing new data\n"));
       return Status;
     }
 
-  // Write backup
-  if (ToUpdate != EraseSize) {
-    Status = MvSpiFlashWrite (Slave, Offset + ToUpdate, EraseSize - ToUpdate,
-      &TmpBuf[ToUpdate]);
-    if (EFI_ERROR (Status)) {
-      DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while writing backup\n"));
-      return Status;
+    // Write backup of the erased data past the updated range
+    if (RunEnd > ToUpdate) {
+      Status = MvSpiFlashWrite (Slave, Offset + ToUpdate, RunEnd - ToUpdate,
+        &TmpBuf[ToUpdate]);
+      if (EFI_ERROR (Status)) {
+        DEBUG((DEBUG_ERROR, "SpiFlash: Update: Error while writing backup\n"));
+        return Status;
+      }
     }
   }
 
+  if (Erased) {
+    Stats->SectorsErased++;
+  } else {
+    Stats->SectorsProgrammed++;
+  }
+
   return EFI_SUCCESS;
 }
 
+STATIC
+VOID
+MvSpiFlashUpdateReport (
+  IN SPI_DEVICE *Slave,
+  IN UINTN ByteCount,
+  IN SPI_FLASH_UPDATE_STATS *Stats
+  )
+{
+  UINTN MinEraseSize;
+  UINTN Saved;
+
+  MinEraseSize = MvSpiFlashMinEraseSize (Slave);
+  Saved = (ALIGN_VALUE (ByteCount, MinEraseSize) - Stats->BytesErased) /
+          MinEraseSize;
+
+  DEBUG ((DEBUG_INFO,
+    "SpiFlash: Update: %Lu sectors unchanged, %Lu programmed without erase, "
+    "%Lu erased, %Lu %LuKB erase cycles saved\n",
+    (UINT64)Stats->SectorsUnchanged,
+    (UINT64)Stats->SectorsProgrammed,
+    (UINT64)Stats->SectorsErased,
+    (UINT64)Saved,
+    (UINT64)(MinEraseSize / SIZE_1KB)));
+}
+
 EFI_STATUS
 MvSpiFlashUpdate (
   IN SPI_DEVICE *Slave,
@@ -365,10 +535,12 @@ MvSpiFlashUpdate (
   EFI_STATUS Status;
   UINT64 SectorSize, ToUpdate, Scale = 1;
   UINT8 *TmpBuf, *End;
+  SPI_FLASH_UPDATE_STATS Stats;
 
   SectorSize = Slave->Info->SectorSize;
 
   End = Buf + ByteCount;
+  ZeroMem (&Stats, sizeof (Stats));
 
   TmpBuf = (UINT8 *)AllocateZeroPool (SectorSize);
   if (TmpBuf == NULL) {
@@ -382,10 +554,12 @@ MvSpiFlashUpdate (
   for (; Buf < End; Buf += ToUpdate, Offset += ToUpdate) {
     ToUpdate = MIN((UINT64)(End - Buf), SectorSize);
     Print (L"   \rUpdating, %d%%", 100 - (End - Buf) / Scale);
-    Status = MvSpiFlashUpdateBlock (Slave, Offset, ToUpdate, Buf, TmpBuf, SectorSize);
+    Status = MvSpiFlashUpdateBlock (Slave, Offset, ToUpdate, Buf, TmpBuf,
+               SectorSize, &Stats);
 
     if (EFI_ERROR (Status)) {
       DEBUG((DEBUG_ERROR, "SpiFlash: Error while updating\n"));
+      FreePool (TmpBuf);
       return Status;
     }
   }
@@ -393,6 +567,8 @@ MvSpiFlashUpdate (
   Print(L"\n");
   FreePool (TmpBuf);
 
+  MvSpiFlashUpdateReport (Slave, ByteCount, &Stats);
+
   return EFI_SUCCESS;
 }
 
@@ -413,10 +589,12 @@ MvSpiFlashUpdateWithProgress (
   UINTN ToUpdate;
   UINTN Index;
   UINT8 *TmpBuf;
+  SPI_FLASH_UPDATE_STATS Stats;
 
   SectorSize = Slave->Info->SectorSize;
-  SectorNum = ByteCount / SectorSize;
+  SectorNum = (ByteCount + SectorSize - 1) / SectorSize;
   ToUpdate = SectorSize;
+  ZeroMem (&Stats, sizeof (Stats));
 
   TmpBuf = (UINT8 *)AllocateZeroPool (SectorSize);
   if (TmpBuf == NULL) {
@@ -432,7 +610,7 @@ MvSpiFlashUpdateWithProgress (
 
     // In the last chunk update only an actual number of remaining bytes.
     if (Index + 1 == SectorNum) {
-      ToUpdate = ByteCount % SectorSize;
+      ToUpdate = ByteCount - Index * SectorSize;
     }
 
     Status = MvSpiFlashUpdateBlock (Slave,
@@ -440,14 +618,18 @@ MvSpiFlashUpdateWithProgress (
                ToUpdate,
                Buffer + Index * SectorSize,
                TmpBuf,
-               SectorSize);
+               SectorSize,
+               &Stats);
     if (EFI_ERROR (Status)) {
       DEBUG ((DEBUG_ERROR, "%a: Error while updating\n", __FUNCTION__));
+      FreePool (TmpBuf);
       return Status;
     }
   }
   FreePool (TmpBuf);
 
+  MvSpiFlashUpdateReport (Slave, ByteCount, &Stats);
+
   if (Progress != NULL) {
     Progress (EndPercentage);
   }
@@ -586,6 +768,7 @@ MvSpiFlashVirtualNotifyEvent (
   //
   EfiConvertPointer (0x0, (VOID**)&SpiMasterProtocol->ReadWrite);
   EfiConvertPointer (0x0, (VOID**)&SpiMasterProtocol->Transfer);
+  EfiConvertPointer (0x0, (VOID**)&SpiMasterProtocol->ReadDirect);
   EfiConvertPointer (0x0, (VOID**)&SpiMasterProtocol);
 
   return;
@@ -89,6 +89,13 @@ typedef struct {
   EFI_HANDLE              Handle;
 } SPI_FLASH_INSTANCE;
 
+typedef struct {
+  UINTN                   SectorsUnchanged;
+  UINTN                   SectorsProgrammed;
+  UINTN                   SectorsErased;
+  UINTN                   BytesErased;
+} SPI_FLASH_UPDATE_STATS;
+
 EFI_STATUS
 EFIAPI
 SpiFlashReadId (
@@ -186,6 +186,23 @@ SpiSetupTransfer (
   EfiReleaseLock (&SpiMaster->Lock);
 }
 
+STATIC
+EFI_STATUS
+SpiWaitForTransfer (
+  IN UINTN SpiRegBase
+  )
+{
+  UINT32 Iterator;
+
+  for (Iterator = 0; Iterator < SPI_TIMEOUT; Iterator++) {
+    if (MmioRead32 (SpiRegBase + SPI_INT_CAUSE_REG)) {
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_TIMEOUT;
+}
+
 EFI_STATUS
 EFIAPI
 MvSpiTransfer (
@@ -198,18 +215,20 @@ MvSpiTransfer (
   )
 {
   SPI_MASTER *SpiMaster;
-  UINT64  Length;
-  UINT32  Iterator, Reg;
+  EFI_STATUS Status;
+  UINTN   Length, Width;
+  UINT32  Conf, Reg;
   UINT8   *DataOutPtr = (UINT8 *)DataOut;
   UINT8   *DataInPtr  = (UINT8 *)DataIn;
-  UINT8   DataToSend  = 0;
+  UINT32  DataToSend;
   UINTN   SpiRegBase;
 
   SpiMaster = SPI_MASTER_FROM_SPI_MASTER_PROTOCOL (This);
 
   SpiRegBase = Slave->HostRegisterBaseAddress;
 
-  Length = 8 * DataByteCount;
+  Length = DataByteCount;
+  Status = EFI_SUCCESS;
 
   if (!EfiAtRuntime ()) {
     EfiAcquireLock (&SpiMaster->Lock);
@@ -220,39 +239,64 @@ MvSpiTransfer (
   }
 
   // Set 8-bit mode
-  Reg = MmioRead32 (SpiRegBase + SPI_CONF_REG);
-  Reg &= ~SPI_BYTE_LENGTH;
-  MmioWrite32 (SpiRegBase + SPI_CONF_REG, Reg);
+  Conf = MmioRead32 (SpiRegBase + SPI_CONF_REG);
+  Conf &= ~SPI_BYTE_LENGTH;
+  MmioWrite32 (SpiRegBase + SPI_CONF_REG, Conf);
+  Width = 1;
 
   while (Length > 0) {
-    if (DataOut != NULL) {
-      DataToSend = *DataOutPtr & 0xFF;
+    //
+    // Move two bytes per transaction in 16-bit mode, the controller shifts
+    // the word MSB first, so the byte order on the bus is preserved.
+    // An odd trailing byte is sent in 8-bit mode.
+    //
+    if ((Length >= 2) != (Width == 2)) {
+      Width = (Length >= 2) ? 2 : 1;
+      MmioWrite32 (SpiRegBase + SPI_CONF_REG,
+        (Width == 2) ? (Conf | SPI_BYTE_LENGTH) : Conf);
+    }
+
+    DataToSend = 0;
+    if (DataOutPtr != NULL) {
+      if (Width == 2) {
+        DataToSend = (DataOutPtr[0] << 8) | DataOutPtr[1];
+      } else {
+        DataToSend = DataOutPtr[0];
+      }
+      DataOutPtr += Width;
     }
+
     // Transmit Data
     MmioWrite32 (SpiRegBase + SPI_INT_CAUSE_REG, 0x0);
     MmioWrite32 (SpiRegBase + SPI_DATA_OUT_REG, DataToSend);
+
     // Wait for memory ready
-    for (Iterator = 0; Iterator < SPI_TIMEOUT; Iterator++) {
-      if (MmioRead32 (SpiRegBase + SPI_INT_CAUSE_REG)) {
-        if (DataInPtr != NULL) {
-          *DataInPtr = MmioRead32 (SpiRegBase + SPI_DATA_IN_REG);
-          DataInPtr++;
-        }
-        if (DataOutPtr != NULL) {
-          DataOutPtr++;
-        }
-        Length -= 8;
-        break;
-      }
+    Status = SpiWaitForTransfer (SpiRegBase);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: Timeout\n", __FUNCTION__));
+      SpiDeactivateCs (Slave);
+      break;
     }
 
-    if (Iterator >= SPI_TIMEOUT) {
-      DEBUG ((DEBUG_ERROR, "%a: Timeout\n", __FUNCTION__));
-      return EFI_TIMEOUT;
+    if (DataInPtr != NULL) {
+      Reg = MmioRead32 (SpiRegBase + SPI_DATA_IN_REG);
+      if (Width == 2) {
+        DataInPtr[0] = (Reg >> 8) & 0xFF;
+        DataInPtr[1] = Reg & 0xFF;
+      } else {
+        DataInPtr[0] = Reg & 0xFF;
+      }
+      DataInPtr += Width;
     }
+
+    Length -= Width;
   }
 
-  if (Flag & SPI_TRANSFER_END) {
+  if (Width == 2) {
+    MmioWrite32 (SpiRegBase + SPI_CONF_REG, Conf);
+  }
+
+  if (!EFI_ERROR (Status) && (Flag & SPI_TRANSFER_END)) {
     SpiDeactivateCs (Slave);
   }
 
@@ -260,6 +304,63 @@ MvSpiTransfer (
     EfiReleaseLock (&SpiMaster->Lock);
   }
 
+  return Status;
+}
+
+EFI_STATUS
+EFIAPI
+MvSpiReadDirect (
+  IN  MARVELL_SPI_MASTER_PROTOCOL *This,
+  IN  SPI_DEVICE *Slave,
+  IN  UINTN Offset,
+  IN  UINTN Length,
+  OUT VOID *Buffer
+  )
+{
+  SPI_MASTER *SpiMaster;
+  UINT8 *DataInPtr = (UINT8 *)Buffer;
+  UINTN Address;
+
+  //
+  // The window is only mapped for boot services, at runtime the flash
+  // contents are read through the register interface.
+  //
+  if (EfiAtRuntime () ||
+      Slave->DirectReadSize == 0 ||
+      Offset >= Slave->DirectReadSize ||
+      Length > Slave->DirectReadSize - Offset) {
+    return EFI_UNSUPPORTED;
+  }
+
+  SpiMaster = SPI_MASTER_FROM_SPI_MASTER_PROTOCOL (This);
+
+  Address = Slave->DirectReadBaseAddress + Offset;
+
+  EfiAcquireLock (&SpiMaster->Lock);
+
+  //
+  // The window is mapped as device memory, which does not allow
+  // unaligned accesses, so only use naturally aligned 32-bit reads.
+  //
+  while (Length > 0 && (Address & (sizeof (UINT32) - 1)) != 0) {
+    *DataInPtr++ = MmioRead8 (Address++);
+    Length--;
+  }
+
+  while (Length >= sizeof (UINT32)) {
+    WriteUnaligned32 ((UINT32 *)DataInPtr, MmioRead32 (Address));
+    DataInPtr += sizeof (UINT32);
+    Address += sizeof (UINT32);
+    Length -= sizeof (UINT32);
+  }
+
+  while (Length > 0) {
+    *DataInPtr++ = MmioRead8 (Address++);
+    Length--;
+  }
+
+  EfiReleaseLock (&SpiMaster->Lock);
+
   return EFI_SUCCESS;
 }
 
@@ -326,6 +427,15 @@ MvSpiSetupSlave (
   Slave->CoreClock = PcdGet32 (PcdSpiClockFrequency);
   Slave->MaxFreq = PcdGet32 (PcdSpiMaxFrequency);
 
+  // Only the boot flash is mapped in the direct read window
+  if (Slave->Cs == PcdGet32 (PcdSpiFlashCs)) {
+    Slave->DirectReadBaseAddress = PcdGet32 (PcdSpiMemoryBase);
+    Slave->DirectReadSize = PcdGet32 (PcdSpiMemorySize);
+  } else {
+    Slave->DirectReadBaseAddress = 0;
+    Slave->DirectReadSize = 0;
+  }
+
   SpiSetupTransfer (This, Slave);
 
   return Slave;
@@ -393,6 +503,7 @@ SpiMasterInitProtocol (
   SpiMasterProtocol->Transfer    = MvSpiTransfer;
   SpiMasterProtocol->ReadWrite   = MvSpiReadWrite;
   SpiMasterProtocol->ConfigRuntime = MvSpiConfigRuntime;
+  SpiMasterProtocol->ReadDirect  = MvSpiReadDirect;
 
   return EFI_SUCCESS;
 }
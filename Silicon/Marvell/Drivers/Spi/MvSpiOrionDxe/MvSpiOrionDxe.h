@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __SPI_MASTER_H__
 #define __SPI_MASTER_H__
 
+#include <Library/BaseLib.h>
 #include <Library/IoLib.h>
 #include <Library/PcdLib.h>
 #include <Library/UefiLib.h>
@@ -117,6 +118,16 @@ MvSpiReadWrite (
   IN  UINTN DataSize
   );
 
+EFI_STATUS
+EFIAPI
+MvSpiReadDirect (
+  IN  MARVELL_SPI_MASTER_PROTOCOL *This,
+  IN  SPI_DEVICE *Slave,
+  IN  UINTN Offset,
+  IN  UINTN Length,
+  OUT VOID *Buffer
+  );
+
 EFI_STATUS
 EFIAPI
 MvSpiInit (
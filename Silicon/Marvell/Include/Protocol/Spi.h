@@ -55,6 +55,8 @@ typedef struct {
   NOR_FLASH_INFO *Info;
   UINTN HostRegisterBaseAddress;
   UINTN CoreClock;
+  UINTN DirectReadBaseAddress;
+  UINTN DirectReadSize;
 } SPI_DEVICE;
 
 typedef
@@ -86,6 +88,21 @@ EFI_STATUS
   IN  UINTN DataSize
   );
 
+//
+// Read flash contents through the memory mapped direct read window.
+// Returns EFI_UNSUPPORTED if the range is not covered by the window
+// of the device, in which case the caller has to fall back to ReadWrite.
+//
+typedef
+EFI_STATUS
+(EFIAPI *MV_SPI_READ_DIRECT) (
+  IN  MARVELL_SPI_MASTER_PROTOCOL *This,
+  IN  SPI_DEVICE *Slave,
+  IN  UINTN Offset,
+  IN  UINTN Length,
+  OUT VOID *Buffer
+  );
+
 typedef
 SPI_DEVICE *
 (EFIAPI *MV_SPI_SETUP_DEVICE) (
@@ -114,6 +131,7 @@ struct _MARVELL_SPI_MASTER_PROTOCOL {
   MV_SPI_SETUP_DEVICE SetupDevice;
   MV_SPI_FREE_DEVICE  FreeDevice;
   MV_SPI_CONFIG_RT    ConfigRuntime;
+  MV_SPI_READ_DIRECT  ReadDirect;
 };
 
 #endif // __MARVELL_SPI_MASTER_PROTOCOL_H__
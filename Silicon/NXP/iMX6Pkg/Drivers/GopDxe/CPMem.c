@@ -421,3 +421,41 @@ ConfigureCpmemFrameBuffer (
 Exit:
   return Status;
 }
+
+// Point the IDMAC channel at a different buffer with the same layout. The
+// new address is picked up by the IDMAC at the start of the next frame.
+EFI_STATUS
+SetCpmemBufferAddress (
+  IN  DISPLAY_INTERFACE_CONTEXT   *DisplayInterfaceContextPtr,
+  IN  UINT32                      Channel,
+  IN  UINT32                      PhyAddr
+  )
+{
+  CPMEM_PARAM *pCpmemChannel;
+  CPMEM_WORD1_PACKED_REG CpmemWord1PackedReg;
+
+  // Buffer address is programmed as [31:3]
+  if ((PhyAddr & 0x7) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  pCpmemChannel = DisplayInterfaceContextPtr->CpMemParamBasePtr;
+  pCpmemChannel = (pCpmemChannel + Channel);
+
+  CopyMem (
+    &CpmemWord1PackedReg,
+    &pCpmemChannel->Word1Pack,
+    sizeof (CpmemWord1PackedReg)
+  );
+
+  CpmemWord1PackedReg.ExtMemBuffer0Address = PhyAddr >> 3;
+  CpmemWord1PackedReg.ExtMemBuffer1Address = PhyAddr >> 3;
+
+  CopyMem (
+    &pCpmemChannel->Word1Pack,
+    &CpmemWord1PackedReg,
+    sizeof (pCpmemChannel->Word1Pack)
+  );
+
+  return EFI_SUCCESS;
+}
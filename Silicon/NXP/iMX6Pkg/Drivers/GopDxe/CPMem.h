@@ -274,4 +274,11 @@ ConfigureCpmemFrameBuffer (
   IN  SURFACE_INFO                *FrameBufferPtr
   );
 
+EFI_STATUS
+SetCpmemBufferAddress (
+  IN  DISPLAY_INTERFACE_CONTEXT   *DisplayInterfaceContextPtr,
+  IN  UINT32                      Channel,
+  IN  UINT32                      PhyAddr
+  );
+
 #endif  /* _CPMEM_H_ */
@@ -434,6 +434,20 @@ Exit:
   return Status;
 }
 
+EFI_STATUS
+SetFrameBufferAddress (
+  IN  DISPLAY_INTERFACE_CONTEXT   *DisplayInterfaceContextPtr,
+  IN  UINT32                      PhyAddr
+  )
+{
+  // Only support single display for now
+  return SetCpmemBufferAddress (
+           DisplayInterfaceContextPtr,
+           IDMAC_CHANNEL_DP_PRIMARY_FLOW_MAIN_PLANE,
+           PhyAddr
+         );
+}
+
 UINT32
 GetColorDepth (
   IN  IMX_PIXEL_FORMAT  PixelFormat
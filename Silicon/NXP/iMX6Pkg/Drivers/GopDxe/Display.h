@@ -167,6 +167,12 @@ ConfigureFrameBuffer (
   IN  SURFACE_INFO                *FrameBufferPtr
   );
 
+EFI_STATUS
+SetFrameBufferAddress (
+  IN  DISPLAY_INTERFACE_CONTEXT   *DisplayInterfaceContextPtr,
+  IN  UINT32                      PhyAddr
+  );
+
 UINT32
 GetColorDepth (
   IN  IMX_PIXEL_FORMAT  PixelFormat
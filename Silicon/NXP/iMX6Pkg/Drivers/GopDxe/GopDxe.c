@@ -21,6 +21,8 @@
 #include <Library/IoLib.h>
 #include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/DmaLib.h>
 
 #include <Protocol/EmbeddedExternalDevice.h>
 #include <Protocol/BlockIo.h>
@@ -44,6 +46,13 @@ typedef struct {
   EFI_DEVICE_PATH End;
 } VID_DEVICE_PATH;
 
+// Interval at which Blt updates to the shadow frame buffer become visible
+#define SHADOW_FRAME_BUFFER_FLUSH_PERIOD  EFI_TIMER_PERIOD_MILLISECONDS (30)
+
+// Height of the hardware scroll buffer in screens. The visible window slides
+// down this buffer and is copied back to the top once it reaches the end.
+#define HW_SCROLL_BUFFER_SCREENS          2
+
 IMX_DISPLAY_TIMING CONST FullHDTiming = {
   148500000,  // Full 1080p HD PixelClock
   1920,       // HActive
@@ -74,6 +83,21 @@ GopDxeQueryMode (
   OUT EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  **Info
   );
 
+EFI_STATUS
+EFIAPI
+GopDxeBlt (
+  IN EFI_GRAPHICS_OUTPUT_PROTOCOL       *This,
+  IN OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer, OPTIONAL
+  IN EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN UINTN                              SourceX,
+  IN UINTN                              SourceY,
+  IN UINTN                              DestinationX,
+  IN UINTN                              DestinationY,
+  IN UINTN                              Width,
+  IN UINTN                              Height,
+  IN UINTN                              Delta OPTIONAL
+  );
+
 STATIC VID_DEVICE_PATH VidDevicePath = {
   {
     {
@@ -107,7 +131,7 @@ STATIC EFI_GRAPHICS_OUTPUT_PROTOCOL_MODE VidGopMode;
 STATIC EFI_GRAPHICS_OUTPUT_PROTOCOL VidGop = {
   GopDxeQueryMode, // QueryMode
   VidGopSetMode,   // SetMode
-  VidGopBlt,       // Blt
+  GopDxeBlt,       // Blt
   &VidGopMode    // Mode
 };
 
@@ -125,6 +149,305 @@ DISPLAY_CONTEXT *DisplayContextPtr;
 
 DISPLAY_INTERFACE_TYPE DisplayDevice;
 
+STATIC EFI_EVENT mShadowFlushEvent;
+STATIC EFI_EVENT mShadowExitBootServicesEvent;
+
+STATIC UINT8     *mScrollBuffer;
+STATIC UINTN     mScrollBufferPages;
+STATIC UINTN     mScrollBufferRows;
+STATIC UINTN     mScrollOffset;
+STATIC EFI_EVENT mScrollReadyToBootEvent;
+STATIC EFI_EVENT mScrollExitBootServicesEvent;
+
+STATIC
+VOID
+EFIAPI
+GopDxeShadowFlush (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  ImxFlushShadowFrameBuffer ();
+}
+
+STATIC
+VOID
+EFIAPI
+GopDxeShadowExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  // The OS owns the frame buffer from now on
+  gBS->SetTimer (mShadowFlushEvent, TimerCancel, 0);
+  ImxDisableShadowFrameBuffer ();
+}
+
+/**
+  Let Blt operate on a cacheable shadow of the frame buffer and copy the
+  modified rectangle to the scan-out buffer periodically.
+**/
+STATIC
+EFI_STATUS
+GopDxeEnableShadowFrameBuffer (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = ImxEnableShadowFrameBuffer (&VidGop);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  GopDxeShadowFlush,
+                  NULL,
+                  &mShadowFlushEvent
+                );
+  if (EFI_ERROR (Status)) {
+    goto Exit;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                  TPL_NOTIFY,
+                  GopDxeShadowExitBootServices,
+                  NULL,
+                  &mShadowExitBootServicesEvent
+                );
+  if (EFI_ERROR (Status)) {
+    goto Exit;
+  }
+
+  Status = gBS->SetTimer (
+                  mShadowFlushEvent,
+                  TimerPeriodic,
+                  SHADOW_FRAME_BUFFER_FLUSH_PERIOD
+                );
+
+Exit:
+  if (EFI_ERROR (Status)) {
+    if (mShadowExitBootServicesEvent != NULL) {
+      gBS->CloseEvent (mShadowExitBootServicesEvent);
+      mShadowExitBootServicesEvent = NULL;
+    }
+    if (mShadowFlushEvent != NULL) {
+      gBS->CloseEvent (mShadowFlushEvent);
+      mShadowFlushEvent = NULL;
+    }
+    ImxDisableShadowFrameBuffer ();
+  }
+  return Status;
+}
+
+/**
+  Move the visible window of the scroll buffer up by Rows, which has the same
+  result as a full screen EfiBltVideoToVideo copy from row Rows to row 0.
+**/
+STATIC
+VOID
+GopDxeHardwareScroll (
+  IN UINTN  Rows
+  )
+{
+  UINTN   Pitch;
+  UINTN   ScreenRows;
+  UINT8   *Window;
+
+  ScreenRows = VidGopModeInfo.VerticalResolution;
+  Pitch = VidGopModeInfo.PixelsPerScanLine * BYTES_PER_PIXEL;
+  Window = mScrollBuffer + (mScrollOffset * Pitch);
+
+  if ((mScrollOffset + Rows + ScreenRows) <= mScrollBufferRows) {
+    // The rows that scroll into view keep their content, as with a copy
+    CopyMem (
+      Window + (ScreenRows * Pitch),
+      Window + ((ScreenRows - Rows) * Pitch),
+      Rows * Pitch
+    );
+    mScrollOffset += Rows;
+  } else {
+    // End of the buffer reached, start over at the top with a regular copy
+    CopyMem (
+      mScrollBuffer,
+      Window + (Rows * Pitch),
+      (ScreenRows - Rows) * Pitch
+    );
+    CopyMem (
+      mScrollBuffer + ((ScreenRows - Rows) * Pitch),
+      Window + ((ScreenRows - Rows) * Pitch),
+      Rows * Pitch
+    );
+    mScrollOffset = 0;
+  }
+
+  Window = mScrollBuffer + (mScrollOffset * Pitch);
+  SetFrameBufferAddress (
+    &DisplayContextPtr->DiContext[DisplayDevice],
+    (UINT32)(UINTN)Window
+  );
+  VidGopMode.FrameBufferBase = (EFI_PHYSICAL_ADDRESS)(UINTN)Window;
+}
+
+/**
+  Copy the visible window back to the reserved frame buffer and scan out from
+  there again, so that boot loaders and the OS find the frame buffer where
+  they expect it. Returns the scroll buffer, which is no longer used.
+**/
+STATIC
+VOID *
+GopDxeStopHardwareScroll (
+  VOID
+  )
+{
+  SURFACE_INFO  *Surface;
+  EFI_TPL       OldTpl;
+  VOID          *Buffer;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  Buffer = mScrollBuffer;
+  if (Buffer != NULL) {
+    Surface = &DisplayContextPtr->DisplayConfig.DisplaySurface[0];
+    CopyMem (
+      (VOID *)(UINTN)Surface->PhyAddr,
+      (VOID *)(UINTN)VidGopMode.FrameBufferBase,
+      VidGopMode.FrameBufferSize
+    );
+    SetFrameBufferAddress (
+      &DisplayContextPtr->DiContext[DisplayDevice],
+      Surface->PhyAddr
+    );
+    VidGopMode.FrameBufferBase = (EFI_PHYSICAL_ADDRESS)Surface->PhyAddr;
+    mScrollBuffer = NULL;
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  return Buffer;
+}
+
+STATIC
+VOID
+EFIAPI
+GopDxeHardwareScrollReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  VOID  *Buffer;
+
+  Buffer = GopDxeStopHardwareScroll ();
+  if (Buffer != NULL) {
+    DmaFreeBuffer (mScrollBufferPages, Buffer);
+  }
+
+  gBS->CloseEvent (Event);
+  mScrollReadyToBootEvent = NULL;
+}
+
+STATIC
+VOID
+EFIAPI
+GopDxeHardwareScrollExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  // Memory can't be freed from an ExitBootServices notification
+  GopDxeStopHardwareScroll ();
+}
+
+/**
+  Implement full screen scrolling by moving the IPU scan-out address through
+  a buffer taller than the screen instead of copying the frame buffer. Used
+  until ReadyToBoot, after which the reserved frame buffer is used again.
+**/
+STATIC
+EFI_STATUS
+GopDxeEnableHardwareScroll (
+  VOID
+  )
+{
+  VOID        *Buffer;
+  UINTN       Pitch;
+  EFI_STATUS  Status;
+
+  Pitch = VidGopModeInfo.PixelsPerScanLine * BYTES_PER_PIXEL;
+  mScrollBufferRows =
+    VidGopModeInfo.VerticalResolution * HW_SCROLL_BUFFER_SCREENS;
+  mScrollBufferPages = EFI_SIZE_TO_PAGES (mScrollBufferRows * Pitch);
+
+  // The IPU reads the buffer directly, so it has to be uncached
+  Status = DmaAllocateBuffer (
+             EfiBootServicesData,
+             mScrollBufferPages,
+             &Buffer
+           );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = EfiCreateEventReadyToBootEx (
+             TPL_CALLBACK,
+             GopDxeHardwareScrollReadyToBoot,
+             NULL,
+             &mScrollReadyToBootEvent
+           );
+  if (EFI_ERROR (Status)) {
+    goto Exit;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                  TPL_NOTIFY,
+                  GopDxeHardwareScrollExitBootServices,
+                  NULL,
+                  &mScrollExitBootServicesEvent
+                );
+  if (EFI_ERROR (Status)) {
+    goto Exit;
+  }
+
+  CopyMem (
+    Buffer,
+    (VOID *)(UINTN)VidGopMode.FrameBufferBase,
+    VidGopMode.FrameBufferSize
+  );
+
+  Status = SetFrameBufferAddress (
+             &DisplayContextPtr->DiContext[DisplayDevice],
+             (UINT32)(UINTN)Buffer
+           );
+  if (EFI_ERROR (Status)) {
+    goto Exit;
+  }
+
+  mScrollBuffer = Buffer;
+  mScrollOffset = 0;
+  VidGopMode.FrameBufferBase = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+
+  DEBUG ((DEBUG_INFO, "%a: Scroll buffer at %p, %d rows\n",
+    __FUNCTION__, Buffer, mScrollBufferRows));
+
+Exit:
+  if (EFI_ERROR (Status)) {
+    if (mScrollExitBootServicesEvent != NULL) {
+      gBS->CloseEvent (mScrollExitBootServicesEvent);
+      mScrollExitBootServicesEvent = NULL;
+    }
+    if (mScrollReadyToBootEvent != NULL) {
+      gBS->CloseEvent (mScrollReadyToBootEvent);
+      mScrollReadyToBootEvent = NULL;
+    }
+    DmaFreeBuffer (mScrollBufferPages, Buffer);
+  }
+  return Status;
+}
+
 EFI_STATUS
 GopDxeInitialize (
   IN EFI_HANDLE         ImageHandle,
@@ -278,6 +601,24 @@ GopDxeInitialize (
     goto Exit;
   }
 
+  if (FeaturePcdGet (PcdIpuHardwareScrollEnable)) {
+    if (EFI_ERROR (GopDxeEnableHardwareScroll ())) {
+      // Not fatal, scrolling falls back to copying the frame buffer
+      DEBUG ((DEBUG_WARN, "%a: Fail to enable hardware scroll\n",
+        __FUNCTION__));
+    }
+  }
+
+  // Scrolling the shadow would copy the whole screen again, so only use it
+  // when hardware scroll is not active
+  if (FeaturePcdGet (PcdShadowFrameBufferEnable) && (mScrollBuffer == NULL)) {
+    if (EFI_ERROR (GopDxeEnableShadowFrameBuffer ())) {
+      // Not fatal, Blt keeps operating on the frame buffer directly
+      DEBUG ((DEBUG_WARN, "%a: Fail to enable shadow frame buffer\n",
+        __FUNCTION__));
+    }
+  }
+
 Exit:
   DEBUG ((DEBUG_INFO, "%a: Exit = %Xh\n",
     __FUNCTION__, Status));
@@ -347,3 +688,55 @@ Exit:
   return Status;
 }
 
+EFI_STATUS
+EFIAPI
+GopDxeBlt (
+  IN EFI_GRAPHICS_OUTPUT_PROTOCOL       *This,
+  IN OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer, OPTIONAL
+  IN EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN UINTN                              SourceX,
+  IN UINTN                              SourceY,
+  IN UINTN                              DestinationX,
+  IN UINTN                              DestinationY,
+  IN UINTN                              Width,
+  IN UINTN                              Height,
+  IN UINTN                              Delta OPTIONAL
+  )
+{
+  EFI_STATUS  Status;
+  EFI_TPL     OldTpl;
+
+  // Keep the shadow flush timer from running in the middle of a Blt
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  // Full screen upward scroll, as done by the text console
+  if ((mScrollBuffer != NULL) &&
+      (BltOperation == EfiBltVideoToVideo) &&
+      (SourceX == 0) &&
+      (DestinationX == 0) &&
+      (DestinationY == 0) &&
+      (Width == VidGopModeInfo.HorizontalResolution) &&
+      (SourceY != 0) &&
+      (Height != 0) &&
+      ((SourceY + Height) == VidGopModeInfo.VerticalResolution)) {
+    GopDxeHardwareScroll (SourceY);
+    Status = EFI_SUCCESS;
+  } else {
+    Status = VidGopBlt (
+               This,
+               BltBuffer,
+               BltOperation,
+               SourceX,
+               SourceY,
+               DestinationX,
+               DestinationY,
+               Width,
+               Height,
+               Delta
+             );
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
@@ -19,6 +19,7 @@
 #include <Library/IoLib.h>
 #include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
 #include <Library/DmaLib.h>
 #include <Protocol/EmbeddedExternalDevice.h>
 #include <Protocol/BlockIo.h>
@@ -32,6 +33,11 @@
 
 #define PIXEL_BYTES 4
 
+//
+// Interval at which Blt updates to the shadow frame buffer become visible
+//
+#define SHADOW_FRAME_BUFFER_FLUSH_PERIOD EFI_TIMER_PERIOD_MILLISECONDS (30)
+
 typedef struct _LCDIF_DISPLAY_CONTEXT {
 
     //
@@ -112,6 +118,8 @@ static VID_DEVICE_PATH LcdifVidDevicePath =
 static LCDIF_DISPLAY_CONTEXT LcdifDisplayContext;
 static EFI_GRAPHICS_OUTPUT_MODE_INFORMATION LcdifGopModeInfo;
 static EFI_GRAPHICS_OUTPUT_PROTOCOL_MODE LcdifGopProtocolMode;
+static EFI_EVENT LcdifShadowFlushEvent;
+static EFI_EVENT LcdifShadowExitBootServicesEvent;
 
 static EFI_GRAPHICS_OUTPUT_PROTOCOL LcdifGopProtocol =
 {
@@ -193,6 +201,89 @@ GetPreferredTiming (
     return;
 }
 
+static
+VOID
+EFIAPI
+LcdifShadowFlush (
+    IN EFI_EVENT Event,
+    IN VOID *Context
+    )
+{
+    ImxFlushShadowFrameBuffer ();
+}
+
+static
+VOID
+EFIAPI
+LcdifShadowExitBootServices (
+    IN EFI_EVENT Event,
+    IN VOID *Context
+    )
+{
+    //
+    // The OS owns the frame buffer from now on
+    //
+    gBS->SetTimer (LcdifShadowFlushEvent, TimerCancel, 0);
+    ImxDisableShadowFrameBuffer ();
+}
+
+//
+// Let Blt operate on a cacheable shadow of the uncached frame buffer and
+// copy the modified rectangle to the scan-out buffer periodically
+//
+static
+EFI_STATUS
+LcdifEnableShadowFrameBuffer (
+    VOID
+    )
+{
+    EFI_STATUS status;
+
+    status = ImxEnableShadowFrameBuffer (&LcdifGopProtocol);
+    if (EFI_ERROR (status)) {
+        return status;
+    }
+
+    status = gBS->CreateEvent (
+        EVT_TIMER | EVT_NOTIFY_SIGNAL,
+        TPL_NOTIFY,
+        LcdifShadowFlush,
+        NULL,
+        &LcdifShadowFlushEvent);
+    if (EFI_ERROR (status)) {
+        goto Exit;
+    }
+
+    status = gBS->CreateEvent (
+        EVT_SIGNAL_EXIT_BOOT_SERVICES,
+        TPL_NOTIFY,
+        LcdifShadowExitBootServices,
+        NULL,
+        &LcdifShadowExitBootServicesEvent);
+    if (EFI_ERROR (status)) {
+        goto Exit;
+    }
+
+    status = gBS->SetTimer (
+        LcdifShadowFlushEvent,
+        TimerPeriodic,
+        SHADOW_FRAME_BUFFER_FLUSH_PERIOD);
+
+Exit:
+    if (EFI_ERROR (status)) {
+        if (LcdifShadowExitBootServicesEvent != NULL) {
+            gBS->CloseEvent (LcdifShadowExitBootServicesEvent);
+            LcdifShadowExitBootServicesEvent = NULL;
+        }
+        if (LcdifShadowFlushEvent != NULL) {
+            gBS->CloseEvent (LcdifShadowFlushEvent);
+            LcdifShadowFlushEvent = NULL;
+        }
+        ImxDisableShadowFrameBuffer ();
+    }
+    return status;
+}
+
 //
 // GOP driver entry point
 //
@@ -308,6 +399,15 @@ LcdifGopInitialize (
         goto Exit;
     }
 
+    if (FeaturePcdGet (PcdShadowFrameBufferEnable)) {
+        if (EFI_ERROR (LcdifEnableShadowFrameBuffer ())) {
+            //
+            // Not fatal, Blt keeps operating on the frame buffer directly
+            //
+            DEBUG ((DEBUG_WARN, "Fail to enable shadow frame buffer\n"));
+        }
+    }
+
     status = EFI_SUCCESS;
 Exit:
 
@@ -405,76 +505,28 @@ LcdifGopBlt (
     IN UINTN Delta OPTIONAL
     )
 {
-    DEBUG ((DEBUG_VERBOSE, "entering LcdifGopBlt\n"));
-    UINT32 *frameBuffer;
-    UINT32 frameWidth;
-    UINT32 frameOffset;
-    UINT32 bufferOffset;
-    UINT32 bufferWidth;
-    UINT32 i;
-
-    frameBuffer = (UINT32 *) (UINTN) LcdifGopProtocolMode.FrameBufferBase;
-    frameWidth = LcdifGopModeInfo.HorizontalResolution;
-
-    if (Delta == 0) {
-        bufferWidth = Width;
-    } else {
-        bufferWidth = Delta / PIXEL_BYTES;
-    }
-
-    if (BltOperation == EfiBltVideoFill) {
-
-        frameOffset = frameWidth * DestinationY + DestinationX;
-        for (i = DestinationY; i < DestinationY + Height; i++) {
-            SetMem32 (frameBuffer + frameOffset,
-                     Width * PIXEL_BYTES,
-                     *(UINT32 *)BltBuffer
-                     );
-            frameOffset += frameWidth;
-        }
-    } else if (BltOperation == EfiBltVideoToBltBuffer) {
-
-        frameOffset = frameWidth * SourceY + SourceX;
-        bufferOffset = bufferWidth * DestinationY + DestinationX;
-
-        for (i = SourceY; i < SourceY + Height; i++) {
-            CopyMem (BltBuffer + bufferOffset,
-                    frameBuffer + frameOffset,
-                    Width * PIXEL_BYTES);
-            frameOffset += frameWidth;
-            bufferOffset += bufferWidth;
-        }
-    } else if (BltOperation == EfiBltBufferToVideo) {
-
-        frameOffset = frameWidth * DestinationY + DestinationX;
-        bufferOffset = bufferWidth * SourceY + SourceX;
-
-        for (i = SourceY; i < SourceY + Height; i++) {
-            CopyMem (frameBuffer + frameOffset,
-                    BltBuffer + bufferOffset,
-                    Width * PIXEL_BYTES);
-            frameOffset += frameWidth;
-            bufferOffset += bufferWidth;
-        }
-
-    } else if (BltOperation == EfiBltVideoToVideo) {
-
-        frameOffset = frameWidth * DestinationY + DestinationX;
-        bufferOffset = frameWidth * SourceY + SourceX;
+    EFI_STATUS status;
+    EFI_TPL oldTpl;
 
-        for (i = SourceY; i < SourceY + Height; i++) {
-            CopyMem (frameBuffer + frameOffset,
-                    frameBuffer + bufferOffset,
-                    Width * PIXEL_BYTES);
-            frameOffset += frameWidth;
-            bufferOffset += frameWidth;
-        }
+    DEBUG ((DEBUG_VERBOSE, "entering LcdifGopBlt\n"));
 
-    } else {
-        DEBUG ((EFI_D_ERROR, "LcdifGopBlt:LcdifGopBlt not implemented %d\n", BltOperation));
-        return EFI_INVALID_PARAMETER;
-    }
+    //
+    // Keep the shadow flush timer from running in the middle of a Blt
+    //
+    oldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    status = VidGopBlt (
+        This,
+        BltBuffer,
+        BltOperation,
+        SourceX,
+        SourceY,
+        DestinationX,
+        DestinationY,
+        Width,
+        Height,
+        Delta);
+    gBS->RestoreTPL (oldTpl);
 
-    return EFI_SUCCESS;
+    return status;
 }
 
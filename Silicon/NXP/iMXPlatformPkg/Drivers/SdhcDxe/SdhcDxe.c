@@ -55,6 +55,8 @@ DumpState (
   USDHC_WTMK_LVL_REG      WtmkLvl;
   UINT32                  VendSpec;
   UINT32                  VendSpec2;
+  UINT32                  AdmaErrStatus;
+  UINT32                  AdmaSysAddr;
 
   Reg = SdhcCtx->RegistersBase;
   BlkAtt.AsUint32 = MmioRead32 ((UINTN)&Reg->BLK_ATT);
@@ -70,6 +72,8 @@ DumpState (
   VendSpec2 = MmioRead32 ((UINTN)&Reg->VEND_SPEC2);
   IntStatus.AsUint32 = MmioRead32 ((UINTN)&Reg->INT_STATUS);
   PresState.AsUint32 = MmioRead32 ((UINTN)&Reg->PRES_STATE);
+  AdmaErrStatus = MmioRead32 ((UINTN)&Reg->ADMA_ERR_STATUS);
+  AdmaSysAddr = MmioRead32 ((UINTN)&Reg->ADMA_SYS_ADDR);
 
   LOG_INFO (
     " - BLK_ATT\t:0x%08x BLKSIZE:0x%x BLKCNT:0x%08x",
@@ -124,9 +128,11 @@ DumpState (
   LOG_INFO (" - VEND_SPEC\t:0x%08x", VendSpec);
   LOG_INFO (" - MMC_BOOT\t:0x%08x", MmcBoot);
   LOG_INFO (" - VEND_SPEC2\t:0x%08x", VendSpec2);
+  LOG_INFO (" - ADMA_ERR_STATUS\t:0x%08x", AdmaErrStatus);
+  LOG_INFO (" - ADMA_SYS_ADDR\t:0x%08x", AdmaSysAddr);
 
   LOG_INFO (
-    " - INT_STATUS\t:0x%08x CC:%d TC:%d BWR:%d BRR:%d CTOE:%d CCE:%d CEBE:%d CIE:%d DTOE:%d DCE:%d DEBE:%d",
+    " - INT_STATUS\t:0x%08x CC:%d TC:%d BWR:%d BRR:%d CTOE:%d CCE:%d CEBE:%d CIE:%d DTOE:%d DCE:%d DEBE:%d DMAE:%d",
     IntStatus.AsUint32,
     IntStatus.Fields.CC,
     IntStatus.Fields.TC,
@@ -138,7 +144,8 @@ DumpState (
     IntStatus.Fields.CIE,
     IntStatus.Fields.DTOE,
     IntStatus.Fields.DCE,
-    IntStatus.Fields.DEBE);
+    IntStatus.Fields.DEBE,
+    IntStatus.Fields.DMAE);
 
   LOG_INFO (
     " - PRES_STATE\t:0x%08x CIHB:%d CDIHB:%d DLA:%d WTA:%d RTA:%d BWEN:%d BREN:%d CINST:%d DLSL:0x%x",
@@ -326,6 +333,46 @@ WaitForCmdResponse (
   }
 }
 
+EFI_STATUS
+WaitForCmdAndTransferComplete (
+  IN USDHC_PRIVATE_CONTEXT *SdhcCtx
+  )
+{
+  USDHC_REGISTERS       *Reg;
+  USDHC_INT_STATUS_REG  IntStatus;
+  UINT32                Retry;
+
+  CONST UINT32 ErrorMask = USDHC_INT_STATUS_ERROR | USDHC_INT_STATUS_DMA_ERROR;
+
+  Reg = SdhcCtx->RegistersBase;
+  IntStatus.AsUint32 = MmioRead32 ((UINTN)&Reg->INT_STATUS);
+  Retry = USDHC_POLL_RETRY_COUNT;
+
+  // The DMA engine moves the data on its own, all that is left is to wait for
+  // the last block to make it to/from the card
+  while (!(IntStatus.Fields.CC && IntStatus.Fields.TC) &&
+         !(IntStatus.AsUint32 & ErrorMask) &&
+         Retry) {
+    gBS->Stall (USDHC_POLL_WAIT_US);
+    --Retry;
+    IntStatus.AsUint32 = MmioRead32 ((UINTN)&Reg->INT_STATUS);
+  }
+
+  if (IntStatus.AsUint32 & ErrorMask) {
+    LOG_ERROR ("Error detected");
+    DumpState (SdhcCtx);
+    return EFI_DEVICE_ERROR;
+  } else if (IntStatus.Fields.CC && IntStatus.Fields.TC) {
+    MmioWrite32 ((UINTN)&Reg->INT_STATUS, IntStatus.AsUint32);
+    return EFI_SUCCESS;
+  } else {
+    ASSERT (!Retry);
+    LOG_ERROR ("Time-out waiting on command and transfer completion");
+    DumpState (SdhcCtx);
+    return EFI_TIMEOUT;
+  }
+}
+
 EFI_STATUS
 SdhcSetBusWidth (
   IN EFI_SDHC_PROTOCOL *This,
@@ -565,14 +612,14 @@ SdhcIsReadOnly (
 }
 
 EFI_STATUS
-SdhcSendCommand (
-  IN EFI_SDHC_PROTOCOL *This,
+SdhcSendCommandInternal (
+  IN USDHC_PRIVATE_CONTEXT *SdhcCtx,
   IN CONST SD_COMMAND *Cmd,
   IN UINT32 Argument,
-  IN OPTIONAL CONST SD_COMMAND_XFR_INFO *XfrInfo
+  IN OPTIONAL CONST SD_COMMAND_XFR_INFO *XfrInfo,
+  IN BOOLEAN UseDma
   )
 {
-  USDHC_PRIVATE_CONTEXT   *SdhcCtx;
   USDHC_REGISTERS         *Reg;
   USDHC_BLK_ATT_REG       BlkAtt;
   USDHC_CMD_XFR_TYP_REG   CmdXfrTyp;
@@ -581,15 +628,8 @@ SdhcSendCommand (
   USDHC_WTMK_LVL_REG      WtmkLvl;
   UINT32                  WtmkThreshold;
 
-  SdhcCtx = (USDHC_PRIVATE_CONTEXT *)This->PrivateContext;
   Reg = SdhcCtx->RegistersBase;
 
-  LOG_TRACE (
-    "SdhcSendCommand(%cCMD%d, %08x)",
-    ((Cmd->Class == SdCommandClassApp) ? 'A' : ' '),
-    (UINT32)Cmd->Index,
-    Argument);
-
   Status = WaitForCmdAndOrDataLine (SdhcCtx, Cmd);
   if (Status != EFI_SUCCESS) {
     LOG_ERROR ("SdhcWaitForCmdAndDataLine failed");
@@ -629,21 +669,37 @@ SdhcSendCommand (
       MixCtrl.Fields.BCEN = 1;
     }
 
+    if (UseDma) {
+      MixCtrl.Fields.DMAEN = 1;
+    }
+
     MmioWrite32 ((UINTN)&Reg->MIX_CTRL, MixCtrl.AsUint32);
 
     WtmkLvl.AsUint32 = 0;
 
     WtmkThreshold = USDHC_BLOCK_LENGTH_BYTES / 4;
+    if (UseDma) {
+      // The DMA engine reads/writes the FIFO in bursts, a watermark matching
+      // the burst length keeps it from stalling on a partially filled FIFO
+      WtmkThreshold = USDHC_ADMA2_BURST_LENGTH;
+    }
+
     if (Cmd->TransferDirection == SdTransferDirectionRead) {
       if (WtmkThreshold > USDHC_WTMK_RD_WML_MAX_VAL) {
         WtmkThreshold = USDHC_WTMK_RD_WML_MAX_VAL;
       }
       WtmkLvl.Fields.RD_WML = WtmkThreshold;
+      if (UseDma) {
+        WtmkLvl.Fields.RD_BRST_LEN = WtmkThreshold;
+      }
     } else {
       if (WtmkThreshold > USDHC_WTMK_WR_WML_MAX_VAL) {
         WtmkThreshold = USDHC_WTMK_WR_WML_MAX_VAL;
       }
       WtmkLvl.Fields.WR_WML = WtmkThreshold;
+      if (UseDma) {
+        WtmkLvl.Fields.WR_BRST_LEN = WtmkThreshold;
+      }
     }
 
     MmioWrite32 ((UINTN)&Reg->WTMK_LVL, WtmkLvl.AsUint32);
@@ -699,6 +755,12 @@ SdhcSendCommand (
   MmioWrite32 ((UINTN)&Reg->CMD_ARG, Argument);
   MmioWrite32 ((UINTN)&Reg->CMD_XFR_TYP, CmdXfrTyp.AsUint32);
 
+  // A DMA transfer can complete before the command completion is seen, both
+  // are collected at once by WaitForCmdAndTransferComplete
+  if (UseDma) {
+    return EFI_SUCCESS;
+  }
+
   Status = WaitForCmdResponse (SdhcCtx);
   if (EFI_ERROR (Status)) {
     LOG_ERROR ("WaitForCmdResponse() failed. %r", Status);
@@ -708,6 +770,159 @@ SdhcSendCommand (
   return EFI_SUCCESS;
 }
 
+EFI_STATUS
+SdhcSendCommand (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN OPTIONAL CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  USDHC_PRIVATE_CONTEXT   *SdhcCtx;
+
+  SdhcCtx = (USDHC_PRIVATE_CONTEXT *)This->PrivateContext;
+
+  LOG_TRACE (
+    "SdhcSendCommand(%cCMD%d, %08x)",
+    ((Cmd->Class == SdCommandClassApp) ? 'A' : ' '),
+    (UINT32)Cmd->Index,
+    Argument);
+
+  return SdhcSendCommandInternal (SdhcCtx, Cmd, Argument, XfrInfo, FALSE);
+}
+
+EFI_STATUS
+SdhcSendDmaCommand (
+  IN EFI_SDHC_PROTOCOL *This,
+  IN CONST SD_COMMAND *Cmd,
+  IN UINT32 Argument,
+  IN CONST SD_COMMAND_XFR_INFO *XfrInfo
+  )
+{
+  USDHC_REGISTERS           *Reg;
+  USDHC_PRIVATE_CONTEXT     *SdhcCtx;
+  USDHC_ADMA_ERR_STATUS_REG AdmaErrStatus;
+  USDHC_ADMA2_DESCRIPTOR    *Desc;
+  EFI_PHYSICAL_ADDRESS      DeviceAddress;
+  UINTN                     DescLength;
+  UINTN                     LengthInBytes;
+  UINTN                     MappedBytes;
+  VOID                      *Mapping;
+  DMA_MAP_OPERATION         MapOperation;
+  USDHC_PROT_CTRL_REG       ProtCtrl;
+  UINTN                     RemainingBytes;
+  EFI_STATUS                Status;
+
+  SdhcCtx = (USDHC_PRIVATE_CONTEXT *)This->PrivateContext;
+  Reg = SdhcCtx->RegistersBase;
+
+  ASSERT (XfrInfo != NULL);
+  ASSERT (XfrInfo->Buffer != NULL);
+
+  LOG_TRACE (
+    "SdhcSendDmaCommand(%cCMD%d, %08x, Blocks: %d)",
+    ((Cmd->Class == SdCommandClassApp) ? 'A' : ' '),
+    (UINT32)Cmd->Index,
+    Argument,
+    XfrInfo->BlockCount);
+
+  if (!SdhcCtx->Adma2Enabled) {
+    return EFI_UNSUPPORTED;
+  }
+
+  LengthInBytes = (UINTN)XfrInfo->BlockSize * XfrInfo->BlockCount;
+  if ((LengthInBytes % USDHC_ADMA2_ADDRESS_ALIGN) != 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (Cmd->TransferDirection == SdTransferDirectionRead) {
+    MapOperation = MapOperationBusMasterWrite;
+  } else {
+    ASSERT (Cmd->TransferDirection == SdTransferDirectionWrite);
+    MapOperation = MapOperationBusMasterRead;
+  }
+
+  // Map the caller buffer for DMA, the DMA lib takes care of cache maintenance
+  // and bounce buffering buffers that aren't suitable for device access
+  MappedBytes = LengthInBytes;
+  Status = DmaMap (
+             MapOperation,
+             XfrInfo->Buffer,
+             &MappedBytes,
+             &DeviceAddress,
+             &Mapping);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("DmaMap() failed. %r", Status);
+    return EFI_UNSUPPORTED;
+  }
+
+  // ADMA2 is 32-bit addressing only and requires word aligned buffers
+  if ((MappedBytes != LengthInBytes) ||
+      ((DeviceAddress + LengthInBytes) > MAX_UINT32) ||
+      ((DeviceAddress % USDHC_ADMA2_ADDRESS_ALIGN) != 0)) {
+    DmaUnmap (Mapping);
+    return EFI_UNSUPPORTED;
+  }
+
+  // Build the descriptor table, one descriptor per contiguous chunk
+  Desc = SdhcCtx->Adma2DescTable;
+  RemainingBytes = LengthInBytes;
+  while (RemainingBytes > 0) {
+    ASSERT (Desc < SdhcCtx->Adma2DescTable + USDHC_ADMA2_DESC_COUNT);
+    DescLength = MIN (RemainingBytes, USDHC_ADMA2_MAX_DESC_LENGTH);
+    Desc->Address = (UINT32)DeviceAddress;
+    Desc->Length = (UINT16)DescLength;
+    Desc->Attributes = USDHC_ADMA2_ATTR_VALID | USDHC_ADMA2_ATTR_ACT_TRAN;
+    DeviceAddress += DescLength;
+    RemainingBytes -= DescLength;
+    if (RemainingBytes == 0) {
+      Desc->Attributes |= USDHC_ADMA2_ATTR_END;
+    }
+    ++Desc;
+  }
+
+  // The descriptor table lives in uncached memory, make sure all its writes
+  // land before the DMA engine is kicked off
+  MemoryFence ();
+
+  ProtCtrl.AsUint32 = MmioRead32 ((UINTN)&Reg->PROT_CTRL);
+  ProtCtrl.Fields.DMASEL = USDHC_PROT_CTRL_DMASEL_ADMA2;
+  MmioWrite32 ((UINTN)&Reg->PROT_CTRL, ProtCtrl.AsUint32);
+  MmioWrite32 (
+    (UINTN)&Reg->ADMA_SYS_ADDR,
+    (UINT32)SdhcCtx->Adma2DescTableDeviceAddress);
+
+  Status = SdhcSendCommandInternal (SdhcCtx, Cmd, Argument, XfrInfo, TRUE);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("SdhcSendCommandInternal() failed. %r", Status);
+    goto Exit;
+  }
+
+  Status = WaitForCmdAndTransferComplete (SdhcCtx);
+  if (EFI_ERROR (Status)) {
+    AdmaErrStatus.AsUint32 = MmioRead32 ((UINTN)&Reg->ADMA_ERR_STATUS);
+    LOG_ERROR (
+      "WaitForCmdAndTransferComplete() failed. %r ADMAES:%d ADMALME:%d ADMADCE:%d",
+      Status,
+      AdmaErrStatus.Fields.ADMAES,
+      AdmaErrStatus.Fields.ADMALME,
+      AdmaErrStatus.Fields.ADMADCE);
+    goto Exit;
+  }
+
+Exit:
+  // Leave the SDHC in PIO mode, which is what SdhcSendCommand assumes
+  ProtCtrl.AsUint32 = MmioRead32 ((UINTN)&Reg->PROT_CTRL);
+  ProtCtrl.Fields.DMASEL = USDHC_PROT_CTRL_DMASEL_NO_DMA;
+  MmioWrite32 ((UINTN)&Reg->PROT_CTRL, ProtCtrl.AsUint32);
+
+  // Unmapping a read completes the cache maintenance and copies back the
+  // bounce buffer if any, it must happen after the DMA engine is done
+  DmaUnmap (Mapping);
+
+  return Status;
+}
+
 EFI_STATUS
 SdhcReceiveResponse (
   IN EFI_SDHC_PROTOCOL *This,
@@ -1021,12 +1236,81 @@ SdhcSoftwareReset (
   return EFI_SUCCESS;
 }
 
+VOID
+SdhcFreeAdma2DescTable (
+  IN USDHC_PRIVATE_CONTEXT *SdhcCtx
+  )
+{
+  if (SdhcCtx->Adma2DescTableMapping != NULL) {
+    DmaUnmap (SdhcCtx->Adma2DescTableMapping);
+    SdhcCtx->Adma2DescTableMapping = NULL;
+  }
+
+  if (SdhcCtx->Adma2DescTable != NULL) {
+    DmaFreeBuffer (
+      EFI_SIZE_TO_PAGES (USDHC_ADMA2_DESC_COUNT * sizeof (USDHC_ADMA2_DESCRIPTOR)),
+      SdhcCtx->Adma2DescTable);
+    SdhcCtx->Adma2DescTable = NULL;
+  }
+
+  SdhcCtx->Adma2Enabled = FALSE;
+}
+
+EFI_STATUS
+SdhcAllocateAdma2DescTable (
+  IN USDHC_PRIVATE_CONTEXT *SdhcCtx
+  )
+{
+  UINTN         DescTableSize;
+  EFI_STATUS    Status;
+
+  DescTableSize = USDHC_ADMA2_DESC_COUNT * sizeof (USDHC_ADMA2_DESCRIPTOR);
+
+  // The descriptor table is fetched by the DMA engine, allocate it from
+  // uncached memory so that it needs no cache maintenance per transfer
+  Status = DmaAllocateBuffer (
+             EfiBootServicesData,
+             EFI_SIZE_TO_PAGES (DescTableSize),
+             (VOID **)&SdhcCtx->Adma2DescTable);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("DmaAllocateBuffer() failed. %r", Status);
+    goto Exit;
+  }
+
+  Status = DmaMap (
+             MapOperationBusMasterCommonBuffer,
+             SdhcCtx->Adma2DescTable,
+             &DescTableSize,
+             &SdhcCtx->Adma2DescTableDeviceAddress,
+             &SdhcCtx->Adma2DescTableMapping);
+  if (EFI_ERROR (Status)) {
+    LOG_ERROR ("DmaMap() failed. %r", Status);
+    goto Exit;
+  }
+
+  if ((SdhcCtx->Adma2DescTableDeviceAddress + DescTableSize) > MAX_UINT32) {
+    LOG_ERROR ("ADMA2 descriptor table is not 32-bit addressable");
+    Status = EFI_UNSUPPORTED;
+    goto Exit;
+  }
+
+  SdhcCtx->Adma2Enabled = TRUE;
+
+Exit:
+  if (EFI_ERROR (Status)) {
+    SdhcFreeAdma2DescTable (SdhcCtx);
+  }
+
+  return Status;
+}
+
 VOID
 SdhcCleanup (
   IN EFI_SDHC_PROTOCOL *This
   )
 {
   if (This->PrivateContext != NULL) {
+    SdhcFreeAdma2DescTable ((USDHC_PRIVATE_CONTEXT *)This->PrivateContext);
     FreePool (This->PrivateContext);
     This->PrivateContext = NULL;
   }
@@ -1065,7 +1349,8 @@ static EFI_SDHC_PROTOCOL mSdhcProtocolTemplate = {
   SdhcReceiveResponse,
   SdhcReadBlockData,
   SdhcWriteBlockData,
-  SdhcCleanup
+  SdhcCleanup,
+  SdhcSendDmaCommand
 };
 
 EFI_STATUS
@@ -1077,6 +1362,7 @@ SdhcDeviceRegister (
   IN USDHC_SIGNAL_SOURCE WriteProtectSignal
   )
 {
+  USDHC_HOST_CTRL_CAP_REG Caps;
   USDHC_PRIVATE_CONTEXT   *SdhcCtx;
   EFI_SDHC_PROTOCOL       *SdhcProtocol;
   EFI_STATUS              Status;
@@ -1143,6 +1429,21 @@ SdhcDeviceRegister (
       SdhcCtx->WriteProtectGpioPin.IoNumber);
   }
 
+  // Use ADMA2 for data transfers if supported, otherwise keep PIO only
+  Caps.AsUint32 = MmioRead32 ((UINTN)&SdhcCtx->RegistersBase->HOST_CTRL_CAP);
+  if (FixedPcdGetBool (PcdSdhcDmaEnable) && Caps.Fields.ADMAS) {
+    Status = SdhcAllocateAdma2DescTable (SdhcCtx);
+    if (EFI_ERROR (Status)) {
+      LOG_ERROR ("Failed to setup ADMA2, falling back to PIO. %r", Status);
+    }
+  }
+
+  if (!SdhcCtx->Adma2Enabled) {
+    SdhcProtocol->SendDmaCommand = NULL;
+  }
+
+  LOG_INFO ("Data transfer mode: %a", SdhcCtx->Adma2Enabled ? "ADMA2" : "PIO");
+
   Status = gBS->InstallMultipleProtocolInterfaces (
              &SdhcCtx->SdhcProtocolHandle,
              &gEfiSdhcProtocolGuid,
@@ -1158,6 +1459,7 @@ Exit:
     LOG_ERROR ("Failed to register and initialize uSDHC%d", SdhcId);
 
     if (SdhcProtocol != NULL && SdhcProtocol->PrivateContext != NULL) {
+      SdhcFreeAdma2DescTable (SdhcProtocol->PrivateContext);
       FreePool (SdhcProtocol->PrivateContext);
       SdhcProtocol->PrivateContext = NULL;
     }
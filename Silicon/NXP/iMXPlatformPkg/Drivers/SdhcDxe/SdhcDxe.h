@@ -44,6 +44,10 @@ typedef struct {
   USDHC_SIGNAL_SOURCE WriteProtectSignal;
   IMX_GPIO_PIN CardDetectGpioPin;
   IMX_GPIO_PIN WriteProtectGpioPin;
+  BOOLEAN Adma2Enabled;
+  USDHC_ADMA2_DESCRIPTOR *Adma2DescTable;
+  EFI_PHYSICAL_ADDRESS Adma2DescTableDeviceAddress;
+  VOID *Adma2DescTableMapping;
 } USDHC_PRIVATE_CONTEXT;
 
 #define LOG_FMT_HELPER(FMT, ...) \
@@ -78,4 +82,16 @@ typedef struct {
 
 #define USDHC_BLOCK_LENGTH_BYTES               512
 
+// Max data length a single ADMA2 descriptor is allowed to cover. Keep it
+// block aligned so that a descriptor never splits a block
+#define USDHC_ADMA2_MAX_DESC_LENGTH     0xFE00
+
+// Enough ADMA2 descriptors to cover a max block count transfer
+#define USDHC_ADMA2_DESC_COUNT \
+    (((USDHC_MAX_BLOCK_COUNT * USDHC_BLOCK_LENGTH_BYTES) + \
+      USDHC_ADMA2_MAX_DESC_LENGTH - 1) / USDHC_ADMA2_MAX_DESC_LENGTH)
+
+// ADMA2 DMA burst length in 32-bit words
+#define USDHC_ADMA2_BURST_LENGTH        16
+
 #endif // _SDHC_DXE_H_
@@ -151,5 +151,49 @@ VidGopBlt (
   IN UINTN                              Delta OPTIONAL
   );
 
+/**
+  Redirect VidGopBlt for a GOP instance to a cacheable shadow copy of its
+  frame buffer. Blt operations then run at cached memory speed and only
+  record the rectangle they modified, the scan-out buffer is updated by
+  ImxFlushShadowFrameBuffer. Only a single GOP instance can be shadowed.
+
+  Direct writes to FrameBufferBase bypass the shadow and may be overwritten
+  by the next flush, so the shadow must be disabled before control of the
+  frame buffer is handed over, e.g. at ExitBootServices.
+
+  @param[in]    This  GOP instance to shadow.
+
+  @retval   EFI_SUCCESS             Blt now operates on the shadow buffer.
+  @retval   EFI_INVALID_PARAMETER   GOP mode information is missing.
+  @retval   EFI_ALREADY_STARTED     A GOP instance is already shadowed.
+  @retval   EFI_OUT_OF_RESOURCES    The shadow buffer could not be allocated.
+
+**/
+EFI_STATUS
+ImxEnableShadowFrameBuffer (
+  IN EFI_GRAPHICS_OUTPUT_PROTOCOL   *This
+  );
+
+/**
+  Copy the part of the shadow buffer modified since the last flush to the
+  scan-out buffer. Must not run concurrently with VidGopBlt.
+
+**/
+VOID
+ImxFlushShadowFrameBuffer (
+  VOID
+  );
+
+/**
+  Flush the shadow buffer and let VidGopBlt operate on the scan-out buffer
+  again. The shadow buffer is not freed so this can be called from an
+  ExitBootServices notification.
+
+**/
+VOID
+ImxDisableShadowFrameBuffer (
+  VOID
+  );
+
 #endif // __IMX_DISPLAY_H__
 
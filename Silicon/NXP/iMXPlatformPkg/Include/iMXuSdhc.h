@@ -232,6 +232,9 @@ typedef union {
 #define USDHC_PROT_CTRL_DTW_4BIT             0x1
 #define USDHC_PROT_CTRL_DTW_8BIT             0x2
 #define USDHC_PROT_CTRL_EMODE_LITTLE_ENDIAN  0x2
+#define USDHC_PROT_CTRL_DMASEL_NO_DMA        0x0
+#define USDHC_PROT_CTRL_DMASEL_ADMA1         0x1
+#define USDHC_PROT_CTRL_DMASEL_ADMA2         0x2
 
 //
 // Interrupt Status uSDHCx_INT_STATUS fields
@@ -272,6 +275,37 @@ typedef union {
 
 #define USDHC_INT_STATUS_CMD_ERROR   (BIT16 | BIT17 | BIT18 | BIT19)
 #define USDHC_INT_STATUS_DATA_ERROR  (BIT20 | BIT21 | BIT22)
+#define USDHC_INT_STATUS_DMA_ERROR   (BIT28)
 #define USDHC_INT_STATUS_ERROR       (USDHC_INT_STATUS_CMD_ERROR | USDHC_INT_STATUS_DATA_ERROR)
 
+//
+// ADMA Error Status uSDHCx_ADMA_ERR_STATUS fields
+//
+typedef union {
+  UINT32 AsUint32;
+  struct {
+    UINT32 ADMAES       : 2; // 0:1
+    UINT32 ADMALME      : 1; // 2
+    UINT32 ADMADCE      : 1; // 3
+    UINT32 _reserved0   : 28; // 4:31
+  } Fields;
+} USDHC_ADMA_ERR_STATUS_REG;
+
+//
+// ADMA2 descriptor table entry
+//
+typedef struct {
+  UINT16 Attributes;
+  UINT16 Length;
+  UINT32 Address;
+} USDHC_ADMA2_DESCRIPTOR;
+
+#define USDHC_ADMA2_ATTR_VALID      BIT0
+#define USDHC_ADMA2_ATTR_END        BIT1
+#define USDHC_ADMA2_ATTR_INT        BIT2
+#define USDHC_ADMA2_ATTR_ACT_TRAN   BIT5
+
+// ADMA2 requires 4-byte aligned data buffers and descriptor lengths
+#define USDHC_ADMA2_ADDRESS_ALIGN   4
+
 #endif // __IMX_USDHC_H__
@@ -14,6 +14,18 @@
 
 #include <iMXDisplay.h>
 
+typedef struct {
+  EFI_GRAPHICS_OUTPUT_PROTOCOL  *Gop;
+  UINT32                        *Buffer;
+  BOOLEAN                       Dirty;
+  UINTN                         DirtyLeft;
+  UINTN                         DirtyTop;
+  UINTN                         DirtyRight;
+  UINTN                         DirtyBottom;
+} IMX_SHADOW_FRAME_BUFFER;
+
+STATIC IMX_SHADOW_FRAME_BUFFER mShadowFrameBuffer;
+
 /**
   Convert detailed timing descriptor to display timing format
 
@@ -261,6 +273,9 @@ VidGopBlt (
 
   Status = EFI_SUCCESS;
   FrameBuffer = (UINT32*)((UINTN)(This->Mode->FrameBufferBase));
+  if (This == mShadowFrameBuffer.Gop) {
+    FrameBuffer = mShadowFrameBuffer.Buffer;
+  }
   FrameWidth = This->Mode->Info->HorizontalResolution;
   if (Delta == 0) {
     BufferWidth = Width;
@@ -323,7 +338,128 @@ VidGopBlt (
               __FUNCTION__, BltOperation));
       Status = EFI_INVALID_PARAMETER;
   }
+
+  // Record the modified rectangle for the next shadow flush
+  if ((This == mShadowFrameBuffer.Gop) &&
+      !EFI_ERROR (Status) &&
+      (BltOperation != EfiBltVideoToBltBuffer) &&
+      (Width != 0) &&
+      (Height != 0)) {
+    if (!mShadowFrameBuffer.Dirty) {
+      mShadowFrameBuffer.DirtyLeft = DestinationX;
+      mShadowFrameBuffer.DirtyTop = DestinationY;
+      mShadowFrameBuffer.DirtyRight = DestinationX + Width;
+      mShadowFrameBuffer.DirtyBottom = DestinationY + Height;
+      mShadowFrameBuffer.Dirty = TRUE;
+    } else {
+      mShadowFrameBuffer.DirtyLeft =
+        MIN (mShadowFrameBuffer.DirtyLeft, DestinationX);
+      mShadowFrameBuffer.DirtyTop =
+        MIN (mShadowFrameBuffer.DirtyTop, DestinationY);
+      mShadowFrameBuffer.DirtyRight =
+        MAX (mShadowFrameBuffer.DirtyRight, DestinationX + Width);
+      mShadowFrameBuffer.DirtyBottom =
+        MAX (mShadowFrameBuffer.DirtyBottom, DestinationY + Height);
+    }
+  }
+
 Exit:
   return Status;
 }
 
+EFI_STATUS
+ImxEnableShadowFrameBuffer (
+  IN EFI_GRAPHICS_OUTPUT_PROTOCOL   *This
+  )
+{
+  UINTN   FrameBufferSize;
+  VOID    *Buffer;
+
+  if ((This == NULL) || (This->Mode == NULL) || (This->Mode->Info == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (mShadowFrameBuffer.Gop != NULL) {
+    return EFI_ALREADY_STARTED;
+  }
+
+  FrameBufferSize = This->Mode->Info->HorizontalResolution *
+                    This->Mode->Info->VerticalResolution *
+                    BYTES_PER_PIXEL;
+
+  Buffer = AllocatePages (EFI_SIZE_TO_PAGES (FrameBufferSize));
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  // Start from what is currently displayed
+  CopyMem (
+    Buffer,
+    (VOID *)(UINTN)This->Mode->FrameBufferBase,
+    FrameBufferSize
+    );
+
+  mShadowFrameBuffer.Buffer = Buffer;
+  mShadowFrameBuffer.Dirty = FALSE;
+  mShadowFrameBuffer.Gop = This;
+
+  DEBUG ((DEBUG_INFO, "%a: Shadow frame buffer at %p\n",
+          __FUNCTION__, Buffer));
+
+  return EFI_SUCCESS;
+}
+
+VOID
+ImxFlushShadowFrameBuffer (
+  VOID
+  )
+{
+  UINT32  *FrameBuffer;
+  UINTN   FrameWidth;
+  UINTN   Offset;
+  UINTN   Row;
+
+  if ((mShadowFrameBuffer.Gop == NULL) || !mShadowFrameBuffer.Dirty) {
+    return;
+  }
+
+  FrameBuffer = (UINT32 *)(UINTN)mShadowFrameBuffer.Gop->Mode->FrameBufferBase;
+  FrameWidth = mShadowFrameBuffer.Gop->Mode->Info->HorizontalResolution;
+  Offset = FrameWidth * mShadowFrameBuffer.DirtyTop +
+           mShadowFrameBuffer.DirtyLeft;
+
+  if ((mShadowFrameBuffer.DirtyLeft == 0) &&
+      (mShadowFrameBuffer.DirtyRight == FrameWidth)) {
+    // Full width rows are contiguous, copy them in one go
+    CopyMem (
+      FrameBuffer + Offset,
+      mShadowFrameBuffer.Buffer + Offset,
+      (mShadowFrameBuffer.DirtyBottom - mShadowFrameBuffer.DirtyTop) *
+      FrameWidth * BYTES_PER_PIXEL
+      );
+  } else {
+    for (Row = mShadowFrameBuffer.DirtyTop;
+         Row < mShadowFrameBuffer.DirtyBottom;
+         Row++) {
+      CopyMem (
+        FrameBuffer + Offset,
+        mShadowFrameBuffer.Buffer + Offset,
+        (mShadowFrameBuffer.DirtyRight - mShadowFrameBuffer.DirtyLeft) *
+        BYTES_PER_PIXEL
+        );
+      Offset += FrameWidth;
+    }
+  }
+
+  mShadowFrameBuffer.Dirty = FALSE;
+}
+
+VOID
+ImxDisableShadowFrameBuffer (
+  VOID
+  )
+{
+  ImxFlushShadowFrameBuffer ();
+  mShadowFrameBuffer.Gop = NULL;
+}
+
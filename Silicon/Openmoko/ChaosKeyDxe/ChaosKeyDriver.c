@@ -140,6 +140,88 @@ GetInfo (
 }
 
 
+/**
+  Perform a single bulk IN transfer of up to one endpoint's worth of data.
+
+  @param[in]      ChaosKey        The device to read from.
+  @param[out]     Buffer          The buffer receiving the data, at least
+                                  EndpointSize bytes long.
+  @param[in,out]  Length          On output, the number of bytes received.
+  @param[out]     Result          The USB transfer status.
+
+  @retval EFI_SUCCESS             Data was received.
+  @retval EFI_NOT_READY           The transfer timed out.
+  @retval EFI_DEVICE_ERROR        The transfer failed.
+
+**/
+STATIC
+EFI_STATUS
+ChaosKeyTransfer (
+  IN      CHAOSKEY_DEV      *ChaosKey,
+  OUT     UINT8             *Buffer,
+  OUT     UINTN             *Length,
+  OUT     UINT32            *Result
+  )
+{
+  EFI_STATUS        Status;
+
+  *Length = ChaosKey->EndpointSize;
+  Status = ChaosKey->UsbIo->UsbBulkTransfer (ChaosKey->UsbIo,
+                                             ChaosKey->EndpointAddress,
+                                             Buffer,
+                                             Length,
+                                             CHAOSKEY_TIMEOUT,
+                                             Result);
+  if (Status == EFI_TIMEOUT) {
+    return EFI_NOT_READY;
+  } else if (EFI_ERROR (Status)) {
+    return EFI_DEVICE_ERROR;
+  }
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Timer notification function keeping the entropy pool filled, so that
+  GetRNG() requests can be completed from memory.
+
+  @param[in]  Event               The refill timer event.
+  @param[in]  Context             The CHAOSKEY_DEV instance.
+
+**/
+STATIC
+VOID
+EFIAPI
+RefillPool (
+  IN EFI_EVENT          Event,
+  IN VOID               *Context
+  )
+{
+  CHAOSKEY_DEV      *ChaosKey;
+  UINTN             Transfers;
+  UINTN             OutSize;
+  UINT32            Result;
+
+  ChaosKey = Context;
+
+  for (Transfers = 0; Transfers < CHAOSKEY_REFILL_TRANSFERS; Transfers++) {
+    if (CHAOSKEY_POOL_SIZE - ChaosKey->PoolCount < ChaosKey->EndpointSize) {
+      break;
+    }
+
+    if (EFI_ERROR (ChaosKeyTransfer (ChaosKey,
+                     ChaosKey->Pool + ChaosKey->PoolCount, &OutSize,
+                     &Result))) {
+      //
+      // Try again on the next tick
+      //
+      break;
+    }
+    ChaosKey->PoolCount += OutSize;
+  }
+}
+
+
 /**
   Produces and returns an RNG value using either the default or specified RNG
   algorithm.
@@ -181,14 +263,37 @@ GetRNG (
   UINT8             Buffer[CHAOSKEY_MAX_EP_SIZE];
   UINT8             *OutPointer;
   UINTN             OutSize;
+  UINTN             Excess;
   UINT32            Result;
+  EFI_TPL           OldTpl;
 
   if (Algorithm != NULL && !CompareGuid (Algorithm, &gEfiRngAlgorithmRaw)) {
     return EFI_UNSUPPORTED;
   }
 
+  if (Value == NULL || ValueLength == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
   ChaosKey = CHAOSKEY_DEV_FROM_THIS (This);
 
+  //
+  // Keep the refill timer away from the pool and the endpoint
+  //
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  //
+  // Serve what we can from the pool, consuming it from the top and wiping
+  // the bytes that have been handed out.
+  //
+  OutSize = MIN (ValueLength, ChaosKey->PoolCount);
+  ChaosKey->PoolCount -= OutSize;
+  gBS->CopyMem (Value, ChaosKey->Pool + ChaosKey->PoolCount, OutSize);
+  ZeroMem (ChaosKey->Pool + ChaosKey->PoolCount, OutSize);
+  Value += OutSize;
+  ValueLength -= OutSize;
+
+  Status = EFI_SUCCESS;
   while (ValueLength > 0) {
     //
     // If more data is requested than the endpoint can deliver in a single
@@ -199,35 +304,40 @@ GetRNG (
     } else {
       OutPointer = Buffer;
     }
-    OutSize = ChaosKey->EndpointSize;
 
-    Status = ChaosKey->UsbIo->UsbBulkTransfer (ChaosKey->UsbIo,
-                                               ChaosKey->EndpointAddress,
-                                               OutPointer,
-                                               &OutSize,
-                                               CHAOSKEY_TIMEOUT,
-                                               &Result);
-
-    if (Status == EFI_TIMEOUT) {
+    Status = ChaosKeyTransfer (ChaosKey, OutPointer, &OutSize, &Result);
+    if (Status == EFI_NOT_READY) {
       DEBUG ((DEBUG_ERROR, "Bulk transfer timed out, USB status == %d\n",
         Result));
-      return EFI_NOT_READY;
+      break;
     } else if (EFI_ERROR (Status)) {
       DEBUG ((DEBUG_ERROR,
         "Bulk transfer failed, Status == %r, USB status == %d\n",
         Status, Result));
-      return EFI_DEVICE_ERROR;
+      break;
     }
 
-    OutSize = MIN (OutSize, ValueLength);
-
-    if (Value != Buffer) {
+    if (OutPointer == Buffer) {
+      //
+      // Return the tail of the request, and keep any excess in the pool.
+      //
+      Excess = (OutSize > ValueLength) ? OutSize - ValueLength : 0;
+      OutSize -= Excess;
       gBS->CopyMem (Value, Buffer, OutSize);
+
+      Excess = MIN (Excess, CHAOSKEY_POOL_SIZE - ChaosKey->PoolCount);
+      gBS->CopyMem (ChaosKey->Pool + ChaosKey->PoolCount, Buffer + OutSize,
+             Excess);
+      ChaosKey->PoolCount += Excess;
+      ZeroMem (Buffer, sizeof (Buffer));
     }
     Value += OutSize;
     ValueLength -= OutSize;
   }
-  return EFI_SUCCESS;
+
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
 }
 
 
@@ -250,6 +360,7 @@ ChaosKeyInit (
   ChaosKey->Signature         = CHAOSKEY_DEV_SIGNATURE;
   ChaosKey->Rng.GetInfo       = GetInfo;
   ChaosKey->Rng.GetRNG        = GetRNG;
+  ChaosKey->PoolCount         = 0;
 
   //
   // Open USB I/O Protocol
@@ -275,6 +386,21 @@ ChaosKeyInit (
   //
   ASSERT (ChaosKey->EndpointSize <= CHAOSKEY_MAX_EP_SIZE);
 
+  //
+  // Fill the entropy pool in the background
+  //
+  Status = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                  RefillPool, ChaosKey, &ChaosKey->RefillEvent);
+  if (EFI_ERROR (Status)) {
+    goto ErrorCloseProtocol;
+  }
+
+  Status = gBS->SetTimer (ChaosKey->RefillEvent, TimerPeriodic,
+                  CHAOSKEY_REFILL_PERIOD);
+  if (EFI_ERROR (Status)) {
+    goto ErrorCloseEvent;
+  }
+
   Status = gBS->InstallProtocolInterface (&ControllerHandle,
                                           &gEfiRngProtocolGuid,
                                           EFI_NATIVE_INTERFACE,
@@ -283,11 +409,14 @@ ChaosKeyInit (
     DEBUG ((DEBUG_ERROR,
       "Failed to install RNG protocol interface (Status == %r)\n",
     Status));
-    goto ErrorCloseProtocol;
+    goto ErrorCloseEvent;
   }
 
   return EFI_SUCCESS;
 
+ErrorCloseEvent:
+  gBS->CloseEvent (ChaosKey->RefillEvent);
+
 ErrorCloseProtocol:
   gBS->CloseProtocol (ControllerHandle, &gEfiUsbIoProtocolGuid,
          DriverBindingHandle, ControllerHandle);
@@ -326,6 +455,8 @@ ChaosKeyRelease (
     return Status;
   }
 
+  gBS->CloseEvent (ChaosKey->RefillEvent);
+
   Status = gBS->CloseProtocol (ControllerHandle,
                                &gEfiUsbIoProtocolGuid,
                                DriverBindingHandle,
@@ -335,6 +466,7 @@ ChaosKeyRelease (
     return Status;
   }
 
+  ZeroMem (ChaosKey->Pool, sizeof (ChaosKey->Pool));
   gBS->FreePool (ChaosKey);
 
   return EFI_SUCCESS;
@@ -30,6 +30,14 @@
 #define CHAOSKEY_TIMEOUT        10 // ms
 #define CHAOSKEY_MAX_EP_SIZE    64 // max EP size for full-speed devices
 
+//
+// Size of the entropy pool kept filled in the background, and the period
+// (in 100 ns units) and number of bulk transfers of each refill.
+//
+#define CHAOSKEY_POOL_SIZE          SIZE_4KB
+#define CHAOSKEY_REFILL_PERIOD      (20 * 10000) // 20 ms
+#define CHAOSKEY_REFILL_TRANSFERS   8
+
 #define CHAOSKEY_DEV_SIGNATURE  SIGNATURE_32('c','h','k','e')
 
 typedef struct {
@@ -38,6 +46,9 @@ typedef struct {
   UINT16                        EndpointSize;
   EFI_USB_IO_PROTOCOL           *UsbIo;
   EFI_RNG_PROTOCOL              Rng;
+  EFI_EVENT                     RefillEvent;
+  UINTN                         PoolCount;
+  UINT8                         Pool[CHAOSKEY_POOL_SIZE];
 } CHAOSKEY_DEV;
 
 #define CHAOSKEY_DEV_FROM_THIS(a) \
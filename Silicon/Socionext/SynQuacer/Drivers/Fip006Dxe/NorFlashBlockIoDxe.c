@@ -127,12 +127,12 @@ NorFlashBlockIoFlushBlocks (
   IN EFI_BLOCK_IO_PROTOCOL  *This
   )
 {
-  // No Flush required for the NOR Flash driver
-  // because cache operations are not permitted.
+  NOR_FLASH_INSTANCE  *Instance;
 
-  DEBUG ((DEBUG_BLKIO,
-    "NorFlashBlockIoFlushBlocks: Function NOT IMPLEMENTED (not required).\n"));
+  Instance = INSTANCE_FROM_BLKIO_THIS(This);
+
+  DEBUG ((DEBUG_BLKIO, "NorFlashBlockIoFlushBlocks()\n"));
 
-  // Nothing to do so just return without error
-  return EFI_SUCCESS;
+  // Commit the block held in the write-back buffer, if any
+  return NorFlashFlushShadowBlock (Instance);
 }
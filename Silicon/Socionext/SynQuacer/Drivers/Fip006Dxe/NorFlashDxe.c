@@ -24,6 +24,17 @@
 #include "NorFlashDxe.h"
 
 STATIC EFI_EVENT mNorFlashVirtualAddrChangeEvent;
+STATIC EFI_EVENT mNorFlashExitBootServicesEvent;
+STATIC EFI_EVENT mNorFlashResetNotificationEvent;
+STATIC VOID      *mNorFlashResetNotificationRegistration;
+
+//
+// Partial block writes are collected in the shadow buffer of the instance
+// and committed with a single erase/program cycle when a different block is
+// written, on BlockIo flush, on reset and at ExitBootServices. Once boot
+// services have been exited, writes go straight to the flash.
+//
+STATIC BOOLEAN   mNorFlashWriteBack = TRUE;
 
 //
 // Global variable declarations
@@ -121,6 +132,7 @@ GenCSDC (
   IN  BOOLEAN   AddrMode4Byte,
   IN  BOOLEAN   HighZ,
   IN  UINT8     TransferMode,
+  IN  UINT8     Cont,
   OUT UINT16    *CmdSeq
   )
 {
@@ -133,23 +145,21 @@ GenCSDC (
   Index = 0;
   CopyMem (CmdSeq, mFip006NullCmdSeq, sizeof (mFip006NullCmdSeq));
 
-  CmdSeq[Index++] = CSDC (Cmd, CSDC_CONT_NON_CONTINUOUS, TransferMode,
-                          CSDC_DEC_LEAVE_ASIS);
+  CmdSeq[Index++] = CSDC (Cmd, Cont, TransferMode, CSDC_DEC_LEAVE_ASIS);
   if (AddrAccess) {
     if (AddrMode4Byte) {
-      CmdSeq[Index++] = CSDC (CSDC_ADDRESS_31_24, CSDC_CONT_NON_CONTINUOUS,
-                              TransferMode, CSDC_DEC_DECODE);
+      CmdSeq[Index++] = CSDC (CSDC_ADDRESS_31_24, Cont, TransferMode,
+                              CSDC_DEC_DECODE);
     }
-    CmdSeq[Index++] = CSDC (CSDC_ADDRESS_23_16, CSDC_CONT_NON_CONTINUOUS,
-                            TransferMode, CSDC_DEC_DECODE);
-    CmdSeq[Index++] = CSDC (CSDC_ADDRESS_15_8, CSDC_CONT_NON_CONTINUOUS,
-                            TransferMode, CSDC_DEC_DECODE);
-    CmdSeq[Index++] = CSDC (CSDC_ADDRESS_7_0, CSDC_CONT_NON_CONTINUOUS,
-                            TransferMode, CSDC_DEC_DECODE);
+    CmdSeq[Index++] = CSDC (CSDC_ADDRESS_23_16, Cont, TransferMode,
+                            CSDC_DEC_DECODE);
+    CmdSeq[Index++] = CSDC (CSDC_ADDRESS_15_8, Cont, TransferMode,
+                            CSDC_DEC_DECODE);
+    CmdSeq[Index++] = CSDC (CSDC_ADDRESS_7_0, Cont, TransferMode,
+                            CSDC_DEC_DECODE);
   }
   if (HighZ) {
-    CmdSeq[Index++] = CSDC (CSDC_HIGH_Z, CSDC_CONT_NON_CONTINUOUS,
-                            TransferMode, CSDC_DEC_DECODE);
+    CmdSeq[Index++] = CSDC (CSDC_HIGH_Z, Cont, TransferMode, CSDC_DEC_DECODE);
   }
 
   return EFI_SUCCESS;
@@ -157,9 +167,10 @@ GenCSDC (
 
 STATIC
 EFI_STATUS
-NorFlashSetHostCommand (
+NorFlashSetHostCommandCont (
   IN  NOR_FLASH_INSTANCE    *Instance,
-  IN  UINT8                 Code
+  IN  UINT8                 Code,
+  IN  UINT8                 Cont
   )
 {
   CONST CSDC_DEFINITION     *Cmd;
@@ -175,12 +186,23 @@ NorFlashSetHostCommand (
       Cmd->AddrMode4Byte,
       Cmd->HighZ,
       Cmd->CsdcTrp,
+      Cont,
       CSDC
       );
   NorFlashSetHostCSDC (Instance, Cmd->ReadWrite, CSDC);
   return EFI_SUCCESS;
 }
 
+STATIC
+EFI_STATUS
+NorFlashSetHostCommand (
+  IN  NOR_FLASH_INSTANCE    *Instance,
+  IN  UINT8                 Code
+  )
+{
+  return NorFlashSetHostCommandCont (Instance, Code, CSDC_CONT_NON_CONTINUOUS);
+}
+
 STATIC
 UINT8
 NorFlashReadStatusRegister (
@@ -433,6 +455,60 @@ NorFlashWriteSingleWord (
   return Status;
 }
 
+/**
+ * Program a single flash page with one page program command. The write
+ * command sequence is put in continuous mode, so the consecutive word
+ * writes are streamed to the flash in a single transaction instead of
+ * issuing a write enable, a command and a status poll for every word.
+ * The page is read back afterwards, EFI_DEVICE_ERROR is returned if it
+ * does not hold the expected data. Pages holding only erased data are
+ * skipped.
+ * The following function presumes that the page has already been erased.
+ **/
+STATIC
+EFI_STATUS
+NorFlashWritePage (
+  IN NOR_FLASH_INSTANCE     *Instance,
+  IN UINTN                  PageAddress,
+  IN UINT32                 *DataBuffer,
+  IN UINT32                 PageSizeInWords
+  )
+{
+  UINT32                WordIndex;
+
+  DEBUG ((DEBUG_BLKIO, "NorFlashWritePage(PageAddress=0x%08x)\n",
+    PageAddress));
+
+  // Nothing to program if the page only holds erased data
+  for (WordIndex = 0; WordIndex < PageSizeInWords; WordIndex++) {
+    if (DataBuffer[WordIndex] != MAX_UINT32) {
+      break;
+    }
+  }
+  if (WordIndex == PageSizeInWords) {
+    return EFI_SUCCESS;
+  }
+
+  if (EFI_ERROR (NorFlashEnableWrite (Instance))) {
+    return EFI_DEVICE_ERROR;
+  }
+  NorFlashSetHostCommandCont (Instance, SPINOR_OP_PP, CSDC_CONT_CONTINUOUS);
+  for (WordIndex = 0; WordIndex < PageSizeInWords; WordIndex++) {
+    MmioWrite32 (PageAddress + WordIndex * 4, DataBuffer[WordIndex]);
+  }
+  MemoryFence ();
+  NorFlashSetHostCSDC (Instance, TRUE, mFip006NullCmdSeq);
+  NorFlashWaitProgramErase (Instance);
+
+  NorFlashDisableWrite (Instance);
+  NorFlashSetHostCSDC (Instance, TRUE, mFip006NullCmdSeq);
+
+  if (CompareMem ((VOID *)PageAddress, DataBuffer, PageSizeInWords * 4) != 0) {
+    return EFI_DEVICE_ERROR;
+  }
+  return EFI_SUCCESS;
+}
+
 STATIC
 EFI_STATUS
 NorFlashWriteFullBlock (
@@ -446,12 +522,14 @@ NorFlashWriteFullBlock (
   UINTN         WordAddress;
   UINT32        WordIndex;
   UINTN         BlockAddress;
+  UINT32        PageSizeInWords;
   EFI_TPL       OriginalTPL;
   BOOLEAN       InterruptsEnabled;
 
   Status = EFI_SUCCESS;
   OriginalTPL = 0;
   InterruptsEnabled = FALSE;
+  PageSizeInWords = Instance->PageSize / 4;
 
   // Get the physical address of the block
   BlockAddress = GET_NOR_BLOCK_ADDRESS (Instance->RegionBaseAddress, Lba,
@@ -475,6 +553,36 @@ NorFlashWriteFullBlock (
     goto EXIT;
   }
 
+  if ((Instance->Flags & NOR_FLASH_WORD_PROGRAM) == 0) {
+    for (WordIndex = 0;
+         WordIndex < BlockSizeInWords;
+         WordIndex += PageSizeInWords, WordAddress += PageSizeInWords * 4) {
+      Status = NorFlashWritePage (Instance, WordAddress,
+                 DataBuffer + WordIndex, PageSizeInWords);
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+    }
+    if (!EFI_ERROR (Status)) {
+      goto EXIT;
+    }
+
+    //
+    // The page did not read back correctly, stop using page programming
+    // and redo the entire block one word at a time.
+    //
+    DEBUG ((DEBUG_WARN,
+      "WriteSingleBlock: page program failed at 0x%X, using word program\n",
+      WordAddress));
+    Instance->Flags |= NOR_FLASH_WORD_PROGRAM;
+    WordAddress = BlockAddress;
+
+    Status = NorFlashUnlockAndEraseSingleBlock (Instance, BlockAddress);
+    if (EFI_ERROR (Status)) {
+      goto EXIT;
+    }
+  }
+
   for (WordIndex=0;
        WordIndex < BlockSizeInWords;
        WordIndex++, DataBuffer++, WordAddress += 4) {
@@ -500,6 +608,94 @@ EXIT:
   return Status;
 }
 
+/**
+ * Commit the block held in the write-back shadow buffer to the flash.
+ **/
+EFI_STATUS
+NorFlashFlushShadowBlock (
+  IN NOR_FLASH_INSTANCE     *Instance
+  )
+{
+  EFI_STATUS    Status;
+
+  if (!Instance->ShadowDirty) {
+    return EFI_SUCCESS;
+  }
+
+  DEBUG ((DEBUG_BLKIO, "NorFlashFlushShadowBlock(Lba=%ld)\n",
+    Instance->ShadowLba));
+
+  Status = NorFlashWriteFullBlock (Instance, Instance->ShadowLba,
+             Instance->ShadowBuffer, Instance->Media.BlockSize / 4);
+  if (EFI_ERROR (Status)) {
+    // Keep the data around so that the next flush retries the write
+    return EFI_DEVICE_ERROR;
+  }
+
+  Instance->ShadowDirty = FALSE;
+  return EFI_SUCCESS;
+}
+
+/**
+ * Prepare for the blocks [Lba, Lba + NumBlocks) to be overwritten or erased
+ * as a whole: pending data for one of these blocks is dropped, pending data
+ * for any other block is committed first to keep the writes in order.
+ **/
+VOID
+NorFlashReleaseShadowBlock (
+  IN NOR_FLASH_INSTANCE     *Instance,
+  IN EFI_LBA                Lba,
+  IN UINTN                  NumBlocks
+  )
+{
+  if (!Instance->ShadowDirty) {
+    return;
+  }
+
+  if (Instance->ShadowLba >= Lba && Instance->ShadowLba < Lba + NumBlocks) {
+    Instance->ShadowDirty = FALSE;
+  } else {
+    NorFlashFlushShadowBlock (Instance);
+  }
+}
+
+/**
+ * Replace the part of a read buffer that is covered by pending data in the
+ * write-back shadow buffer.
+ **/
+STATIC
+VOID
+NorFlashOverlayShadowBlock (
+  IN  NOR_FLASH_INSTANCE    *Instance,
+  IN  EFI_LBA               Lba,
+  IN  UINTN                 Offset,
+  IN  UINTN                 BufferSizeInBytes,
+  OUT VOID                  *Buffer
+  )
+{
+  UINT64        Start;
+  UINT64        End;
+  UINT64        ShadowStart;
+  UINT64        ShadowEnd;
+
+  if (!Instance->ShadowDirty) {
+    return;
+  }
+
+  Start = MultU64x32 (Lba, Instance->Media.BlockSize) + Offset;
+  End = Start + BufferSizeInBytes;
+  ShadowStart = MultU64x32 (Instance->ShadowLba, Instance->Media.BlockSize);
+  ShadowEnd = ShadowStart + Instance->Media.BlockSize;
+
+  if (End <= ShadowStart || Start >= ShadowEnd) {
+    return;
+  }
+
+  CopyMem ((UINT8 *)Buffer + (MAX (Start, ShadowStart) - Start),
+    (UINT8 *)Instance->ShadowBuffer + (MAX (Start, ShadowStart) - ShadowStart),
+    MIN (End, ShadowEnd) - MAX (Start, ShadowStart));
+}
+
 EFI_STATUS
 NorFlashWriteBlocks (
   IN NOR_FLASH_INSTANCE     *Instance,
@@ -551,6 +747,8 @@ NorFlashWriteBlocks (
     return EFI_INVALID_PARAMETER;
   }
 
+  NorFlashReleaseShadowBlock (Instance, Lba, NumBlocks);
+
   ASSERT (((UINTN)Buffer % sizeof (UINT32)) == 0);
 
   BlockSizeInWords = Instance->Media.BlockSize / 4;
@@ -629,6 +827,7 @@ NorFlashReadBlocks (
 
   // Readout the data
   CopyMem(Buffer, (UINTN *)StartAddress, BufferSizeInBytes);
+  NorFlashOverlayShadowBlock (Instance, Lba, 0, BufferSizeInBytes, Buffer);
 
   return EFI_SUCCESS;
 }
@@ -671,6 +870,7 @@ NorFlashRead (
 
   // Readout the data
   CopyMem (Buffer, (UINTN *)(StartAddress + Offset), BufferSizeInBytes);
+  NorFlashOverlayShadowBlock (Instance, Lba, Offset, BufferSizeInBytes, Buffer);
 
   return EFI_SUCCESS;
 }
@@ -742,6 +942,19 @@ NorFlashWriteSingleBlock (
     return EFI_BAD_BUFFER_SIZE;
   }
 
+  // Merge the data into the shadow buffer if it already holds this block
+  if (Instance->ShadowDirty && Instance->ShadowLba == Lba) {
+    CopyMem ((VOID*)((UINTN)Instance->ShadowBuffer + Offset), Buffer,
+      *NumBytes);
+    goto CommitShadow;
+  }
+
+  // Writes to another block commit the pending one first
+  TempStatus = NorFlashFlushShadowBlock (Instance);
+  if (EFI_ERROR (TempStatus)) {
+    return EFI_DEVICE_ERROR;
+  }
+
   // Pick 128bytes as a good start for word operations as opposed to erasing the
   // block and writing the data regardless if an erase is really needed.
   // It looks like most individual NV variable writes are smaller than 128bytes.
@@ -884,13 +1097,17 @@ NorFlashWriteSingleBlock (
 
   // Put the data at the appropriate location inside the buffer area
   CopyMem ((VOID*)((UINTN)Instance->ShadowBuffer + Offset), Buffer, *NumBytes);
-
-  // Write the modified buffer back to the NorFlash
-  TempStatus = NorFlashWriteBlocks (Instance, Lba, BlockSize,
-                 Instance->ShadowBuffer);
-  if (EFI_ERROR (TempStatus)) {
-    // Return one of the pre-approved error statuses
-    return EFI_DEVICE_ERROR;
+  Instance->ShadowLba = Lba;
+  Instance->ShadowDirty = TRUE;
+
+CommitShadow:
+  // Write the modified buffer back to the NorFlash, unless deferred
+  if (!mNorFlashWriteBack || EfiAtRuntime ()) {
+    TempStatus = NorFlashFlushShadowBlock (Instance);
+    if (EFI_ERROR (TempStatus)) {
+      // Return one of the pre-approved error statuses
+      return EFI_DEVICE_ERROR;
+    }
   }
 
   return EFI_SUCCESS;
@@ -1012,6 +1229,7 @@ NorFlashDiskIoWriteDisk (
   do {
     if (WriteSize == BlockSize) {
       // Write a full block
+      NorFlashReleaseShadowBlock (Instance, Lba, 1);
       Status = NorFlashWriteFullBlock (Instance, Lba, Buffer,
                  BlockSize / sizeof (UINT32));
     } else {
@@ -1087,6 +1305,8 @@ STATIC CONST NOR_FLASH_INSTANCE mNorFlashInstanceTemplate = {
   }, //  FvbProtoccol;
 
   NULL, // ShadowBuffer
+  0, // ShadowLba
+  FALSE, // ShadowDirty
   {
     {
       {
@@ -1109,7 +1329,8 @@ STATIC CONST NOR_FLASH_INSTANCE mNorFlashInstanceTemplate = {
 
   NULL, // CmdTable
   0, // CmdTableSize
-  0 // Flags
+  0, // Flags
+  0 // PageSize
 };
 
 STATIC
@@ -1171,6 +1392,17 @@ NorFlashCreateInstance (
     Instance->Flags = NOR_FLASH_POLL_FSR;
   }
 
+  //
+  // Full blocks are written a page at a time, unless the page size does not
+  // fit evenly into the block size.
+  //
+  Instance->PageSize = FlashInfo->PageSize;
+  if (Instance->PageSize == 0 ||
+      (Instance->PageSize % 4) != 0 ||
+      (BlockSize % Instance->PageSize) != 0) {
+    Instance->Flags |= NOR_FLASH_WORD_PROGRAM;
+  }
+
   Instance->ShadowBuffer = AllocateRuntimePool (BlockSize);;
   if (Instance->ShadowBuffer == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
@@ -1237,6 +1469,77 @@ NorFlashReadID (
   return EFI_SUCCESS;
 }
 
+STATIC
+VOID
+NorFlashFlushAllShadowBlocks (
+  VOID
+  )
+{
+  UINT32  Index;
+
+  for (Index = 0; Index < mNorFlashDeviceCount; Index++) {
+    if (mNorFlashInstances[Index] != NULL) {
+      NorFlashFlushShadowBlock (mNorFlashInstances[Index]);
+    }
+  }
+}
+
+/**
+  Commit all pending writes before the system is reset.
+**/
+STATIC
+VOID
+EFIAPI
+NorFlashResetNotify (
+  IN EFI_RESET_TYPE   ResetType,
+  IN EFI_STATUS       ResetStatus,
+  IN UINTN            DataSize,
+  IN VOID             *ResetData OPTIONAL
+  )
+{
+  NorFlashFlushAllShadowBlocks ();
+}
+
+STATIC
+VOID
+EFIAPI
+NorFlashResetNotificationInstalled (
+  IN EFI_EVENT        Event,
+  IN VOID             *Context
+  )
+{
+  EFI_STATUS                        Status;
+  EDKII_RESET_NOTIFICATION_PROTOCOL *ResetNotification;
+
+  Status = gBS->LocateProtocol (&gEdkiiResetNotificationProtocolGuid, NULL,
+                  (VOID **)&ResetNotification);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  gBS->CloseEvent (Event);
+
+  Status = ResetNotification->RegisterResetNotify (ResetNotification,
+                                NorFlashResetNotify);
+  ASSERT_EFI_ERROR (Status);
+}
+
+/**
+  Commit all pending writes and stop deferring writes from now on, since
+  nothing would flush them at runtime.
+**/
+STATIC
+VOID
+EFIAPI
+NorFlashExitBootServicesEvent (
+  IN EFI_EVENT        Event,
+  IN VOID             *Context
+  )
+{
+  NorFlashFlushAllShadowBlocks ();
+  mNorFlashWriteBack = FALSE;
+}
+
 /**
   Fixup internal data so that EFI can be call in virtual mode.
   Call the passed in Child Notify event and convert any pointers in
@@ -1381,5 +1684,20 @@ NorFlashInitialise (
                   &mNorFlashVirtualAddrChangeEvent);
   ASSERT_EFI_ERROR (Status);
 
+  //
+  // Commit deferred writes at ExitBootServices and on reset
+  //
+  Status = gBS->CreateEvent (EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY,
+                  NorFlashExitBootServicesEvent, NULL,
+                  &mNorFlashExitBootServicesEvent);
+  ASSERT_EFI_ERROR (Status);
+
+  mNorFlashResetNotificationEvent = EfiCreateProtocolNotifyEvent (
+                                      &gEdkiiResetNotificationProtocolGuid,
+                                      TPL_CALLBACK,
+                                      NorFlashResetNotificationInstalled,
+                                      NULL,
+                                      &mNorFlashResetNotificationRegistration);
+
   return Status;
 }
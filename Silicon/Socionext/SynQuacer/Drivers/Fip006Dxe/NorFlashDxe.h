@@ -25,6 +25,7 @@
 #include <Protocol/BlockIo.h>
 #include <Protocol/DiskIo.h>
 #include <Protocol/FirmwareVolumeBlock.h>
+#include <Protocol/ResetNotification.h>
 
 #include <Library/DebugLib.h>
 #include <Library/DxeServicesTableLib.h>
@@ -111,6 +112,8 @@ struct _NOR_FLASH_INSTANCE {
 
   EFI_FIRMWARE_VOLUME_BLOCK2_PROTOCOL FvbProtocol;
   VOID*                               ShadowBuffer;
+  EFI_LBA                             ShadowLba;
+  BOOLEAN                             ShadowDirty;
 
   NOR_FLASH_DEVICE_PATH               DevicePath;
 
@@ -119,6 +122,9 @@ struct _NOR_FLASH_INSTANCE {
 
   UINT32                              Flags;
 #define NOR_FLASH_POLL_FSR      BIT0
+#define NOR_FLASH_WORD_PROGRAM  BIT1
+
+  UINT32                              PageSize;
 };
 
 EFI_STATUS
@@ -268,6 +274,18 @@ NorFlashWriteSingleBlock (
   IN        UINT8                *Buffer
   );
 
+EFI_STATUS
+NorFlashFlushShadowBlock (
+  IN NOR_FLASH_INSTANCE     *Instance
+  );
+
+VOID
+NorFlashReleaseShadowBlock (
+  IN NOR_FLASH_INSTANCE     *Instance,
+  IN EFI_LBA                Lba,
+  IN UINTN                  NumBlocks
+  );
+
 EFI_STATUS
 NorFlashWriteBlocks (
   IN  NOR_FLASH_INSTANCE *Instance,
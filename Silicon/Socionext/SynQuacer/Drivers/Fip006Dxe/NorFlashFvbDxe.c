@@ -695,6 +695,8 @@ FvbEraseBlocks (
       // Erase it
       DEBUG ((DEBUG_BLKIO, "FvbEraseBlocks: Erasing Lba=%ld @ 0x%08x.\n",
         Instance->StartLba + StartingLba, BlockAddress));
+      NorFlashReleaseShadowBlock (Instance, Instance->StartLba + StartingLba,
+        1);
       Status = NorFlashUnlockAndEraseSingleBlock (Instance, BlockAddress);
       if (EFI_ERROR(Status)) {
         VA_END (Args);
@@ -811,6 +813,12 @@ NorFlashFvbInitialize (
     if (EFI_ERROR(Status)) {
       return Status;
     }
+
+    // The variable driver reads the headers straight from the flash
+    Status = NorFlashFlushShadowBlock (Instance);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
   }
 
   //
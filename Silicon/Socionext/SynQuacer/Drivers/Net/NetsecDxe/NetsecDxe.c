@@ -110,6 +110,7 @@ Probe (
   if (ogma_err != OGMA_ERR_OK) {
     DEBUG ((DEBUG_ERROR, "NETSEC: ogma_init() failed with error code %d\n",
       ogma_err));
+    pfdep_uninit_pkt_buf_pool (Handle);
     return EFI_DEVICE_ERROR;
   }
 
@@ -695,7 +696,7 @@ SnpGetStatus (
       if (pkt_handle->Released) {
         *TxBuff = pkt_handle->Buffer;
         RemoveEntryList (Link);
-        FreePool (pkt_handle);
+        InsertTailList (&LanDriver->TxHandleFreeList, Link);
         break;
       }
     }
@@ -747,14 +748,6 @@ SnpTransmit (
     return EFI_DEVICE_ERROR;
   }
 
-  pkt_handle = AllocateZeroPool (sizeof (*pkt_handle));
-  if (pkt_handle == NULL) {
-    return EFI_OUT_OF_RESOURCES;
-  }
-
-  pkt_handle->Buffer = BufAddr;
-  pkt_handle->RecycleForTx = TRUE;
-
   // Serialize access to data and registers
   SavedTpl = gBS->RaiseTPL (TPL_CALLBACK);
 
@@ -821,9 +814,26 @@ SnpTransmit (
       sizeof (UINT16));
   }
 
+  //
+  // Every submitted buffer holds a handle until it is returned by GetStatus,
+  // so running out of handles means the caller has to recycle buffers first.
+  //
+  if (IsListEmpty (&LanDriver->TxHandleFreeList)) {
+    ReturnUnlock (EFI_NOT_READY);
+  }
+
+  pkt_handle = BASE_CR (GetFirstNode (&LanDriver->TxHandleFreeList),
+                 PACKET_HANDLE, Link);
+  RemoveEntryList (&pkt_handle->Link);
+
+  pkt_handle->Buffer = BufAddr;
+  pkt_handle->Released = FALSE;
+
   Status = DmaMap (MapOperationBusMasterRead, BufAddr, &BufSize,
              &scat_info.phys_addr, &pkt_handle->Mapping);
   if (EFI_ERROR (Status)) {
+    pkt_handle->Mapping = NULL;
+    InsertTailList (&LanDriver->TxHandleFreeList, &pkt_handle->Link);
     goto ExitUnlock;
   }
 
@@ -851,7 +861,8 @@ SnpTransmit (
 
   if (ogma_err != OGMA_ERR_OK) {
     DmaUnmap (pkt_handle->Mapping);
-    FreePool (pkt_handle);
+    pkt_handle->Mapping = NULL;
+    InsertTailList (&LanDriver->TxHandleFreeList, &pkt_handle->Link);
     DEBUG ((DEBUG_ERROR,
       "NETSEC: ogma_set_tx_pkt_data failed with error code: %d\n",
       (INT32)ogma_err));
@@ -869,7 +880,6 @@ SnpTransmit (
 
   // Restore TPL and return
 ExitUnlock:
-  FreePool (pkt_handle);
   gBS->RestoreTPL (SavedTpl);
   return Status;
 }
@@ -938,9 +948,6 @@ SnpReceive (
       ReturnUnlock (EFI_DEVICE_ERROR);
     }
 
-    DmaUnmap (pkt_handle->Mapping);
-    pkt_handle->Mapping = NULL;
-
     CopyMem (Data, (VOID *)rx_data.addr, len);
     *BuffSize = len;
 
@@ -982,6 +989,7 @@ NetsecInit (
   NETSEC_DRIVER                     *LanDriver;
   EFI_SIMPLE_NETWORK_PROTOCOL       *Snp;
   EFI_SIMPLE_NETWORK_MODE           *SnpMode;
+  UINTN                             Index;
 
   // Allocate Resources
   LanDriver = AllocateZeroPool (sizeof (NETSEC_DRIVER));
@@ -989,6 +997,20 @@ NetsecInit (
     return EFI_OUT_OF_RESOURCES;
   }
 
+  LanDriver->TxHandles = AllocateZeroPool (sizeof (PACKET_HANDLE) *
+                                           FixedPcdGet16 (PcdEncTxDescNum));
+  if (LanDriver->TxHandles == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeDevice;
+  }
+
+  InitializeListHead (&LanDriver->TxHandleFreeList);
+  for (Index = 0; Index < FixedPcdGet16 (PcdEncTxDescNum); Index++) {
+    LanDriver->TxHandles[Index].RecycleForTx = TRUE;
+    InsertTailList (&LanDriver->TxHandleFreeList,
+      &LanDriver->TxHandles[Index].Link);
+  }
+
   Status = gBS->OpenProtocol (ControllerHandle,
                               &gEdkiiNonDiscoverableDeviceProtocolGuid,
                               (VOID **)&LanDriver->Dev,
@@ -1099,6 +1121,7 @@ NetsecInit (
     DEBUG ((DEBUG_ERROR, "%a: InstallMultipleProtocolInterfaces failed - %r\n",
       __FUNCTION__, Status));
     ogma_terminate (LanDriver->Handle);
+    pfdep_uninit_pkt_buf_pool (LanDriver->Handle);
     goto CloseDeviceProtocol;
   }
   return EFI_SUCCESS;
@@ -1109,6 +1132,9 @@ CloseDeviceProtocol:
          ControllerHandle);
 
 FreeDevice:
+  if (LanDriver->TxHandles != NULL) {
+    FreePool (LanDriver->TxHandles);
+  }
   FreePool (LanDriver);
   return Status;
 }
@@ -1146,6 +1172,7 @@ NetsecRelease (
   }
 
   ogma_terminate (LanDriver->Handle);
+  pfdep_uninit_pkt_buf_pool (LanDriver->Handle);
 
   gBS->CloseEvent (LanDriver->ExitBootEvent);
 
@@ -1158,6 +1185,7 @@ NetsecRelease (
     return Status;
   }
 
+  gBS->FreePool (LanDriver->TxHandles);
   gBS->FreePool (LanDriver);
 
   return EFI_SUCCESS;
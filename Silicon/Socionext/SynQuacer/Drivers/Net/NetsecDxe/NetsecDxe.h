@@ -69,6 +69,10 @@ typedef struct {
   // List of submitted TX buffers
   LIST_ENTRY                        TxBufferList;
 
+  // Pool of TX packet handles, one per TX descriptor
+  PACKET_HANDLE                     *TxHandles;
+  LIST_ENTRY                        TxHandleFreeList;
+
   EFI_EVENT                         ExitBootEvent;
 
   EFI_EVENT                         PhyStatusEvent;
@@ -149,6 +149,10 @@ void pfdep_free_pkt_buf (
     pfdep_pkt_handle_t pkt_handle
     );
 
+void pfdep_uninit_pkt_buf_pool (
+    pfdep_dev_handle_t dev_handle
+    );
+
 static __inline pfdep_err_t pfdep_init_hard_lock(pfdep_hard_lock_t *hard_lock_p)
 {
     (void)hard_lock_p; /* suppress compiler warning */
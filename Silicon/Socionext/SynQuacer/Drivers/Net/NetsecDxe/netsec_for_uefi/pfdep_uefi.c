@@ -19,7 +19,6 @@
 #include <Library/DmaLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/NetLib.h>
-#include <Library/SynchronizationLib.h>
 
 /**********************************************************************
  * Variable definitions
@@ -103,13 +102,91 @@ pfdep_dma_free (
 
 //
 // On the receive path, we allocate a new packet and link it into the RX ring
-// before returning the received packet to the caller. This means we perform
-// one allocation and one free operation for each buffer received.
-// So let's cache a single packet, and get rid of most of the alloc/free
-// overhead on the RX path.
+// before returning the received packet to the caller. Rather than allocating
+// and mapping a buffer for each packet received, the RX buffers are carved
+// out of a single slab which is allocated and mapped for DMA once, the first
+// time the RX ring is filled. The slab holds one buffer per RX descriptor,
+// plus the one being returned to the caller while its replacement is already
+// linked into the ring.
 //
-STATIC pfdep_pkt_handle_t mSparePacketBuffer;
-STATIC UINT32 mSparePacketBufferSize;
+#define RX_PKT_BUF_POOL_SIZE    (FixedPcdGet16 (PcdDecRxDescNum) + 1)
+
+STATIC LIST_ENTRY         mRxPktBufFreeList =
+                            INITIALIZE_LIST_HEAD_VARIABLE (mRxPktBufFreeList);
+STATIC PACKET_HANDLE      *mRxPktHandles;
+STATIC VOID               *mRxPktBufBase;
+STATIC UINTN              mRxPktBufPages;
+STATIC VOID               *mRxPktBufMapping;
+STATIC pfdep_phys_addr_t  mRxPktBufPhysBase;
+STATIC pfdep_uint16       mRxPktBufLen;
+
+STATIC
+pfdep_err_t
+pfdep_init_pkt_buf_pool (
+  IN  pfdep_uint16              len
+  )
+{
+  EFI_STATUS    Status;
+  UINTN         BufSize;
+  UINTN         NumBytes;
+  UINTN         Index;
+
+  BufSize = ALIGN_VALUE (len, mCpu->DmaBufferAlignment);
+  mRxPktBufPages = EFI_SIZE_TO_PAGES (BufSize * RX_PKT_BUF_POOL_SIZE);
+
+  mRxPktHandles = AllocateZeroPool (sizeof (PACKET_HANDLE) *
+                                    RX_PKT_BUF_POOL_SIZE);
+  if (mRxPktHandles == NULL) {
+    return PFDEP_ERR_ALLOC;
+  }
+
+  Status = DmaAllocateBuffer (EfiBootServicesData, mRxPktBufPages,
+             &mRxPktBufBase);
+  if (EFI_ERROR (Status)) {
+    goto FreeHandles;
+  }
+
+  NumBytes = EFI_PAGES_TO_SIZE (mRxPktBufPages);
+  Status = DmaMap (MapOperationBusMasterCommonBuffer, mRxPktBufBase, &NumBytes,
+             &mRxPktBufPhysBase, &mRxPktBufMapping);
+  if (EFI_ERROR (Status) || NumBytes < EFI_PAGES_TO_SIZE (mRxPktBufPages)) {
+    goto FreeBuffer;
+  }
+
+  for (Index = 0; Index < RX_PKT_BUF_POOL_SIZE; Index++) {
+    mRxPktHandles[Index].Buffer = (UINT8 *)mRxPktBufBase + Index * BufSize;
+    InsertTailList (&mRxPktBufFreeList, &mRxPktHandles[Index].Link);
+  }
+
+  mRxPktBufLen = len;
+
+  return PFDEP_ERR_OK;
+
+FreeBuffer:
+  DmaFreeBuffer (mRxPktBufPages, mRxPktBufBase);
+
+FreeHandles:
+  FreePool (mRxPktHandles);
+  mRxPktHandles = NULL;
+  return PFDEP_ERR_ALLOC;
+}
+
+VOID
+pfdep_uninit_pkt_buf_pool (
+  IN  pfdep_dev_handle_t        dev_handle
+  )
+{
+  if (mRxPktHandles == NULL) {
+    return;
+  }
+
+  DmaUnmap (mRxPktBufMapping);
+  DmaFreeBuffer (mRxPktBufPages, mRxPktBufBase);
+  FreePool (mRxPktHandles);
+
+  InitializeListHead (&mRxPktBufFreeList);
+  mRxPktHandles = NULL;
+}
 
 pfdep_err_t
 pfdep_alloc_pkt_buf (
@@ -120,31 +197,28 @@ pfdep_alloc_pkt_buf (
   OUT pfdep_pkt_handle_t        *pkt_handle_p
   )
 {
-  EFI_STATUS    Status;
-  UINTN         NumBytes;
-
-  NumBytes = ALIGN_VALUE (len, mCpu->DmaBufferAlignment);
+  pfdep_err_t   Err;
+  LIST_ENTRY    *Link;
 
-  if (InterlockedCompareExchange32 (&mSparePacketBufferSize, len, 0) == len) {
-    *pkt_handle_p = mSparePacketBuffer;
-  } else {
-    *pkt_handle_p = AllocateZeroPool (NumBytes + sizeof(PACKET_HANDLE) +
-                                      (mCpu->DmaBufferAlignment - 8));
-    if (*pkt_handle_p == NULL) {
-      return PFDEP_ERR_ALLOC;
+  if (mRxPktHandles == NULL) {
+    Err = pfdep_init_pkt_buf_pool (len);
+    if (Err != PFDEP_ERR_OK) {
+      return Err;
     }
-
-    (*pkt_handle_p)->Buffer = ALIGN_POINTER (*pkt_handle_p + 1,
-                                             mCpu->DmaBufferAlignment);
   }
 
-  *addr_p = (*pkt_handle_p)->Buffer;
-  Status = DmaMap (MapOperationBusMasterWrite, *addr_p, &NumBytes, phys_addr_p,
-             &(*pkt_handle_p)->Mapping);
-  if (EFI_ERROR (Status) || NumBytes < len) {
-    FreePool (*pkt_handle_p);
+  if (len > mRxPktBufLen || IsListEmpty (&mRxPktBufFreeList)) {
     return PFDEP_ERR_ALLOC;
   }
+
+  Link = GetFirstNode (&mRxPktBufFreeList);
+  RemoveEntryList (Link);
+
+  *pkt_handle_p = BASE_CR (Link, PACKET_HANDLE, Link);
+  *addr_p = (*pkt_handle_p)->Buffer;
+  *phys_addr_p = mRxPktBufPhysBase +
+                 ((UINTN)(*pkt_handle_p)->Buffer - (UINTN)mRxPktBufBase);
+
   return PFDEP_ERR_OK;
 }
 
@@ -164,13 +238,12 @@ pfdep_free_pkt_buf (
 
   if (pkt_handle->Mapping != NULL) {
     DmaUnmap (pkt_handle->Mapping);
+    pkt_handle->Mapping = NULL;
   }
 
   if (pkt_handle->RecycleForTx) {
-      pkt_handle->Released = TRUE;
-  } else if (!InterlockedCompareExchange32 (&mSparePacketBufferSize, 0, len)) {
-    mSparePacketBuffer = pkt_handle;
+    pkt_handle->Released = TRUE;
   } else {
-    FreePool (pkt_handle);
+    InsertTailList (&mRxPktBufFreeList, &pkt_handle->Link);
   }
 }